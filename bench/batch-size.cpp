@@ -0,0 +1,117 @@
+#include "fss-transport.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Compares sending position reports one frame each against combining
+   them into batches, both in bytes and in time over a local connection.
+   usage: batch-size [threads] [reports per thread] */
+
+constexpr uint16_t single_port = 20401;
+constexpr uint16_t batch_port = 20403;
+constexpr double pos_lat = -43.5;
+constexpr double pos_lng = 172.5;
+
+static std::shared_ptr<flight_safety_system::transport::fss_connection> server_conn{};
+
+class counting_cb : public flight_safety_system::transport::fss_message_cb
+{
+public:
+    std::atomic<uint64_t> received{0};
+    explicit counting_cb(std::shared_ptr<flight_safety_system::transport::fss_connection> t_conn) : fss_message_cb(std::move(t_conn)) {};
+    void processMessage(std::shared_ptr<flight_safety_system::transport::fss_message> message __attribute__((unused))) override {
+        this->received++;
+    }
+};
+
+static auto
+accept_cb(std::shared_ptr<flight_safety_system::transport::fss_connection> conn) -> bool
+{
+    server_conn = std::move(conn);
+    return true;
+}
+
+static auto
+report(uint64_t i) -> std::shared_ptr<flight_safety_system::transport::fss_message_position_report>
+{
+    return std::make_shared<flight_safety_system::transport::fss_message_position_report>(pos_lat, pos_lng, 300 + i % 100, 0, 45, 0, 0xC80000 + i % 50, "ZK-" + std::to_string(i % 50), 01200, 0, 0, 1, 1, i);
+}
+
+static auto
+timed_send(bool batching, size_t num_threads, uint64_t per_thread) -> uint64_t
+{
+    uint16_t listen_port = batching ? batch_port : single_port;
+    auto listen = std::make_shared<flight_safety_system::transport::fss_listen>(listen_port, accept_cb);
+    auto conn = std::make_shared<flight_safety_system::transport::fss_connection>();
+    if (!conn->connectTo("localhost", listen_port))
+    {
+        return 0;
+    }
+    while (server_conn == nullptr)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto cb = std::make_shared<counting_cb>(server_conn);
+    server_conn->setHandler(cb.get());
+    conn->setBatching(batching);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++)
+    {
+        threads.emplace_back([&conn, per_thread]() {
+            for (uint64_t i = 0; i < per_thread; i++)
+            {
+                conn->sendMsg(report(i));
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    while (cb->received < num_threads * per_thread)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    conn->disconnect();
+    server_conn = nullptr;
+    listen->disconnect();
+    return static_cast<uint64_t>(elapsed);
+}
+
+auto
+main(int argc, char *argv[]) -> int
+{
+    size_t num_threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 8;
+    uint64_t per_thread = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20000;
+
+    /* A burst of reports being relayed to one client */
+    constexpr uint64_t burst = 50;
+    uint64_t single_bytes = 0;
+    auto batch = std::make_shared<flight_safety_system::transport::fss_message_batch>();
+    for (uint64_t i = 0; i < burst; i++)
+    {
+        auto msg = report(i);
+        single_bytes += msg->getPacked()->getLength();
+        batch->add(msg);
+    }
+    uint64_t batch_bytes = batch->getPacked()->getLength();
+    std::cout << "burst of " << burst << " reports: single " << single_bytes << " bytes, batched " << batch_bytes << " bytes, saving " << 100.0 * (1.0 - static_cast<double>(batch_bytes) / static_cast<double>(single_bytes)) << "%" << std::endl;
+
+    auto count = static_cast<double>(num_threads * per_thread);
+    auto single_time = timed_send(false, num_threads, per_thread);
+    auto batch_time = timed_send(true, num_threads, per_thread);
+    std::cout << num_threads << " threads sending " << per_thread << " reports each" << std::endl;
+    std::cout << "single  " << single_time / 1000 << "ms, " << static_cast<double>(single_time) * 1000 / count << "ns/report" << std::endl;
+    std::cout << "batched " << batch_time / 1000 << "ms, " << static_cast<double>(batch_time) * 1000 / count << "ns/report" << std::endl;
+
+    return single_time != 0 && batch_time != 0 ? 0 : 1;
+}
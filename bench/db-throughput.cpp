@@ -0,0 +1,73 @@
+#include "fss-server.hpp"
+#include "fss.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Drives a db_connection the way the server does, one thread per connected asset writing
+   position reports and now and then looking up its command. Built against the libpq backend.
+   usage: db-throughput-libpq host user pass db asset [threads] [reports per thread] [connections] */
+
+constexpr uint64_t command_every = 10;
+
+auto
+main(int argc, char *argv[]) -> int
+{
+    if (argc < 6)
+    {
+        std::cerr << "usage: " << argv[0] << " host user pass db asset [threads] [reports per thread] [connections]" << std::endl;
+        return -1;
+    }
+    std::string asset = argv[5];
+    size_t num_threads = argc > 6 ? std::strtoul(argv[6], nullptr, 10) : 8;
+    uint64_t per_thread = argc > 7 ? std::strtoull(argv[7], nullptr, 10) : 1000;
+    size_t connections = argc > 8 ? std::strtoul(argv[8], nullptr, 10) : 1;
+
+    auto dbc = std::make_shared<flight_safety_system::server::db_connection_postgres>(argv[1], argv[2], argv[3], argv[4], connections);
+    if (!dbc->check_asset(asset))
+    {
+        std::cerr << "Asset " << asset << " isn't in the database" << std::endl;
+        return 1;
+    }
+
+    std::atomic<uint64_t> lookups{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++)
+    {
+        threads.emplace_back([&dbc, &asset, &lookups, per_thread, t]() {
+            for (uint64_t i = 0; i < per_thread; i++)
+            {
+                dbc->asset_add_position(asset, -43.5 + static_cast<double>(t) * 0.01, 172.5 + static_cast<double>(i) * 0.0001, 300, flight_safety_system::fss_current_timestamp());
+                if (i % command_every == 0)
+                {
+                    dbc->asset_get_command(asset);
+                    lookups++;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    auto submitted = std::chrono::steady_clock::now();
+    auto pool = dbc->getPoolStats();
+    /* Only done once every insert has been written */
+    dbc = nullptr;
+    auto finished = std::chrono::steady_clock::now();
+
+    uint64_t inserts = num_threads * per_thread;
+    auto submit_time = std::chrono::duration_cast<std::chrono::milliseconds>(submitted - start).count();
+    auto total_time = std::chrono::duration_cast<std::chrono::milliseconds>(finished - start).count();
+    std::cout << "inserts " << inserts << " lookups " << lookups << " from " << num_threads << " threads" << std::endl;
+    std::cout << "submitted in " << submit_time << "ms, written in " << total_time << "ms (" << (total_time > 0 ? static_cast<double>(inserts + lookups) * 1000 / static_cast<double>(total_time) : 0) << " statements/s)" << std::endl;
+    std::cout << "connections " << pool.connections << " average wait " << (pool.statements > 0 ? pool.wait_total_us / pool.statements : 0) << "us max wait " << pool.wait_max_us << "us utilisation " << static_cast<int>(pool.utilisation * 100) << "%" << std::endl;
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "fss-transport-ssl.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+
+/* Compares the CPU time spent relaying position reports from a server
+   connection to a client over TLS on loopback, with the records encrypted
+   and decrypted by GnuTLS and by the kernel (kTLS).
+   usage: kernel-tls [reports] */
+
+constexpr const char * CA_PUBLIC_FILE = "certs/ca.public.pem";
+constexpr const char * SERVER_PRIVATE_FILE = "certs/localhost.private.pem";
+constexpr const char * SERVER_PUBLIC_FILE = "certs/localhost.public.pem";
+constexpr const char * CLIENT_PRIVATE_FILE = "certs/client.private.pem";
+constexpr const char * CLIENT_PUBLIC_FILE = "certs/client.public.pem";
+
+constexpr uint16_t gnutls_port = 20410;
+constexpr uint16_t kernel_port = 20411;
+constexpr double pos_lat = -43.5;
+constexpr double pos_lng = 172.5;
+
+static std::shared_ptr<flight_safety_system::transport::fss_connection> server_conn{};
+
+class counting_cb : public flight_safety_system::transport::fss_message_cb
+{
+public:
+    std::atomic<uint64_t> received{0};
+    explicit counting_cb(std::shared_ptr<flight_safety_system::transport::fss_connection> t_conn) : fss_message_cb(std::move(t_conn)) {};
+    void processMessage(std::shared_ptr<flight_safety_system::transport::fss_message> message) override {
+        if (message != nullptr)
+        {
+            this->received++;
+        }
+    }
+};
+
+static auto
+accept_cb(std::shared_ptr<flight_safety_system::transport::fss_connection> conn) -> bool
+{
+    server_conn = std::move(conn);
+    return true;
+}
+
+static auto
+report(uint64_t i) -> std::shared_ptr<flight_safety_system::transport::fss_message_position_report>
+{
+    return std::make_shared<flight_safety_system::transport::fss_message_position_report>(pos_lat, pos_lng, 300 + i % 100, 0, 45, 0, 0xC80000 + i % 50, "ZK-" + std::to_string(i % 50), 01200, 0, 0, 1, 1, i);
+}
+
+static auto
+cpu_time() -> uint64_t
+{
+    struct timespec ts = {};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+class relay_result {
+public:
+    uint64_t cpu{0};
+    uint64_t elapsed{0};
+    bool kernel_send{false};
+    bool kernel_recv{false};
+};
+
+static auto
+timed_relay(bool kernel_tls, uint64_t count) -> relay_result
+{
+    relay_result result;
+    uint16_t listen_port = kernel_tls ? kernel_port : gnutls_port;
+    auto listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port, accept_cb, CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE);
+    listen->setKernelTLS(kernel_tls);
+    auto conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    conn->setKernelTLS(kernel_tls);
+    auto cb = std::make_shared<counting_cb>(conn);
+    conn->setHandler(cb.get());
+    if (!conn->connectTo("localhost", listen_port))
+    {
+        return result;
+    }
+    while (server_conn == nullptr)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto relay = std::dynamic_pointer_cast<flight_safety_system::transport_ssl::fss_connection>(server_conn);
+
+    uint64_t cpu_start = cpu_time();
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < count; i++)
+    {
+        relay->sendMsg(report(i));
+    }
+    while (cb->received < count)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    result.elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    result.cpu = cpu_time() - cpu_start;
+    result.kernel_send = relay->kernelSending();
+    result.kernel_recv = conn->kernelReceiving();
+
+    conn->disconnect();
+    relay = nullptr;
+    server_conn = nullptr;
+    listen->disconnect();
+    return result;
+}
+
+static void
+print_result(const std::string &name, const relay_result &result, uint64_t count)
+{
+    std::cout << name << result.elapsed / 1000 << "ms, " << static_cast<double>(result.cpu) / static_cast<double>(count) << "ns CPU/report";
+    std::cout << " (kernel send " << (result.kernel_send ? "on" : "off") << ", kernel recv " << (result.kernel_recv ? "on" : "off") << ")" << std::endl;
+}
+
+auto
+main(int argc, char *argv[]) -> int
+{
+    uint64_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+
+    auto gnutls_result = timed_relay(false, count);
+    auto kernel_result = timed_relay(true, count);
+    std::cout << "relaying " << count << " reports over loopback TLS" << std::endl;
+    print_result("gnutls  ", gnutls_result, count);
+    print_result("kernel  ", kernel_result, count);
+    if (!kernel_result.kernel_send && !kernel_result.kernel_recv)
+    {
+        std::cout << "kernel TLS was not available, both runs used GnuTLS" << std::endl;
+    }
+
+    return gnutls_result.elapsed != 0 && kernel_result.elapsed != 0 ? 0 : 1;
+}
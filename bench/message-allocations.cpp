@@ -0,0 +1,101 @@
+#include "fss-transport.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+
+/* Counts the allocator calls made on a connection's receive thread while it decodes
+   and delivers a steady stream of messages, after a warm up to fill the pools.
+   usage: message-allocations [messages] */
+
+static thread_local bool counting = false;
+static std::atomic<uint64_t> allocations{0};
+
+auto
+operator new(size_t size) -> void *
+{
+    if (counting)
+    {
+        allocations++;
+    }
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void
+operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void
+operator delete(void *p, size_t size __attribute__((unused))) noexcept
+{
+    free(p);
+}
+
+constexpr uint64_t warm_up = 1000;
+
+class counting_cb : public flight_safety_system::transport::fss_message_cb
+{
+public:
+    std::atomic<uint64_t> received{0};
+    explicit counting_cb(std::shared_ptr<flight_safety_system::transport::fss_connection> t_conn) : fss_message_cb(std::move(t_conn)) {};
+    void processMessage(std::shared_ptr<flight_safety_system::transport::fss_message> message __attribute__((unused))) override {
+        /* Runs on the receive thread, so only its allocations are counted from here on */
+        if (++this->received == warm_up)
+        {
+            counting = true;
+        }
+    }
+};
+
+auto
+main(int argc, char *argv[]) -> int
+{
+    uint64_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        perror("socketpair");
+        return 1;
+    }
+    flight_safety_system::transport::fss_peer_credentials credentials;
+    auto receiver = std::make_shared<flight_safety_system::transport::fss_connection_local>(fds[0], credentials, std::list<std::string>());
+    auto sender = std::make_shared<flight_safety_system::transport::fss_connection_local>(fds[1], credentials, std::list<std::string>());
+    auto cb = std::make_shared<counting_cb>(receiver);
+    receiver->setHandler(cb.get());
+
+    auto report = std::make_shared<flight_safety_system::transport::fss_message_position_report>(-43.5, 172.5, 300, 1800, 200, 0, 0xC80000, "ZK-ABC", 01200, 0, 0, 1, 1, 0);
+    auto status = std::make_shared<flight_safety_system::transport::fss_message_system_status>(75, 1000, 11.4);
+    uint64_t total = warm_up + count;
+    for (uint64_t i = 0; i < total; i++)
+    {
+        sender->sendMsg(i % 4 == 0 ? std::static_pointer_cast<flight_safety_system::transport::fss_message>(status) : std::static_pointer_cast<flight_safety_system::transport::fss_message>(report));
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (cb->received < total && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint64_t counted = cb->received > warm_up ? cb->received - warm_up : 0;
+    uint64_t allocated = allocations;
+
+    std::cout << "messages    " << counted << std::endl;
+    std::cout << "allocations " << allocated << " (" << (counted > 0 ? static_cast<double>(allocated) / static_cast<double>(counted) : 0) << "/message)" << std::endl;
+
+    sender->disconnect();
+    receiver->disconnect();
+    return counted == count ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#include "fss-transport.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+/* Compares handling decoded messages by switching on the type and using dynamic_pointer_cast
+   with handing them to fss_message_dispatch, which passes the concrete type by reference.
+   usage: message-dispatch [messages] [rounds] */
+
+/* Adds up a field from each message so the work can't be optimised away */
+class summing_handler {
+public:
+    double total{0};
+    void handleMessage(flight_safety_system::transport::fss_message &msg __attribute__((unused)), const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused))) {
+    }
+    void handleMessage(flight_safety_system::transport::fss_message_position_report &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused))) {
+        this->total += msg.getLatitude() + msg.getAltitude() + msg.getHeading();
+    }
+    void handleMessage(flight_safety_system::transport::fss_message_system_status &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused))) {
+        this->total += msg.getBatVoltage();
+    }
+    void handleMessage(flight_safety_system::transport::fss_message_search_status &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused))) {
+        this->total += static_cast<double>(msg.getSearchCompleted());
+    }
+    void handleMessage(flight_safety_system::transport::fss_message_rtt_response &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused))) {
+        this->total += static_cast<double>(msg.getRequestId());
+    }
+};
+
+static auto
+handle_with_casts(const std::shared_ptr<flight_safety_system::transport::fss_message> &msg) -> double
+{
+    switch (msg->getType())
+    {
+        case flight_safety_system::transport::message_type_position_report:
+        {
+            auto position = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_position_report>(msg);
+            if (position != nullptr)
+            {
+                return position->getLatitude() + position->getAltitude() + position->getHeading();
+            }
+        } break;
+        case flight_safety_system::transport::message_type_system_status:
+        {
+            auto status = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_system_status>(msg);
+            if (status != nullptr)
+            {
+                return status->getBatVoltage();
+            }
+        } break;
+        case flight_safety_system::transport::message_type_search_status:
+        {
+            auto search = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_search_status>(msg);
+            if (search != nullptr)
+            {
+                return static_cast<double>(search->getSearchCompleted());
+            }
+        } break;
+        case flight_safety_system::transport::message_type_rtt_response:
+        {
+            auto rtt = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_rtt_response>(msg);
+            if (rtt != nullptr)
+            {
+                return static_cast<double>(rtt->getRequestId());
+            }
+        } break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+auto
+main(int argc, char *argv[]) -> int
+{
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    size_t rounds = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200;
+
+    /* Mostly positions, as the server sees, decoded from the wire so they are what a handler gets */
+    std::vector<std::shared_ptr<flight_safety_system::transport::fss_message>> messages;
+    for (size_t i = 0; i < count; i++)
+    {
+        std::shared_ptr<flight_safety_system::transport::fss_message> msg;
+        switch (i % 8)
+        {
+            case 0:
+                msg = std::make_shared<flight_safety_system::transport::fss_message_system_status>(75, 1000, 11.4);
+                break;
+            case 1:
+                msg = std::make_shared<flight_safety_system::transport::fss_message_search_status>(1, i, count);
+                break;
+            case 2:
+                msg = std::make_shared<flight_safety_system::transport::fss_message_rtt_response>(i);
+                break;
+            default:
+                msg = std::make_shared<flight_safety_system::transport::fss_message_position_report>(-43.5, 172.5, 300, 1800, 200, 0, 0xC80000 + i % 100, "ZK-ABC", 01200, 0, 0, 1, 1, i);
+                break;
+        }
+        messages.push_back(flight_safety_system::transport::fss_message::decode(msg->getPacked()));
+    }
+
+    double cast_total = 0;
+    auto cast_start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (const auto &msg : messages)
+        {
+            cast_total += handle_with_casts(msg);
+        }
+    }
+    auto cast_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - cast_start).count();
+
+    summing_handler handler;
+    auto dispatch_start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (const auto &msg : messages)
+        {
+            flight_safety_system::transport::fss_message_dispatch(msg, handler);
+        }
+    }
+    auto dispatch_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - dispatch_start).count();
+
+    auto handled = static_cast<double>(count * rounds);
+    std::cout << "messages " << count << " rounds " << rounds << std::endl;
+    std::cout << "dynamic_pointer_cast " << static_cast<double>(cast_time) / handled << "ns/message" << std::endl;
+    std::cout << "dispatch             " << static_cast<double>(dispatch_time) / handled << "ns/message" << std::endl;
+    std::cout << "speedup              " << static_cast<double>(cast_time) / static_cast<double>(dispatch_time) << "x" << std::endl;
+
+    return cast_total == handler.total ? 0 : 1;
+}
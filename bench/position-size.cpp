@@ -0,0 +1,81 @@
+#include "fss-transport.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+/* Compares the bytes on the wire for full and compact position reports
+   for a group of aircraft each reporting once a second.
+   usage: position-size [aircraft] [reports] [keyframe interval] */
+
+constexpr double origin_lat = -43.49;
+constexpr double origin_lng = 172.55;
+constexpr double orbit_radius = 0.05;
+constexpr uint64_t report_interval = 1000;
+constexpr uint64_t start_time = 1600000000000;
+
+static auto
+simulated_report(uint32_t aircraft, uint64_t report) -> std::shared_ptr<flight_safety_system::transport::fss_message_position_report>
+{
+    /* Each aircraft flies a slow orbit, climbing for the first few minutes */
+    double angle = (static_cast<double>(report) / 600.0 + static_cast<double>(aircraft)) * 2 * M_PI;
+    double lat = origin_lat + orbit_radius * std::sin(angle);
+    double lng = origin_lng + orbit_radius * std::cos(angle);
+    auto altitude = static_cast<uint32_t>(300 + std::min<uint64_t>(report, 300) * 5);
+    auto heading = static_cast<uint16_t>(std::fmod(angle * 18000 / M_PI + 9000, 36000));
+    int16_t vertical = report < 300 ? 5 : 0;
+    return std::make_shared<flight_safety_system::transport::fss_message_position_report>(lat, lng, altitude, heading, 45, vertical, 0xC80000 + aircraft, "ZK-" + std::to_string(aircraft), 01200, 0, 0, 1, 1, start_time + report * report_interval);
+}
+
+auto
+main(int argc, char *argv[]) -> int
+{
+    uint32_t aircraft = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10;
+    uint64_t reports = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 3600;
+    uint64_t keyframe_interval = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : flight_safety_system::transport::fss_position_encoder::default_keyframe_interval;
+
+    std::vector<std::shared_ptr<flight_safety_system::transport::fss_message_position_report>> messages;
+    for (uint64_t r = 0; r < reports; r++)
+    {
+        for (uint32_t a = 0; a < aircraft; a++)
+        {
+            messages.push_back(simulated_report(a, r));
+        }
+    }
+
+    uint64_t full_bytes = 0;
+    auto full_start = std::chrono::steady_clock::now();
+    for (auto &msg : messages)
+    {
+        full_bytes += msg->getPacked()->getLength();
+    }
+    auto full_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - full_start).count();
+
+    flight_safety_system::transport::fss_position_encoder encoder(keyframe_interval);
+    flight_safety_system::transport::fss_position_decoder decoder;
+    uint64_t compact_bytes = 0;
+    uint64_t decoded = 0;
+    auto compact_start = std::chrono::steady_clock::now();
+    for (auto &msg : messages)
+    {
+        auto bl = encoder.encode(msg)->getPacked();
+        compact_bytes += bl->getLength();
+        auto compact = std::static_pointer_cast<flight_safety_system::transport::fss_message_position_compact>(flight_safety_system::transport::fss_message::decode(bl));
+        if (decoder.decode(compact) != nullptr)
+        {
+            decoded++;
+        }
+    }
+    auto compact_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - compact_start).count();
+
+    auto count = static_cast<double>(messages.size());
+    std::cout << "reports " << messages.size() << " (" << aircraft << " aircraft, keyframe every " << keyframe_interval << ")" << std::endl;
+    std::cout << "full    " << full_bytes << " bytes, " << static_cast<double>(full_bytes) / count << " bytes/report, pack " << static_cast<double>(full_time) * 1000 / count << "ns/report" << std::endl;
+    std::cout << "compact " << compact_bytes << " bytes, " << static_cast<double>(compact_bytes) / count << " bytes/report, pack+decode " << static_cast<double>(compact_time) * 1000 / count << "ns/report" << std::endl;
+    std::cout << "saving  " << 100.0 * (1.0 - static_cast<double>(compact_bytes) / static_cast<double>(full_bytes)) << "%" << std::endl;
+    std::cout << "decoded " << decoded << " gaps " << decoder.getGaps() << std::endl;
+
+    return decoded == messages.size() ? 0 : 1;
+}
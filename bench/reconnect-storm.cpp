@@ -0,0 +1,165 @@
+#include "fss-transport-ssl.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Simulates every client reconnecting at once after a server restart and
+   reports how long it takes for all of them to get back on.
+   usage: reconnect-storm [clients] [threads] [rate] [burst] [naive]
+   A rate of 0 disables admission control, 'naive' uses the old doubling backoff without jitter */
+
+constexpr const char * CA_PUBLIC_FILE = "certs/ca.public.pem";
+constexpr const char * SERVER_PRIVATE_FILE = "certs/localhost.private.pem";
+constexpr const char * SERVER_PUBLIC_FILE = "certs/localhost.public.pem";
+constexpr const char * CLIENT_PRIVATE_FILE = "certs/client.private.pem";
+constexpr const char * CLIENT_PUBLIC_FILE = "certs/client.public.pem";
+
+constexpr uint16_t listen_port = 20400;
+constexpr uint64_t retry_delay_start = 100;
+constexpr uint64_t retry_delay_cap = 30000;
+
+static std::atomic<uint64_t> server_accepted{0};
+
+static auto
+accept_cb(std::shared_ptr<flight_safety_system::transport::fss_connection> conn __attribute__((unused))) -> bool
+{
+    server_accepted++;
+    return true;
+}
+
+class simulated_client {
+public:
+    std::chrono::steady_clock::time_point next_attempt{};
+    flight_safety_system::transport::fss_backoff backoff{retry_delay_start, retry_delay_cap};
+    uint64_t naive_delay{retry_delay_start};
+    uint64_t connected_after{0};
+    bool connected{false};
+};
+
+class storm_results {
+public:
+    uint64_t attempts{0};
+    uint64_t busy{0};
+    uint64_t failed{0};
+    std::vector<uint64_t> connect_times{};
+};
+
+static void
+run_clients(std::vector<simulated_client> *clients, std::shared_ptr<flight_safety_system::transport_ssl::fss_credentials> credentials, bool naive, std::chrono::steady_clock::time_point start, storm_results *results)
+{
+    size_t remaining = clients->size();
+    while (remaining > 0)
+    {
+        /* Pick the client due soonest */
+        auto next = std::min_element(clients->begin(), clients->end(), [](const simulated_client &a, const simulated_client &b) {
+            return !a.connected && (b.connected || a.next_attempt < b.next_attempt);
+        });
+        std::this_thread::sleep_until(next->next_attempt);
+
+        results->attempts++;
+        auto conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(credentials);
+        if (conn->connectTo("localhost", listen_port))
+        {
+            next->connected = true;
+            next->connected_after = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+            results->connect_times.push_back(next->connected_after);
+            remaining--;
+            continue;
+        }
+
+        uint64_t delay;
+        if (conn->getRetryAfter() != 0)
+        {
+            results->busy++;
+        }
+        else
+        {
+            results->failed++;
+        }
+        if (naive)
+        {
+            delay = next->naive_delay;
+            next->naive_delay = std::min(retry_delay_cap, next->naive_delay * 2);
+        }
+        else
+        {
+            delay = next->backoff.next(conn->getRetryAfter());
+        }
+        next->next_attempt = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+    }
+}
+
+auto
+main(int argc, char *argv[]) -> int
+{
+    size_t num_clients = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    size_t num_threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+    double rate = argc > 3 ? std::strtod(argv[3], nullptr) : 400;
+    double burst = argc > 4 ? std::strtod(argv[4], nullptr) : 50;
+    bool naive = argc > 5 && std::string(argv[5]) == "naive";
+    num_threads = std::max<size_t>(1, std::min(num_threads, num_clients));
+
+    auto server_credentials = std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE);
+    auto listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port, accept_cb, server_credentials, nullptr);
+    listen->setMaxPendingConnections(static_cast<int>(std::min<size_t>(num_clients, 4096)));
+    /* All the simulated clients come from the same address, so lift the per source limit */
+    auto pool = std::make_shared<flight_safety_system::transport::fss_handshake_pool>(flight_safety_system::transport::fss_handshake_pool::default_workers, num_clients, num_clients, flight_safety_system::transport::fss_handshake_pool::default_timeout);
+    pool->setRateLimit(rate, burst);
+    listen->setHandshakePool(pool);
+
+    auto client_credentials = std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    std::vector<std::vector<simulated_client>> clients(num_threads);
+    std::vector<storm_results> results(num_threads);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_clients; i++)
+    {
+        auto &c = clients[i % num_threads];
+        c.emplace_back();
+        /* Everyone notices the server is back within the same second */
+        if (!naive)
+        {
+            c.back().next_attempt = start + std::chrono::milliseconds(c.back().backoff.spread());
+        }
+        else
+        {
+            c.back().next_attempt = start;
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        threads.emplace_back(run_clients, &clients[i], client_credentials, naive, start, &results[i]);
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    storm_results total;
+    for (auto &r : results)
+    {
+        total.attempts += r.attempts;
+        total.busy += r.busy;
+        total.failed += r.failed;
+        total.connect_times.insert(total.connect_times.end(), r.connect_times.begin(), r.connect_times.end());
+    }
+    std::sort(total.connect_times.begin(), total.connect_times.end());
+    auto percentile = [&total](double p) { return total.connect_times[static_cast<size_t>(p * static_cast<double>(total.connect_times.size() - 1))]; };
+    auto stats = pool->getStats();
+
+    std::cout << "clients " << num_clients << " threads " << num_threads << " rate " << rate << " burst " << burst << (naive ? " naive backoff" : " jittered backoff") << std::endl;
+    std::cout << "all connected after " << elapsed << "ms" << std::endl;
+    std::cout << "connect time p50 " << percentile(0.5) << "ms p90 " << percentile(0.9) << "ms p99 " << percentile(0.99) << "ms" << std::endl;
+    std::cout << "attempts " << total.attempts << " busy " << total.busy << " failed " << total.failed << std::endl;
+    std::cout << "server handshakes " << stats.completed << " failed " << stats.failed << " busy " << stats.rejected_busy << " queue full " << stats.rejected_queue_full << " per source " << stats.rejected_per_source << " max queue wait " << stats.queue_wait_max << "ms" << std::endl;
+
+    return 0;
+}
@@ -72,9 +72,12 @@ main(int argc, char *argv[]) -> int
             constexpr int alt_type = 1;
             constexpr int emitter_type = 14;
             auto msg_pos = std::make_shared<flight_safety_system::transport::fss_message_position_report>(lat, lng, alt, heading_cdeg, hor_vel, vert_vel, icao_address, callsign, squawk_code, time_since_last_contact, flags, alt_type, emitter_type, flight_safety_system::fss_current_timestamp());
-            client->sendMsgAll(msg_status);
-            client->sendMsgAll(msg_search);
-            client->sendMsgAll(msg_pos);
+            /* Sent as one frame to servers that accept batches, and one at a time to the rest */
+            auto batch = std::make_shared<flight_safety_system::transport::fss_message_batch>();
+            batch->add(msg_status);
+            batch->add(msg_search);
+            batch->add(msg_pos);
+            client->sendMsgAll(batch);
         }
     }
     client->disconnect();
@@ -0,0 +1,408 @@
+#include "fss-transport.hpp"
+#include "fss-transport-ssl.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+/* Simulates many assets flying around and reporting their positions to one server, from a few sending threads.
+   Positions relayed back by the server are timestamped by the sender, so each one received gives the relay latency.
+   usage: fss-load-generator [-n assets] [-t threads] [-r rate[:max rate]] [-d duration] [-R reconnect interval] [-i stats interval] [-N name]
+                             (-l socket | -a address -p port -c ca -k key -C cert) */
+
+constexpr double origin_lat = -43.49;
+constexpr double origin_lng = 172.55;
+constexpr double max_orbit_radius = 0.2;
+constexpr double min_orbit_period = 120;
+constexpr double max_orbit_period = 900;
+constexpr uint64_t reconnect_delay_start = 100;
+constexpr uint64_t reconnect_delay_cap = 10000;
+constexpr uint32_t icao_base = 0xC00000;
+constexpr uint64_t max_latency = 10000;
+
+static std::atomic<bool> running{true};
+
+static void sigIntHandler(int signum __attribute__((unused)))
+{
+    running = false;
+}
+
+/* Latencies in milliseconds, one bucket per millisecond so any thread can add to it without a lock */
+class latency_histogram {
+private:
+    std::vector<std::atomic<uint64_t>> buckets;
+public:
+    latency_histogram() : buckets(max_latency + 1) {};
+    void add(uint64_t latency) {
+        this->buckets[std::min(latency, max_latency)]++;
+    }
+    auto snapshot() -> std::vector<uint64_t> {
+        std::vector<uint64_t> ret(this->buckets.size());
+        for (size_t i = 0; i < this->buckets.size(); i++)
+        {
+            ret[i] = this->buckets[i];
+        }
+        return ret;
+    }
+    /* The p'th percentile of the counts in (after - before) */
+    static auto percentile(const std::vector<uint64_t> &before, const std::vector<uint64_t> &after, double p) -> uint64_t {
+        uint64_t total = 0;
+        for (size_t i = 0; i < after.size(); i++)
+        {
+            total += after[i] - before[i];
+        }
+        auto target = static_cast<uint64_t>(std::ceil(p * static_cast<double>(total)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < after.size(); i++)
+        {
+            seen += after[i] - before[i];
+            if (seen >= target && seen > 0)
+            {
+                return i;
+            }
+        }
+        return 0;
+    }
+};
+
+class load_counters {
+public:
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> send_failures{0};
+    std::atomic<uint64_t> relayed{0};
+    std::atomic<uint64_t> connects{0};
+    std::atomic<uint64_t> connect_failures{0};
+    std::atomic<uint64_t> disconnects{0};
+    std::atomic<int64_t> connected{0};
+    latency_histogram latency{};
+};
+
+/* Times the positions relayed to an asset, everything else is ignored */
+class asset_handler : public flight_safety_system::transport::fss_message_cb {
+private:
+    load_counters *counters;
+    std::atomic<bool> closed{false};
+public:
+    asset_handler(std::shared_ptr<flight_safety_system::transport::fss_connection> t_conn, load_counters *t_counters) : fss_message_cb(std::move(t_conn)), counters(t_counters) {};
+    asset_handler(const asset_handler &) = delete;
+    asset_handler(asset_handler &&) = delete;
+    auto operator=(const asset_handler &) -> asset_handler& = delete;
+    auto operator=(asset_handler &&) -> asset_handler& = delete;
+    ~asset_handler() override = default;
+    void processMessage(std::shared_ptr<flight_safety_system::transport::fss_message> message) override {
+        if (message == nullptr)
+        {
+            return;
+        }
+        switch (message->getType())
+        {
+            case flight_safety_system::transport::message_type_closed:
+                this->closed = true;
+                break;
+            case flight_safety_system::transport::message_type_rtt_request:
+                /* Answered like a real client, so servers watching for dead connections keep us */
+                this->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_response>(message->getId()));
+                break;
+            case flight_safety_system::transport::message_type_position_report:
+            {
+                uint64_t now = flight_safety_system::fss_current_timestamp();
+                uint64_t sent = message->getTimeStamp();
+                this->counters->relayed++;
+                this->counters->latency.add(now > sent ? now - sent : 0);
+            } break;
+            default:
+                break;
+        }
+    }
+    auto isClosed() -> bool {
+        return this->closed;
+    }
+};
+
+class load_options {
+public:
+    size_t assets{1000};
+    size_t threads{4};
+    double min_rate{1};
+    double max_rate{1};
+    uint64_t duration{60};
+    double reconnect_interval{0};
+    uint64_t stats_interval{5};
+    std::string name{};
+    std::string local_path{};
+    std::string address{};
+    uint16_t port{0};
+    std::shared_ptr<flight_safety_system::transport_ssl::fss_credentials> credentials{};
+};
+
+class simulated_asset {
+public:
+    uint32_t index{0};
+    double rate{1};
+    double radius{0};
+    double period{0};
+    double phase{0};
+    std::chrono::steady_clock::time_point started{};
+    std::shared_ptr<asset_handler> handler{};
+    flight_safety_system::transport::fss_backoff backoff{reconnect_delay_start, reconnect_delay_cap};
+
+    auto position() -> std::shared_ptr<flight_safety_system::transport::fss_message_position_report> {
+        double flying = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->started).count();
+        double angle = this->phase + flying / this->period * 2 * M_PI;
+        double lat = origin_lat + this->radius * std::sin(angle);
+        double lng = origin_lng + this->radius * std::cos(angle);
+        /* Climb to a cruising altitude over the first few minutes */
+        auto altitude = static_cast<uint32_t>(300 + std::min(flying, 300.0) * 5);
+        auto heading = static_cast<uint16_t>(std::fmod(angle * 18000 / M_PI + 9000, 36000));
+        auto speed = static_cast<uint16_t>(this->radius * 111000 * 2 * M_PI / this->period * 100);
+        int16_t vertical = flying < 300 ? 500 : 0;
+        return std::make_shared<flight_safety_system::transport::fss_message_position_report>(lat, lng, altitude, heading, speed, vertical, icao_base + this->index, "LOAD" + std::to_string(this->index), 01200, 0, 0, 1, 1, flight_safety_system::fss_current_timestamp());
+    }
+};
+
+static auto
+asset_connect(const load_options &options, simulated_asset *asset, load_counters *counters) -> bool
+{
+    std::shared_ptr<flight_safety_system::transport::fss_connection> conn;
+    bool ok;
+    if (!options.local_path.empty())
+    {
+        auto local = std::make_shared<flight_safety_system::transport::fss_connection_local>();
+        ok = local->connectTo(options.local_path);
+        conn = local;
+    }
+    else
+    {
+        auto tls = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(options.credentials);
+        ok = tls->connectTo(options.address, options.port);
+        conn = tls;
+    }
+    if (!ok)
+    {
+        counters->connect_failures++;
+        return false;
+    }
+    asset->handler = std::make_shared<asset_handler>(conn, counters);
+    conn->setHandler(asset->handler.get());
+    conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_identity>(options.name.empty() ? "load-" + std::to_string(asset->index) : options.name));
+    counters->connects++;
+    counters->connected++;
+    return true;
+}
+
+static void
+asset_disconnect(simulated_asset *asset, load_counters *counters)
+{
+    if (asset->handler != nullptr)
+    {
+        asset->handler->disconnect();
+        asset->handler = nullptr;
+        counters->disconnects++;
+        counters->connected--;
+    }
+}
+
+/* Each thread looks after its own assets, sending whatever is due next */
+static void
+run_assets(const load_options *options, std::vector<simulated_asset> *assets, load_counters *counters, uint64_t seed)
+{
+    using due_entry = std::pair<std::chrono::steady_clock::time_point, size_t>;
+    std::priority_queue<due_entry, std::vector<due_entry>, std::greater<due_entry>> due;
+    std::mt19937_64 random(seed);
+    std::uniform_real_distribution<double> unit(0, 1);
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < assets->size(); i++)
+    {
+        /* Spread the connections over the first report interval rather than everyone arriving at once */
+        due.emplace(now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(unit(random) / (*assets)[i].rate)), i);
+    }
+    while (running && !due.empty())
+    {
+        auto next = due.top();
+        due.pop();
+        std::this_thread::sleep_until(next.first);
+        auto &asset = (*assets)[next.second];
+        if (asset.handler != nullptr && asset.handler->isClosed())
+        {
+            asset_disconnect(&asset, counters);
+        }
+        if (asset.handler == nullptr)
+        {
+            if (!asset_connect(*options, &asset, counters))
+            {
+                due.emplace(std::chrono::steady_clock::now() + std::chrono::milliseconds(asset.backoff.next()), next.second);
+                continue;
+            }
+            asset.backoff.reset();
+        }
+        if (asset.handler->sendMsg(asset.position()))
+        {
+            counters->sent++;
+        }
+        else
+        {
+            counters->send_failures++;
+        }
+        auto interval = std::chrono::duration<double>(1.0 / asset.rate);
+        /* Drop off now and then, like an aircraft flying out of coverage */
+        if (options->reconnect_interval > 0 && unit(random) < interval.count() / options->reconnect_interval)
+        {
+            asset_disconnect(&asset, counters);
+            due.emplace(std::chrono::steady_clock::now() + std::chrono::milliseconds(asset.backoff.next()), next.second);
+            continue;
+        }
+        due.emplace(next.first + std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval), next.second);
+    }
+    for (auto &asset : *assets)
+    {
+        asset_disconnect(&asset, counters);
+    }
+}
+
+static void
+usage(const char *name)
+{
+    std::cerr << "usage: " << name << " [-n assets] [-t threads] [-r rate[:max rate]] [-d duration] [-R reconnect interval] [-i stats interval] [-N name] (-l socket | -a address -p port -c ca -k key -C cert)" << std::endl;
+}
+
+auto
+main(int argc, char *argv[]) -> int
+{
+    load_options options;
+    std::string ca;
+    std::string private_key;
+    std::string public_key;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:r:d:R:i:N:l:a:p:c:k:C:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                options.assets = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 't':
+                options.threads = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'r':
+            {
+                /* Each asset reports at a rate picked between the two */
+                char *end = nullptr;
+                options.min_rate = std::strtod(optarg, &end);
+                options.max_rate = (end != nullptr && *end == ':') ? std::strtod(end + 1, nullptr) : options.min_rate;
+            } break;
+            case 'd':
+                options.duration = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 'R':
+                options.reconnect_interval = std::strtod(optarg, nullptr);
+                break;
+            case 'i':
+                options.stats_interval = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 'N':
+                options.name = optarg;
+                break;
+            case 'l':
+                options.local_path = optarg;
+                break;
+            case 'a':
+                options.address = optarg;
+                break;
+            case 'p':
+                options.port = static_cast<uint16_t>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'c':
+                ca = optarg;
+                break;
+            case 'k':
+                private_key = optarg;
+                break;
+            case 'C':
+                public_key = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if ((options.local_path.empty() && (options.address.empty() || options.port == 0 || ca.empty() || private_key.empty() || public_key.empty())) || options.assets == 0 || options.min_rate <= 0 || options.max_rate < options.min_rate)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    if (options.local_path.empty())
+    {
+        options.credentials = std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(ca, private_key, public_key);
+    }
+    options.threads = std::max<size_t>(1, std::min(options.threads, options.assets));
+    signal (SIGINT, sigIntHandler);
+    signal (SIGPIPE, SIG_IGN);
+
+    std::mt19937_64 random(std::random_device{}());
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::vector<std::vector<simulated_asset>> assets(options.threads);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < options.assets; i++)
+    {
+        simulated_asset asset;
+        asset.index = static_cast<uint32_t>(i);
+        asset.rate = options.min_rate + (options.max_rate - options.min_rate) * unit(random);
+        asset.radius = max_orbit_radius * (0.1 + 0.9 * unit(random));
+        asset.period = min_orbit_period + (max_orbit_period - min_orbit_period) * unit(random);
+        asset.phase = 2 * M_PI * unit(random);
+        asset.started = start;
+        assets[i % options.threads].push_back(asset);
+    }
+
+    load_counters counters;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.threads; i++)
+    {
+        threads.emplace_back(run_assets, &options, &assets[i], &counters, random());
+    }
+
+    std::cout << "assets " << options.assets << " threads " << options.threads << " rate " << options.min_rate << "-" << options.max_rate << "/s" << std::endl;
+    auto latency_start = counters.latency.snapshot();
+    auto latency_last = latency_start;
+    uint64_t sent_last = 0;
+    uint64_t relayed_last = 0;
+    auto last = start;
+    while (running && std::chrono::steady_clock::now() - start < std::chrono::seconds(options.duration))
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(options.stats_interval));
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - last).count();
+        uint64_t sent = counters.sent;
+        uint64_t relayed = counters.relayed;
+        auto latency = counters.latency.snapshot();
+        std::cout << std::chrono::duration_cast<std::chrono::seconds>(now - start).count() << "s connected " << counters.connected << " sent " << static_cast<double>(sent - sent_last) / seconds << "/s relayed " << static_cast<double>(relayed - relayed_last) / seconds << "/s latency p50 " << latency_histogram::percentile(latency_last, latency, 0.5) << "ms p99 " << latency_histogram::percentile(latency_last, latency, 0.99) << "ms max " << latency_histogram::percentile(latency_last, latency, 1) << "ms" << std::endl;
+        sent_last = sent;
+        relayed_last = relayed;
+        latency_last = latency;
+        last = now;
+    }
+    running = false;
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto latency = counters.latency.snapshot();
+    std::cout << "total sent " << counters.sent << " (" << static_cast<double>(counters.sent) / elapsed << "/s) failed " << counters.send_failures << std::endl;
+    std::cout << "total relayed " << counters.relayed << " (" << static_cast<double>(counters.relayed) / elapsed << "/s)" << std::endl;
+    std::cout << "latency p50 " << latency_histogram::percentile(latency_start, latency, 0.5) << "ms p90 " << latency_histogram::percentile(latency_start, latency, 0.9) << "ms p99 " << latency_histogram::percentile(latency_start, latency, 0.99) << "ms max " << latency_histogram::percentile(latency_start, latency, 1) << "ms" << std::endl;
+    std::cout << "connects " << counters.connects << " failed " << counters.connect_failures << " disconnects " << counters.disconnects << std::endl;
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include <fss-client-ssl.hpp>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+/* How far each new measurement moves the smoothed values */
+constexpr double rtt_gain = 0.125;
+constexpr double loss_gain = 0.2;
+
+void
+flight_safety_system::client_ssl::fss_server::probe(uint64_t timeout)
+{
+    if (!this->connected())
+    {
+        return;
+    }
+    uint64_t now = fss_monotonic_timestamp();
+    std::lock_guard<std::mutex> lock_holder(this->link_lock);
+    if (this->probe_sent != 0)
+    {
+        if (now - this->probe_sent < timeout)
+        {
+            return;
+        }
+        this->link.loss += loss_gain * (1 - this->link.loss);
+        this->probe_sent = 0;
+    }
+    /* Still holding the lock, so the response can't be handled before the request is recorded */
+    auto request = std::make_shared<flight_safety_system::transport::fss_message_rtt_request>();
+    if (!this->sendMsg(request))
+    {
+        return;
+    }
+    this->probe_id = request->getId();
+    this->probe_sent = now;
+    this->link.probes++;
+}
+
+auto
+flight_safety_system::client_ssl::fss_server::getLink() -> fss_server_link
+{
+    uint64_t now = fss_monotonic_timestamp();
+    std::lock_guard<std::mutex> lock_holder(this->link_lock);
+    fss_server_link current = this->link;
+    current.waiting = this->probe_sent != 0 ? now - this->probe_sent : 0;
+    return current;
+}
+
+void
+flight_safety_system::client_ssl::fss_server::handleMessage(flight_safety_system::transport::fss_message_rtt_response &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused)))
+{
+    uint64_t now = fss_monotonic_timestamp();
+    std::lock_guard<std::mutex> lock_holder(this->link_lock);
+    if (this->probe_sent == 0 || msg.getRequestId() != this->probe_id)
+    {
+        return;
+    }
+    auto sample = static_cast<double>(now - this->probe_sent);
+    this->link.rtt = this->link.responses == 0 ? sample : this->link.rtt + rtt_gain * (sample - this->link.rtt);
+    this->link.loss -= loss_gain * this->link.loss;
+    this->link.responses++;
+    this->probe_sent = 0;
+}
+
+void
+flight_safety_system::client_ssl::fss_client::setServerSelection(const fss_server_selection &t_selection)
+{
+    std::atomic_store(&this->selection, std::shared_ptr<const fss_server_selection>(std::make_shared<fss_server_selection>(t_selection)));
+}
+
+auto
+flight_safety_system::client_ssl::fss_client::getPrimary() -> std::shared_ptr<fss_server>
+{
+    return std::atomic_load(&this->primary);
+}
+
+void
+flight_safety_system::client_ssl::fss_client::probeServers()
+{
+    auto current = std::atomic_load(&this->selection);
+    uint64_t now = fss_monotonic_timestamp();
+    uint64_t last = this->last_probe;
+    if (now - last < current->probe_interval || !this->last_probe.compare_exchange_strong(last, now))
+    {
+        return;
+    }
+    for (const auto &server : this->getServers()->connected)
+    {
+        server->probe(current->probe_timeout);
+    }
+    this->selectPrimary();
+}
+
+void
+flight_safety_system::client_ssl::fss_client::selectPrimary()
+{
+    auto current = std::atomic_load(&this->selection);
+    auto previous = this->getPrimary();
+    std::shared_ptr<fss_server> best = nullptr;
+    double best_rtt = 0;
+    bool previous_healthy = false;
+    double previous_rtt = 0;
+    for (const auto &server : this->getServers()->connected)
+    {
+        auto link = server->getLink();
+        /* A server that has gone quiet is as slow as it has been quiet, and one not yet measured can't be picked */
+        double rtt = std::max(link.rtt, static_cast<double>(link.waiting));
+        bool healthy = link.responses > 0 && rtt <= current->max_rtt && link.loss <= current->max_loss;
+        if (server == previous)
+        {
+            previous_healthy = healthy;
+            previous_rtt = rtt;
+        }
+        if (healthy && (best == nullptr || rtt < best_rtt))
+        {
+            best = server;
+            best_rtt = rtt;
+        }
+    }
+    /* Don't flap between servers that are about as good as each other */
+    if (previous_healthy && best_rtt + current->switch_margin > previous_rtt)
+    {
+        best = previous;
+    }
+    std::atomic_store(&this->primary, best);
+}
+
+auto
+flight_safety_system::client_ssl::fss_client::policyFor(flight_safety_system::transport::fss_message_type type, const fss_server_selection &current) -> const fss_message_policy *
+{
+    switch (type)
+    {
+        case flight_safety_system::transport::message_type_position_report:
+            return &current.position;
+        case flight_safety_system::transport::message_type_system_status:
+            return &current.status;
+        case flight_safety_system::transport::message_type_search_status:
+            return &current.search_status;
+        default:
+            return nullptr;
+    }
+}
+
+auto
+flight_safety_system::client_ssl::fss_client::copyDue(flight_safety_system::transport::fss_message_type type, const fss_message_policy &policy, uint64_t now) -> bool
+{
+    if (policy.copy_interval == 0)
+    {
+        return false;
+    }
+    auto &last = this->last_copy[type == flight_safety_system::transport::message_type_position_report ? 0 : type == flight_safety_system::transport::message_type_system_status ? 1 : 2];
+    uint64_t previous = last;
+    return now - previous >= policy.copy_interval && last.compare_exchange_strong(previous, now);
+}
@@ -1,5 +1,6 @@
 #include <fss-client-ssl.hpp>
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <ostream>
@@ -11,6 +12,44 @@
 #include <json/json.h>
 #pragma GCC diagnostic pop
 
+static auto
+socket_profile_from_config(const Json::Value &config) -> flight_safety_system::transport::fss_socket_profile
+{
+    flight_safety_system::transport::fss_socket_profile profile;
+    profile.nodelay = config.get("nodelay", profile.nodelay).asBool();
+    profile.send_buffer = config.get("send_buffer", 0).asInt();
+    profile.recv_buffer = config.get("recv_buffer", 0).asInt();
+    profile.keepalive = config.get("keepalive", false).asBool();
+    profile.keepalive_idle = config.get("keepalive_idle", 0).asInt();
+    profile.keepalive_interval = config.get("keepalive_interval", 0).asInt();
+    profile.keepalive_count = config.get("keepalive_count", 0).asInt();
+    profile.user_timeout = config.get("user_timeout", 0).asUInt();
+    profile.max_missed_rtt = config.get("max_missed_rtt", 0).asUInt();
+    return profile;
+}
+
+static void
+message_policy_from_config(flight_safety_system::client_ssl::fss_message_policy &policy, const Json::Value &config)
+{
+    policy.best_only = config.get("best_only", false).asBool();
+    policy.copy_interval = config.get("copy_interval", 0).asUInt64();
+}
+
+static auto
+server_selection_from_config(const Json::Value &config) -> flight_safety_system::client_ssl::fss_server_selection
+{
+    flight_safety_system::client_ssl::fss_server_selection selection;
+    message_policy_from_config(selection.position, config["position"]);
+    message_policy_from_config(selection.status, config["status"]);
+    message_policy_from_config(selection.search_status, config["search_status"]);
+    selection.probe_interval = config.get("probe_interval", Json::Value::UInt64(selection.probe_interval)).asUInt64();
+    selection.probe_timeout = config.get("probe_timeout", Json::Value::UInt64(selection.probe_timeout)).asUInt64();
+    selection.max_rtt = config.get("max_rtt", selection.max_rtt).asDouble();
+    selection.max_loss = config.get("max_loss", selection.max_loss).asDouble();
+    selection.switch_margin = config.get("switch_margin", selection.switch_margin).asDouble();
+    return selection;
+}
+
 flight_safety_system::client_ssl::fss_client::fss_client(const std::string &t_fileName)
 {
     /* Open the config file */
@@ -25,21 +64,33 @@ flight_safety_system::client_ssl::fss_client::fss_client(const std::string &t_fi
 
     this->setAssetName(config["name"].asString());
 
-    this->ca_file = config["ssl"]["ca_public_key"].asString();
-    this->private_key_file = config["ssl"]["client_private_key"].asString();
-    this->public_key_file = config["ssl"]["client_public_key"].asString();
+    this->credentials = std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(config["ssl"]["ca_public_key"].asString(), config["ssl"]["client_private_key"].asString(), config["ssl"]["client_public_key"].asString());
+    this->early_identity = config["ssl"]["early_identity"].asBool();
+    this->kernel_tls = config["ssl"]["kernel_tls"].asBool();
+    this->compact_positions = config["compact_positions"].asBool();
+    this->batch_messages = config["batch_messages"].asBool();
+    this->socket_profile = socket_profile_from_config(config["socket"]);
+    this->datagram = config["datagram"].asBool();
+    if (config.isMember("selection"))
+    {
+        this->setServerSelection(server_selection_from_config(config["selection"]));
+    }
+    if (config.isMember("traffic"))
+    {
+        this->traffic = std::make_shared<flight_safety_system::client_ssl::fss_traffic_table>(config["traffic"].get("capacity", Json::Value::UInt64(fss_traffic_table::default_capacity)).asUInt64(), config["traffic"].get("max_age", Json::Value::UInt64(fss_traffic_table::default_max_age)).asUInt64());
+    }
 
     /* Load all the known servers from the config */
     for (unsigned int idx = 0; idx < config["servers"].size(); idx++)
     {
-        auto server = std::make_shared<flight_safety_system::client_ssl::fss_server>(this, config["servers"][idx]["address"].asString(), config["servers"][idx]["port"].asInt(), this->ca_file, this->private_key_file, this->public_key_file);
+        auto server = std::make_shared<flight_safety_system::client_ssl::fss_server>(this, config["servers"][idx]["address"].asString(), config["servers"][idx]["port"].asInt(), this->credentials);
         this->addServer(server);
     }
 }
 
 flight_safety_system::client_ssl::fss_client::fss_client() = default;
 
-flight_safety_system::client_ssl::fss_client::fss_client(std::string t_ca, std::string t_private_key, std::string t_public_key) : ca_file(std::move(t_ca)), private_key_file(std::move(t_private_key)), public_key_file(std::move(t_public_key))
+flight_safety_system::client_ssl::fss_client::fss_client(std::string t_ca, std::string t_private_key, std::string t_public_key) : credentials(std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(std::move(t_ca), std::move(t_private_key), std::move(t_public_key)))
 {
 }
 
@@ -48,7 +99,7 @@ flight_safety_system::client_ssl::fss_client::~fss_client() = default;
 void
 flight_safety_system::client_ssl::fss_client::disconnect()
 {
-    for (const auto &server : this->servers)
+    for (const auto &server : this->getServers()->connected)
     {
         server->disconnect();
     }
@@ -62,7 +113,7 @@ flight_safety_system::client_ssl::fss_client::setAssetName(std::string t_asset_n
 void
 flight_safety_system::client_ssl::fss_client::connectTo(const std::string &t_address, uint16_t t_port, bool t_connect)
 {
-    auto server = std::make_shared<flight_safety_system::client_ssl::fss_server>(this, t_address, t_port, this->ca_file, this->private_key_file, this->public_key_file);
+    auto server = std::make_shared<flight_safety_system::client_ssl::fss_server>(this, t_address, t_port, this->credentials);
     if (t_connect)
     {
         server->reconnect();
@@ -73,68 +124,230 @@ flight_safety_system::client_ssl::fss_client::connectTo(const std::string &t_add
 void
 flight_safety_system::client_ssl::fss_client::attemptReconnect()
 {
-    std::list<std::shared_ptr<fss_server>> reconnected;
-    bool any_connected = false;
-    for (auto const &server : this->reconnect_servers)
+    this->probeServers();
+    /* Connecting takes a while, so it is done outside any update */
+    std::vector<std::shared_ptr<fss_server>> reconnected;
+    for (auto const &server : this->getServers()->reconnect)
     {
         if(server->reconnect())
         {
             reconnected.push_back(server);
-            any_connected = true;
         }
     }
-    while(!reconnected.empty())
+    if (reconnected.empty())
     {
-        auto server = reconnected.front();
-        reconnected.pop_front();
-        reconnect_servers.remove(server);
-        servers.push_back(server);
-    }
-    if (any_connected)
-    {
-        this->notifyConnectionStatus();
+        return;
     }
+    this->updateServerSet([&reconnected](fss_server_set &set) -> bool {
+        for (auto const &server : reconnected)
+        {
+            auto it = std::find(set.reconnect.begin(), set.reconnect.end(), server);
+            if (it != set.reconnect.end())
+            {
+                set.reconnect.erase(it);
+                set.connected.push_back(server);
+            }
+        }
+        return true;
+    });
+    this->notifyConnectionStatus();
 }
 
 void
 flight_safety_system::client_ssl::fss_client::sendMsgAll(const std::shared_ptr<flight_safety_system::transport::fss_message> &msg)
 {
-    for (auto const &server: this->servers)
+    /* The set holds its servers, so they stay valid while they are sent to even if they disconnect */
+    auto set = this->getServers();
+    auto current = std::atomic_load(&this->selection);
+    auto best = this->getPrimary();
+    /* Without a primary that is still connected, everything goes everywhere */
+    if (!(current->position.best_only || current->status.best_only || current->search_status.best_only) || best == nullptr || std::find(set->connected.begin(), set->connected.end(), best) == set->connected.end())
+    {
+        for (auto const &server: set->connected)
+        {
+            server->sendMsg(msg);
+        }
+        return;
+    }
+    uint64_t now = fss_monotonic_timestamp();
+    auto everyone = [this, &current, now](const std::shared_ptr<flight_safety_system::transport::fss_message> &m) -> bool {
+        const auto *policy = this->policyFor(m->getType(), *current);
+        return policy == nullptr || !policy->best_only || this->copyDue(m->getType(), *policy, now);
+    };
+    if (msg->getType() != flight_safety_system::transport::message_type_batch)
+    {
+        bool all = everyone(msg);
+        for (auto const &server: set->connected)
+        {
+            if (all || server == best)
+            {
+                server->sendMsg(msg);
+            }
+        }
+        return;
+    }
+    /* The primary gets the whole batch, the others only what is meant for them */
+    auto others = std::make_shared<flight_safety_system::transport::fss_message_batch>();
+    bool whole = true;
+    for (auto const &m : std::static_pointer_cast<flight_safety_system::transport::fss_message_batch>(msg)->getMessages())
+    {
+        if (everyone(m))
+        {
+            others->add(m);
+        }
+        else
+        {
+            whole = false;
+        }
+    }
+    for (auto const &server: set->connected)
     {
-        server->sendMsg(msg);
+        if (whole || server == best)
+        {
+            server->sendMsg(msg);
+        }
+        else if (!others->getMessages().empty())
+        {
+            server->sendMsg(others);
+        }
     }
 }
 
+auto
+flight_safety_system::client_ssl::fss_client::getServers() -> std::shared_ptr<const fss_server_set>
+{
+    return std::atomic_load(&this->servers);
+}
+
+auto
+flight_safety_system::client_ssl::fss_client::updateServerSet(const std::function<bool(fss_server_set &)> &change) -> std::shared_ptr<const fss_server_set>
+{
+    auto current = std::atomic_load(&this->servers);
+    std::shared_ptr<const fss_server_set> next;
+    do
+    {
+        auto changed = std::make_shared<fss_server_set>(*current);
+        if (!change(*changed))
+        {
+            return current;
+        }
+        next = changed;
+    } while (!std::atomic_compare_exchange_weak(&this->servers, &current, next));
+    return next;
+}
+
 auto
 flight_safety_system::client_ssl::fss_client::getAssetName() -> std::string
 {
     return this->asset_name;
 }
 
-void
-flight_safety_system::client_ssl::fss_client::addServer(const std::shared_ptr<flight_safety_system::client_ssl::fss_server> &server)
+auto
+flight_safety_system::client_ssl::fss_client::reloadCredentials() -> bool
 {
-    if (server->connected())
+    if (this->credentials == nullptr)
     {
-        this->servers.push_back(server);
-    }
-    else
-    {
-        this->reconnect_servers.push_back(server);
+        return false;
     }
+    return this->credentials->reload();
 }
 
-static auto
-server_list_matches (const std::list<std::shared_ptr<flight_safety_system::client_ssl::fss_server>> &servers, const std::string &address, uint16_t port) -> bool
+void
+flight_safety_system::client_ssl::fss_client::setEarlyIdentity(bool t_early_identity)
+{
+    this->early_identity = t_early_identity;
+}
+
+auto
+flight_safety_system::client_ssl::fss_client::getEarlyIdentity() -> bool
+{
+    return this->early_identity;
+}
+
+void
+flight_safety_system::client_ssl::fss_client::setCompactPositions(bool t_compact_positions)
+{
+    this->compact_positions = t_compact_positions;
+}
+
+auto
+flight_safety_system::client_ssl::fss_client::getCompactPositions() -> bool
+{
+    return this->compact_positions;
+}
+
+void
+flight_safety_system::client_ssl::fss_client::setBatchMessages(bool t_batch_messages)
+{
+    this->batch_messages = t_batch_messages;
+}
+
+auto
+flight_safety_system::client_ssl::fss_client::getBatchMessages() -> bool
+{
+    return this->batch_messages;
+}
+
+void
+flight_safety_system::client_ssl::fss_client::setSocketProfile(const flight_safety_system::transport::fss_socket_profile &t_profile)
+{
+    this->socket_profile = t_profile;
+}
+
+auto
+flight_safety_system::client_ssl::fss_client::getSocketProfile() -> flight_safety_system::transport::fss_socket_profile
+{
+    return this->socket_profile;
+}
+
+void
+flight_safety_system::client_ssl::fss_client::setKernelTLS(bool t_kernel_tls)
 {
-    for(auto const &server: servers)
+    this->kernel_tls = t_kernel_tls;
+}
+
+auto
+flight_safety_system::client_ssl::fss_client::getKernelTLS() -> bool
+{
+    return this->kernel_tls;
+}
+
+void
+flight_safety_system::client_ssl::fss_client::setDatagram(bool t_datagram)
+{
+    this->datagram = t_datagram;
+}
+
+auto
+flight_safety_system::client_ssl::fss_client::getDatagram() -> bool
+{
+    return this->datagram;
+}
+
+void
+flight_safety_system::client_ssl::fss_client::addServer(const std::shared_ptr<flight_safety_system::client_ssl::fss_server> &server)
+{
+    bool connected = server->connected();
+    this->updateServerSet([&server, connected](fss_server_set &set) -> bool {
+        (connected ? set.connected : set.reconnect).push_back(server);
+        return true;
+    });
+}
+
+auto
+flight_safety_system::client_ssl::fss_server_set::find(const std::string &address, uint16_t port) const -> std::shared_ptr<fss_server>
+{
+    for (const auto *list : {&this->connected, &this->reconnect})
     {
-        if (server->getAddress().compare(address) == 0 && server->getPort() == port)
+        for (auto const &server : *list)
         {
-            return true;
+            if (server->getAddress() == address && server->getPort() == port)
+            {
+                return server;
+            }
         }
     }
-    return false;
+    return nullptr;
 }
 
 void
@@ -142,30 +355,41 @@ flight_safety_system::client_ssl::fss_client::updateServers(const std::shared_pt
 {
     for (auto const &server_entry: msg->getServers())
     {
-        bool exists = false;
-        exists = server_list_matches(this->servers, server_entry.first, server_entry.second);
-        if (!exists)
-        {
-            exists = server_list_matches(this->reconnect_servers, server_entry.first, server_entry.second);
-        }
-        if (!exists)
+        if (this->getServers()->find(server_entry.first, server_entry.second) != nullptr)
         {
-            this->connectTo(server_entry.first, server_entry.second, false);
+            continue;
         }
+        /* Another server's list may name it at the same time, only one of them is kept */
+        auto server = std::make_shared<flight_safety_system::client_ssl::fss_server>(this, server_entry.first, server_entry.second, this->credentials);
+        this->updateServerSet([&server](fss_server_set &set) -> bool {
+            if (set.find(server->getAddress(), server->getPort()) != nullptr)
+            {
+                return false;
+            }
+            set.reconnect.push_back(server);
+            return true;
+        });
     }
 }
 
 void
 flight_safety_system::client_ssl::fss_client::serverRequiresReconnect(flight_safety_system::client_ssl::fss_server *server)
 {
-    for (auto s : this->servers)
-    {
-        if (s.get() == server)
+    this->updateServerSet([server](fss_server_set &set) -> bool {
+        for (auto it = set.connected.begin(); it != set.connected.end(); ++it)
         {
-            this->servers.remove(s);
-            this->reconnect_servers.push_back(std::move(s));
-            break;
+            if (it->get() == server)
+            {
+                set.reconnect.push_back(*it);
+                set.connected.erase(it);
+                return true;
+            }
         }
+        return false;
+    });
+    if (this->getPrimary().get() == server)
+    {
+        this->selectPrimary();
     }
     this->notifyConnectionStatus();
 }
@@ -173,7 +397,7 @@ flight_safety_system::client_ssl::fss_client::serverRequiresReconnect(flight_saf
 void
 flight_safety_system::client_ssl::fss_client::notifyConnectionStatus()
 {
-    switch (this->servers.size())
+    switch (this->getServers()->connected.size())
     {
         case 0:
             this->connectionStatusChange(CLIENT_CONNECTION_STATUS_DISCONNECTED);
@@ -197,6 +421,12 @@ flight_safety_system::client_ssl::fss_client::handleCommand(const std::shared_pt
 {
 }
 
+auto
+flight_safety_system::client_ssl::fss_client::getTraffic() -> std::shared_ptr<fss_traffic_table>
+{
+    return this->traffic;
+}
+
 void
 flight_safety_system::client_ssl::fss_client::handlePositionReport(const std::shared_ptr<flight_safety_system::transport::fss_message_position_report> &msg __attribute__((unused)))
 {
@@ -207,11 +437,30 @@ flight_safety_system::client_ssl::fss_client::handleSMMSettings(const std::share
 {
 }
 
-flight_safety_system::client_ssl::fss_server::fss_server(flight_safety_system::client_ssl::fss_client *t_client, std::string t_address, uint16_t t_port, std::string t_ca, std::string t_private_key, std::string t_public_key) : flight_safety_system::transport::fss_message_cb(nullptr), client(t_client), address(std::move(t_address)), port(t_port), ca_file(std::move(t_ca)), private_key_file(std::move(t_private_key)), public_key_file(std::move(t_public_key))
+flight_safety_system::client_ssl::fss_server::fss_server(flight_safety_system::client_ssl::fss_client *t_client, std::string t_address, uint16_t t_port, std::string t_ca, std::string t_private_key, std::string t_public_key) : fss_server(t_client, std::move(t_address), t_port, std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(std::move(t_ca), std::move(t_private_key), std::move(t_public_key)))
+{
+}
+
+flight_safety_system::client_ssl::fss_server::fss_server(flight_safety_system::client_ssl::fss_client *t_client, std::string t_address, uint16_t t_port, std::shared_ptr<flight_safety_system::transport_ssl::fss_credentials> t_credentials) : flight_safety_system::transport::fss_message_cb(nullptr), client(t_client), address(std::move(t_address)), port(t_port), credentials(std::move(t_credentials))
 {
+    /* Start resolving the name now so the first connect doesn't wait on it */
+    flight_safety_system::transport::fss_resolver::getResolver()->prefetch(this->address);
 }
 
-flight_safety_system::client_ssl::fss_server::~fss_server() = default;
+flight_safety_system::client_ssl::fss_server::~fss_server()
+{
+    this->stopDatagram();
+}
+
+void
+flight_safety_system::client_ssl::fss_server::stopDatagram()
+{
+    if (this->datagram != nullptr)
+    {
+        this->datagram->stop();
+        this->datagram = nullptr;
+    }
+}
 
 auto
 flight_safety_system::client_ssl::fss_server::getAddress() -> std::string
@@ -236,46 +485,75 @@ void
 flight_safety_system::client_ssl::fss_server::sendIdentify()
 {
     auto ident_msg = std::make_shared<flight_safety_system::transport::fss_message_identity>(this->client->getAssetName());
-    this->getConnection()->sendMsg(ident_msg);
+    this->sendMsg(ident_msg);
 }
 
 auto
 flight_safety_system::client_ssl::fss_server::reconnect_to() -> bool
 {
-    this->setConnection(std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(this->ca_file, this->private_key_file, this->public_key_file));
-    return this->getConnection()->connectTo(this->getAddress(), this->getPort());
+    bool early_identity = this->client->getEarlyIdentity() && !this->resume_data.empty();
+    auto ssl_conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(this->credentials, early_identity);
+    /* Resume the previous TLS session (if the server still accepts the ticket) */
+    ssl_conn->setResumeData(this->resume_data);
+    if (early_identity)
+    {
+        ssl_conn->setEarlyMsg(std::make_shared<flight_safety_system::transport::fss_message_identity>(this->client->getAssetName()));
+    }
+    ssl_conn->setCompactPositions(this->client->getCompactPositions());
+    ssl_conn->setBatching(this->client->getBatchMessages());
+    ssl_conn->setSocketProfile(this->client->getSocketProfile());
+    ssl_conn->setKernelTLS(this->client->getKernelTLS());
+    this->setConnection(ssl_conn);
+    return ssl_conn->connectTo(this->getAddress(), this->getPort());
 }
 
 auto
 flight_safety_system::client_ssl::fss_server::reconnect() -> bool
 {
-    uint64_t ts = fss_current_timestamp();
+    uint64_t ts = fss_monotonic_timestamp();
     uint64_t elapsed_time = ts - this->last_tried;
 
-    if (this->getConnection() != nullptr)
+    this->stopDatagram();
+    {
+        /* A request in flight went with the old connection */
+        std::lock_guard<std::mutex> lock_holder(this->link_lock);
+        this->probe_sent = 0;
+    }
+    auto old_conn = std::dynamic_pointer_cast<flight_safety_system::transport_ssl::fss_connection_client>(this->getConnection());
+    if (old_conn != nullptr)
     {
-        this->clearConnection();
+        this->resume_data = old_conn->getResumeData();
     }
+    this->clearConnection();
 
     if (elapsed_time > this->retry_delay)
     {
         this->retry_count++;
-        if (this->retry_delay < retry_delay_cap)
-        {
-            this->retry_delay += this->retry_delay;
-        }
         this->last_tried = ts;
-        if (!this->reconnect_to())
+        bool connected = this->reconnect_to();
+        /* Senders may be reading the connection meanwhile, so work from one copy of it */
+        auto ssl_conn = std::dynamic_pointer_cast<flight_safety_system::transport_ssl::fss_connection_client>(this->getConnection());
+        if (!connected || ssl_conn == nullptr)
         {
+            /* Back off with jitter so clients don't retry in lock step, and never sooner than the server asked */
+            this->retry_delay = this->backoff.next(ssl_conn != nullptr ? ssl_conn->getRetryAfter() : 0);
             this->clearConnection();
         }
         else
         {
-            this->getConnection()->setHandler(this);
-            this->sendIdentify();
+            ssl_conn->setHandler(this);
+            if (!ssl_conn->earlyDataAccepted())
+            {
+                this->sendIdentify();
+            }
+            if (this->client->getDatagram())
+            {
+                this->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_datagram_request>());
+            }
             this->retry_count = 0;
             this->last_tried = 0;
-            this->retry_delay = retry_delay_start;
+            this->retry_delay = 0;
+            this->backoff.reset();
             return true;
         }
     }
@@ -294,70 +572,66 @@ flight_safety_system::client_ssl::fss_server::processMessage(std::shared_ptr<fli
 #endif
     if (msg->getType() == flight_safety_system::transport::message_type_closed)
     {
-        /* Connection has been closed, schedule reconnection */
+        /* Connection has been closed, schedule reconnection.
+           When a server restarts every client sees this at once, so spread out the first attempt */
         this->getClient()->serverRequiresReconnect(this);
-        this->last_tried = 0;
+        this->last_tried = fss_monotonic_timestamp();
+        this->retry_delay = this->backoff.spread();
         this->retry_count = 0;
         return;
     }
-    else
+    flight_safety_system::transport::fss_message_dispatch(msg, *this);
+}
+
+void
+flight_safety_system::client_ssl::fss_server::handleMessage(flight_safety_system::transport::fss_message &msg __attribute__((unused)), const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused)))
+{
+    /* Compact positions and batches are unpacked by the connection, and servers don't send status reports */
+}
+
+void
+flight_safety_system::client_ssl::fss_server::handleMessage(flight_safety_system::transport::fss_message_datagram_offer &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused)))
+{
+    /* Position reports go over DTLS once it is up, everything else stays here */
+    auto current = this->getConnection();
+    if (this->datagram == nullptr && current != nullptr)
     {
-        switch (msg->getType())
-        {
-            case flight_safety_system::transport::message_type_unknown:
-            case flight_safety_system::transport::message_type_closed:
-            case flight_safety_system::transport::message_type_identity:
-            case flight_safety_system::transport::message_type_identity_non_aircraft:
-            case flight_safety_system::transport::message_type_identity_required:
-                break;
-            case flight_safety_system::transport::message_type_rtt_request:
-            {
-                /* Send a response */
-                auto reply_msg = std::make_shared<flight_safety_system::transport::fss_message_rtt_response>(msg->getId());
-                this->sendMsg(reply_msg);
-            }
-                break;
-            case flight_safety_system::transport::message_type_rtt_response:
-            /* Currently we don't send any rtt requests */
-                break;
-            case flight_safety_system::transport::message_type_position_report:
-            {
-                /* Servers will be relaying position reports, so this is another asset */
-                auto position_msg = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_position_report>(msg);
-                if (position_msg != nullptr)
-                {
-                    this->getClient()->handlePositionReport(position_msg);
-                }
-            } break;
-            case flight_safety_system::transport::message_type_system_status:
-            /* Servers don't currently send status reports */
-            case flight_safety_system::transport::message_type_search_status:
-            /* Servers don't have a search status to report */
-                break;
-            case flight_safety_system::transport::message_type_command:
-            {
-                auto command_msg = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_asset_command>(msg);
-                if (command_msg != nullptr)
-                {
-                    this->getClient()->handleCommand(command_msg);
-                }
-            } break;
-            case flight_safety_system::transport::message_type_server_list:
-            {
-                auto server_list_msg = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_server_list>(msg);
-                if (server_list_msg != nullptr)
-                {
-                    this->getClient()->updateServers(server_list_msg);
-                }
-            } break;
-            case flight_safety_system::transport::message_type_smm_settings:
-            {
-                auto smm_settings_msg = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_smm_settings>(msg);
-                if (smm_settings_msg != nullptr)
-                {
-                    this->getClient()->handleSMMSettings(smm_settings_msg);
-                }
-            } break;
-        }
+        this->datagram = std::make_shared<flight_safety_system::transport_ssl::fss_datagram_client>(this->credentials, current);
+        current->setDatagramChannel(this->datagram);
+        this->datagram->start(this->getAddress(), msg.getPort(), msg.getToken());
     }
+}
+
+void
+flight_safety_system::client_ssl::fss_server::handleMessage(flight_safety_system::transport::fss_message_rtt_request &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused)))
+{
+    /* Send a response */
+    auto reply_msg = std::make_shared<flight_safety_system::transport::fss_message_rtt_response>(msg.getId());
+    this->sendMsg(reply_msg);
+}
+
+void
+flight_safety_system::client_ssl::fss_server::handleMessage(flight_safety_system::transport::fss_message_position_report &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner)
+{
+    /* Servers will be relaying position reports, so this is another asset */
+    this->getClient()->getTraffic()->update(msg);
+    this->getClient()->handlePositionReport(std::static_pointer_cast<flight_safety_system::transport::fss_message_position_report>(owner));
+}
+
+void
+flight_safety_system::client_ssl::fss_server::handleMessage(flight_safety_system::transport::fss_message_asset_command &msg __attribute__((unused)), const std::shared_ptr<flight_safety_system::transport::fss_message> &owner)
+{
+    this->getClient()->handleCommand(std::static_pointer_cast<flight_safety_system::transport::fss_message_asset_command>(owner));
+}
+
+void
+flight_safety_system::client_ssl::fss_server::handleMessage(flight_safety_system::transport::fss_message_server_list &msg __attribute__((unused)), const std::shared_ptr<flight_safety_system::transport::fss_message> &owner)
+{
+    this->getClient()->updateServers(std::static_pointer_cast<flight_safety_system::transport::fss_message_server_list>(owner));
+}
+
+void
+flight_safety_system::client_ssl::fss_server::handleMessage(flight_safety_system::transport::fss_message_smm_settings &msg __attribute__((unused)), const std::shared_ptr<flight_safety_system::transport::fss_message> &owner)
+{
+    this->getClient()->handleSMMSettings(std::static_pointer_cast<flight_safety_system::transport::fss_message_smm_settings>(owner));
 }
\ No newline at end of file
@@ -0,0 +1,254 @@
+#include <fss-client-ssl.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+static_assert(std::is_trivially_copyable<flight_safety_system::client_ssl::fss_traffic_target>::value, "traffic targets are copied word by word");
+
+constexpr uint64_t icao_key = 1ULL << 63;
+constexpr uint64_t fnv_offset = 14695981039346656037ULL;
+constexpr uint64_t fnv_prime = 1099511628211ULL;
+constexpr uint64_t golden_ratio = 0x9E3779B97F4A7C15ULL;
+
+auto
+flight_safety_system::client_ssl::fss_traffic_target::getCallSign() const -> std::string
+{
+    return std::string(this->callsign.data(), strnlen(this->callsign.data(), callsign_size));
+}
+
+flight_safety_system::client_ssl::fss_traffic_table::fss_traffic_table(size_t capacity, uint64_t t_max_age) : slots(capacity > 0 ? capacity : 1), max_age(t_max_age)
+{
+}
+
+flight_safety_system::client_ssl::fss_traffic_table::~fss_traffic_table() = default;
+
+/* ICAO addresses have the top bit set, hashed callsigns don't, and 0 is never a key */
+auto
+flight_safety_system::client_ssl::fss_traffic_table::keyFor(const fss_traffic_target &target) -> uint64_t
+{
+    if (target.icao_address != 0)
+    {
+        return icao_key | target.icao_address;
+    }
+    uint64_t hash = fnv_offset;
+    for (size_t i = 0; i < fss_traffic_target::callsign_size && target.callsign[i] != '\0'; i++)
+    {
+        hash = (hash ^ static_cast<uint8_t>(target.callsign[i])) * fnv_prime;
+    }
+    if (target.callsign[0] == '\0')
+    {
+        return 0;
+    }
+    hash &= ~icao_key;
+    return hash != 0 ? hash : 1;
+}
+
+auto
+flight_safety_system::client_ssl::fss_traffic_table::home(uint64_t key) const -> size_t
+{
+    return static_cast<size_t>((key * golden_ratio) >> 32) % this->slots.size();
+}
+
+auto
+flight_safety_system::client_ssl::fss_traffic_table::store(slot &s, uint64_t key, const fss_traffic_target &target, bool reuse) -> bool
+{
+    /* Several servers relay the same aircraft, so writers take the slot in turn */
+    uint32_t sequence = s.sequence.load(std::memory_order_relaxed);
+    do
+    {
+        while ((sequence & 1) != 0)
+        {
+            sequence = s.sequence.load(std::memory_order_relaxed);
+        }
+    } while (!s.sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire, std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_release);
+    bool write = true;
+    if (reuse)
+    {
+        write = s.key.load(std::memory_order_relaxed) != key && s.updated.load(std::memory_order_relaxed) + this->max_age < target.received;
+        if (write)
+        {
+            s.key.store(key, std::memory_order_relaxed);
+        }
+    }
+    if (write)
+    {
+        std::array<uint64_t, target_words> words{};
+        memcpy(words.data(), &target, sizeof(target));
+        for (size_t i = 0; i < target_words; i++)
+        {
+            s.data[i].store(words[i], std::memory_order_relaxed);
+        }
+        s.updated.store(target.received, std::memory_order_relaxed);
+    }
+    s.sequence.store(sequence + 2, std::memory_order_release);
+    return write;
+}
+
+auto
+flight_safety_system::client_ssl::fss_traffic_table::load(const slot &s, uint64_t key, uint64_t now, fss_traffic_target &target) const -> bool
+{
+    for (int attempt = 0; attempt < read_attempts; attempt++)
+    {
+        uint32_t before = s.sequence.load(std::memory_order_acquire);
+        if ((before & 1) != 0)
+        {
+            continue;
+        }
+        std::array<uint64_t, target_words> words{};
+        for (size_t i = 0; i < target_words; i++)
+        {
+            words[i] = s.data[i].load(std::memory_order_relaxed);
+        }
+        uint64_t slot_key = s.key.load(std::memory_order_relaxed);
+        uint64_t updated = s.updated.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.sequence.load(std::memory_order_relaxed) != before)
+        {
+            continue;
+        }
+        if (updated == 0 || updated + this->max_age < now || (key != 0 && slot_key != key))
+        {
+            return false;
+        }
+        memcpy(static_cast<void *>(&target), words.data(), sizeof(target));
+        return true;
+    }
+    return false;
+}
+
+auto
+flight_safety_system::client_ssl::fss_traffic_table::update(fss_traffic_target target) -> bool
+{
+    uint64_t key = keyFor(target);
+    if (key == 0)
+    {
+        return false;
+    }
+    target.received = fss_monotonic_timestamp();
+    size_t start = this->home(key);
+    slot *stale = nullptr;
+    for (size_t i = 0; i < this->slots.size(); i++)
+    {
+        slot &s = this->slots[(start + i) % this->slots.size()];
+        uint64_t slot_key = s.key.load(std::memory_order_acquire);
+        if (slot_key == 0 && !s.key.compare_exchange_strong(slot_key, key, std::memory_order_acq_rel))
+        {
+            /* Claimed by another writer, possibly for this target */
+            if (slot_key != key)
+            {
+                continue;
+            }
+        }
+        if (slot_key == 0 || slot_key == key)
+        {
+            return this->store(s, key, target, false);
+        }
+        if (stale == nullptr && s.updated.load(std::memory_order_relaxed) + this->max_age < target.received)
+        {
+            stale = &s;
+        }
+    }
+    if (stale != nullptr && this->store(*stale, key, target, true))
+    {
+        return true;
+    }
+    this->dropped++;
+    return false;
+}
+
+auto
+flight_safety_system::client_ssl::fss_traffic_table::update(flight_safety_system::transport::fss_message_position_report &msg) -> bool
+{
+    fss_traffic_target target;
+    target.latitude = msg.getLatitude();
+    target.longitude = msg.getLongitude();
+    target.timestamp = msg.getTimeStamp();
+    target.altitude = msg.getAltitude();
+    target.icao_address = msg.getICAOAddress();
+    target.heading = msg.getHeading();
+    target.horizontal_velocity = msg.getHorzVel();
+    target.vertical_velocity = msg.getVertVel();
+    target.squawk = msg.getSquawk();
+    target.flags = msg.getFlags();
+    target.tslc = msg.getTSLC();
+    target.altitude_type = msg.getAltitudeType();
+    target.emitter_type = msg.getEmitterType();
+    std::string callsign = msg.getCallSign();
+    memcpy(target.callsign.data(), callsign.data(), std::min(callsign.size(), target.callsign.size() - 1));
+    return this->update(target);
+}
+
+auto
+flight_safety_system::client_ssl::fss_traffic_table::findKey(uint64_t key, fss_traffic_target &target) const -> bool
+{
+    if (key == 0)
+    {
+        return false;
+    }
+    uint64_t now = fss_monotonic_timestamp();
+    size_t start = this->home(key);
+    for (size_t i = 0; i < this->slots.size(); i++)
+    {
+        const slot &s = this->slots[(start + i) % this->slots.size()];
+        uint64_t slot_key = s.key.load(std::memory_order_acquire);
+        if (slot_key == 0)
+        {
+            return false;
+        }
+        if (slot_key == key)
+        {
+            return this->load(s, key, now, target);
+        }
+    }
+    return false;
+}
+
+auto
+flight_safety_system::client_ssl::fss_traffic_table::find(uint32_t icao_address, fss_traffic_target &target) const -> bool
+{
+    fss_traffic_target wanted;
+    wanted.icao_address = icao_address;
+    return this->findKey(keyFor(wanted), target);
+}
+
+auto
+flight_safety_system::client_ssl::fss_traffic_table::find(const std::string &callsign, fss_traffic_target &target) const -> bool
+{
+    fss_traffic_target wanted;
+    memcpy(wanted.callsign.data(), callsign.data(), std::min(callsign.size(), wanted.callsign.size() - 1));
+    return this->findKey(keyFor(wanted), target);
+}
+
+void
+flight_safety_system::client_ssl::fss_traffic_table::snapshot(std::vector<fss_traffic_target> &targets) const
+{
+    targets.clear();
+    uint64_t now = fss_monotonic_timestamp();
+    fss_traffic_target target;
+    for (const auto &s : this->slots)
+    {
+        if (this->load(s, 0, now, target))
+        {
+            targets.push_back(target);
+        }
+    }
+}
+
+auto
+flight_safety_system::client_ssl::fss_traffic_table::snapshot() const -> std::vector<fss_traffic_target>
+{
+    std::vector<fss_traffic_target> targets;
+    targets.reserve(this->slots.size());
+    this->snapshot(targets);
+    return targets;
+}
+
+auto
+flight_safety_system::client_ssl::fss_traffic_table::getDropped() -> uint64_t
+{
+    return this->dropped;
+}
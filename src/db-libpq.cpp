@@ -0,0 +1,801 @@
+#include "fss-server.hpp"
+#include "fss.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <libpq-fe.h>
+
+#include "transport.hpp"
+
+/* Every statement is prepared once, and the inserts look up the asset id themselves
+   so nothing has to wait for an earlier reply before it can be sent */
+using db_statement = enum db_statement_e {
+    db_statement_asset_id,
+    db_statement_rtt,
+    db_statement_status,
+    db_statement_search_status,
+    db_statement_position,
+    db_statement_command,
+    db_statement_smm_settings,
+    db_statement_servers,
+    db_statement_count
+};
+
+constexpr Oid int8_oid = 20;
+constexpr Oid text_oid = 25;
+constexpr Oid float8_oid = 701;
+constexpr int max_params = 5;
+
+class db_statement_def {
+public:
+    const char *name;
+    const char *sql;
+    int params;
+    Oid types[max_params];
+};
+
+static const db_statement_def statements[db_statement_count] = {
+    { "asset_id", "SELECT id FROM assets_asset WHERE name = $1", 1, { text_oid } },
+    { "rtt", "INSERT INTO assets_assetrtt (asset_id, rtt, timestamp) SELECT id, $2, to_timestamp($3 / 1000.0) FROM assets_asset WHERE name = $1", 3, { text_oid, int8_oid, int8_oid } },
+    { "status", "INSERT INTO assets_assetstatus (asset_id, bat_percent, bat_used_mah, bat_volt, timestamp) SELECT id, $2, $3, $4, to_timestamp($5 / 1000.0) FROM assets_asset WHERE name = $1", 5, { text_oid, int8_oid, int8_oid, float8_oid, int8_oid } },
+    { "search_status", "INSERT INTO assets_assetsearchprogress (asset_id, search, search_progress, search_progress_of, timestamp) SELECT id, $2, $3, $4, to_timestamp($5 / 1000.0) FROM assets_asset WHERE name = $1", 5, { text_oid, int8_oid, int8_oid, int8_oid, int8_oid } },
+    { "position", "INSERT INTO assets_assetposition (asset_id, position, altitude, timestamp) SELECT id, ST_SetSRID(ST_MakePoint($3, $2), 4326), $4, to_timestamp($5 / 1000.0) FROM assets_asset WHERE name = $1", 5, { text_oid, float8_oid, float8_oid, int8_oid, int8_oid } },
+    { "command", "SELECT AC.id, (extract(epoch from AC.timestamp) * 1000)::bigint, AC.command, ST_Y(AC.position::geometry), ST_X(AC.position::geometry), AC.altitude FROM assets_assetcommand AS AC, assets_asset AS A WHERE A.name = $1 AND AC.asset_id = A.id ORDER BY AC.timestamp DESC LIMIT 1", 1, { text_oid } },
+    { "smm_settings", "SELECT SMM.address, SMM.port, SMM.https, A.smm_login, A.smm_password FROM config_assetconfig AS A, config_smmconfig AS SMM, assets_asset AS AA WHERE AA.name = $1 AND A.asset_id = AA.id AND A.smm_id = SMM.id", 1, { text_oid } },
+    { "servers", "SELECT address, client_port FROM config_serverconfig WHERE active = TRUE", 0, { } },
+};
+
+/* Parameters are sent in binary, which for text is just the bytes */
+static auto
+bin_int8(uint64_t value) -> std::string
+{
+    uint64_t be = htonll(value);
+    return std::string(reinterpret_cast<const char *>(&be), sizeof(be));
+}
+
+static auto
+bin_float8(double value) -> std::string
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bin_int8(bits);
+}
+
+class db_request {
+public:
+    db_statement statement;
+    std::vector<std::string> params;
+    /* Inserts are sent and forgotten, lookups wait for their rows */
+    bool wants_result;
+    std::promise<std::shared_ptr<PGresult>> result{};
+    std::shared_ptr<PGresult> rows{};
+    std::chrono::steady_clock::time_point queued_at{};
+    /* What a write was for, so it can be handed back if the connection is lost */
+    std::shared_ptr<flight_safety_system::server::db_record> record{};
+    db_request(db_statement t_statement, std::vector<std::string> t_params, bool t_wants_result) : statement(t_statement), params(std::move(t_params)), wants_result(t_wants_result) {};
+    void finish() {
+        if (this->wants_result)
+        {
+            this->result.set_value(this->rows);
+        }
+    }
+};
+
+/* One connection in pipeline mode, driven by its own thread. Requests are sent as soon as
+   they are queued, with a sync after each group, while the replies to earlier ones are still
+   coming back. A lost connection is made again, until then requests are turned away */
+class db_pipeline {
+private:
+    std::string host;
+    std::string user;
+    std::string pass;
+    std::string db;
+    PGconn *conn{nullptr};
+    std::atomic<bool> connected{false};
+    std::function<void(const flight_safety_system::server::db_record &)> lost_writes{};
+    int wake_fds[2]{-1, -1};
+    std::mutex lock{};
+    std::deque<std::shared_ptr<db_request>> queued{};
+    bool stopping{false};
+    /* Sent and waiting for results, a nullptr marks each sync */
+    std::deque<std::shared_ptr<db_request>> in_flight{};
+    std::thread io_thread{};
+    /* Submitted and not yet finished, and when that last went from none to some */
+    std::atomic<uint64_t> outstanding{0};
+    std::chrono::steady_clock::time_point busy_since{};
+    std::chrono::steady_clock::time_point created{std::chrono::steady_clock::now()};
+    uint64_t sent{0};
+    uint64_t wait_total_us{0};
+    uint64_t wait_max_us{0};
+    uint64_t busy_us{0};
+    void complete(const std::shared_ptr<db_request> &request);
+    auto setup() -> bool;
+    auto sendQueued() -> bool;
+    auto readResults() -> bool;
+    void failAll();
+    /* Until stopped (true) or the connection fails (false) */
+    auto serve() -> bool;
+    void run();
+public:
+    static constexpr int reconnect_interval = 1000;
+    /* More outstanding than this and the database isn't keeping up */
+    static constexpr uint64_t max_outstanding = 4096;
+    db_pipeline(std::string t_host, std::string t_user, std::string t_pass, std::string t_db);
+    db_pipeline(db_pipeline&) = delete;
+    db_pipeline(db_pipeline&&) = delete;
+    auto operator=(db_pipeline&) -> db_pipeline& = delete;
+    auto operator=(db_pipeline&&) -> db_pipeline& = delete;
+    ~db_pipeline();
+    /* False, with the request finished, if it can't be sent */
+    auto submit(const std::shared_ptr<db_request> &request) -> bool;
+    /* Waits for the rows, nullptr if the statement failed */
+    auto query(db_statement statement, std::vector<std::string> params) -> std::shared_ptr<PGresult>;
+    /* Statements submitted and not yet finished */
+    auto getOutstanding() -> uint64_t;
+    auto isHealthy() -> bool;
+    void setLostWriteHandler(std::function<void(const flight_safety_system::server::db_record &)> handler);
+    /* This connection's share, with utilisation as a fraction of its own time */
+    auto getStats() -> flight_safety_system::server::db_pool_stats;
+};
+
+db_pipeline::db_pipeline(std::string t_host, std::string t_user, std::string t_pass, std::string t_db) : host(std::move(t_host)), user(std::move(t_user)), pass(std::move(t_pass)), db(std::move(t_db))
+{
+    if (pipe2(this->wake_fds, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        perror("Failed to create the database wake pipe: ");
+        return;
+    }
+    /* The first connection is made before returning, so lookups straight away work */
+    this->connected = this->setup();
+    this->io_thread = std::thread([this]() { this->run(); });
+}
+
+db_pipeline::~db_pipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        this->stopping = true;
+    }
+    if (this->wake_fds[1] >= 0 && write(this->wake_fds[1], "x", 1) < 0)
+    {
+        perror("Failed to wake the database thread: ");
+    }
+    if (this->io_thread.joinable())
+    {
+        this->io_thread.join();
+    }
+    this->failAll();
+    for (int fd : this->wake_fds)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+    if (this->conn != nullptr)
+    {
+        PQfinish(this->conn);
+    }
+}
+
+auto
+db_pipeline::setup() -> bool
+{
+    /* A fresh connection each time, rather than resetting one left in pipeline mode */
+    if (this->conn != nullptr)
+    {
+        PQfinish(this->conn);
+    }
+    const char *keywords[] = { "host", "user", "dbname", "password", nullptr };
+    const char *values[] = { this->host.c_str(), this->user.c_str(), this->db.c_str(), this->pass.empty() ? nullptr : this->pass.c_str(), nullptr };
+    this->conn = PQconnectdbParams(keywords, values, 0);
+    if (PQstatus(this->conn) != CONNECTION_OK)
+    {
+        std::cerr << "Failed to connect to the database: " << PQerrorMessage(this->conn);
+        return false;
+    }
+    for (const auto &statement : statements)
+    {
+        PGresult *res = PQprepare(this->conn, statement.name, statement.sql, statement.params, statement.types);
+        if (PQresultStatus(res) != PGRES_COMMAND_OK)
+        {
+            std::cerr << "Failed to prepare " << statement.name << ": " << PQerrorMessage(this->conn);
+        }
+        PQclear(res);
+    }
+    if (PQenterPipelineMode(this->conn) != 1 || PQsetnonblocking(this->conn, 1) != 0)
+    {
+        std::cerr << "Failed to set up the database pipeline: " << PQerrorMessage(this->conn);
+        return false;
+    }
+    return true;
+}
+
+auto
+db_pipeline::submit(const std::shared_ptr<db_request> &request) -> bool
+{
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        if (!this->io_thread.joinable() || this->stopping || !this->connected)
+        {
+            request->finish();
+            return false;
+        }
+        request->queued_at = std::chrono::steady_clock::now();
+        if (this->outstanding++ == 0)
+        {
+            this->busy_since = request->queued_at;
+        }
+        this->queued.push_back(request);
+        /* Only the first of a group needs to wake the thread */
+        if (this->queued.size() > 1)
+        {
+            return true;
+        }
+    }
+    if (write(this->wake_fds[1], "x", 1) < 0 && errno != EAGAIN)
+    {
+        perror("Failed to wake the database thread: ");
+    }
+    return true;
+}
+
+auto
+db_pipeline::query(db_statement statement, std::vector<std::string> params) -> std::shared_ptr<PGresult>
+{
+    auto request = std::make_shared<db_request>(statement, std::move(params), true);
+    auto rows = request->result.get_future();
+    this->submit(request);
+    return rows.get();
+}
+
+auto
+db_pipeline::sendQueued() -> bool
+{
+    std::deque<std::shared_ptr<db_request>> sending;
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        sending.swap(this->queued);
+    }
+    if (sending.empty())
+    {
+        return true;
+    }
+    {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        for (const auto &request : sending)
+        {
+            auto waited = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - request->queued_at).count());
+            this->sent++;
+            this->wait_total_us += waited;
+            this->wait_max_us = std::max(this->wait_max_us, waited);
+        }
+    }
+    const char *values[max_params];
+    int lengths[max_params];
+    const int formats[max_params] = { 1, 1, 1, 1, 1 };
+    for (const auto &request : sending)
+    {
+        const auto &statement = statements[request->statement];
+        for (size_t i = 0; i < request->params.size() && i < max_params; i++)
+        {
+            values[i] = request->params[i].data();
+            lengths[i] = static_cast<int>(request->params[i].size());
+        }
+        if (PQsendQueryPrepared(this->conn, statement.name, statement.params, values, lengths, formats, 0) != 1)
+        {
+            std::cerr << "Failed to send " << statement.name << ": " << PQerrorMessage(this->conn);
+            this->complete(request);
+            continue;
+        }
+        this->in_flight.push_back(request);
+    }
+    /* An error only aborts the statements up to the next sync */
+    if (PQpipelineSync(this->conn) != 1)
+    {
+        std::cerr << "Failed to sync the database pipeline: " << PQerrorMessage(this->conn);
+        return false;
+    }
+    this->in_flight.push_back(nullptr);
+    return true;
+}
+
+auto
+db_pipeline::readResults() -> bool
+{
+    if (PQconsumeInput(this->conn) != 1)
+    {
+        std::cerr << "Lost the database connection: " << PQerrorMessage(this->conn);
+        return false;
+    }
+    while (!this->in_flight.empty() && PQisBusy(this->conn) == 0)
+    {
+        PGresult *res = PQgetResult(this->conn);
+        auto request = this->in_flight.front();
+        if (request == nullptr)
+        {
+            /* The sync has no terminating nullptr of its own */
+            if (res == nullptr)
+            {
+                break;
+            }
+            if (PQresultStatus(res) == PGRES_PIPELINE_SYNC)
+            {
+                this->in_flight.pop_front();
+            }
+            PQclear(res);
+            continue;
+        }
+        if (res == nullptr)
+        {
+            this->complete(request);
+            this->in_flight.pop_front();
+            continue;
+        }
+        switch (PQresultStatus(res))
+        {
+            case PGRES_TUPLES_OK:
+                if (request->wants_result && request->rows == nullptr)
+                {
+                    request->rows = std::shared_ptr<PGresult>(res, PQclear);
+                    res = nullptr;
+                }
+                break;
+            case PGRES_COMMAND_OK:
+                break;
+            case PGRES_PIPELINE_ABORTED:
+                std::cerr << statements[request->statement].name << " skipped after an earlier error" << std::endl;
+                break;
+            default:
+                std::cerr << statements[request->statement].name << " failed: " << PQresultErrorMessage(res);
+                break;
+        }
+        if (res != nullptr)
+        {
+            PQclear(res);
+        }
+    }
+    return true;
+}
+
+void
+db_pipeline::failAll()
+{
+    std::deque<std::shared_ptr<db_request>> waiting;
+    std::function<void(const flight_safety_system::server::db_record &)> lost;
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        this->connected = false;
+        waiting.swap(this->queued);
+        lost = this->lost_writes;
+    }
+    /* Oldest first, so writes are handed back in the order they were made */
+    std::deque<std::shared_ptr<db_request>> failed;
+    for (auto &request : this->in_flight)
+    {
+        if (request != nullptr)
+        {
+            failed.push_back(request);
+        }
+    }
+    this->in_flight.clear();
+    failed.insert(failed.end(), waiting.begin(), waiting.end());
+    for (auto &request : failed)
+    {
+        /* A write that was sent may have been made before the connection went, so could be written twice */
+        if (lost && request->record != nullptr)
+        {
+            lost(*request->record);
+        }
+        this->complete(request);
+    }
+}
+
+auto
+db_pipeline::serve() -> bool
+{
+    while (true)
+    {
+        bool stop;
+        {
+            std::lock_guard<std::mutex> lock_holder(this->lock);
+            /* Anything already queued is still written before stopping */
+            stop = this->stopping && this->queued.empty() && this->in_flight.empty();
+        }
+        if (stop)
+        {
+            return true;
+        }
+        int flushing = PQflush(this->conn);
+        if (flushing < 0)
+        {
+            std::cerr << "Failed to send to the database: " << PQerrorMessage(this->conn);
+            return false;
+        }
+        struct pollfd fds[2] = {
+            { PQsocket(this->conn), static_cast<short>(POLLIN | (flushing == 1 ? POLLOUT : 0)), 0 },
+            { this->wake_fds[0], POLLIN, 0 }
+        };
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Failed to poll the database connection: ");
+            return false;
+        }
+        if ((fds[1].revents & POLLIN) != 0)
+        {
+            char drain[64];
+            while (read(this->wake_fds[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+        if (!this->sendQueued())
+        {
+            return false;
+        }
+        if ((fds[0].revents & (POLLIN | POLLERR | POLLHUP)) != 0 && !this->readResults())
+        {
+            return false;
+        }
+    }
+}
+
+void
+db_pipeline::run()
+{
+    while (true)
+    {
+        if (this->connected)
+        {
+            if (this->serve())
+            {
+                break;
+            }
+            this->failAll();
+        }
+        {
+            std::lock_guard<std::mutex> lock_holder(this->lock);
+            if (this->stopping)
+            {
+                break;
+            }
+        }
+        /* Wait before trying again, unless woken to stop */
+        struct pollfd wake = { this->wake_fds[0], POLLIN, 0 };
+        if (poll(&wake, 1, reconnect_interval) > 0)
+        {
+            char drain[64];
+            while (read(this->wake_fds[0], drain, sizeof(drain)) > 0)
+            {
+            }
+            continue;
+        }
+        if (this->setup())
+        {
+            std::cerr << "Reconnected to the database" << std::endl;
+            std::lock_guard<std::mutex> lock_holder(this->lock);
+            this->connected = true;
+        }
+    }
+    /* Nothing more can be sent, so nobody should be left waiting */
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        this->stopping = true;
+    }
+    this->failAll();
+}
+
+void
+db_pipeline::complete(const std::shared_ptr<db_request> &request)
+{
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        if (this->outstanding > 0 && --this->outstanding == 0)
+        {
+            this->busy_us += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - this->busy_since).count());
+        }
+    }
+    request->finish();
+}
+
+auto
+db_pipeline::getOutstanding() -> uint64_t
+{
+    return this->outstanding;
+}
+
+auto
+db_pipeline::isHealthy() -> bool
+{
+    return this->connected && this->outstanding < max_outstanding;
+}
+
+void
+db_pipeline::setLostWriteHandler(std::function<void(const flight_safety_system::server::db_record &)> handler)
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    this->lost_writes = std::move(handler);
+}
+
+auto
+db_pipeline::getStats() -> flight_safety_system::server::db_pool_stats
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    auto now = std::chrono::steady_clock::now();
+    flight_safety_system::server::db_pool_stats stats;
+    stats.connections = 1;
+    stats.statements = this->sent;
+    stats.wait_total_us = this->wait_total_us;
+    stats.wait_max_us = this->wait_max_us;
+    uint64_t busy = this->busy_us;
+    if (this->outstanding > 0)
+    {
+        busy += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - this->busy_since).count());
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - this->created).count();
+    stats.utilisation = elapsed > 0 ? static_cast<double>(busy) / static_cast<double>(elapsed) : 0;
+    return stats;
+}
+
+/* Several pipelines, with each asset's writes kept to one of them */
+class flight_safety_system::server::db_connection_postgres::db_state {
+private:
+    std::vector<std::shared_ptr<db_pipeline>> pipelines{};
+public:
+    db_state(const std::string &host, const std::string &user, const std::string &pass, const std::string &db, size_t connections);
+    auto forAsset(const std::string &asset_name) -> db_pipeline &;
+    auto leastLoaded() -> db_pipeline &;
+    auto getStats() -> db_pool_stats;
+    auto isHealthy() -> bool;
+    void setLostWriteHandler(const std::function<void(const db_record &)> &handler);
+    /* Sends an insert down the asset's pipeline, keeping the record in case the connection is lost */
+    auto write(db_statement statement, std::vector<std::string> params, db_record record) -> bool;
+};
+
+flight_safety_system::server::db_connection_postgres::db_state::db_state(const std::string &host, const std::string &user, const std::string &pass, const std::string &db, size_t connections)
+{
+    for (size_t i = 0; i < std::max(connections, static_cast<size_t>(1)); i++)
+    {
+        this->pipelines.push_back(std::make_shared<db_pipeline>(host, user, pass, db));
+    }
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::db_state::forAsset(const std::string &asset_name) -> db_pipeline &
+{
+    return *this->pipelines[std::hash<std::string>()(asset_name) % this->pipelines.size()];
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::db_state::leastLoaded() -> db_pipeline &
+{
+    size_t best = 0;
+    uint64_t best_outstanding = UINT64_MAX;
+    for (size_t i = 0; i < this->pipelines.size(); i++)
+    {
+        uint64_t outstanding = this->pipelines[i]->getOutstanding();
+        if (outstanding < best_outstanding)
+        {
+            best = i;
+            best_outstanding = outstanding;
+        }
+    }
+    return *this->pipelines[best];
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::db_state::getStats() -> db_pool_stats
+{
+    db_pool_stats stats;
+    for (const auto &pipeline : this->pipelines)
+    {
+        auto one = pipeline->getStats();
+        stats.connections++;
+        stats.statements += one.statements;
+        stats.wait_total_us += one.wait_total_us;
+        stats.wait_max_us = std::max(stats.wait_max_us, one.wait_max_us);
+        stats.utilisation += one.utilisation;
+    }
+    if (stats.connections > 0)
+    {
+        stats.utilisation /= static_cast<double>(stats.connections);
+    }
+    return stats;
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::db_state::isHealthy() -> bool
+{
+    for (const auto &pipeline : this->pipelines)
+    {
+        if (!pipeline->isHealthy())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+flight_safety_system::server::db_connection_postgres::db_state::setLostWriteHandler(const std::function<void(const db_record &)> &handler)
+{
+    for (const auto &pipeline : this->pipelines)
+    {
+        pipeline->setLostWriteHandler(handler);
+    }
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::db_state::write(db_statement statement, std::vector<std::string> params, db_record record) -> bool
+{
+    auto request = std::make_shared<db_request>(statement, std::move(params), false);
+    request->record = std::make_shared<db_record>(std::move(record));
+    return this->forAsset(request->record->asset_name).submit(request);
+}
+
+static auto
+convert_to_http(const std::string &address, int port, bool https) -> std::string
+{
+    constexpr int http_port = 80;
+    constexpr int https_port = 443;
+    std::string url = (https ? "https://" : "http://") + address;
+    if (port != (https ? https_port : http_port))
+    {
+        url += ":" + std::to_string(port);
+    }
+    return url;
+}
+
+flight_safety_system::server::db_connection_postgres::db_connection_postgres(const std::string &host, const std::string &user, const std::string &pass, const std::string &db, size_t connections) : state(std::make_shared<db_state>(host, user, pass, db, connections))
+{
+}
+
+flight_safety_system::server::db_connection_postgres::~db_connection_postgres() = default;
+
+auto
+flight_safety_system::server::db_connection_postgres::check_asset(const std::string &asset_name) -> bool
+{
+    auto rows = this->state->leastLoaded().query(db_statement_asset_id, { asset_name });
+    return rows != nullptr && PQntuples(rows.get()) > 0 && std::strtoull(PQgetvalue(rows.get(), 0, 0), nullptr, 10) != 0;
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::asset_add_rtt(const std::string &asset_name, uint64_t delta, uint64_t timestamp) -> bool
+{
+    db_record record;
+    record.kind = db_record_rtt;
+    record.asset_name = asset_name;
+    record.timestamp = timestamp;
+    record.rtt = delta;
+    return this->state->write(db_statement_rtt, { asset_name, bin_int8(delta), bin_int8(timestamp) }, std::move(record));
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::asset_add_status(const std::string &asset_name, uint8_t bat_percent, uint32_t bat_mah_used, double bat_voltage, uint64_t timestamp) -> bool
+{
+    db_record record;
+    record.kind = db_record_status;
+    record.asset_name = asset_name;
+    record.timestamp = timestamp;
+    record.bat_percent = bat_percent;
+    record.bat_mah_used = bat_mah_used;
+    record.bat_voltage = bat_voltage;
+    return this->state->write(db_statement_status, { asset_name, bin_int8(bat_percent), bin_int8(bat_mah_used), bin_float8(bat_voltage), bin_int8(timestamp) }, std::move(record));
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::asset_add_search_status(const std::string &asset_name, uint64_t search_id, uint64_t search_completed, uint64_t search_total, uint64_t timestamp) -> bool
+{
+    db_record record;
+    record.kind = db_record_search_status;
+    record.asset_name = asset_name;
+    record.timestamp = timestamp;
+    record.search_id = search_id;
+    record.search_completed = search_completed;
+    record.search_total = search_total;
+    return this->state->write(db_statement_search_status, { asset_name, bin_int8(search_id), bin_int8(search_completed), bin_int8(search_total), bin_int8(timestamp) }, std::move(record));
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::asset_add_position(const std::string &asset_name, double latitude, double longitude, uint16_t altitude, uint64_t timestamp) -> bool
+{
+    db_record record;
+    record.kind = db_record_position;
+    record.asset_name = asset_name;
+    record.timestamp = timestamp;
+    record.latitude = latitude;
+    record.longitude = longitude;
+    record.altitude = altitude;
+    return this->state->write(db_statement_position, { asset_name, bin_float8(latitude), bin_float8(longitude), bin_int8(altitude), bin_int8(timestamp) }, std::move(record));
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::asset_get_command(const std::string &asset_name) -> std::shared_ptr<asset_command>
+{
+    auto rows = this->state->leastLoaded().query(db_statement_command, { asset_name });
+    if (rows == nullptr || PQntuples(rows.get()) == 0)
+    {
+        return nullptr;
+    }
+    PGresult *res = rows.get();
+    return std::make_shared<asset_command>(std::strtoull(PQgetvalue(res, 0, 0), nullptr, 10), std::strtoull(PQgetvalue(res, 0, 1), nullptr, 10), std::string(PQgetvalue(res, 0, 2)),
+        PQgetisnull(res, 0, 3) ? 0.0 : std::strtod(PQgetvalue(res, 0, 3), nullptr),
+        PQgetisnull(res, 0, 4) ? 0.0 : std::strtod(PQgetvalue(res, 0, 4), nullptr),
+        PQgetisnull(res, 0, 5) ? 0 : static_cast<uint16_t>(std::strtoul(PQgetvalue(res, 0, 5), nullptr, 10)));
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::asset_get_smm_settings(const std::string &asset_name) -> std::shared_ptr<smm_settings>
+{
+    auto rows = this->state->leastLoaded().query(db_statement_smm_settings, { asset_name });
+    if (rows == nullptr || PQntuples(rows.get()) == 0)
+    {
+        return nullptr;
+    }
+    PGresult *res = rows.get();
+    bool https = PQgetvalue(res, 0, 2)[0] == 't';
+    return std::make_shared<smm_settings>(convert_to_http(PQgetvalue(res, 0, 0), std::atoi(PQgetvalue(res, 0, 1)), https), std::string(PQgetvalue(res, 0, 3)), std::string(PQgetvalue(res, 0, 4)));
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::get_active_fss_servers() -> std::list<std::shared_ptr<fss_server_details>>
+{
+    std::list<std::shared_ptr<fss_server_details>> servers;
+    auto rows = this->state->leastLoaded().query(db_statement_servers, {});
+    if (rows == nullptr)
+    {
+        return servers;
+    }
+    for (int i = 0; i < PQntuples(rows.get()); i++)
+    {
+        servers.push_back(std::make_shared<fss_server_details>(PQgetvalue(rows.get(), i, 0), static_cast<uint16_t>(std::atoi(PQgetvalue(rows.get(), i, 1)))));
+    }
+    return servers;
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::getPoolStats() -> db_pool_stats
+{
+    return this->state->getStats();
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::isHealthy() -> bool
+{
+    return this->state->isHealthy();
+}
+
+auto
+flight_safety_system::server::db_connection_postgres::recover() -> bool
+{
+    /* Each pipeline reconnects by itself */
+    return this->state->isHealthy();
+}
+
+void
+flight_safety_system::server::db_connection_postgres::setLostWriteHandler(std::function<void(const db_record &)> handler)
+{
+    this->state->setLostWriteHandler(handler);
+}
@@ -0,0 +1,213 @@
+#include "fss-server.hpp"
+
+#include <string>
+#include <vector>
+
+flight_safety_system::server::db_connection_memory::db_connection_memory(bool t_any_asset, size_t t_max_records) : any_asset(t_any_asset), max_records(t_max_records)
+{
+}
+
+flight_safety_system::server::db_connection_memory::~db_connection_memory() = default;
+
+auto
+flight_safety_system::server::db_connection_memory::findAsset(const std::string &asset_name, bool create) -> std::shared_ptr<memory_asset>
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    auto it = this->assets.find(asset_name);
+    if (it != this->assets.end())
+    {
+        return it->second;
+    }
+    if (!create)
+    {
+        return nullptr;
+    }
+    auto asset = std::make_shared<memory_asset>();
+    this->assets.emplace(asset_name, asset);
+    return asset;
+}
+
+void
+flight_safety_system::server::db_connection_memory::addAsset(const std::string &asset_name)
+{
+    this->findAsset(asset_name, true);
+}
+
+void
+flight_safety_system::server::db_connection_memory::setCommand(const std::string &asset_name, const std::string &cmd, double latitude, double longitude, uint16_t altitude)
+{
+    uint64_t dbid;
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        dbid = this->next_command++;
+    }
+    auto command = std::make_shared<asset_command>(dbid, fss_current_timestamp(), cmd, latitude, longitude, altitude);
+    auto asset = this->findAsset(asset_name, true);
+    std::lock_guard<std::mutex> lock_holder(asset->lock);
+    asset->command = command;
+}
+
+void
+flight_safety_system::server::db_connection_memory::setSmmSettings(const std::string &asset_name, const std::string &address, const std::string &username, const std::string &password)
+{
+    auto settings = std::make_shared<smm_settings>(address, username, password);
+    auto asset = this->findAsset(asset_name, true);
+    std::lock_guard<std::mutex> lock_holder(asset->lock);
+    asset->smm = settings;
+}
+
+void
+flight_safety_system::server::db_connection_memory::addServer(const std::string &address, uint16_t port)
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    this->servers.push_back(std::make_shared<fss_server_details>(address, port));
+}
+
+auto
+flight_safety_system::server::db_connection_memory::getRecords(const std::string &asset_name, db_record_kind kind) -> std::vector<db_record>
+{
+    auto asset = this->findAsset(asset_name, false);
+    if (asset == nullptr)
+    {
+        return {};
+    }
+    std::lock_guard<std::mutex> lock_holder(asset->lock);
+    const auto &records = asset->records[kind - 1];
+    return std::vector<db_record>(records.begin(), records.end());
+}
+
+auto
+flight_safety_system::server::db_connection_memory::add(const db_record &record) -> bool
+{
+    auto asset = this->findAsset(record.asset_name, this->any_asset);
+    if (asset == nullptr)
+    {
+        return false;
+    }
+    this->writes++;
+    if (this->max_records == 0)
+    {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock_holder(asset->lock);
+    auto &records = asset->records[record.kind - 1];
+    if (records.size() >= this->max_records)
+    {
+        records.pop_front();
+    }
+    records.push_back(record);
+    return true;
+}
+
+auto
+flight_safety_system::server::db_connection_memory::check_asset(const std::string &asset_name) -> bool
+{
+    return this->any_asset || this->findAsset(asset_name, false) != nullptr;
+}
+
+auto
+flight_safety_system::server::db_connection_memory::asset_add_rtt(const std::string &asset_name, uint64_t rtt, uint64_t timestamp) -> bool
+{
+    db_record record;
+    record.kind = db_record_rtt;
+    record.asset_name = asset_name;
+    record.timestamp = timestamp;
+    record.rtt = rtt;
+    return this->add(record);
+}
+
+auto
+flight_safety_system::server::db_connection_memory::asset_add_status(const std::string &asset_name, uint8_t bat_percent, uint32_t bat_mah_used, double bat_voltage, uint64_t timestamp) -> bool
+{
+    db_record record;
+    record.kind = db_record_status;
+    record.asset_name = asset_name;
+    record.timestamp = timestamp;
+    record.bat_percent = bat_percent;
+    record.bat_mah_used = bat_mah_used;
+    record.bat_voltage = bat_voltage;
+    return this->add(record);
+}
+
+auto
+flight_safety_system::server::db_connection_memory::asset_add_search_status(const std::string &asset_name, uint64_t search_id, uint64_t search_completed, uint64_t search_total, uint64_t timestamp) -> bool
+{
+    db_record record;
+    record.kind = db_record_search_status;
+    record.asset_name = asset_name;
+    record.timestamp = timestamp;
+    record.search_id = search_id;
+    record.search_completed = search_completed;
+    record.search_total = search_total;
+    return this->add(record);
+}
+
+auto
+flight_safety_system::server::db_connection_memory::asset_add_position(const std::string &asset_name, double latitude, double longitude, uint16_t altitude, uint64_t timestamp) -> bool
+{
+    db_record record;
+    record.kind = db_record_position;
+    record.asset_name = asset_name;
+    record.timestamp = timestamp;
+    record.latitude = latitude;
+    record.longitude = longitude;
+    record.altitude = altitude;
+    return this->add(record);
+}
+
+auto
+flight_safety_system::server::db_connection_memory::asset_get_command(const std::string &asset_name) -> std::shared_ptr<asset_command>
+{
+    auto asset = this->findAsset(asset_name, false);
+    if (asset == nullptr)
+    {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock_holder(asset->lock);
+    return asset->command;
+}
+
+auto
+flight_safety_system::server::db_connection_memory::asset_get_smm_settings(const std::string &asset_name) -> std::shared_ptr<smm_settings>
+{
+    auto asset = this->findAsset(asset_name, false);
+    if (asset == nullptr)
+    {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock_holder(asset->lock);
+    return asset->smm;
+}
+
+auto
+flight_safety_system::server::db_connection_memory::get_active_fss_servers() -> std::list<std::shared_ptr<fss_server_details>>
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->servers;
+}
+
+auto
+flight_safety_system::server::db_connection_memory::getPoolStats() -> db_pool_stats
+{
+    db_pool_stats stats;
+    stats.statements = this->writes;
+    return stats;
+}
+
+auto
+flight_safety_system::server::db_connection_memory::isHealthy() -> bool
+{
+    return true;
+}
+
+auto
+flight_safety_system::server::db_connection_memory::recover() -> bool
+{
+    return true;
+}
+
+void
+flight_safety_system::server::db_connection_memory::setLostWriteHandler(std::function<void(const db_record &)> handler __attribute__((unused)))
+{
+    /* Nothing taken is ever lost */
+}
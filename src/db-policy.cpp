@@ -0,0 +1,106 @@
+#include "fss-server.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+constexpr double earth_radius = 6371000;
+constexpr double deg_to_rad = M_PI / 180;
+
+/* Good enough over the distances between two reports */
+static auto
+distance_between(double lat1, double lon1, double lat2, double lon2) -> double
+{
+    double x = (lon2 - lon1) * deg_to_rad * std::cos((lat1 + lat2) / 2 * deg_to_rad);
+    double y = (lat2 - lat1) * deg_to_rad;
+    return std::sqrt(x * x + y * y) * earth_radius;
+}
+
+template<typename T>
+static auto
+moved_by(T a, T b) -> T
+{
+    return a > b ? a - b : b - a;
+}
+
+auto
+flight_safety_system::server::db_write_filter::decide(last_written &last, const db_write_rules::interval &interval, uint64_t now, bool transition, bool changed) -> bool
+{
+    this->rules->considered++;
+    bool write = false;
+    if (!last.valid || transition)
+    {
+        write = true;
+    }
+    else
+    {
+        uint64_t elapsed = now - last.when;
+        if (elapsed >= interval.min_interval)
+        {
+            write = changed || (interval.max_interval != 0 && elapsed >= interval.max_interval);
+        }
+    }
+    if (write)
+    {
+        this->rules->written++;
+        last.valid = true;
+        last.when = now;
+    }
+    return write;
+}
+
+auto
+flight_safety_system::server::db_write_filter::allowPosition(uint64_t now, double t_latitude, double t_longitude, uint16_t t_altitude) -> bool
+{
+    bool changed = distance_between(this->latitude, this->longitude, t_latitude, t_longitude) >= this->rules->position_distance || moved_by(this->altitude, t_altitude) >= this->rules->position_altitude;
+    if (!this->decide(this->position, this->rules->position, now, false, changed))
+    {
+        return false;
+    }
+    this->latitude = t_latitude;
+    this->longitude = t_longitude;
+    this->altitude = t_altitude;
+    return true;
+}
+
+auto
+flight_safety_system::server::db_write_filter::allowStatus(uint64_t now, uint8_t t_bat_percent, double t_bat_voltage) -> bool
+{
+    uint8_t low = this->rules->status_low_percent;
+    bool transition = low != 0 && (this->bat_percent < low) != (t_bat_percent < low);
+    bool changed = moved_by(this->bat_percent, t_bat_percent) >= this->rules->status_percent || std::fabs(this->bat_voltage - t_bat_voltage) >= this->rules->status_voltage;
+    if (!this->decide(this->status, this->rules->status, now, transition, changed))
+    {
+        return false;
+    }
+    this->bat_percent = t_bat_percent;
+    this->bat_voltage = t_bat_voltage;
+    return true;
+}
+
+auto
+flight_safety_system::server::db_write_filter::allowSearchStatus(uint64_t now, uint64_t t_search_id, uint64_t t_search_completed, uint64_t t_search_total) -> bool
+{
+    /* A new search, or one finishing, always gets recorded */
+    bool transition = t_search_id != this->search_id || t_search_total != this->search_total || (t_search_completed == t_search_total && this->search_completed != t_search_completed);
+    bool changed = moved_by(this->search_completed, t_search_completed) >= this->rules->search_completed;
+    if (!this->decide(this->search_status, this->rules->search_status, now, transition, changed))
+    {
+        return false;
+    }
+    this->search_id = t_search_id;
+    this->search_completed = t_search_completed;
+    this->search_total = t_search_total;
+    return true;
+}
+
+auto
+flight_safety_system::server::db_write_filter::allowRtt(uint64_t now, uint64_t t_rtt) -> bool
+{
+    bool changed = moved_by(this->rtt_value, t_rtt) >= this->rules->rtt_change;
+    if (!this->decide(this->rtt, this->rules->rtt, now, false, changed))
+    {
+        return false;
+    }
+    this->rtt_value = t_rtt;
+    return true;
+}
@@ -0,0 +1,475 @@
+#include "fss-server.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* kind, bat_percent, altitude, bat_mah_used, nine 8 byte fields, then the asset name's length before the name */
+constexpr size_t record_fixed_size = 1 + 1 + 2 + 4 + 9 * 8 + 2;
+constexpr size_t max_asset_name = 1024;
+constexpr size_t record_alignment = 8;
+
+static auto
+crc_table() -> std::array<uint32_t, 256>
+{
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < table.size(); i++)
+    {
+        uint32_t c = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            c = (c & 1) != 0 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+
+static auto
+crc32(const char *data, size_t length) -> uint32_t
+{
+    static const std::array<uint32_t, 256> table = crc_table();
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+static auto
+aligned(size_t length) -> size_t
+{
+    return (length + record_alignment - 1) & ~(record_alignment - 1);
+}
+
+/* The spool never leaves this machine, so fields are kept in its own byte order */
+template<typename T>
+static void
+put(char *&dst, T value)
+{
+    memcpy(dst, &value, sizeof(value));
+    dst += sizeof(value);
+}
+
+template<typename T>
+static void
+take(const char *&src, T &value)
+{
+    memcpy(&value, src, sizeof(value));
+    src += sizeof(value);
+}
+
+static void
+encode_record(const flight_safety_system::server::db_record &record, char *dst)
+{
+    put(dst, static_cast<uint8_t>(record.kind));
+    put(dst, record.bat_percent);
+    put(dst, record.altitude);
+    put(dst, record.bat_mah_used);
+    put(dst, record.timestamp);
+    put(dst, record.rtt);
+    put(dst, record.bat_voltage);
+    put(dst, record.search_id);
+    put(dst, record.search_completed);
+    put(dst, record.search_total);
+    put(dst, record.latitude);
+    put(dst, record.longitude);
+    put(dst, static_cast<uint16_t>(record.asset_name.size()));
+    memcpy(dst, record.asset_name.data(), record.asset_name.size());
+}
+
+static auto
+decode_record(const char *src, size_t length, flight_safety_system::server::db_record &record) -> bool
+{
+    uint8_t kind;
+    uint16_t name_length;
+    if (length < record_fixed_size)
+    {
+        return false;
+    }
+    take(src, kind);
+    take(src, record.bat_percent);
+    take(src, record.altitude);
+    take(src, record.bat_mah_used);
+    take(src, record.timestamp);
+    take(src, record.rtt);
+    take(src, record.bat_voltage);
+    take(src, record.search_id);
+    take(src, record.search_completed);
+    take(src, record.search_total);
+    take(src, record.latitude);
+    take(src, record.longitude);
+    take(src, name_length);
+    if (kind < flight_safety_system::server::db_record_rtt || kind > flight_safety_system::server::db_record_position || record_fixed_size + name_length != length)
+    {
+        return false;
+    }
+    record.kind = static_cast<flight_safety_system::server::db_record_kind>(kind);
+    record.asset_name.assign(src, name_length);
+    return true;
+}
+
+flight_safety_system::server::db_spool::db_spool(std::string t_directory, size_t t_segment_size, size_t t_max_segments) : directory(std::move(t_directory)), segment_size(std::max(t_segment_size, header_size + aligned(record_header_size + record_fixed_size + max_asset_name))), max_segments(std::max(t_max_segments, static_cast<size_t>(1)))
+{
+    if (mkdir(this->directory.c_str(), S_IRWXU | S_IRGRP | S_IXGRP) < 0 && errno != EEXIST)
+    {
+        perror(("Failed to create spool directory " + this->directory).c_str());
+        return;
+    }
+    std::vector<uint64_t> found;
+    DIR *dir = opendir(this->directory.c_str());
+    if (dir == nullptr)
+    {
+        perror(("Failed to open spool directory " + this->directory).c_str());
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        unsigned long long sequence;
+        char check[8];
+        if (sscanf(entry->d_name, "%16llu.wa%1s", &sequence, check) == 2 && strcmp(check, "l") == 0 && strlen(entry->d_name) == 20)
+        {
+            found.push_back(sequence);
+        }
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+    /* Whatever an earlier run didn't replay is replayed first */
+    for (auto sequence : found)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llu.wal", static_cast<unsigned long long>(sequence));
+        this->next_sequence = sequence + 1;
+        auto seg = this->openSegment(this->directory + name, false);
+        if (seg == nullptr)
+        {
+            continue;
+        }
+        size_t offset = this->getReplayed(seg);
+        db_record record;
+        for (size_t next = this->readRecord(seg, offset, record); next != 0; next = this->readRecord(seg, offset, record))
+        {
+            offset = next;
+            seg->records++;
+        }
+        seg->used = offset;
+        if (seg->records == 0)
+        {
+            this->closeSegment(seg, true);
+            continue;
+        }
+        this->backlog += seg->records;
+        this->segments.push_back(seg);
+    }
+    if (this->backlog > 0)
+    {
+        std::cerr << "Spool has " << this->backlog << " records to replay" << std::endl;
+    }
+}
+
+flight_safety_system::server::db_spool::~db_spool()
+{
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    if (this->replay_thread.joinable())
+    {
+        this->replay_thread.join();
+    }
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    for (const auto &seg : this->segments)
+    {
+        this->closeSegment(seg, seg->records == 0);
+    }
+    this->segments.clear();
+}
+
+auto
+flight_safety_system::server::db_spool::openSegment(const std::string &path, bool create) -> std::shared_ptr<segment>
+{
+    auto seg = std::make_shared<segment>();
+    seg->path = path;
+    seg->fd = open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), S_IRUSR | S_IWUSR);
+    if (seg->fd < 0)
+    {
+        perror(("Failed to open spool segment " + path).c_str());
+        return nullptr;
+    }
+    if (create)
+    {
+        if (ftruncate(seg->fd, static_cast<off_t>(this->segment_size)) < 0)
+        {
+            perror("Failed to size spool segment: ");
+            close(seg->fd);
+            return nullptr;
+        }
+        seg->size = this->segment_size;
+    }
+    else
+    {
+        struct stat st = {};
+        if (fstat(seg->fd, &st) < 0 || static_cast<size_t>(st.st_size) < header_size)
+        {
+            std::cerr << path << " is not a spool segment" << std::endl;
+            close(seg->fd);
+            return nullptr;
+        }
+        seg->size = static_cast<size_t>(st.st_size);
+    }
+    void *mapped = mmap(nullptr, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        perror("Failed to map spool segment: ");
+        close(seg->fd);
+        return nullptr;
+    }
+    seg->map = static_cast<char *>(mapped);
+    if (create)
+    {
+        memcpy(seg->map, magic, magic_size);
+        this->setReplayed(seg, header_size);
+        seg->used = header_size;
+        seg->writable = true;
+    }
+    else if (memcmp(seg->map, magic, magic_size) != 0 || this->getReplayed(seg) < header_size || this->getReplayed(seg) > seg->size)
+    {
+        std::cerr << path << " is not a spool segment" << std::endl;
+        munmap(seg->map, seg->size);
+        close(seg->fd);
+        return nullptr;
+    }
+    return seg;
+}
+
+void
+flight_safety_system::server::db_spool::closeSegment(const std::shared_ptr<segment> &seg, bool remove)
+{
+    if (seg->map == nullptr)
+    {
+        return;
+    }
+    munmap(seg->map, seg->size);
+    seg->map = nullptr;
+    /* Drop the unused tail, a later run reads up to the end of the file */
+    if (!remove && seg->writable && ftruncate(seg->fd, static_cast<off_t>(seg->used)) < 0)
+    {
+        perror("Failed to trim spool segment: ");
+    }
+    close(seg->fd);
+    seg->fd = -1;
+    if (remove && unlink(seg->path.c_str()) < 0)
+    {
+        perror(("Failed to remove spool segment " + seg->path).c_str());
+    }
+}
+
+auto
+flight_safety_system::server::db_spool::getReplayed(const std::shared_ptr<segment> &seg) -> size_t
+{
+    uint64_t offset;
+    memcpy(&offset, seg->map + magic_size, sizeof(offset));
+    return static_cast<size_t>(offset);
+}
+
+void
+flight_safety_system::server::db_spool::setReplayed(const std::shared_ptr<segment> &seg, size_t offset)
+{
+    uint64_t value = offset;
+    memcpy(seg->map + magic_size, &value, sizeof(value));
+}
+
+auto
+flight_safety_system::server::db_spool::readRecord(const std::shared_ptr<segment> &seg, size_t offset, db_record &record) -> size_t
+{
+    if (offset + record_header_size > seg->size)
+    {
+        return 0;
+    }
+    uint32_t length;
+    uint32_t crc;
+    memcpy(&length, seg->map + offset, sizeof(length));
+    memcpy(&crc, seg->map + offset + 4, sizeof(crc));
+    if (length == 0)
+    {
+        return 0;
+    }
+    const char *payload = seg->map + offset + record_header_size;
+    if (offset + record_header_size + length > seg->size || crc32(payload, length) != crc || !decode_record(payload, length, record))
+    {
+        this->corrupt++;
+        return 0;
+    }
+    return offset + aligned(record_header_size + length);
+}
+
+auto
+flight_safety_system::server::db_spool::append(const db_record &record) -> bool
+{
+    if (record.asset_name.size() > max_asset_name)
+    {
+        return false;
+    }
+    size_t length = record_fixed_size + record.asset_name.size();
+    size_t needed = aligned(record_header_size + length);
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    auto seg = this->segments.empty() ? nullptr : this->segments.back();
+    if (seg == nullptr || !seg->writable || seg->used + needed > seg->size)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llu.wal", static_cast<unsigned long long>(this->next_sequence++));
+        seg = this->openSegment(this->directory + name, true);
+        if (seg == nullptr)
+        {
+            return false;
+        }
+        this->segments.push_back(seg);
+        /* Over the disk budget, the oldest records go */
+        while (this->segments.size() > this->max_segments)
+        {
+            auto oldest = this->segments.front();
+            this->dropped += oldest->records;
+            this->backlog -= oldest->records;
+            this->closeSegment(oldest, true);
+            this->segments.pop_front();
+        }
+    }
+    char *dst = seg->map + seg->used;
+    encode_record(record, dst + record_header_size);
+    uint32_t crc = crc32(dst + record_header_size, length);
+    memcpy(dst + 4, &crc, sizeof(crc));
+    /* The length goes in last, so a record is only there once it is whole */
+    std::atomic_signal_fence(std::memory_order_release);
+    auto length32 = static_cast<uint32_t>(length);
+    memcpy(dst, &length32, sizeof(length32));
+    seg->used += needed;
+    seg->records++;
+    this->spooled++;
+    if (this->backlog++ == 0)
+    {
+        this->wake.notify_all();
+    }
+    return true;
+}
+
+auto
+flight_safety_system::server::db_spool::pending() -> bool
+{
+    return this->backlog > 0;
+}
+
+auto
+flight_safety_system::server::db_spool::replay(size_t max, const std::function<bool(const db_record &)> &write) -> size_t
+{
+    std::vector<db_record> batch;
+    std::vector<size_t> ends;
+    std::shared_ptr<segment> seg = nullptr;
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        /* Segments that have been replayed go, apart from the one being written to */
+        while (!this->segments.empty() && this->getReplayed(this->segments.front()) >= this->segments.front()->used && this->segments.front() != this->segments.back())
+        {
+            this->closeSegment(this->segments.front(), true);
+            this->segments.pop_front();
+        }
+        if (this->segments.empty())
+        {
+            return 0;
+        }
+        seg = this->segments.front();
+        size_t offset = this->getReplayed(seg);
+        while (batch.size() < max && offset < seg->used)
+        {
+            db_record record;
+            size_t next = this->readRecord(seg, offset, record);
+            if (next == 0)
+            {
+                /* Nothing after a damaged record can be found, so the rest of the segment is lost */
+                this->backlog -= seg->records - batch.size();
+                seg->records = batch.size();
+                seg->used = offset;
+                break;
+            }
+            batch.push_back(std::move(record));
+            ends.push_back(next);
+            offset = next;
+        }
+    }
+    size_t done = 0;
+    for (const auto &record : batch)
+    {
+        if (!write(record))
+        {
+            break;
+        }
+        done++;
+    }
+    if (done > 0)
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        /* Unless the budget dropped the segment while these were being written */
+        if (seg->map != nullptr)
+        {
+            this->setReplayed(seg, ends[done - 1]);
+            seg->records -= done;
+            this->backlog -= done;
+        }
+        this->replayed += done;
+    }
+    return done;
+}
+
+void
+flight_safety_system::server::db_spool::startReplay(std::function<bool()> healthy, std::function<bool(const db_record &)> write)
+{
+    this->replay_thread = std::thread([this, healthy, write]() {
+        while (!this->stopping)
+        {
+            {
+                std::unique_lock<std::mutex> lock_holder(this->lock);
+                this->wake.wait_for(lock_holder, std::chrono::seconds(1), [this]() { return this->stopping.load(); });
+                /* Have the kernel start writing out what has been appended */
+                if (!this->segments.empty())
+                {
+                    msync(this->segments.back()->map, this->segments.back()->size, MS_ASYNC);
+                }
+            }
+            if (!this->pending() || !healthy())
+            {
+                continue;
+            }
+            while (!this->stopping && this->pending() && this->replay(replay_batch, write) > 0)
+            {
+            }
+        }
+    });
+}
+
+auto
+flight_safety_system::server::db_spool::getStats() -> db_spool_stats
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    db_spool_stats stats;
+    stats.spooled = this->spooled;
+    stats.replayed = this->replayed;
+    stats.backlog = this->backlog;
+    stats.segments = this->segments.size();
+    stats.dropped = this->dropped;
+    stats.corrupt = this->corrupt;
+    return stats;
+}
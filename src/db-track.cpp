@@ -0,0 +1,148 @@
+#include "fss-server.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+constexpr double earth_radius = 6371000;
+constexpr double deg_to_rad = M_PI / 180;
+/* Altitudes are whole numbers, so the interpolated one can be up to this far out before it means anything */
+constexpr double altitude_rounding = 0.5;
+
+void
+flight_safety_system::server::track_rules::record(uint64_t t_points_in, uint64_t t_points_out, const std::vector<double> &errors)
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    this->points_in += t_points_in;
+    this->points_out += t_points_out;
+    for (auto error : errors)
+    {
+        this->error_total += error;
+        this->error_max = std::max(this->error_max, error);
+    }
+    this->error_count += errors.size();
+}
+
+auto
+flight_safety_system::server::track_rules::getCompression() -> double
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->points_out > 0 ? static_cast<double>(this->points_in) / static_cast<double>(this->points_out) : 1;
+}
+
+auto
+flight_safety_system::server::track_rules::getErrorAverage() -> double
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->error_count > 0 ? this->error_total / static_cast<double>(this->error_count) : 0;
+}
+
+auto
+flight_safety_system::server::track_rules::getErrorMax() -> double
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->error_max;
+}
+
+/* Metres east and north of origin, near enough over the length of one leg */
+static void
+local_offset(const flight_safety_system::server::track_point &origin, const flight_safety_system::server::track_point &point, double &east, double &north)
+{
+    east = (point.longitude - origin.longitude) * deg_to_rad * std::cos((origin.latitude + point.latitude) / 2 * deg_to_rad) * earth_radius;
+    north = (point.latitude - origin.latitude) * deg_to_rad * earth_radius;
+}
+
+auto
+flight_safety_system::server::track_simplifier::offTrack(const track_point &from, const track_point &to, const track_point &point, double &distance) -> bool
+{
+    double to_east, to_north, east, north;
+    local_offset(from, to, to_east, to_north);
+    local_offset(from, point, east, north);
+    /* How far along from -> to the point is closest, and how far it is from there */
+    double length = to_east * to_east + to_north * to_north;
+    double along = length > 0 ? std::min(std::max((east * to_east + north * to_north) / length, 0.0), 1.0) : 0;
+    distance = std::hypot(east - along * to_east, north - along * to_north);
+    double altitude = from.altitude + along * (static_cast<double>(to.altitude) - static_cast<double>(from.altitude));
+    return distance > this->rules->tolerance || std::fabs(point.altitude - altitude) > this->rules->altitude_tolerance + altitude_rounding;
+}
+
+auto
+flight_safety_system::server::track_simplifier::turned(const track_point &point) -> bool
+{
+    if (this->rules->turn_angle <= 0)
+    {
+        return false;
+    }
+    const track_point &corner = this->held.back();
+    const track_point &before = this->held.size() > 1 ? this->held[this->held.size() - 2] : this->anchor;
+    double in_east, in_north, out_east, out_north;
+    local_offset(before, corner, in_east, in_north);
+    local_offset(corner, point, out_east, out_north);
+    /* Legs shorter than the tolerance are mostly noise */
+    if (std::hypot(in_east, in_north) <= this->rules->tolerance || std::hypot(out_east, out_north) <= this->rules->tolerance)
+    {
+        return false;
+    }
+    double change = std::fabs(std::atan2(out_east, out_north) - std::atan2(in_east, in_north)) / deg_to_rad;
+    return std::min(change, 360 - change) > this->rules->turn_angle;
+}
+
+void
+flight_safety_system::server::track_simplifier::keep(size_t index, const std::function<void(const track_point &)> &store)
+{
+    const track_point &kept = this->held[index];
+    this->errors.clear();
+    for (size_t i = 0; i < index; i++)
+    {
+        double distance = 0;
+        this->offTrack(this->anchor, kept, this->held[i], distance);
+        this->errors.push_back(distance);
+    }
+    this->rules->record(index + 1, 1, this->errors);
+    store(kept);
+    this->anchor = kept;
+    this->held.erase(this->held.begin(), this->held.begin() + static_cast<std::ptrdiff_t>(index) + 1);
+}
+
+void
+flight_safety_system::server::track_simplifier::addPoint(const track_point &point, const std::function<void(const track_point &)> &store)
+{
+    if (!this->anchored || this->rules->tolerance <= 0)
+    {
+        this->rules->record(1, 1, {});
+        store(point);
+        this->anchor = point;
+        this->anchored = true;
+        return;
+    }
+    if (!this->held.empty() && this->turned(point))
+    {
+        this->keep(this->held.size() - 1, store);
+    }
+    /* If a straight line from the last point kept to this one misses any held point, the last one held is needed */
+    for (const auto &held_point : this->held)
+    {
+        double distance = 0;
+        if (this->offTrack(this->anchor, point, held_point, distance))
+        {
+            this->keep(this->held.size() - 1, store);
+            break;
+        }
+    }
+    this->held.push_back(point);
+    if ((this->rules->max_interval != 0 && point.when - this->anchor.when >= this->rules->max_interval) || (this->rules->max_points != 0 && this->held.size() >= this->rules->max_points))
+    {
+        this->keep(this->held.size() - 1, store);
+    }
+}
+
+void
+flight_safety_system::server::track_simplifier::flush(const std::function<void(const track_point &)> &store)
+{
+    if (!this->held.empty())
+    {
+        this->keep(this->held.size() - 1, store);
+    }
+}
@@ -1,7 +1,12 @@
 #include <fss-transport-ssl.hpp>
 
+#include <array>
+#include <atomic>
+#include <functional>
 #include <list>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 namespace flight_safety_system {
 namespace client_ssl {
@@ -16,14 +21,146 @@ CLIENT_CONNECTION_STATUS_CONNECTED_2_OR_MORE,
 CLIENT_CONNECTION_STATUS_DISCONNECTED,
 };
 
+/* The last report heard from another aircraft. Kept trivially copyable, so it can be copied in and out of the traffic table word by word */
+class fss_traffic_target {
+public:
+    static constexpr size_t callsign_size = 9;
+    double latitude{0};
+    double longitude{0};
+    /* ms since the epoch, as reported */
+    uint64_t timestamp{0};
+    /* fss_monotonic_timestamp() when it was heard */
+    uint64_t received{0};
+    uint32_t altitude{0};
+    uint32_t icao_address{0};
+    uint16_t heading{0};
+    uint16_t horizontal_velocity{0};
+    int16_t vertical_velocity{0};
+    uint16_t squawk{0};
+    uint16_t flags{0};
+    uint8_t tslc{0};
+    uint8_t altitude_type{0};
+    uint8_t emitter_type{0};
+    /* Nul terminated, longer callsigns are cut short */
+    std::array<char, callsign_size> callsign{};
+    auto getCallSign() const -> std::string;
+};
+
+/* Other aircraft, keyed by ICAO address or, without one, callsign. Targets live in a flat array of slots found by open addressing,
+   each guarded by a sequence lock: writers (the receive threads) take a slot by making its sequence odd, readers copy a slot out
+   and check the sequence didn't move. Readers never wait, a slot that keeps changing under them is left out after a few tries.
+   Targets not heard from for max_age ms are left out, and their slots reused */
+class fss_traffic_table {
+private:
+    static constexpr size_t target_words = (sizeof(fss_traffic_target) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    static constexpr int read_attempts = 8;
+    class slot {
+    public:
+        std::atomic<uint32_t> sequence{0};
+        /* 0 until first used, after that a slot always has a key so probing can't stop short */
+        std::atomic<uint64_t> key{0};
+        std::atomic<uint64_t> updated{0};
+        std::array<std::atomic<uint64_t>, target_words> data{};
+    };
+    std::vector<slot> slots;
+    uint64_t max_age;
+    std::atomic<uint64_t> dropped{0};
+    static auto keyFor(const fss_traffic_target &target) -> uint64_t;
+    auto home(uint64_t key) const -> size_t;
+    /* With reuse, only writes if the slot's target is (still) stale, taking the slot over for key */
+    auto store(slot &s, uint64_t key, const fss_traffic_target &target, bool reuse) -> bool;
+    /* Copies out a live target, with the given key unless key is 0 */
+    auto load(const slot &s, uint64_t key, uint64_t now, fss_traffic_target &target) const -> bool;
+    auto findKey(uint64_t key, fss_traffic_target &target) const -> bool;
+public:
+    static constexpr size_t default_capacity = 256;
+    static constexpr uint64_t default_max_age = 30000;
+    explicit fss_traffic_table(size_t capacity = default_capacity, uint64_t t_max_age = default_max_age);
+    fss_traffic_table(fss_traffic_table&) = delete;
+    fss_traffic_table(fss_traffic_table&&) = delete;
+    auto operator=(fss_traffic_table&) -> fss_traffic_table& = delete;
+    auto operator=(fss_traffic_table&&) -> fss_traffic_table& = delete;
+    ~fss_traffic_table();
+    /* False if it has neither an ICAO address nor a callsign, or every slot holds a live target */
+    auto update(fss_traffic_target target) -> bool;
+    auto update(flight_safety_system::transport::fss_message_position_report &msg) -> bool;
+    auto find(uint32_t icao_address, fss_traffic_target &target) const -> bool;
+    auto find(const std::string &callsign, fss_traffic_target &target) const -> bool;
+    /* Fills targets (reusing its storage) with every live target */
+    void snapshot(std::vector<fss_traffic_target> &targets) const;
+    auto snapshot() const -> std::vector<fss_traffic_target>;
+    /* Updates lost to a full table */
+    auto getDropped() -> uint64_t;
+};
+
+/* How the connection to a server is doing, measured by the RTT requests the client sends it */
+class fss_server_link {
+public:
+    /* Smoothed, in ms, 0 until the first response */
+    double rtt{0};
+    /* Smoothed share of requests that went unanswered, 0 to 1 */
+    double loss{0};
+    /* How long the request in flight has been waiting, 0 if there isn't one */
+    uint64_t waiting{0};
+    uint64_t probes{0};
+    uint64_t responses{0};
+};
+
+/* Which servers get one kind of message. With best_only it goes to the primary server,
+   and a copy goes to the others at most every copy_interval ms (0 for never) */
+class fss_message_policy {
+public:
+    bool best_only{false};
+    uint64_t copy_interval{0};
+};
+
+/* Picking the primary server from the RTT and loss measured to each. The defaults send everything to every server */
+class fss_server_selection {
+public:
+    fss_message_policy position{};
+    fss_message_policy status{};
+    fss_message_policy search_status{};
+    /* How often each connected server is sent an RTT request, and when one is given up on as lost (ms) */
+    uint64_t probe_interval{1000};
+    uint64_t probe_timeout{3000};
+    /* A primary slower or losing more than this is failed over from (ms, 0 to 1) */
+    double max_rtt{1000};
+    double max_loss{0.5};
+    /* While the primary is within the limits, only move to a server faster by this much (ms) */
+    double switch_margin{20};
+};
+
+/* The known servers, split by whether they are connected. A set is never changed once published,
+   changes build a new one and swap it in, so it can be walked from any thread without a lock */
+class fss_server_set {
+public:
+    std::vector<std::shared_ptr<fss_server>> connected{};
+    std::vector<std::shared_ptr<fss_server>> reconnect{};
+    auto find(const std::string &address, uint16_t port) const -> std::shared_ptr<fss_server>;
+};
+
 class fss_client {
 private:
     std::string asset_name{""};
-    std::string ca_file{""};
-    std::string private_key_file{""};
-    std::string public_key_file{""};
-    std::list<std::shared_ptr<flight_safety_system::client_ssl::fss_server>> servers{};
-    std::list<std::shared_ptr<flight_safety_system::client_ssl::fss_server>> reconnect_servers{};
+    std::shared_ptr<flight_safety_system::transport_ssl::fss_credentials> credentials{};
+    bool early_identity{false};
+    bool compact_positions{false};
+    bool batch_messages{false};
+    bool datagram{false};
+    bool kernel_tls{false};
+    flight_safety_system::transport::fss_socket_profile socket_profile{};
+    std::shared_ptr<const fss_server_set> servers{std::make_shared<fss_server_set>()};
+    std::shared_ptr<fss_traffic_table> traffic{std::make_shared<fss_traffic_table>()};
+    std::shared_ptr<const fss_server_selection> selection{std::make_shared<fss_server_selection>()};
+    std::shared_ptr<fss_server> primary{nullptr};
+    std::atomic<uint64_t> last_probe{0};
+    /* When a copy of each best_only kind of message last went to the other servers */
+    std::array<std::atomic<uint64_t>, 3> last_copy{};
+    auto policyFor(flight_safety_system::transport::fss_message_type type, const fss_server_selection &current) -> const fss_message_policy *;
+    auto copyDue(flight_safety_system::transport::fss_message_type type, const fss_message_policy &policy, uint64_t now) -> bool;
+    /* Applies change to a copy of the current set and publishes it, retrying if another thread got in first.
+       change may run more than once, and returns false to leave the set as it is */
+    auto updateServerSet(const std::function<bool(fss_server_set &)> &change) -> std::shared_ptr<const fss_server_set>;
     void notifyConnectionStatus();
     virtual void connectionStatusChange(flight_safety_system::client_ssl::connection_status status);
 protected:
@@ -39,13 +176,40 @@ public:
     auto operator=(fss_client&&) -> fss_client& = delete;
     virtual ~fss_client();
     virtual void connectTo(const std::string &t_address, uint16_t t_port, bool connect);
+    /* Also probes the connected servers, so call it regularly */
     virtual void attemptReconnect();
     virtual void disconnect();
     virtual void sendMsgAll(const std::shared_ptr<flight_safety_system::transport::fss_message> &msg);
     virtual auto getAssetName() -> std::string;
+    virtual void setServerSelection(const fss_server_selection &t_selection);
+    /* Sends RTT requests to the connected servers every probe_interval, and picks the primary again */
+    virtual void probeServers();
+    /* Chooses the best connected server from what has been measured, nullptr if none are connected */
+    virtual void selectPrimary();
+    auto getPrimary() -> std::shared_ptr<fss_server>;
+    /* A consistent view of the servers, still valid however they change after */
+    auto getServers() -> std::shared_ptr<const fss_server_set>;
+    virtual auto reloadCredentials() -> bool;
+    virtual void setEarlyIdentity(bool t_early_identity);
+    virtual auto getEarlyIdentity() -> bool;
+    virtual void setCompactPositions(bool t_compact_positions);
+    virtual auto getCompactPositions() -> bool;
+    virtual void setBatchMessages(bool t_batch_messages);
+    virtual auto getBatchMessages() -> bool;
+    /* TCP options for connections to servers, and how many probes a server can leave unanswered before it is reconnected to */
+    virtual void setSocketProfile(const flight_safety_system::transport::fss_socket_profile &t_profile);
+    virtual auto getSocketProfile() -> flight_safety_system::transport::fss_socket_profile;
+    /* Hand the TLS records to the kernel where it can take them */
+    virtual void setKernelTLS(bool t_kernel_tls);
+    virtual auto getKernelTLS() -> bool;
+    /* Ask servers for a DTLS channel to carry position reports */
+    virtual void setDatagram(bool t_datagram);
+    virtual auto getDatagram() -> bool;
     virtual void serverRequiresReconnect(fss_server *server);
     virtual void updateServers(const std::shared_ptr<flight_safety_system::transport::fss_message_server_list> &msg);
     virtual void handleCommand(const std::shared_ptr<flight_safety_system::transport::fss_message_asset_command> &msg __attribute__((unused)));
+    /* Kept up to date from the position reports servers relay, before handlePositionReport is called */
+    auto getTraffic() -> std::shared_ptr<fss_traffic_table>;
     virtual void handlePositionReport(const std::shared_ptr<flight_safety_system::transport::fss_message_position_report> &msg __attribute__((unused)));
     virtual void handleSMMSettings(const std::shared_ptr<flight_safety_system::transport::fss_message_smm_settings> &msg __attribute__((unused)));
 };
@@ -55,29 +219,49 @@ private:
     fss_client *client;
     std::string address;
     uint16_t port;
-    std::string ca_file{""};
-    std::string private_key_file{""};
-    std::string public_key_file{""};
+    std::shared_ptr<flight_safety_system::transport_ssl::fss_credentials> credentials;
+    std::string resume_data{};
     uint64_t last_tried{0};
     uint64_t retry_count{0};
     static constexpr uint64_t retry_delay_start = 1000;
     static constexpr uint64_t retry_delay_cap = 30000;
-    uint64_t retry_delay{retry_delay_start};
+    uint64_t retry_delay{0};
+    flight_safety_system::transport::fss_backoff backoff{retry_delay_start, retry_delay_cap};
+    std::shared_ptr<flight_safety_system::transport_ssl::fss_datagram_client> datagram{};
+    std::mutex link_lock{};
+    fss_server_link link{};
+    uint64_t probe_id{0};
+    /* When the request in flight was sent, 0 if there isn't one */
+    uint64_t probe_sent{0};
+    void stopDatagram();
 protected:
     auto reconnect_to() -> bool;
 public:
     fss_server(fss_client *t_client, std::string t_address, uint16_t t_port, std::string t_ca, std::string t_private_key, std::string t_public_key);
+    fss_server(fss_client *t_client, std::string t_address, uint16_t t_port, std::shared_ptr<flight_safety_system::transport_ssl::fss_credentials> t_credentials);
     fss_server(fss_server &other) = delete;
     fss_server(fss_server&&) = delete;
     auto operator=(fss_server&) -> fss_server& = delete;
     auto operator=(fss_server&&) -> fss_server& = delete;
     ~fss_server() override;
     void processMessage(std::shared_ptr<flight_safety_system::transport::fss_message> message) override;
+    /* Called by fss_message_dispatch with each message as its concrete type */
+    void handleMessage(flight_safety_system::transport::fss_message &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner);
+    void handleMessage(flight_safety_system::transport::fss_message_datagram_offer &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner);
+    void handleMessage(flight_safety_system::transport::fss_message_rtt_request &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner);
+    void handleMessage(flight_safety_system::transport::fss_message_rtt_response &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner);
+    void handleMessage(flight_safety_system::transport::fss_message_position_report &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner);
+    void handleMessage(flight_safety_system::transport::fss_message_asset_command &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner);
+    void handleMessage(flight_safety_system::transport::fss_message_server_list &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner);
+    void handleMessage(flight_safety_system::transport::fss_message_smm_settings &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner);
     virtual auto getAddress() -> std::string;
     virtual auto getPort() -> uint16_t;
     virtual auto reconnect() -> bool;
     virtual auto getClient() -> fss_client *;
     virtual void sendIdentify();
+    /* Sends an RTT request unless one is in flight, first counting the last as lost if it has waited timeout ms */
+    virtual void probe(uint64_t timeout);
+    virtual auto getLink() -> fss_server_link;
 };
 
 
@@ -1,13 +1,51 @@
 #include "fss.hpp"
 
-#include <sys/time.h>
+#include <atomic>
+
+#include <time.h>
+
+static std::atomic<uint64_t> coarse_timestamp{0};
+static std::atomic<uint64_t> coarse_monotonic_timestamp{0};
+
+static auto
+clock_msec(clockid_t clock) -> uint64_t
+{
+    struct timespec ts = {};
+    clock_gettime(clock, &ts);
+    constexpr uint64_t sec_to_msec = 1000;
+    constexpr uint64_t nsec_to_msec = 1000000;
+    return static_cast<uint64_t>(ts.tv_sec) * sec_to_msec + static_cast<uint64_t>(ts.tv_nsec) / nsec_to_msec;
+}
 
 auto
 flight_safety_system::fss_current_timestamp() -> uint64_t
 {
-    struct timeval tv = {};
-    gettimeofday(&tv, nullptr);
-    constexpr int sec_to_msec = 1000;
-    constexpr int usec_to_msec = 1000;
-    return tv.tv_sec * sec_to_msec + (tv.tv_usec / usec_to_msec);
+    return clock_msec(CLOCK_REALTIME);
+}
+
+auto
+flight_safety_system::fss_monotonic_timestamp() -> uint64_t
+{
+    return clock_msec(CLOCK_MONOTONIC);
+}
+
+void
+flight_safety_system::fss_clock_tick()
+{
+    coarse_timestamp = fss_current_timestamp();
+    coarse_monotonic_timestamp = fss_monotonic_timestamp();
+}
+
+auto
+flight_safety_system::fss_coarse_timestamp() -> uint64_t
+{
+    uint64_t ts = coarse_timestamp;
+    return ts != 0 ? ts : fss_current_timestamp();
+}
+
+auto
+flight_safety_system::fss_coarse_monotonic_timestamp() -> uint64_t
+{
+    uint64_t ts = coarse_monotonic_timestamp;
+    return ts != 0 ? ts : fss_monotonic_timestamp();
 }
@@ -1,8 +1,17 @@
 #include "fss-transport.hpp"
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <string>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace  flight_safety_system {
 namespace server {
@@ -47,24 +56,341 @@ public:
     auto getAltitude() -> uint16_t;
 };
 
+class db_pool_stats {
+public:
+    uint64_t connections{0};
+    uint64_t statements{0};
+    /* How long statements waited to be sent down the pipeline (libpq only) */
+    uint64_t wait_total_us{0};
+    uint64_t wait_max_us{0};
+    /* Share of the time since the pool was created that connections had a statement outstanding, 0 to 1 */
+    double utilisation{0};
+};
+
+using db_record_kind = enum db_record_kind_e {
+    db_record_rtt = 1,
+    db_record_status,
+    db_record_search_status,
+    db_record_position,
+};
+
+/* A record for one of the asset_add_* calls, so it can be kept until the database can take it.
+   Only the fields for its kind are used */
+class db_record {
+public:
+    db_record_kind kind{db_record_position};
+    std::string asset_name{};
+    /* ms since the epoch */
+    uint64_t timestamp{0};
+    uint64_t rtt{0};
+    uint8_t bat_percent{0};
+    uint32_t bat_mah_used{0};
+    double bat_voltage{0};
+    uint64_t search_id{0};
+    uint64_t search_completed{0};
+    uint64_t search_total{0};
+    double latitude{0};
+    double longitude{0};
+    uint16_t altitude{0};
+};
+
+/* Where the server keeps assets, their commands and settings, and the telemetry they report.
+   Each asset's records have to be written in the order they are given */
 class db_connection {
-private:
-    std::mutex db_lock;
 public:
-    db_connection(const std::string &host, const std::string &user, const std::string &pass, const std::string &db);
+    db_connection() = default;
     db_connection(db_connection&) = delete;
     db_connection(db_connection&&) = delete;
     auto operator=(db_connection&) -> db_connection& = delete;
     auto operator=(db_connection&&) -> db_connection& = delete;
-    ~db_connection();
-    auto check_asset(const std::string &asset_name) -> bool;
-    void asset_add_rtt(const std::string &asset_name, uint64_t rtt);
-    void asset_add_status(const std::string &asset_name, uint8_t bat_percent, uint32_t bat_mah_used, double bat_voltage);
-    void asset_add_search_status(const std::string &asset_name, uint64_t search_id, uint64_t search_completed, uint64_t search_total);
-    void asset_add_position(const std::string &asset_name, double latitude, double longitude, uint16_t altitude);
-    auto asset_get_command(const std::string &asset_name) -> std::shared_ptr<asset_command>;
-    auto asset_get_smm_settings(const std::string &asset_name) -> std::shared_ptr<smm_settings>;
-    auto get_active_fss_servers() -> std::list<std::shared_ptr<fss_server_details>>;
+    virtual ~db_connection();
+    virtual auto check_asset(const std::string &asset_name) -> bool = 0;
+    /* timestamp is in ms since the epoch, records can be written some time after they were reported.
+       Each returns false if the database couldn't take the record, so it can be kept for later */
+    virtual auto asset_add_rtt(const std::string &asset_name, uint64_t rtt, uint64_t timestamp) -> bool = 0;
+    virtual auto asset_add_status(const std::string &asset_name, uint8_t bat_percent, uint32_t bat_mah_used, double bat_voltage, uint64_t timestamp) -> bool = 0;
+    virtual auto asset_add_search_status(const std::string &asset_name, uint64_t search_id, uint64_t search_completed, uint64_t search_total, uint64_t timestamp) -> bool = 0;
+    virtual auto asset_add_position(const std::string &asset_name, double latitude, double longitude, uint16_t altitude, uint64_t timestamp) -> bool = 0;
+    auto write(const db_record &record) -> bool;
+    virtual auto asset_get_command(const std::string &asset_name) -> std::shared_ptr<asset_command> = 0;
+    virtual auto asset_get_smm_settings(const std::string &asset_name) -> std::shared_ptr<smm_settings> = 0;
+    virtual auto get_active_fss_servers() -> std::list<std::shared_ptr<fss_server_details>> = 0;
+    virtual auto getPoolStats() -> db_pool_stats = 0;
+    /* Connected, and keeping up with the writes */
+    virtual auto isHealthy() -> bool = 0;
+    /* Reconnects if the connection was lost, then as isHealthy() */
+    virtual auto recover() -> bool = 0;
+    /* Called with writes that were taken but then lost with the connection */
+    virtual void setLostWriteHandler(std::function<void(const db_record &)> handler) = 0;
+};
+
+/* PostgreSQL, through ECPG or libpq depending on how the server was built. With libpq writes for an asset
+   always go to the same connection, so they stay in order, lookups go to whichever connection is least loaded */
+class db_connection_postgres : public db_connection {
+private:
+    /* Whatever the database backend (ECPG or libpq) needs, defined alongside it */
+    class db_state;
+    std::shared_ptr<db_state> state;
+public:
+    db_connection_postgres(const std::string &host, const std::string &user, const std::string &pass, const std::string &db, size_t connections = 1);
+    db_connection_postgres(db_connection_postgres&) = delete;
+    db_connection_postgres(db_connection_postgres&&) = delete;
+    auto operator=(db_connection_postgres&) -> db_connection_postgres& = delete;
+    auto operator=(db_connection_postgres&&) -> db_connection_postgres& = delete;
+    ~db_connection_postgres() override;
+    auto check_asset(const std::string &asset_name) -> bool override;
+    auto asset_add_rtt(const std::string &asset_name, uint64_t rtt, uint64_t timestamp) -> bool override;
+    auto asset_add_status(const std::string &asset_name, uint8_t bat_percent, uint32_t bat_mah_used, double bat_voltage, uint64_t timestamp) -> bool override;
+    auto asset_add_search_status(const std::string &asset_name, uint64_t search_id, uint64_t search_completed, uint64_t search_total, uint64_t timestamp) -> bool override;
+    auto asset_add_position(const std::string &asset_name, double latitude, double longitude, uint16_t altitude, uint64_t timestamp) -> bool override;
+    auto asset_get_command(const std::string &asset_name) -> std::shared_ptr<asset_command> override;
+    auto asset_get_smm_settings(const std::string &asset_name) -> std::shared_ptr<smm_settings> override;
+    auto get_active_fss_servers() -> std::list<std::shared_ptr<fss_server_details>> override;
+    auto getPoolStats() -> db_pool_stats override;
+    auto isHealthy() -> bool override;
+    auto recover() -> bool override;
+    void setLostWriteHandler(std::function<void(const db_record &)> handler) override;
+};
+
+/* Keeps everything in memory, so the server can be run (and benchmarked) without a database.
+   Assets are looked up by name, and the newest max_records of each kind of record are kept for each */
+class db_connection_memory : public db_connection {
+private:
+    class memory_asset {
+    public:
+        std::mutex lock{};
+        std::shared_ptr<asset_command> command{nullptr};
+        std::shared_ptr<smm_settings> smm{nullptr};
+        /* Indexed by db_record_kind - 1 */
+        std::array<std::deque<db_record>, db_record_position> records{};
+    };
+    std::mutex lock{};
+    std::unordered_map<std::string, std::shared_ptr<memory_asset>> assets{};
+    std::list<std::shared_ptr<fss_server_details>> servers{};
+    bool any_asset;
+    size_t max_records;
+    uint64_t next_command{1};
+    std::atomic<uint64_t> writes{0};
+    /* Assets that haven't been added are created on first use when any_asset is set */
+    auto findAsset(const std::string &asset_name, bool create) -> std::shared_ptr<memory_asset>;
+    auto add(const db_record &record) -> bool;
+public:
+    static constexpr size_t default_max_records = 1000;
+    explicit db_connection_memory(bool t_any_asset = true, size_t t_max_records = default_max_records);
+    db_connection_memory(db_connection_memory&) = delete;
+    db_connection_memory(db_connection_memory&&) = delete;
+    auto operator=(db_connection_memory&) -> db_connection_memory& = delete;
+    auto operator=(db_connection_memory&&) -> db_connection_memory& = delete;
+    ~db_connection_memory() override;
+    void addAsset(const std::string &asset_name);
+    /* Becomes the asset's current command, cmd as in the database ("RTL", "GOTO", ...) */
+    void setCommand(const std::string &asset_name, const std::string &cmd, double latitude = 0, double longitude = 0, uint16_t altitude = 0);
+    void setSmmSettings(const std::string &asset_name, const std::string &address, const std::string &username, const std::string &password);
+    void addServer(const std::string &address, uint16_t port);
+    /* Oldest first */
+    auto getRecords(const std::string &asset_name, db_record_kind kind) -> std::vector<db_record>;
+    auto check_asset(const std::string &asset_name) -> bool override;
+    auto asset_add_rtt(const std::string &asset_name, uint64_t rtt, uint64_t timestamp) -> bool override;
+    auto asset_add_status(const std::string &asset_name, uint8_t bat_percent, uint32_t bat_mah_used, double bat_voltage, uint64_t timestamp) -> bool override;
+    auto asset_add_search_status(const std::string &asset_name, uint64_t search_id, uint64_t search_completed, uint64_t search_total, uint64_t timestamp) -> bool override;
+    auto asset_add_position(const std::string &asset_name, double latitude, double longitude, uint16_t altitude, uint64_t timestamp) -> bool override;
+    auto asset_get_command(const std::string &asset_name) -> std::shared_ptr<asset_command> override;
+    auto asset_get_smm_settings(const std::string &asset_name) -> std::shared_ptr<smm_settings> override;
+    auto get_active_fss_servers() -> std::list<std::shared_ptr<fss_server_details>> override;
+    auto getPoolStats() -> db_pool_stats override;
+    auto isHealthy() -> bool override;
+    auto recover() -> bool override;
+    void setLostWriteHandler(std::function<void(const db_record &)> handler) override;
+};
+
+class db_spool_stats {
+public:
+    uint64_t spooled{0};
+    uint64_t replayed{0};
+    uint64_t backlog{0};
+    uint64_t segments{0};
+    /* Lost to the disk budget, or failing their checksum */
+    uint64_t dropped{0};
+    uint64_t corrupt{0};
+};
+
+/* A write-ahead log for records the database can't take yet, replayed in order once it can. Segment files are memory mapped,
+   so records survive the server crashing, and a new one is started each time one fills, with the oldest dropped beyond max_segments.
+   A segment is the magic, the offset replayed up to (uint64), then records of: length (uint32), crc32 (uint32), the record, padded to 8 bytes */
+class db_spool {
+private:
+    class segment {
+    public:
+        std::string path{};
+        int fd{-1};
+        char *map{nullptr};
+        size_t size{0};
+        size_t used{0};
+        /* Records not yet replayed */
+        uint64_t records{0};
+        /* Only segments started by this process are appended to, earlier ones may end in a torn record */
+        bool writable{false};
+    };
+    std::mutex lock{};
+    std::condition_variable wake{};
+    std::string directory;
+    size_t segment_size;
+    size_t max_segments;
+    std::deque<std::shared_ptr<segment>> segments{};
+    uint64_t next_sequence{0};
+    std::atomic<uint64_t> backlog{0};
+    uint64_t spooled{0};
+    uint64_t replayed{0};
+    uint64_t dropped{0};
+    uint64_t corrupt{0};
+    std::atomic<bool> stopping{false};
+    std::thread replay_thread{};
+    auto openSegment(const std::string &path, bool create) -> std::shared_ptr<segment>;
+    void closeSegment(const std::shared_ptr<segment> &seg, bool remove);
+    /* The offset of the record after, or 0 if there isn't a whole one at offset */
+    auto readRecord(const std::shared_ptr<segment> &seg, size_t offset, db_record &record) -> size_t;
+    auto getReplayed(const std::shared_ptr<segment> &seg) -> size_t;
+    void setReplayed(const std::shared_ptr<segment> &seg, size_t offset);
+public:
+    static constexpr size_t default_segment_size = 4 * 1024 * 1024;
+    static constexpr size_t default_max_segments = 256;
+    static constexpr size_t replay_batch = 256;
+    static constexpr const char *magic = "FSSWAL01";
+    static constexpr size_t magic_size = 8;
+    static constexpr size_t header_size = 16;
+    static constexpr size_t record_header_size = 8;
+    /* Picks up any segments left in directory, to be replayed first */
+    explicit db_spool(std::string t_directory, size_t t_segment_size = default_segment_size, size_t t_max_segments = default_max_segments);
+    db_spool(db_spool&) = delete;
+    db_spool(db_spool&&) = delete;
+    auto operator=(db_spool&) -> db_spool& = delete;
+    auto operator=(db_spool&&) -> db_spool& = delete;
+    ~db_spool();
+    auto append(const db_record &record) -> bool;
+    /* Records are waiting, so new ones should be appended behind them */
+    auto pending() -> bool;
+    /* Hands up to max of the oldest records to write, in order, and forgets each it returns true for, stopping at the first false */
+    auto replay(size_t max, const std::function<bool(const db_record &)> &write) -> size_t;
+    /* Replays from a thread of its own whenever healthy() says the database is ready */
+    void startReplay(std::function<bool()> healthy, std::function<bool(const db_record &)> write);
+    auto getStats() -> db_spool_stats;
+};
+
+/* When a record is worth writing to the database. Each kind of record is written at most every
+   min_interval ms, then only when it has changed by a threshold or max_interval ms (0 for never)
+   have passed since the last one. The first record from an asset, and transitions, are always written.
+   The defaults write everything */
+class db_write_rules {
+public:
+    class interval {
+    public:
+        uint64_t min_interval{0};
+        uint64_t max_interval{0};
+    };
+    interval position{};
+    interval status{};
+    interval search_status{};
+    interval rtt{};
+    /* Metres across the ground, and in the units of the reported altitude */
+    double position_distance{0};
+    uint16_t position_altitude{0};
+    uint8_t status_percent{0};
+    double status_voltage{0};
+    /* Crossing this battery percent, in either direction, is a transition */
+    uint8_t status_low_percent{0};
+    uint64_t search_completed{0};
+    uint64_t rtt_change{0};
+    /* Records seen, and written, over all the assets */
+    std::atomic<uint64_t> considered{0};
+    std::atomic<uint64_t> written{0};
+};
+
+/* The records last written for one asset, checked against the rules. Only used from the asset's receive thread */
+class db_write_filter {
+private:
+    std::shared_ptr<db_write_rules> rules;
+    class last_written {
+    public:
+        bool valid{false};
+        uint64_t when{0};
+    };
+    last_written position{};
+    double latitude{0};
+    double longitude{0};
+    uint16_t altitude{0};
+    last_written status{};
+    uint8_t bat_percent{0};
+    double bat_voltage{0};
+    last_written search_status{};
+    uint64_t search_id{0};
+    uint64_t search_completed{0};
+    uint64_t search_total{0};
+    last_written rtt{};
+    uint64_t rtt_value{0};
+    auto decide(last_written &last, const db_write_rules::interval &interval, uint64_t now, bool transition, bool changed) -> bool;
+public:
+    explicit db_write_filter(std::shared_ptr<db_write_rules> t_rules) : rules(std::move(t_rules)) {};
+    /* Each returns true if the record should be written, now is a monotonic time in ms */
+    auto allowPosition(uint64_t now, double t_latitude, double t_longitude, uint16_t t_altitude) -> bool;
+    auto allowStatus(uint64_t now, uint8_t t_bat_percent, double t_bat_voltage) -> bool;
+    auto allowSearchStatus(uint64_t now, uint64_t t_search_id, uint64_t t_search_completed, uint64_t t_search_total) -> bool;
+    auto allowRtt(uint64_t now, uint64_t t_rtt) -> bool;
+};
+
+class track_point {
+public:
+    /* Monotonic ms, for deciding how long a point has been held, and ms since the epoch, for storing */
+    uint64_t when{0};
+    uint64_t timestamp{0};
+    double latitude{0};
+    double longitude{0};
+    uint16_t altitude{0};
+};
+
+/* How closely the stored track has to follow the reported one. A tolerance of 0 stores every point */
+class track_rules {
+private:
+    std::mutex lock{};
+    uint64_t points_in{0};
+    uint64_t points_out{0};
+    double error_total{0};
+    double error_max{0};
+    uint64_t error_count{0};
+public:
+    /* Metres across the ground, and in the units of the reported altitude */
+    double tolerance{0};
+    double altitude_tolerance{0};
+    /* A change of heading (degrees) that always keeps the point it happened at */
+    double turn_angle{0};
+    /* Never hold a point back for longer than this (ms), or keep more than max_points waiting */
+    uint64_t max_interval{0};
+    size_t max_points{100};
+    void record(uint64_t t_points_in, uint64_t t_points_out, const std::vector<double> &errors);
+    /* Points reported for every one stored */
+    auto getCompression() -> double;
+    /* Distance in metres of the points left out from the stored track */
+    auto getErrorAverage() -> double;
+    auto getErrorMax() -> double;
+};
+
+/* Streaming line simplification for one asset: a point is only stored when the track can't be
+   rebuilt from the points either side of it to within the tolerance. Only used from the asset's receive thread */
+class track_simplifier {
+private:
+    std::shared_ptr<track_rules> rules;
+    bool anchored{false};
+    track_point anchor{};
+    std::vector<track_point> held{};
+    std::vector<double> errors{};
+    auto offTrack(const track_point &from, const track_point &to, const track_point &point, double &distance) -> bool;
+    auto turned(const track_point &point) -> bool;
+    void keep(size_t index, const std::function<void(const track_point &)> &store);
+public:
+    explicit track_simplifier(std::shared_ptr<track_rules> t_rules) : rules(std::move(t_rules)) {};
+    /* Calls store with each point that has to be kept, in order, which may be some time after it was added */
+    void addPoint(const track_point &point, const std::function<void(const track_point &)> &store);
+    /* Stores the last point held, when the track ends */
+    void flush(const std::function<void(const track_point &)> &store);
 };
 
 class fss_client_rtt {
@@ -86,6 +412,8 @@ private:
     auto getName() -> std::string;
     uint64_t last_command_send_ts{0};
     uint64_t last_command_dbid{0};
+    db_write_filter db_filter;
+    track_simplifier track;
 public:
     explicit fss_client(std::shared_ptr<transport::fss_connection> conn);
     fss_client(fss_client&) = delete;
@@ -94,6 +422,14 @@ public:
     auto operator=(fss_client&&) -> fss_client& = delete;
     ~fss_client() override;
     void processMessage(std::shared_ptr<transport::fss_message> message) override;
+    /* Called by fss_message_dispatch with each message as its concrete type */
+    void handleMessage(transport::fss_message &msg, const std::shared_ptr<transport::fss_message> &owner);
+    void handleMessage(transport::fss_message_datagram_request &msg, const std::shared_ptr<transport::fss_message> &owner);
+    void handleMessage(transport::fss_message_rtt_request &msg, const std::shared_ptr<transport::fss_message> &owner);
+    void handleMessage(transport::fss_message_rtt_response &msg, const std::shared_ptr<transport::fss_message> &owner);
+    void handleMessage(transport::fss_message_position_report &msg, const std::shared_ptr<transport::fss_message> &owner);
+    void handleMessage(transport::fss_message_system_status &msg, const std::shared_ptr<transport::fss_message> &owner);
+    void handleMessage(transport::fss_message_search_status &msg, const std::shared_ptr<transport::fss_message> &owner);
     void sendRTTRequest(const std::shared_ptr<transport::fss_message_rtt_request> &rtt_req);
     void sendSMMSettings();
     void sendCommand();
@@ -1,79 +1,316 @@
 #include <fss-transport.hpp>
 
+#include <atomic>
+#include <deque>
 #include <list>
+#include <map>
+#include <mutex>
+#include <thread>
 
 #include <gnutls/gnutls.h>
+#include <gnutls/dtls.h>
 #include <gnutls/gnutlsxx.h>
 
 namespace flight_safety_system {
 namespace transport_ssl {
-class fss_connection : public flight_safety_system::transport::fss_connection {
+/* The CN of each certificate the peer presented */
+auto peer_certificate_names(gnutls_session_t session) -> std::list<std::string>;
+
+/* Parsed CA and key files, shared by every connection that uses them.
+   Reloading swaps in a new set of credentials, existing sessions keep the set they started with. */
+class fss_credentials {
 private:
-    gnutls::certificate_credentials credentials{};
+    std::mutex lock{};
     std::string ca_file;
     std::string private_key_file;
     std::string public_key_file;
+    std::shared_ptr<gnutls::certificate_credentials> current{};
+    std::string files_state{};
+    uint64_t last_checked{0};
+    auto filesState() -> std::string;
+public:
+    static constexpr uint64_t check_interval = 1000;
+    fss_credentials(std::string t_ca, std::string t_private_key, std::string t_public_key);
+    fss_credentials(fss_credentials&) = delete;
+    fss_credentials(fss_credentials&&) = delete;
+    auto operator=(fss_credentials&) -> fss_credentials& = delete;
+    auto operator=(fss_credentials&&) -> fss_credentials& = delete;
+    ~fss_credentials();
+    auto reload() -> bool;
+    auto get() -> std::shared_ptr<gnutls::certificate_credentials>;
+};
+
+/* Server side session ticket keys and 0-RTT anti-replay state, shared by all the connections of a listener */
+class fss_session_tickets {
+private:
+    std::mutex lock{};
+    gnutls_datum_t key{nullptr, 0};
+    uint64_t key_generated{0};
+    uint64_t lifetime;
+    uint64_t key_rotation;
+    bool early_data;
+    gnutls_anti_replay_t anti_replay{nullptr};
+    std::map<std::string, time_t> seen_early_data{};
+    static auto antiReplayAdd(void *ptr, time_t exp_time, const gnutls_datum_t *key, const gnutls_datum_t *data) -> int;
+    void rotateKey(uint64_t ts);
+public:
+    static constexpr uint64_t default_lifetime = 6 * 60 * 60;
+    /* GnuTLS takes a single master key, so replacing it invalidates every ticket issued so far
+       and those clients all do a full handshake next time. 0 keeps the master key, leaving
+       GnuTLS to rotate the keys it derives from it every lifetime (the previous one stays valid) */
+    static constexpr uint64_t default_key_rotation = 24 * 60 * 60;
+    static constexpr size_t max_early_data_size = 1024;
+    fss_session_tickets(uint64_t t_lifetime, uint64_t t_key_rotation, bool t_early_data);
+    fss_session_tickets(fss_session_tickets&) = delete;
+    fss_session_tickets(fss_session_tickets&&) = delete;
+    auto operator=(fss_session_tickets&) -> fss_session_tickets& = delete;
+    auto operator=(fss_session_tickets&&) -> fss_session_tickets& = delete;
+    ~fss_session_tickets();
+    auto earlyData() -> bool;
+    void enable(gnutls_session_t session);
+};
+
+class fss_connection : public flight_safety_system::transport::fss_connection {
+private:
+    std::shared_ptr<fss_credentials> store;
+    std::shared_ptr<gnutls::certificate_credentials> credentials{};
+    /* Set once the kernel encrypts or decrypts the records in that direction, and GnuTLS no longer does */
+    std::atomic<bool> kernel_send{false};
+    std::atomic<bool> kernel_recv{false};
+    auto kernelSend(const char *data, size_t length) -> bool;
+    auto kernelRecv(void *bytes, size_t max_bytes) -> ssize_t;
 protected:
     bool usable{false};
+    bool kernel_tls{false};
     auto sendSessionMsg(gnutls::session &session, const std::shared_ptr<flight_safety_system::transport::buf_len> &bl) -> bool;
     auto recvSessionBytes(gnutls::session &session, void *bytes, size_t max_bytes) -> ssize_t;
     void setupSession(gnutls::session &session);
+    /* Gives up once timeout (ms, 0 for the default) has passed or the peer stops making progress */
+    auto handshakeSession(gnutls::session &session, unsigned int timeout) -> int;
+    /* Hands the session's keys for each direction asked for to the kernel (kTLS), leaving GnuTLS
+       with any it can't take. Only call between records, with nothing else using the session */
+    void offloadSession(gnutls::session &session, bool send, bool recv);
+    void closeSession(gnutls::session &session);
 public:
     fss_connection(std::string t_ca, std::string t_private_key, std::string t_public_key);
     fss_connection(int t_fd, std::string t_ca, std::string t_private_key, std::string t_public_key);
+    explicit fss_connection(std::shared_ptr<fss_credentials> t_store);
+    static constexpr unsigned int default_handshake_timeout = 40000;
+    /* GNUTLS_E_AGAIN results in a row, without any data, before a peer is given up on */
+    static constexpr unsigned int max_retries = 64;
     fss_connection(fss_connection&) = delete;
     fss_connection(fss_connection&&) = delete;
     auto operator=(fss_connection&) -> fss_connection& = delete;
     auto operator=(fss_connection&&) -> fss_connection& = delete;
     ~fss_connection() override;
+    /* Try kernel TLS once connected, quietly staying with GnuTLS where it isn't available */
+    void setKernelTLS(bool t_kernel_tls);
+    auto kernelSending() -> bool;
+    auto kernelReceiving() -> bool;
 };
 
 class fss_connection_client : public fss_connection {
 private:
     gnutls::client_session session;
     std::string hostname{};
+    std::string resume_data{};
+    std::shared_ptr<flight_safety_system::transport::buf_len> early_data{};
+    std::atomic<bool> ticket_received{false};
+    bool checked_reply{false};
+    uint64_t retry_after{0};
+    /* TLS 1.3 session tickets arrive after the handshake, and only GnuTLS can take them in */
+    bool offload_recv_pending{false};
+    static auto ticketHook(gnutls_session_t session, unsigned int htype, unsigned when, unsigned int incoming, const gnutls_datum_t *msg) -> int;
+    static auto pullHook(gnutls_transport_ptr_t ptr, void *data, size_t len) -> ssize_t;
+    static auto pullTimeoutHook(gnutls_transport_ptr_t ptr, unsigned int ms) -> int;
+    auto pullBytes(void *data, size_t len) -> ssize_t;
 protected:
     auto setupSSL() -> bool;
     auto sendMsg(const std::shared_ptr<flight_safety_system::transport::buf_len> &bl) -> bool override;
     auto recvBytes(void *bytes, size_t max_bytes) -> ssize_t override;
 public:
-    fss_connection_client(std::string t_ca, std::string t_private_key, std::string t_public_key);
+    fss_connection_client(std::string t_ca, std::string t_private_key, std::string t_public_key, bool t_early_data = false);
+    explicit fss_connection_client(std::shared_ptr<fss_credentials> t_store, bool t_early_data = false);
     fss_connection_client(fss_connection_client &) = delete;
     fss_connection_client(fss_connection_client &&) = delete;
     auto operator=(fss_connection_client &) -> fss_connection& = delete;
     auto operator=(fss_connection_client &&) -> fss_connection& = delete;
     ~fss_connection_client() override;
     auto connectTo(const std::string &address, uint16_t port) -> bool override;
+    void setResumeData(const std::string &data);
+    auto getResumeData() -> std::string;
+    void setEarlyMsg(const std::shared_ptr<flight_safety_system::transport::fss_message> &msg);
+    auto isResumed() -> bool;
+    auto earlyDataAccepted() -> bool;
+    /* How long the server asked us to wait before trying again (in milliseconds), 0 if it didn't */
+    auto getRetryAfter() -> uint64_t;
 };
 
 
 class fss_connection_server : public fss_connection {
 private:
     std::list<std::string> possible_names{};
-    gnutls::server_session session{};
+    gnutls::server_session session;
+    std::shared_ptr<fss_session_tickets> tickets{};
+    unsigned int handshake_timeout{0};
+    std::string early_data{};
+    size_t early_data_offset{0};
+    void readEarlyData();
 protected:
     auto setupSSL() -> bool;
     auto sendMsg(const std::shared_ptr<flight_safety_system::transport::buf_len> &bl) -> bool override;
     auto recvBytes(void *bytes, size_t max_bytes) -> ssize_t override;
 public:
     fss_connection_server(int t_fd, std::string t_ca, std::string t_private_key, std::string t_public_key);
+    fss_connection_server(int t_fd, std::shared_ptr<fss_credentials> t_store, std::shared_ptr<fss_session_tickets> t_tickets, unsigned int t_handshake_timeout = 0, bool t_kernel_tls = false);
     fss_connection_server(fss_connection_server&) = delete;
     fss_connection_server(fss_connection_server&&) = delete;
     auto operator=(fss_connection_server&) -> fss_connection_server& = delete;
     auto operator=(fss_connection_server&&) -> fss_connection_server& = delete;
     ~fss_connection_server() override;
     auto getClientNames() -> std::list<std::string> override;
+    auto handshakeComplete() -> bool override;
 };
 
 class fss_listen : public flight_safety_system::transport::fss_listen {
 private:
-    std::string ca_file;
-    std::string private_key_file;
-    std::string public_key_file;
+    std::shared_ptr<fss_credentials> store;
+    std::shared_ptr<fss_session_tickets> tickets{};
+    std::atomic<bool> kernel_tls{false};
 protected:
     auto newConnection(int fd) -> std::shared_ptr<flight_safety_system::transport::fss_connection> override;
 public:
     fss_listen(uint16_t t_port, flight_safety_system::transport::fss_connect_cb t_cb, std::string t_ca, std::string t_private_key, std::string t_public_key);
+    fss_listen(uint16_t t_port, flight_safety_system::transport::fss_connect_cb t_cb, std::string t_ca, std::string t_private_key, std::string t_public_key, std::shared_ptr<fss_session_tickets> t_tickets);
+    fss_listen(uint16_t t_port, flight_safety_system::transport::fss_connect_cb t_cb, std::shared_ptr<fss_credentials> t_store, std::shared_ptr<fss_session_tickets> t_tickets);
+    fss_listen(fss_listen &) = delete;
+    fss_listen(fss_listen &&) = delete;
+    auto operator=(fss_listen &) -> fss_listen& = delete;
+    auto operator=(fss_listen &&) -> fss_listen& = delete;
+    ~fss_listen() override;
+    auto getCredentials() -> std::shared_ptr<fss_credentials>;
+    /* For the connections accepted from here on */
+    void setKernelTLS(bool t_kernel_tls);
+};
+/* Client end of a DTLS channel to the server's fss_datagram_listen, set up in the
+   background after the server offers it. Until it is confirmed (or if UDP is blocked)
+   the connection keeps sending everything over TLS */
+class fss_datagram_client : public flight_safety_system::transport::fss_datagram_channel {
+private:
+    std::shared_ptr<fss_credentials> store;
+    std::shared_ptr<gnutls::certificate_credentials> credentials{};
+    std::weak_ptr<flight_safety_system::transport::fss_connection> conn;
+    gnutls::client_session session;
+    /* Serialises use of the session between the receive thread and senders */
+    std::mutex session_lock{};
+    std::thread recv_thread{};
+    int fd{-1};
+    std::atomic<bool> run{false};
+    std::atomic<bool> ready{false};
+    auto setup(const std::string &hostname, uint16_t port) -> bool;
+    auto bind(uint64_t token) -> bool;
+    void processDatagrams(std::string hostname, uint16_t port, uint64_t token);
+public:
+    /* All in milliseconds */
+    static constexpr unsigned int handshake_timeout = 3000;
+    static constexpr unsigned int retransmit_timeout = 500;
+    static constexpr unsigned int bind_attempts = 5;
+    static constexpr unsigned int bind_interval = 300;
+    static constexpr unsigned int recv_timeout = 500;
+    /* How long a read waits for the rest of a record once the socket is readable */
+    static constexpr unsigned int record_timeout = 10;
+    static constexpr unsigned int keepalive_interval = 15000;
+    static constexpr size_t max_datagram = 2048;
+    fss_datagram_client(std::shared_ptr<fss_credentials> t_store, std::weak_ptr<flight_safety_system::transport::fss_connection> t_conn);
+    fss_datagram_client(fss_datagram_client&) = delete;
+    fss_datagram_client(fss_datagram_client&&) = delete;
+    auto operator=(fss_datagram_client&) -> fss_datagram_client& = delete;
+    auto operator=(fss_datagram_client&&) -> fss_datagram_client& = delete;
+    ~fss_datagram_client() override;
+    void start(const std::string &hostname, uint16_t port, uint64_t token);
+    void stop();
+    auto isReady() -> bool override;
+    auto sendDatagram(const std::shared_ptr<flight_safety_system::transport::buf_len> &bl) -> bool override;
+};
+
+/* Server end of one DTLS association, fed datagrams by fss_datagram_listen */
+class fss_datagram_session : public flight_safety_system::transport::fss_datagram_channel {
+private:
+    int fd;
+    struct sockaddr_storage peer;
+    socklen_t peer_len;
+    std::shared_ptr<gnutls::certificate_credentials> credentials;
+    gnutls::server_session session;
+    std::mutex lock{};
+    std::deque<std::string> pending{};
+    std::weak_ptr<flight_safety_system::transport::fss_connection> conn{};
+    std::list<std::string> names{};
+    std::chrono::steady_clock::time_point created;
+    std::chrono::steady_clock::time_point last_heard;
+    bool handshaken{false};
+    bool bound{false};
+    bool closed{false};
+    static auto pushHook(gnutls_transport_ptr_t ptr, const void *data, size_t len) -> ssize_t;
+    static auto pullHook(gnutls_transport_ptr_t ptr, void *data, size_t len) -> ssize_t;
+    static auto pullTimeoutHook(gnutls_transport_ptr_t ptr, unsigned int ms) -> int;
+    void continueHandshake();
+public:
+    fss_datagram_session(int t_fd, const struct sockaddr_storage &t_peer, socklen_t t_peer_len, std::shared_ptr<gnutls::certificate_credentials> t_credentials, gnutls_dtls_prestate_st *prestate);
+    fss_datagram_session(fss_datagram_session&) = delete;
+    fss_datagram_session(fss_datagram_session&&) = delete;
+    auto operator=(fss_datagram_session&) -> fss_datagram_session& = delete;
+    auto operator=(fss_datagram_session&&) -> fss_datagram_session& = delete;
+    ~fss_datagram_session() override;
+    /* Returns the application data in the datagram, if any */
+    auto receive(std::string datagram) -> std::vector<std::string>;
+    /* Resends handshake messages that may have been lost */
+    void retransmit();
+    void bind(const std::shared_ptr<flight_safety_system::transport::fss_connection> &t_conn);
+    auto getConnection() -> std::shared_ptr<flight_safety_system::transport::fss_connection>;
+    auto getNames() -> std::list<std::string>;
+    auto isBound() -> bool;
+    /* Whether the session should be dropped: closed, unbound for too long or gone quiet */
+    auto expired(std::chrono::steady_clock::time_point now, std::chrono::milliseconds bind_timeout, std::chrono::milliseconds idle_timeout) -> bool;
+    void close();
+    auto isReady() -> bool override;
+    auto sendDatagram(const std::shared_ptr<flight_safety_system::transport::buf_len> &bl) -> bool override;
+};
+
+/* A UDP port for the DTLS channels of clients connected over TLS. Clients are offered
+   a token over their TLS connection, which they send over DTLS to tie the two together */
+class fss_datagram_listen {
+private:
+    std::shared_ptr<fss_credentials> store;
+    int fd{-1};
+    uint16_t port{0};
+    gnutls_datum_t cookie_key{nullptr, 0};
+    std::mutex lock{};
+    std::map<std::string, std::shared_ptr<fss_datagram_session>> sessions{};
+    std::map<uint64_t, std::pair<std::weak_ptr<flight_safety_system::transport::fss_connection>, std::chrono::steady_clock::time_point>> offers{};
+    std::mt19937_64 random{std::random_device{}()};
+    std::atomic<bool> run{false};
+    std::thread thread{};
+    void processDatagrams();
+    void receiveDatagram(const struct sockaddr_storage &peer, socklen_t peer_len, std::string datagram);
+    void handleRecord(const std::shared_ptr<fss_datagram_session> &session, const std::string &record);
+    void expireSessions();
+public:
+    /* All in milliseconds */
+    static constexpr uint64_t offer_lifetime = 30000;
+    static constexpr uint64_t idle_timeout = 120000;
+    static constexpr int poll_interval = 100;
+    static constexpr size_t max_datagram = 2048;
+    fss_datagram_listen(uint16_t t_port, std::shared_ptr<fss_credentials> t_store);
+    fss_datagram_listen(fss_datagram_listen&) = delete;
+    fss_datagram_listen(fss_datagram_listen&&) = delete;
+    auto operator=(fss_datagram_listen&) -> fss_datagram_listen& = delete;
+    auto operator=(fss_datagram_listen&&) -> fss_datagram_listen& = delete;
+    ~fss_datagram_listen();
+    /* The port actually bound, when asked for 0 */
+    auto getPort() -> uint16_t;
+    /* A token for conn to bind a DTLS session with */
+    auto offer(const std::shared_ptr<flight_safety_system::transport::fss_connection> &conn) -> uint64_t;
+    auto getSessionCount() -> size_t;
 };
 } // namespace transport_ssl
 } // namespace flight_safety_system
\ No newline at end of file
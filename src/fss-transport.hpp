@@ -1,6 +1,15 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <thread>
 #include <list>
@@ -13,6 +22,8 @@ namespace transport {
 class fss_connection;
 class fss_listen;
 class fss_message;
+class fss_message_position_report;
+class fss_message_position_compact;
 
 using  fss_connect_cb = bool (*)(std::shared_ptr<fss_connection> conn);
 
@@ -42,6 +53,19 @@ using fss_message_type = enum fss_message_type_e {
 
     /* Please send identity */
     message_type_identity_required,
+
+    /* Server is too busy, try again later */
+    message_type_busy,
+
+    /* Position report as a change from the previous one */
+    message_type_position_compact,
+
+    /* Several messages in one frame */
+    message_type_batch,
+
+    /* Setting up a channel for messages that don't need to be retransmitted */
+    message_type_datagram_request,
+    message_type_datagram_offer,
 };
 
 using fss_asset_command = enum fss_asset_command_e {
@@ -77,12 +101,15 @@ public:
     auto operator=(const buf_len &other) -> buf_len &;
     auto isValid() -> bool;
     auto addData(const char *new_data, uint16_t len) -> bool;
+    /* Replaces the contents, reusing the space already held */
+    void setData(const char *new_data, uint16_t len);
     auto getData() -> const char *;
     auto getLength() -> size_t;
 };
 
 class fss_message_cb {
 private:
+    /* Replaced by reconnects while other threads send, so only accessed with std::atomic_load/atomic_store */
     std::shared_ptr<fss_connection> conn;
 protected:
     void setConnection(std::shared_ptr<fss_connection> t_conn);
@@ -102,22 +129,285 @@ public:
     virtual auto sendMsg(const std::shared_ptr<fss_message> &msg) -> bool;
 };
 
+class fss_resolver_stats {
+public:
+    uint64_t lookups{0};
+    uint64_t cache_hits{0};
+    uint64_t stale_hits{0};
+    uint64_t negative_hits{0};
+    uint64_t misses{0};
+    uint64_t failures{0};
+};
+
+/* Resolves host names on worker threads and caches the results,
+   so connecting only waits on DNS the first time a name is used */
+class fss_resolver {
+private:
+    class entry {
+    public:
+        std::vector<struct sockaddr_storage> addresses{};
+        std::chrono::steady_clock::time_point refresh{};
+        std::chrono::steady_clock::time_point expires{};
+        bool resolved{false};
+        bool queued{false};
+    };
+    std::mutex lock{};
+    std::condition_variable work{};
+    std::condition_variable done{};
+    std::map<std::string, entry> cache{};
+    std::deque<std::string> queue{};
+    std::vector<std::thread> workers{};
+    fss_resolver_stats stats{};
+    std::chrono::seconds ttl;
+    std::chrono::seconds negative_ttl;
+    bool run{true};
+    void processLookups();
+    void queueLookup(const std::string &name, entry &e);
+public:
+    static constexpr size_t default_workers = 2;
+    static constexpr uint64_t default_ttl = 300;
+    static constexpr uint64_t default_negative_ttl = 10;
+    static constexpr uint64_t default_wait = 5000;
+    static auto getResolver() -> std::shared_ptr<fss_resolver>;
+    fss_resolver(size_t t_workers, uint64_t t_ttl, uint64_t t_negative_ttl);
+    fss_resolver(fss_resolver &) = delete;
+    fss_resolver(fss_resolver &&) = delete;
+    auto operator=(fss_resolver &) -> fss_resolver& = delete;
+    auto operator=(fss_resolver &&) -> fss_resolver& = delete;
+    ~fss_resolver();
+    /* Returns every address for the name, waiting at most wait ms when nothing is cached yet */
+    auto resolve(const std::string &name, uint16_t port, uint64_t wait = default_wait) -> std::vector<struct sockaddr_storage>;
+    void prefetch(const std::string &name);
+    void flush();
+    auto getStats() -> fss_resolver_stats;
+};
+
+/* The last position sent (or received) for one stream, lat/lng in fixed point */
+class fss_position_state {
+public:
+    uint64_t seq{0};
+    uint64_t timestamp{0};
+    int32_t latitude{0};
+    int32_t longitude{0};
+    uint32_t altitude{0};
+    uint16_t heading{0};
+    uint16_t horizontal_velocity{0};
+    int16_t vertical_velocity{0};
+    uint16_t squawk{0};
+    std::string callsign{};
+    uint8_t tslc{0};
+    uint16_t flags{0};
+    uint8_t altitude_type{0};
+    uint8_t emitter_type{0};
+};
+
+/* Turns position reports into compact messages, one stream per ICAO address.
+   Every keyframe_interval reports (and the first on each stream) is sent in full */
+class fss_position_encoder {
+private:
+    std::map<uint32_t, fss_position_state> streams{};
+    uint64_t keyframe_interval;
+public:
+    static constexpr uint64_t default_keyframe_interval = 32;
+    explicit fss_position_encoder(uint64_t t_keyframe_interval = default_keyframe_interval);
+    auto encode(const std::shared_ptr<fss_message_position_report> &msg) -> std::shared_ptr<fss_message_position_compact>;
+    /* Start every stream again with a keyframe */
+    void reset();
+};
+
+class fss_position_decoder {
+private:
+    std::map<uint32_t, fss_position_state> streams{};
+    uint64_t gaps{0};
+public:
+    /* Returns nullptr when a change can't be applied, until the next keyframe on that stream */
+    auto decode(const std::shared_ptr<fss_message_position_compact> &msg) -> std::shared_ptr<fss_message_position_report>;
+    void reset();
+    auto getGaps() -> uint64_t;
+};
+
+class fss_datagram_stats {
+public:
+    uint64_t sent{0};
+    uint64_t received{0};
+    /* Skipped sequence numbers, less any that turned up later */
+    uint64_t lost{0};
+    uint64_t reordered{0};
+    uint64_t duplicate{0};
+    /* Too far behind the newest message to be delivered */
+    uint64_t late{0};
+};
+
+/* Numbers the messages sent over a datagram channel, and works out from the
+   other end's numbers what was lost, reordered or duplicated on the way */
+class fss_datagram_sequence {
+private:
+    uint64_t next_seq{1};
+    uint64_t highest{0};
+    /* Bit n is set if highest - n has been received */
+    uint64_t window{0};
+    fss_datagram_stats stats{};
+public:
+    static constexpr uint64_t window_size = 64;
+    auto next() -> uint64_t;
+    /* Returns false if the message shouldn't be delivered */
+    auto accept(uint64_t seq) -> bool;
+    auto getStats() -> fss_datagram_stats;
+};
+
+/* Carries messages without retransmission, alongside a connection */
+class fss_datagram_channel {
+public:
+    fss_datagram_channel() = default;
+    fss_datagram_channel(fss_datagram_channel&) = delete;
+    fss_datagram_channel(fss_datagram_channel&&) = delete;
+    auto operator=(fss_datagram_channel&) -> fss_datagram_channel& = delete;
+    auto operator=(fss_datagram_channel&&) -> fss_datagram_channel& = delete;
+    virtual ~fss_datagram_channel();
+    /* False until both ends have confirmed the channel works */
+    virtual auto isReady() -> bool = 0;
+    virtual auto sendDatagram(const std::shared_ptr<buf_len> &bl) -> bool = 0;
+};
+
+using fss_capture_direction = enum fss_capture_direction_e {
+    capture_received,
+    capture_sent,
+};
+
+/* One frame as it was seen on the wire */
+class fss_capture_record {
+public:
+    /* Microseconds since the epoch */
+    uint64_t timestamp{0};
+    uint32_t connection{0};
+    fss_capture_direction direction{capture_received};
+    std::string frame{};
+};
+
+/* Tees frames into append-only capture files, each memory mapped and replaced by the next once it reaches rotate_size.
+   A file is the magic followed by records of: timestamp (uint64), connection (uint32), length (uint16), direction (uint8), a spare byte, then the frame */
+class fss_capture {
+private:
+    std::mutex lock{};
+    std::string prefix;
+    size_t rotate_size;
+    int fd{-1};
+    char *map{nullptr};
+    size_t used{0};
+    uint64_t file_index{0};
+    std::vector<std::string> files{};
+    std::atomic<uint32_t> next_connection{1};
+    auto openFile() -> bool;
+    void closeFile();
+public:
+    static constexpr size_t default_rotate_size = 64 * 1024 * 1024;
+    static constexpr size_t record_header_size = 16;
+    static constexpr const char *magic = "FSSCAP01";
+    static constexpr size_t magic_size = 8;
+    explicit fss_capture(std::string t_prefix, size_t t_rotate_size = default_rotate_size);
+    fss_capture(fss_capture &) = delete;
+    fss_capture(fss_capture &&) = delete;
+    auto operator=(fss_capture &) -> fss_capture& = delete;
+    auto operator=(fss_capture &&) -> fss_capture& = delete;
+    ~fss_capture();
+    auto nextConnectionId() -> uint32_t;
+    void record(uint32_t connection, fss_capture_direction direction, const char *data, size_t length);
+    /* Every file written to so far, oldest first */
+    auto getFiles() -> std::vector<std::string>;
+};
+
+class fss_capture_reader {
+private:
+    int fd{-1};
+    bool valid{false};
+public:
+    explicit fss_capture_reader(const std::string &path);
+    fss_capture_reader(fss_capture_reader &) = delete;
+    fss_capture_reader(fss_capture_reader &&) = delete;
+    auto operator=(fss_capture_reader &) -> fss_capture_reader& = delete;
+    auto operator=(fss_capture_reader &&) -> fss_capture_reader& = delete;
+    ~fss_capture_reader();
+    auto isValid() -> bool;
+    /* False at the end of the file (or of what was written before a crash) */
+    auto next(fss_capture_record *record) -> bool;
+};
+
+/* Options for TCP sockets, applied before connecting or, for accepted ones, before the handshake */
+class fss_socket_profile {
+public:
+    /* Send each frame straight away rather than waiting to fill a segment */
+    bool nodelay{true};
+    /* Kernel buffer sizes (bytes), 0 leaves the system default */
+    int send_buffer{0};
+    int recv_buffer{0};
+    /* Probe an idle connection after keepalive_idle seconds, every keepalive_interval seconds, giving up after keepalive_count */
+    bool keepalive{false};
+    int keepalive_idle{0};
+    int keepalive_interval{0};
+    int keepalive_count{0};
+    /* Drop the connection when sent data goes unacknowledged this long (ms), 0 leaves the system default */
+    unsigned int user_timeout{0};
+    /* Close the connection when this many RTT requests in a row go unanswered, 0 never does */
+    unsigned int max_missed_rtt{0};
+    /* Sockets that aren't TCP are left alone */
+    auto apply(int fd) const -> bool;
+};
+
 class fss_connection {
     bool run{false};
     int fd{-1};
-    uint64_t last_msg_id{0};
+    std::atomic<uint64_t> last_msg_id{0};
     fss_message_cb *handler{nullptr};
     std::queue<std::shared_ptr<fss_message>> messages{};
     std::thread recv_thread{};
     std::mutex send_lock{};
+    bool compact_positions{false};
+    fss_position_encoder position_encoder{};
+    fss_position_decoder position_decoder{};
+    std::mutex queue_lock{};
+    std::condition_variable queue_sent{};
+    std::vector<std::shared_ptr<fss_message>> send_queue{};
+    uint64_t queued_count{0};
+    uint64_t sent_count{0};
+    bool sending{false};
+    /* The result of each flush, up to the last ticket it carried, until everyone waiting on it has read it */
+    class send_generation {
+    public:
+        uint64_t last_ticket;
+        bool result;
+        size_t waiters;
+    };
+    std::deque<send_generation> send_results{};
+    bool batching{false};
+    std::mutex deliver_lock{};
+    std::mutex datagram_lock{};
+    std::shared_ptr<fss_datagram_channel> datagram_channel{};
+    fss_datagram_sequence datagram_sequence{};
+    std::shared_ptr<fss_capture> capture{};
+    std::atomic<uint32_t> capture_id{0};
+    /* Reused for each frame received, so a busy connection doesn't allocate for every one */
+    std::string recv_data{};
+    std::shared_ptr<buf_len> recv_frame{};
+    std::mutex profile_lock{};
+    fss_socket_profile socket_profile{};
+    /* RTT requests sent since the last response */
+    std::atomic<unsigned int> rtt_unanswered{0};
+    void rttRequestSent();
+    void captureFrame(fss_capture_direction direction, const char *data, size_t length);
+    void deliverMsg(std::shared_ptr<fss_message> msg);
+    auto sendDatagram(const std::shared_ptr<fss_message> &msg) -> bool;
+    auto sendQueued(const std::vector<std::shared_ptr<fss_message>> &pending) -> bool;
+    auto sendFrame(const std::shared_ptr<fss_message> &msg) -> bool;
 protected:
     auto recvMsg() -> std::shared_ptr<fss_message>;
-    auto getMessageId() -> uint64_t;
+    /* Reserves count consecutive ids, returning the first */
+    auto getMessageId(uint64_t count = 1) -> uint64_t;
     virtual auto sendMsg(const std::shared_ptr<flight_safety_system::transport::buf_len> &bl) -> bool;
     virtual auto recvBytes(void *bytes, size_t max_bytes) -> ssize_t;
     auto getFd() -> int;
     void setFd(int new_fd);
     void startRecvThread(std::thread t_recv_thread);
+    auto connectSocket(const std::string &address, uint16_t port) -> bool;
 public:
     fss_connection();
     explicit fss_connection(int fd);
@@ -133,6 +423,133 @@ public:
     virtual void processMessages();
     virtual void disconnect();
     virtual auto getClientNames() -> std::list<std::string>;
+    virtual auto handshakeComplete() -> bool;
+    /* Send position reports as compact messages, the remote end must understand them */
+    void setCompactPositions(bool t_compact_positions);
+    /* Combine messages queued by concurrent senders into batch frames, the remote end must understand them */
+    void setBatching(bool t_batching);
+    /* Send position reports over channel whenever it is ready, and over this connection otherwise */
+    void setDatagramChannel(std::shared_ptr<fss_datagram_channel> channel);
+    auto getDatagramChannel() -> std::shared_ptr<fss_datagram_channel>;
+    /* A message (led by its sequence number) that arrived over the datagram channel */
+    void receiveDatagram(const char *data, size_t length);
+    auto getDatagramStats() -> fss_datagram_stats;
+    /* Record every frame sent and received on this connection */
+    void setCapture(std::shared_ptr<fss_capture> t_capture);
+    /* Used for the sockets connected from here on, listeners pass it on to the connections they accept */
+    void setSocketProfile(const fss_socket_profile &t_profile);
+    auto getSocketProfile() -> fss_socket_profile;
+};
+
+class fss_handshake_stats {
+public:
+    uint64_t accepted{0};
+    uint64_t rejected_queue_full{0};
+    uint64_t rejected_per_source{0};
+    uint64_t rejected_busy{0};
+    uint64_t completed{0};
+    uint64_t failed{0};
+    /* All times are in milliseconds */
+    uint64_t queue_wait_total{0};
+    uint64_t queue_wait_max{0};
+    uint64_t handshake_total{0};
+    uint64_t handshake_max{0};
+};
+
+/* Admits at most rate events per second, with bursts of up to burst */
+class fss_token_bucket {
+private:
+    double rate;
+    double burst;
+    double tokens;
+    std::chrono::steady_clock::time_point last;
+    void refill();
+public:
+    fss_token_bucket(double t_rate, double t_burst);
+    auto take() -> bool;
+    /* Milliseconds until count more tokens are available */
+    auto waitTime(size_t count) -> uint64_t;
+};
+
+/* Decorrelated jitter: each delay is picked at random between base and three times the previous one */
+class fss_backoff {
+private:
+    uint64_t base;
+    uint64_t cap;
+    uint64_t current;
+    std::mt19937_64 random;
+    auto between(uint64_t low, uint64_t high) -> uint64_t;
+public:
+    fss_backoff(uint64_t t_base, uint64_t t_cap);
+    /* A delay of up to base, to spread out the first attempt after a disconnect */
+    auto spread() -> uint64_t;
+    /* The next delay, never less than the retry after hint from the server */
+    auto next(uint64_t hint = 0) -> uint64_t;
+    void reset();
+};
+
+/* Runs the handshakes for newly accepted connections so a slow client can't stall the accept loop */
+class fss_handshake_pool {
+private:
+    class pending {
+    public:
+        int fd;
+        std::string source;
+        std::chrono::steady_clock::time_point queued;
+    };
+    class rejecting {
+    public:
+        int fd;
+        uint64_t retry_after;
+        std::chrono::steady_clock::time_point until;
+    };
+    std::mutex lock{};
+    std::condition_variable work{};
+    std::condition_variable reject_work{};
+    std::deque<pending> queue{};
+    /* Turned away connections waiting to be told when to come back, kept off the workers */
+    std::deque<rejecting> rejects{};
+    std::thread rejecter{};
+    std::map<std::string, size_t> per_source{};
+    std::vector<std::thread> workers{};
+    std::function<bool(int)> handler{};
+    std::function<void(int, uint64_t)> busy{};
+    std::shared_ptr<fss_token_bucket> admission{};
+    fss_handshake_stats stats{};
+    size_t num_workers;
+    size_t max_queue;
+    size_t max_per_source;
+    uint64_t timeout;
+    bool run{false};
+    void processHandshakes();
+    void processRejects();
+    void releaseSource(const std::string &t_source);
+    void reject(int fd, uint64_t retry_after);
+    /* How long until ahead more handshakes could be started */
+    auto backlogWait(size_t ahead) -> uint64_t;
+public:
+    static constexpr size_t default_workers = 4;
+    static constexpr size_t default_max_queue = 64;
+    static constexpr size_t default_max_per_source = 4;
+    static constexpr uint64_t default_timeout = 10000;
+    /* Time given to a rejected client's opening bytes, so closing doesn't reset the connection before the reply is read */
+    static constexpr int reject_wait = 100;
+    static constexpr size_t max_rejects = 256;
+    static constexpr uint64_t min_retry_after = 1000;
+    fss_handshake_pool(size_t t_workers, size_t t_max_queue, size_t t_max_per_source, uint64_t t_timeout);
+    fss_handshake_pool(fss_handshake_pool &) = delete;
+    fss_handshake_pool(fss_handshake_pool &&) = delete;
+    auto operator=(fss_handshake_pool &) -> fss_handshake_pool& = delete;
+    auto operator=(fss_handshake_pool &&) -> fss_handshake_pool& = delete;
+    ~fss_handshake_pool();
+    void start(std::function<bool(int)> t_handler, std::function<void(int, uint64_t)> t_busy);
+    void stop();
+    /* Limit new handshakes to rate per second, anything over is told to retry later */
+    void setRateLimit(double rate, double burst);
+    /* Queues the handshake, or tells the client when to retry and returns false */
+    auto submit(int fd, const std::string &source) -> bool;
+    auto getTimeout() -> uint64_t;
+    auto getStats() -> fss_handshake_stats;
 };
 
 class fss_listen : public fss_connection {
@@ -140,11 +557,19 @@ private:
     uint16_t port;
     auto startListening() -> bool;
     fss_connect_cb cb;
-    static constexpr int default_max_pending_conns = 10;
     int max_pending_connections{default_max_pending_conns};
+    std::mutex pool_lock{};
+    std::shared_ptr<fss_handshake_pool> pool{};
 protected:
+    /* For listeners that open their own socket, they call startAccepting once it is bound */
+    explicit fss_listen(fss_connect_cb t_cb);
+    auto startAccepting() -> bool;
     virtual auto newConnection(int fd) -> std::shared_ptr<flight_safety_system::transport::fss_connection>;
+    auto acceptConnection(int fd) -> bool;
+    void rejectConnection(int fd, uint64_t retry_after);
+    void stopHandshakePool();
 public:
+    static constexpr int default_max_pending_conns = 10;
     fss_listen(uint16_t t_port, fss_connect_cb t_cb);
     fss_listen(fss_listen &) = delete;
     fss_listen(fss_listen &&) = delete;
@@ -152,8 +577,229 @@ public:
     auto operator=(fss_listen &&) -> fss_listen& = delete;
     ~fss_listen() override;
     void processMessages() override;
+    void setMaxPendingConnections(int t_max_pending_connections);
+    void setHandshakePool(std::shared_ptr<fss_handshake_pool> t_pool);
+    auto getHandshakePool() -> std::shared_ptr<fss_handshake_pool>;
+};
+
+/* Who is on the other end of a unix domain socket, as reported by the kernel */
+class fss_peer_credentials {
+public:
+    pid_t pid{0};
+    uid_t uid{0};
+    gid_t gid{0};
+};
+
+/* A connection over a unix domain socket, for clients on the same host as the server */
+class fss_connection_local : public fss_connection {
+private:
+    fss_peer_credentials credentials{};
+    std::list<std::string> names{};
+public:
+    fss_connection_local();
+    fss_connection_local(int fd, const fss_peer_credentials &t_credentials, std::list<std::string> t_names);
+    fss_connection_local(fss_connection_local &) = delete;
+    fss_connection_local(fss_connection_local &&) = delete;
+    auto operator=(fss_connection_local &) -> fss_connection_local& = delete;
+    auto operator=(fss_connection_local &&) -> fss_connection_local& = delete;
+    ~fss_connection_local() override;
+    auto connectTo(const std::string &path) -> bool;
+    auto connectTo(const std::string &address, uint16_t port) -> bool override;
+    auto getClientNames() -> std::list<std::string> override;
+    auto getPeerCredentials() -> fss_peer_credentials;
+};
+
+/* Listens on a unix domain socket, the kernel vouches for the peer's uid so no certificates are needed */
+class fss_listen_local : public fss_listen {
+private:
+    std::string path;
+    /* uid -> names that uid may identify as (empty for any), anyone else is refused */
+    std::map<uid_t, std::list<std::string>> users;
+    bool bound{false};
+    auto startListening() -> bool;
+protected:
+    auto newConnection(int fd) -> std::shared_ptr<flight_safety_system::transport::fss_connection> override;
+public:
+    fss_listen_local(std::string t_path, fss_connect_cb t_cb, std::map<uid_t, std::list<std::string>> t_users);
+    fss_listen_local(fss_listen_local &) = delete;
+    fss_listen_local(fss_listen_local &&) = delete;
+    auto operator=(fss_listen_local &) -> fss_listen_local& = delete;
+    auto operator=(fss_listen_local &&) -> fss_listen_local& = delete;
+    ~fss_listen_local() override;
+    auto getPath() -> std::string;
+    static auto peerCredentials(int fd, fss_peer_credentials *credentials) -> bool;
 };
 
+/* Keeps the freed blocks of one type for reuse, so decoding at a steady rate doesn't go to the
+   allocator. Each thread has a small cache, exchanging blocks in batches with a depot shared by all
+   threads, so a message freed on a different thread to the one that decoded it still comes back. */
+template <typename T>
+class fss_pool {
+private:
+    class block {
+    public:
+        block *next;
+    };
+    class block_list {
+    public:
+        block *head{nullptr};
+        size_t count{0};
+        block_list() = default;
+        block_list(block_list &) = delete;
+        block_list(block_list &&) = delete;
+        auto operator=(block_list &) -> block_list& = delete;
+        auto operator=(block_list &&) -> block_list& = delete;
+        ~block_list() = default;
+        void push(block *b) {
+            b->next = this->head;
+            this->head = b;
+            this->count++;
+        }
+        auto pop() -> block * {
+            block *b = this->head;
+            this->head = b->next;
+            this->count--;
+            return b;
+        }
+    };
+    class depot {
+    public:
+        std::mutex lock{};
+        block_list blocks{};
+        depot() = default;
+        depot(depot &) = delete;
+        depot(depot &&) = delete;
+        auto operator=(depot &) -> depot& = delete;
+        auto operator=(depot &&) -> depot& = delete;
+        ~depot() {
+            while (this->blocks.head != nullptr)
+            {
+                ::operator delete(this->blocks.pop());
+            }
+        }
+    };
+    class cache {
+    public:
+        block_list blocks{};
+        cache() = default;
+        cache(cache &) = delete;
+        cache(cache &&) = delete;
+        auto operator=(cache &) -> cache& = delete;
+        auto operator=(cache &&) -> cache& = delete;
+        ~cache() {
+            while (this->blocks.head != nullptr)
+            {
+                fss_pool<T>::release(this->blocks.pop());
+            }
+        }
+    };
+    static auto getDepot() -> depot & {
+        static depot shared;
+        return shared;
+    }
+    static auto getCache() -> cache & {
+        thread_local cache local;
+        return local;
+    }
+    /* Back to the depot, or the allocator once the depot holds plenty */
+    static void release(block *b) {
+        depot &shared = getDepot();
+        std::lock_guard<std::mutex> lock_holder(shared.lock);
+        if (shared.blocks.count < depot_limit)
+        {
+            shared.blocks.push(b);
+        }
+        else
+        {
+            ::operator delete(b);
+        }
+    }
+public:
+    static constexpr size_t block_size = sizeof(T) > sizeof(block) ? sizeof(T) : sizeof(block);
+    static constexpr size_t cache_limit = 256;
+    static constexpr size_t batch_size = 64;
+    static constexpr size_t depot_limit = 16384;
+    static auto take() -> void * {
+        cache &local = getCache();
+        if (local.blocks.head == nullptr)
+        {
+            depot &shared = getDepot();
+            std::lock_guard<std::mutex> lock_holder(shared.lock);
+            for (size_t i = 0; i < batch_size && shared.blocks.head != nullptr; i++)
+            {
+                local.blocks.push(shared.blocks.pop());
+            }
+        }
+        if (local.blocks.head == nullptr)
+        {
+            return ::operator new(block_size);
+        }
+        return local.blocks.pop();
+    }
+    static void give(void *p) {
+        cache &local = getCache();
+        local.blocks.push(static_cast<block *>(p));
+        if (local.blocks.count > cache_limit)
+        {
+            depot &shared = getDepot();
+            std::lock_guard<std::mutex> lock_holder(shared.lock);
+            for (size_t i = 0; i < batch_size; i++)
+            {
+                block *b = local.blocks.pop();
+                if (shared.blocks.count < depot_limit)
+                {
+                    shared.blocks.push(b);
+                }
+                else
+                {
+                    ::operator delete(b);
+                }
+            }
+        }
+    }
+};
+
+/* Allocates single objects from the fss_pool for their type, for use with std::allocate_shared
+   (which rebinds it to the type holding both the object and its reference counts) */
+template <typename T>
+class fss_pool_allocator {
+public:
+    using value_type = T;
+    fss_pool_allocator() = default;
+    template <typename U>
+    fss_pool_allocator(const fss_pool_allocator<U> &other __attribute__((unused))) {}
+    auto allocate(size_t n) -> T * {
+        if (n != 1)
+        {
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T *>(fss_pool<T>::take());
+    }
+    void deallocate(T *p, size_t n) {
+        if (n != 1)
+        {
+            ::operator delete(p);
+            return;
+        }
+        fss_pool<T>::give(p);
+    }
+    template <typename U>
+    auto operator==(const fss_pool_allocator<U> &other __attribute__((unused))) const -> bool {
+        return true;
+    }
+    template <typename U>
+    auto operator!=(const fss_pool_allocator<U> &other __attribute__((unused))) const -> bool {
+        return false;
+    }
+};
+
+/* std::make_shared, but with the object and its reference counts in a pooled block */
+template <typename T, typename... Args>
+auto fss_make_pooled(Args&&... args) -> std::shared_ptr<T>
+{
+    return std::allocate_shared<T>(fss_pool_allocator<T>(), std::forward<Args>(args)...);
+}
+
 class fss_message {
 private:
     uint64_t id;
@@ -163,6 +809,8 @@ protected:
     virtual void packData(std::shared_ptr<buf_len> bl) = 0;
 public:
     explicit fss_message(fss_message_type t_type);
+    /* Length, type and id, which every message starts with */
+    static constexpr size_t header_length = sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint64_t);
     fss_message(uint64_t t_id, fss_message_type t_type);
     fss_message(fss_message &) = delete;
     fss_message(fss_message &&) = delete;
@@ -182,14 +830,14 @@ public:
     static auto decode(const std::shared_ptr<buf_len> &bl) -> std::shared_ptr<fss_message>;
 };
 
-class fss_message_closed: public fss_message {
+class fss_message_closed final : public fss_message {
 protected:
     void packData(std::shared_ptr<buf_len>) override;
 public:
     fss_message_closed();
 };
 
-class fss_message_identity : public fss_message {
+class fss_message_identity final : public fss_message {
 private:
     std::string name;
 protected:
@@ -201,7 +849,7 @@ public:
     virtual auto getName() -> std::string;
 };
 
-class fss_message_rtt_request : public fss_message {
+class fss_message_rtt_request final : public fss_message {
 protected:
     void packData(std::shared_ptr<buf_len> bl) override;
 public:
@@ -209,7 +857,7 @@ public:
     fss_message_rtt_request(uint64_t t_id, const std::shared_ptr<buf_len> &bl);
 };
 
-class fss_message_rtt_response : public fss_message {
+class fss_message_rtt_response final : public fss_message {
 private:
     uint64_t request_id;
 protected:
@@ -221,7 +869,7 @@ public:
     virtual auto getRequestId() -> uint64_t;
 };
 
-class fss_message_position_report : public fss_message {
+class fss_message_position_report final : public fss_message {
 private:
     double latitude{NAN};
     double longitude{NAN};
@@ -263,7 +911,7 @@ public:
     virtual auto getEmitterType() -> uint8_t;
 };
 
-class fss_message_system_status: public fss_message {
+class fss_message_system_status final : public fss_message {
 private:
     uint8_t bat_percent;
     uint32_t mah_used;
@@ -279,7 +927,7 @@ public:
     virtual auto getBatVoltage() -> double;
 };
 
-class fss_message_search_status: public fss_message {
+class fss_message_search_status final : public fss_message {
 private:
     uint64_t search_id;
     uint64_t point_completed;
@@ -295,7 +943,7 @@ public:
     virtual auto getSearchTotal() -> uint64_t;
 };
 
-class fss_message_asset_command: public fss_message {
+class fss_message_asset_command final : public fss_message {
 private:
     fss_asset_command command;
     double latitude;
@@ -317,7 +965,7 @@ public:
     auto getTimeStamp() -> uint64_t override;
 };
 
-class fss_message_smm_settings: public fss_message {
+class fss_message_smm_settings final : public fss_message {
 private:
     std::string server_url;
     std::string username;
@@ -333,7 +981,7 @@ public:
     virtual auto getPassword() -> std::string;
 };
 
-class fss_message_server_list: public fss_message {
+class fss_message_server_list final : public fss_message {
 private:
     std::vector<std::pair<std::string, uint16_t>> servers;
 protected:
@@ -346,7 +994,7 @@ public:
     virtual auto getServers() -> std::vector<std::pair<std::string, uint16_t>>;
 };
 
-class fss_message_identity_non_aircraft: public fss_message {
+class fss_message_identity_non_aircraft final : public fss_message {
 private:
     uint64_t capabilities{0};
 protected:
@@ -359,7 +1007,7 @@ public:
     auto getCapability(uint8_t cap_id) -> bool;
 };
 
-class fss_message_identity_required : public fss_message {
+class fss_message_identity_required final : public fss_message {
 private:
 protected:
     void packData(std::shared_ptr<buf_len> bl) override;
@@ -367,5 +1015,138 @@ public:
     fss_message_identity_required();
     fss_message_identity_required(uint64_t t_id, const std::shared_ptr<buf_len> &bl);
 };
+
+class fss_message_busy final : public fss_message {
+private:
+    uint64_t retry_after;
+protected:
+    void unpackData(const std::shared_ptr<buf_len> &bl);
+    void packData(std::shared_ptr<buf_len> bl) override;
+public:
+    explicit fss_message_busy(uint64_t t_retry_after);
+    fss_message_busy(uint64_t t_id, const std::shared_ptr<buf_len> &bl);
+    /* In milliseconds */
+    virtual auto getRetryAfter() -> uint64_t;
+};
+
+class fss_message_datagram_request final : public fss_message {
+protected:
+    void packData(std::shared_ptr<buf_len> bl) override;
+public:
+    fss_message_datagram_request();
+    fss_message_datagram_request(uint64_t t_id, const std::shared_ptr<buf_len> &bl);
+};
+
+/* Where to set up the datagram channel, and the token that ties it to this connection.
+   Also sent over the channel to bind it, and echoed back to confirm */
+class fss_message_datagram_offer final : public fss_message {
+private:
+    uint16_t port;
+    uint64_t token;
+protected:
+    void unpackData(const std::shared_ptr<buf_len> &bl);
+    void packData(std::shared_ptr<buf_len> bl) override;
+public:
+    fss_message_datagram_offer(uint16_t t_port, uint64_t t_token);
+    fss_message_datagram_offer(uint64_t t_id, const std::shared_ptr<buf_len> &bl);
+    virtual auto getPort() -> uint16_t;
+    virtual auto getToken() -> uint64_t;
+};
+
+class fss_message_position_compact final : public fss_message {
+private:
+    std::string payload;
+protected:
+    void unpackData(const std::shared_ptr<buf_len> &bl);
+    void packData(std::shared_ptr<buf_len> bl) override;
+public:
+    explicit fss_message_position_compact(std::string t_payload);
+    fss_message_position_compact(uint64_t t_id, const std::shared_ptr<buf_len> &bl);
+    virtual auto getPayload() -> const std::string &;
+};
+
+/* Carries several messages behind one header. Each is stored as its length, type and data,
+   the ids follow on from the id of the batch */
+class fss_message_batch final : public fss_message {
+private:
+    std::vector<std::shared_ptr<fss_message>> messages{};
+    std::string entries{};
+protected:
+    void unpackData(const std::shared_ptr<buf_len> &bl);
+    void packData(std::shared_ptr<buf_len> bl) override;
+public:
+    static constexpr size_t max_length = 16384;
+    fss_message_batch();
+    fss_message_batch(uint64_t t_id, const std::shared_ptr<buf_len> &bl);
+    /* Returns false (and doesn't add it) if the message won't fit */
+    auto add(const std::shared_ptr<fss_message> &msg) -> bool;
+    virtual auto getMessages() -> const std::vector<std::shared_ptr<fss_message>> &;
+};
+/* Hands msg to handler.handleMessage() as its concrete type, picked by a switch on the type rather than RTTI.
+   The handler overloads handleMessage(T &, const std::shared_ptr<fss_message> &) for the messages it wants,
+   and handleMessage(fss_message &, const std::shared_ptr<fss_message> &) catches the rest.
+   The shared pointer is there for handlers that need to keep or forward the message */
+template <typename Handler>
+void fss_message_dispatch(const std::shared_ptr<fss_message> &msg, Handler &handler)
+{
+    fss_message &base = *msg;
+    switch (base.getType())
+    {
+        case message_type_unknown:
+            handler.handleMessage(base, msg);
+            break;
+        case message_type_closed:
+            handler.handleMessage(static_cast<fss_message_closed &>(base), msg);
+            break;
+        case message_type_identity:
+            handler.handleMessage(static_cast<fss_message_identity &>(base), msg);
+            break;
+        case message_type_rtt_request:
+            handler.handleMessage(static_cast<fss_message_rtt_request &>(base), msg);
+            break;
+        case message_type_rtt_response:
+            handler.handleMessage(static_cast<fss_message_rtt_response &>(base), msg);
+            break;
+        case message_type_position_report:
+            handler.handleMessage(static_cast<fss_message_position_report &>(base), msg);
+            break;
+        case message_type_system_status:
+            handler.handleMessage(static_cast<fss_message_system_status &>(base), msg);
+            break;
+        case message_type_search_status:
+            handler.handleMessage(static_cast<fss_message_search_status &>(base), msg);
+            break;
+        case message_type_command:
+            handler.handleMessage(static_cast<fss_message_asset_command &>(base), msg);
+            break;
+        case message_type_server_list:
+            handler.handleMessage(static_cast<fss_message_server_list &>(base), msg);
+            break;
+        case message_type_smm_settings:
+            handler.handleMessage(static_cast<fss_message_smm_settings &>(base), msg);
+            break;
+        case message_type_identity_non_aircraft:
+            handler.handleMessage(static_cast<fss_message_identity_non_aircraft &>(base), msg);
+            break;
+        case message_type_identity_required:
+            handler.handleMessage(static_cast<fss_message_identity_required &>(base), msg);
+            break;
+        case message_type_busy:
+            handler.handleMessage(static_cast<fss_message_busy &>(base), msg);
+            break;
+        case message_type_position_compact:
+            handler.handleMessage(static_cast<fss_message_position_compact &>(base), msg);
+            break;
+        case message_type_batch:
+            handler.handleMessage(static_cast<fss_message_batch &>(base), msg);
+            break;
+        case message_type_datagram_request:
+            handler.handleMessage(static_cast<fss_message_datagram_request &>(base), msg);
+            break;
+        case message_type_datagram_offer:
+            handler.handleMessage(static_cast<fss_message_datagram_offer &>(base), msg);
+            break;
+    }
+}
 } // namespace transport
 } // namespace flight_safety_system
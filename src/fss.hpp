@@ -15,6 +15,14 @@
 
 namespace flight_safety_system {
 
+/* Milliseconds since the epoch, for the timestamps carried in messages */
 auto fss_current_timestamp() -> uint64_t;
+/* Milliseconds from an arbitrary point, never stepped by NTP, for measuring intervals */
+auto fss_monotonic_timestamp() -> uint64_t;
+/* Reads both clocks once for the coarse versions below, call it once per event loop iteration */
+void fss_clock_tick();
+/* The clocks as of the last fss_clock_tick() (or now, before the first), for hot paths that can live with that resolution */
+auto fss_coarse_timestamp() -> uint64_t;
+auto fss_coarse_monotonic_timestamp() -> uint64_t;
 } // namespace flight_safety_system
 
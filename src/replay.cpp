@@ -0,0 +1,193 @@
+#include "fss-transport.hpp"
+#include "fss-transport-ssl.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+/* Replays frames from capture files against a server, one connection per connection in the capture.
+   usage: fss-replay [-s speed|max] [-d received|sent] (-l socket | -a address -p port -c ca -k key -C cert) capture... */
+
+static bool running = true;
+
+static void sigIntHandler(int signum __attribute__((unused)))
+{
+    running = false;
+}
+
+/* Counts (and otherwise ignores) whatever the server sends back */
+class replay_handler : public flight_safety_system::transport::fss_message_cb {
+private:
+    std::atomic<uint64_t> *replies;
+    std::atomic<bool> closed{false};
+public:
+    replay_handler(std::shared_ptr<flight_safety_system::transport::fss_connection> t_conn, std::atomic<uint64_t> *t_replies) : fss_message_cb(std::move(t_conn)), replies(t_replies) {};
+    replay_handler(const replay_handler &) = delete;
+    replay_handler(replay_handler &&) = delete;
+    auto operator=(const replay_handler &) -> replay_handler& = delete;
+    auto operator=(replay_handler &&) -> replay_handler& = delete;
+    ~replay_handler() override = default;
+    void processMessage(std::shared_ptr<flight_safety_system::transport::fss_message> message) override {
+        if (message != nullptr && message->getType() == flight_safety_system::transport::message_type_closed)
+        {
+            this->closed = true;
+            return;
+        }
+        (*this->replies)++;
+    }
+    auto isClosed() -> bool {
+        return this->closed;
+    }
+};
+
+class replay_options {
+public:
+    double speed{1};
+    flight_safety_system::transport::fss_capture_direction direction{flight_safety_system::transport::capture_received};
+    std::string local_path{};
+    std::string address{};
+    uint16_t port{0};
+    std::string ca{};
+    std::string private_key{};
+    std::string public_key{};
+};
+
+static auto
+replay_connect(const replay_options &options, const std::shared_ptr<flight_safety_system::transport_ssl::fss_credentials> &credentials) -> std::shared_ptr<flight_safety_system::transport::fss_connection>
+{
+    if (!options.local_path.empty())
+    {
+        auto conn = std::make_shared<flight_safety_system::transport::fss_connection_local>();
+        return conn->connectTo(options.local_path) ? conn : nullptr;
+    }
+    auto conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(credentials);
+    return conn->connectTo(options.address, options.port) ? conn : nullptr;
+}
+
+auto
+main(int argc, char *argv[]) -> int
+{
+    replay_options options;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:l:a:p:c:k:C:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                /* 0 means as fast as possible */
+                options.speed = std::string(optarg) == "max" ? 0 : std::strtod(optarg, nullptr);
+                break;
+            case 'd':
+                options.direction = std::string(optarg) == "sent" ? flight_safety_system::transport::capture_sent : flight_safety_system::transport::capture_received;
+                break;
+            case 'l':
+                options.local_path = optarg;
+                break;
+            case 'a':
+                options.address = optarg;
+                break;
+            case 'p':
+                options.port = static_cast<uint16_t>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'c':
+                options.ca = optarg;
+                break;
+            case 'k':
+                options.private_key = optarg;
+                break;
+            case 'C':
+                options.public_key = optarg;
+                break;
+            default:
+                std::cerr << "usage: " << argv[0] << " [-s speed|max] [-d received|sent] (-l socket | -a address -p port -c ca -k key -C cert) capture..." << std::endl;
+                return -1;
+        }
+    }
+    if (optind >= argc || (options.local_path.empty() && (options.address.empty() || options.port == 0 || options.ca.empty() || options.private_key.empty() || options.public_key.empty())))
+    {
+        std::cerr << "usage: " << argv[0] << " [-s speed|max] [-d received|sent] (-l socket | -a address -p port -c ca -k key -C cert) capture..." << std::endl;
+        return -1;
+    }
+    signal (SIGINT, sigIntHandler);
+    signal (SIGPIPE, SIG_IGN);
+
+    std::shared_ptr<flight_safety_system::transport_ssl::fss_credentials> credentials;
+    if (options.local_path.empty())
+    {
+        credentials = std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(options.ca, options.private_key, options.public_key);
+    }
+
+    std::atomic<uint64_t> replies{0};
+    std::map<uint32_t, std::shared_ptr<replay_handler>> connections;
+    uint64_t frames = 0;
+    uint64_t failed = 0;
+    uint64_t first_timestamp = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = optind; i < argc && running; i++)
+    {
+        flight_safety_system::transport::fss_capture_reader reader(argv[i]);
+        flight_safety_system::transport::fss_capture_record record;
+        while (running && reader.next(&record))
+        {
+            if (record.direction != options.direction)
+            {
+                continue;
+            }
+            if (first_timestamp == 0)
+            {
+                first_timestamp = record.timestamp;
+                start = std::chrono::steady_clock::now();
+            }
+            if (options.speed > 0 && record.timestamp > first_timestamp)
+            {
+                std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<uint64_t>(static_cast<double>(record.timestamp - first_timestamp) / options.speed)));
+            }
+            auto &handler = connections[record.connection];
+            if (handler == nullptr)
+            {
+                auto conn = replay_connect(options, credentials);
+                if (conn == nullptr)
+                {
+                    failed++;
+                    connections.erase(record.connection);
+                    continue;
+                }
+                handler = std::make_shared<replay_handler>(conn, &replies);
+                conn->setHandler(handler.get());
+            }
+            if (handler->isClosed())
+            {
+                failed++;
+                continue;
+            }
+            auto msg = flight_safety_system::transport::fss_message::decode(std::make_shared<flight_safety_system::transport::buf_len>(record.frame.data(), record.frame.size()));
+            if (msg == nullptr || !handler->sendMsg(msg))
+            {
+                failed++;
+                continue;
+            }
+            frames++;
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    /* Give the server a moment to answer the last few */
+    sleep(1);
+    std::cout << "connections " << connections.size() << std::endl;
+    std::cout << "frames      " << frames << " in " << elapsed << "ms (" << (elapsed > 0 ? static_cast<double>(frames) * 1000 / static_cast<double>(elapsed) : 0) << "/s)" << std::endl;
+    std::cout << "failed      " << failed << std::endl;
+    std::cout << "replies     " << replies << std::endl;
+    for (auto &entry : connections)
+    {
+        entry.second->disconnect();
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -16,97 +16,44 @@
 #include <json/json.h>
 #pragma GCC diagnostic pop
 
+#include <pwd.h>
 #include <unistd.h>
 
 constexpr int sec_to_msec = 1000;
 
+/* Declared first so it outlives dbc, which hands it the writes lost with a connection */
+std::shared_ptr<flight_safety_system::server::db_spool> spool = nullptr;
 std::shared_ptr<flight_safety_system::server::db_connection> dbc = nullptr;
-
-flight_safety_system::server::smm_settings::smm_settings(std::string t_address, std::string t_username, std::string t_password) : address(std::move(t_address)), username(std::move(t_username)), password(std::move(t_password))
+std::shared_ptr<flight_safety_system::transport_ssl::fss_datagram_listen> datagram_listen = nullptr;
+std::shared_ptr<flight_safety_system::transport::fss_capture> capture = nullptr;
+std::shared_ptr<flight_safety_system::server::db_write_rules> db_rules = std::make_shared<flight_safety_system::server::db_write_rules>();
+std::shared_ptr<flight_safety_system::server::track_rules> track_settings = std::make_shared<flight_safety_system::server::track_rules>();
+
+/* While the database is down, or anything is still spooled (to keep records in order), records go to the spool */
+static void
+store_record(const flight_safety_system::server::db_record &record)
 {
-}
-
-auto
-flight_safety_system::server::smm_settings::getAddress() -> std::string
-{
-    return this->address;
-}
-auto
-flight_safety_system::server::smm_settings::getUsername() -> std::string
-{
-    return this->username;
-}
-auto
-flight_safety_system::server::smm_settings::getPassword() -> std::string
-{
-    return this->password;
-}
-
-flight_safety_system::server::fss_server_details::fss_server_details(std::string t_address, uint16_t t_port) : address(std::move(t_address)), port(t_port)
-{
-}
-
-auto
-flight_safety_system::server::fss_server_details::getAddress() -> std::string
-{
-    return this->address;
-}
-auto
-flight_safety_system::server::fss_server_details::getPort() -> uint16_t
-{
-    return this->port;
-}
-
-flight_safety_system::server::asset_command::asset_command(uint64_t t_dbid, uint64_t t_timestamp, const std::string &t_cmd, double t_latitude, double t_longitude, uint16_t t_altitude) : dbid(t_dbid), timestamp(t_timestamp), latitude(t_latitude), longitude(t_longitude), altitude(t_altitude)
-{
-    if (t_cmd == "RTL") {
-        this->command = transport::asset_command_rtl;
-    } else if (t_cmd == "HOLD") {
-        this->command = transport::asset_command_hold;
-    } else if (t_cmd == "GOTO") {
-        this->command = transport::asset_command_goto;
-    } else if (t_cmd == "RON") {
-        this->command = transport::asset_command_resume;
-    } else if (t_cmd == "DISARM") {
-        this->command = transport::asset_command_disarm;
-    } else if (t_cmd == "ALT") {
-        this->command = transport::asset_command_altitude;
-    } else if (t_cmd == "TERM") {
-        this->command = transport::asset_command_terminate;
-    } else if (t_cmd == "MAN") {
-        this->command = transport::asset_command_manual;
+    if (spool != nullptr && (spool->pending() || !dbc->isHealthy()))
+    {
+        spool->append(record);
+    }
+    else if (!dbc->write(record) && spool != nullptr)
+    {
+        spool->append(record);
     }
 }
 
-auto
-flight_safety_system::server::asset_command::getDBId() -> uint64_t
-{
-    return this->dbid;
-}
-auto
-flight_safety_system::server::asset_command::getTimeStamp() -> uint64_t
-{
-    return this->timestamp;
-}
-auto
-flight_safety_system::server::asset_command::getCommand() -> transport::fss_asset_command
-{
-    return this->command;
-}
-auto
-flight_safety_system::server::asset_command::getLatitude() -> double
-{
-    return this->latitude;
-}
-auto
-flight_safety_system::server::asset_command::getLongitude() -> double
-{
-    return this->longitude;
-}
-auto
-flight_safety_system::server::asset_command::getAltitude() -> uint16_t
+static auto
+position_record(const std::string &name, const flight_safety_system::server::track_point &kept) -> flight_safety_system::server::db_record
 {
-    return this->altitude;
+    flight_safety_system::server::db_record record;
+    record.kind = flight_safety_system::server::db_record_position;
+    record.asset_name = name;
+    record.timestamp = kept.timestamp;
+    record.latitude = kept.latitude;
+    record.longitude = kept.longitude;
+    record.altitude = kept.altitude;
+    return record;
 }
 
 flight_safety_system::server::fss_client_rtt::fss_client_rtt(uint64_t t_timestamp, uint64_t t_reqid) : timestamp(t_timestamp), reqid(t_reqid)
@@ -216,17 +163,26 @@ public:
 
 std::shared_ptr<server_clients> clients = nullptr;
 
-flight_safety_system::server::fss_client::fss_client(std::shared_ptr<flight_safety_system::transport::fss_connection> t_conn) : fss_message_cb(std::move(t_conn))
+flight_safety_system::server::fss_client::fss_client(std::shared_ptr<flight_safety_system::transport::fss_connection> t_conn) : fss_message_cb(std::move(t_conn)), db_filter(db_rules), track(track_settings)
 {
     this->getConnection()->setHandler(this);
 }
 
-flight_safety_system::server::fss_client::~fss_client() = default;
+flight_safety_system::server::fss_client::~fss_client()
+{
+    /* The end of the track is always kept */
+    if (dbc != nullptr)
+    {
+        this->track.flush([this](const track_point &kept) {
+            store_record(position_record(this->name, kept));
+        });
+    }
+}
 
 void
 flight_safety_system::server::fss_client::sendCommand()
 {
-    uint64_t ts = fss_current_timestamp();
+    uint64_t ts = fss_monotonic_timestamp();
     auto ac = dbc->asset_get_command(this->name);
     constexpr int timeout_time = 10 * sec_to_msec;
     if (ac != nullptr && (ac->getDBId() != this->last_command_dbid || ts > (this->last_command_send_ts + timeout_time)))
@@ -268,7 +224,7 @@ flight_safety_system::server::fss_client::getName() -> std::string
 void
 flight_safety_system::server::fss_client::sendRTTRequest(const std::shared_ptr<flight_safety_system::transport::fss_message_rtt_request> &rtt_req)
 {
-    uint64_t ts = fss_current_timestamp();
+    uint64_t ts = fss_monotonic_timestamp();
     this->getConnection()->sendMsg(rtt_req);
     this->outstanding_rtt_requests.push_back(std::make_shared<fss_client_rtt>(ts, rtt_req->getId()));
 }
@@ -316,40 +272,38 @@ flight_safety_system::server::fss_client::processMessage(std::shared_ptr<flight_
         /* Only accept identify messages */
         if (msg->getType() == flight_safety_system::transport::message_type_identity)
         {
-            auto identity_msg = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_identity>(msg);
-            if (identity_msg != nullptr)
+            /* The type says what it is, no need for RTTI */
+            auto &identity_msg = static_cast<flight_safety_system::transport::fss_message_identity &>(*msg);
+            this->name = identity_msg.getName();
+            auto possible_names = this->getConnection()->getClientNames();
+            if (possible_names.empty())
             {
-                this->name = identity_msg->getName();
-                auto possible_names = this->getConnection()->getClientNames();
-                if (possible_names.empty())
-                {
-                    /* No client names, so accept anything */
-                    this->identified = true;
-                }
-                else
+                /* No client names, so accept anything */
+                this->identified = true;
+            }
+            else
+            {
+                for (const auto &possible_name: possible_names)
                 {
-                    for (const auto &possible_name: possible_names)
+                    if (possible_name == this->name)
                     {
-                        if (possible_name == this->name)
-                        {
-                            this->identified = true;
-                            break;
-                        }
+                        this->identified = true;
+                        break;
                     }
                 }
-                if (!this->identified)
-                {
-                    clients->clientDisconnected(this);
-                    return;
-                }
-                this->aircraft = true;
-                /* send the current command */
-                this->sendCommand();
-                /* send SMM config and servers list */
-                this->sendSMMSettings();
-                /* Send all the known fss servers */
-                this->getConnection()->sendMsg(getServersListMsg());
             }
+            if (!this->identified)
+            {
+                clients->clientDisconnected(this);
+                return;
+            }
+            this->aircraft = true;
+            /* send the current command */
+            this->sendCommand();
+            /* send SMM config and servers list */
+            this->sendSMMSettings();
+            /* Send all the known fss servers */
+            this->getConnection()->sendMsg(getServersListMsg());
         }
         else if(msg->getType() == flight_safety_system::transport::message_type_identity_non_aircraft)
         {
@@ -363,104 +317,251 @@ flight_safety_system::server::fss_client::processMessage(std::shared_ptr<flight_
     }
     else
     {
-        switch (msg->getType())
+        flight_safety_system::transport::fss_message_dispatch(msg, *this);
+    }
+}
+
+void
+flight_safety_system::server::fss_client::handleMessage(flight_safety_system::transport::fss_message &msg __attribute__((unused)), const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused)))
+{
+    /* Identity is only accepted before anything else, compact positions and batches are unpacked by the connection,
+       and the rest are server->client only */
+}
+
+void
+flight_safety_system::server::fss_client::handleMessage(flight_safety_system::transport::fss_message_datagram_request &msg __attribute__((unused)), const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused)))
+{
+    /* Offer a DTLS channel for position reports, if there is one */
+    if (datagram_listen != nullptr)
+    {
+        this->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_datagram_offer>(datagram_listen->getPort(), datagram_listen->offer(this->getConnection())));
+    }
+}
+
+void
+flight_safety_system::server::fss_client::handleMessage(flight_safety_system::transport::fss_message_rtt_request &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused)))
+{
+    /* Send a response */
+    auto reply_msg = std::make_shared<flight_safety_system::transport::fss_message_rtt_response>(msg.getId());
+    this->getConnection()->sendMsg(reply_msg);
+}
+
+void
+flight_safety_system::server::fss_client::handleMessage(flight_safety_system::transport::fss_message_rtt_response &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused)))
+{
+    /* Find the original message and calculate the response time */
+    std::shared_ptr<fss_client_rtt> rtt_req = nullptr;
+    uint64_t current_ts = fss_monotonic_timestamp();
+    for(const auto &req : this->outstanding_rtt_requests)
+    {
+        if(req->getRequestId() == msg.getRequestId())
         {
-            case flight_safety_system::transport::message_type_unknown:
-            case flight_safety_system::transport::message_type_closed:
-            case flight_safety_system::transport::message_type_identity:
-            case flight_safety_system::transport::message_type_identity_non_aircraft:
-            case flight_safety_system::transport::message_type_identity_required:
-                break;
-            case flight_safety_system::transport::message_type_rtt_request:
-            {
-                /* Send a response */
-                auto reply_msg = std::make_shared<flight_safety_system::transport::fss_message_rtt_response>(msg->getId());
-                this->getConnection()->sendMsg(reply_msg);
-            }
-                break;
-            case flight_safety_system::transport::message_type_rtt_response:
-            {
-                /* Find the original message and calculate the response time */
-                std::shared_ptr<fss_client_rtt> rtt_req = nullptr;
-                uint64_t current_ts = fss_current_timestamp();
-                auto rtt_resp_msg = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_rtt_response>(msg);
-                if (rtt_resp_msg != nullptr)
-                {
-                    for(const auto &req : this->outstanding_rtt_requests)
-                    {
-                        if(req->getRequestId() == rtt_resp_msg->getRequestId())
-                        {
-                            rtt_req = req;
-                        }
-                    }
-                }
-                if (rtt_req != nullptr)
-                {
-                    this->outstanding_rtt_requests.remove(rtt_req);
+            rtt_req = req;
+        }
+    }
+    if (rtt_req != nullptr)
+    {
+        this->outstanding_rtt_requests.remove(rtt_req);
 #ifdef DEBUG
-                    std::cout << "RTT for " << this->getName() << " is " << (current_ts - rtt_req->getTimeStamp()) << std::endl;
+        std::cout << "RTT for " << this->getName() << " is " << (current_ts - rtt_req->getTimeStamp()) << std::endl;
 #endif
-                    dbc->asset_add_rtt(this->name, current_ts - rtt_req->getTimeStamp());
-                }
-            }
-                break;
-            case flight_safety_system::transport::message_type_position_report:
-            {
-                if (this->aircraft)
-                {
-                    /* Capture and store in the database */
-                    dbc->asset_add_position(this->name, msg->getLatitude(), msg->getLongitude(), msg->getAltitude());
-                }
-                /* Reflect this message to all aircraft clients */
-                clients->sendMsg(msg, this);
-            }
-                break;
-            case flight_safety_system::transport::message_type_system_status:
-            {
-                /* Capture and store in the database */
-                auto status_msg = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_system_status>(msg);
-                if (status_msg != nullptr)
-                {
-                    dbc->asset_add_status(this->name, status_msg->getBatRemaining(), status_msg->getBatMAHUsed(), status_msg->getBatVoltage());
-                }
-            }
-                break;
-            case flight_safety_system::transport::message_type_search_status:
-            {
-                /* Capture and store in the database */
-                auto status_msg = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_search_status>(msg);
-                if (status_msg != nullptr)
-                {
-                    dbc->asset_add_search_status(this->name, status_msg->getSearchId(), status_msg->getSearchCompleted(), status_msg->getSearchTotal());
-                }
-            }
-                break;
-            /* These are server->client only */
-            case flight_safety_system::transport::message_type_command:
-            case flight_safety_system::transport::message_type_server_list:
-            case flight_safety_system::transport::message_type_smm_settings:
-                break;
+        if (this->db_filter.allowRtt(current_ts, current_ts - rtt_req->getTimeStamp()))
+        {
+            db_record record;
+            record.kind = db_record_rtt;
+            record.asset_name = this->name;
+            record.timestamp = fss_current_timestamp();
+            record.rtt = current_ts - rtt_req->getTimeStamp();
+            store_record(record);
         }
     }
 }
 
+void
+flight_safety_system::server::fss_client::handleMessage(flight_safety_system::transport::fss_message_position_report &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner)
+{
+    if (this->aircraft)
+    {
+        /* Capture and store in the database */
+        if (this->db_filter.allowPosition(fss_coarse_monotonic_timestamp(), msg.getLatitude(), msg.getLongitude(), msg.getAltitude()))
+        {
+            track_point point;
+            point.when = fss_coarse_monotonic_timestamp();
+            point.timestamp = fss_current_timestamp();
+            point.latitude = msg.getLatitude();
+            point.longitude = msg.getLongitude();
+            point.altitude = msg.getAltitude();
+            /* Only the points needed to rebuild the track are stored, possibly a little later */
+            this->track.addPoint(point, [this](const track_point &kept) {
+                store_record(position_record(this->name, kept));
+            });
+        }
+    }
+    /* Everything is relayed, however much of it is stored */
+    /* Reflect this message to all aircraft clients */
+    clients->sendMsg(owner, this);
+}
+
+void
+flight_safety_system::server::fss_client::handleMessage(flight_safety_system::transport::fss_message_system_status &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused)))
+{
+    /* Capture and store in the database */
+    if (this->db_filter.allowStatus(fss_coarse_monotonic_timestamp(), msg.getBatRemaining(), msg.getBatVoltage()))
+    {
+        db_record record;
+        record.kind = db_record_status;
+        record.asset_name = this->name;
+        record.timestamp = fss_current_timestamp();
+        record.bat_percent = msg.getBatRemaining();
+        record.bat_mah_used = msg.getBatMAHUsed();
+        record.bat_voltage = msg.getBatVoltage();
+        store_record(record);
+    }
+}
+
+void
+flight_safety_system::server::fss_client::handleMessage(flight_safety_system::transport::fss_message_search_status &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused)))
+{
+    /* Capture and store in the database */
+    if (this->db_filter.allowSearchStatus(fss_coarse_monotonic_timestamp(), msg.getSearchId(), msg.getSearchCompleted(), msg.getSearchTotal()))
+    {
+        db_record record;
+        record.kind = db_record_search_status;
+        record.asset_name = this->name;
+        record.timestamp = fss_current_timestamp();
+        record.search_id = msg.getSearchId();
+        record.search_completed = msg.getSearchCompleted();
+        record.search_total = msg.getSearchTotal();
+        store_record(record);
+    }
+}
+
 bool running = true;
+volatile sig_atomic_t reload_credentials = 0;
+bool compact_positions = false;
+bool batch_messages = false;
 
 void sigIntHandler(int signum __attribute__((unused)))
 {
     running = false;
 }
 
+void sigHupHandler(int signum __attribute__((unused)))
+{
+    reload_credentials = 1;
+}
+
 auto
 new_client_connect(std::shared_ptr<flight_safety_system::transport::fss_connection> conn) -> bool
 {
 #ifdef DEBUG
     std::cout << "New client connected" << std::endl;
 #endif
+    conn->setCapture(capture);
+    conn->setCompactPositions(compact_positions);
+    conn->setBatching(batch_messages);
     clients->clientConnected(std::make_shared<flight_safety_system::server::fss_client>(std::move(conn)));
     return true;
 }
 
+static void
+db_write_interval_from_config(flight_safety_system::server::db_write_rules::interval &interval, const Json::Value &config)
+{
+    interval.min_interval = config.get("min_interval", 0).asUInt64();
+    interval.max_interval = config.get("max_interval", 0).asUInt64();
+}
+
+static auto
+db_write_rules_from_config(const Json::Value &config) -> std::shared_ptr<flight_safety_system::server::db_write_rules>
+{
+    auto rules = std::make_shared<flight_safety_system::server::db_write_rules>();
+    db_write_interval_from_config(rules->position, config["position"]);
+    rules->position_distance = config["position"].get("distance", 0).asDouble();
+    rules->position_altitude = static_cast<uint16_t>(config["position"].get("altitude", 0).asUInt());
+    db_write_interval_from_config(rules->status, config["status"]);
+    rules->status_percent = static_cast<uint8_t>(config["status"].get("percent", 0).asUInt());
+    rules->status_voltage = config["status"].get("voltage", 0).asDouble();
+    rules->status_low_percent = static_cast<uint8_t>(config["status"].get("low_percent", 0).asUInt());
+    db_write_interval_from_config(rules->search_status, config["search_status"]);
+    rules->search_completed = config["search_status"].get("completed", 0).asUInt64();
+    db_write_interval_from_config(rules->rtt, config["rtt"]);
+    rules->rtt_change = config["rtt"].get("change", 0).asUInt64();
+    return rules;
+}
+
+/* Assets, their settings and the other servers, for running without a database */
+static auto
+memory_storage_from_config(const Json::Value &config) -> std::shared_ptr<flight_safety_system::server::db_connection>
+{
+    auto storage = std::make_shared<flight_safety_system::server::db_connection_memory>(config.get("any_asset", true).asBool(), config.get("max_records", Json::Value::UInt64(flight_safety_system::server::db_connection_memory::default_max_records)).asUInt64());
+    for (const auto &asset : config["assets"].getMemberNames())
+    {
+        storage->addAsset(asset);
+        const auto &smm = config["assets"][asset]["smm"];
+        if (smm.isObject())
+        {
+            storage->setSmmSettings(asset, smm["address"].asString(), smm["username"].asString(), smm["password"].asString());
+        }
+    }
+    for (const auto &server : config["servers"])
+    {
+        storage->addServer(server["address"].asString(), static_cast<uint16_t>(server["port"].asUInt()));
+    }
+    return storage;
+}
+
+static auto
+socket_profile_from_config(const Json::Value &config) -> flight_safety_system::transport::fss_socket_profile
+{
+    flight_safety_system::transport::fss_socket_profile profile;
+    profile.nodelay = config.get("nodelay", profile.nodelay).asBool();
+    profile.send_buffer = config.get("send_buffer", 0).asInt();
+    profile.recv_buffer = config.get("recv_buffer", 0).asInt();
+    profile.keepalive = config.get("keepalive", false).asBool();
+    profile.keepalive_idle = config.get("keepalive_idle", 0).asInt();
+    profile.keepalive_interval = config.get("keepalive_interval", 0).asInt();
+    profile.keepalive_count = config.get("keepalive_count", 0).asInt();
+    profile.user_timeout = config.get("user_timeout", 0).asUInt();
+    profile.max_missed_rtt = config.get("max_missed_rtt", 0).asUInt();
+    return profile;
+}
+
+/* Maps the configured user names (or numeric uids) to the names they may identify as */
+static auto
+local_users(const Json::Value &users) -> std::map<uid_t, std::list<std::string>>
+{
+    std::map<uid_t, std::list<std::string>> ret;
+    for (const auto &user : users.getMemberNames())
+    {
+        uid_t uid;
+        char *end = nullptr;
+        auto numeric = std::strtoul(user.c_str(), &end, 10);
+        if (!user.empty() && end != nullptr && *end == '\0')
+        {
+            uid = static_cast<uid_t>(numeric);
+        }
+        else
+        {
+            struct passwd pwd = {};
+            struct passwd *result = nullptr;
+            std::vector<char> buf(sysconf(_SC_GETPW_R_SIZE_MAX) > 0 ? sysconf(_SC_GETPW_R_SIZE_MAX) : 16384);
+            if (getpwnam_r(user.c_str(), &pwd, buf.data(), buf.size(), &result) != 0 || result == nullptr)
+            {
+                std::cerr << "Unknown local user '" << user << "'" << std::endl;
+                continue;
+            }
+            uid = pwd.pw_uid;
+        }
+        std::list<std::string> names;
+        for (const auto &name : users[user])
+        {
+            names.push_back(name.asString());
+        }
+        ret[uid] = names;
+    }
+    return ret;
+}
+
 auto
 main(int argc, char *argv[]) -> int
 {
@@ -468,6 +569,8 @@ main(int argc, char *argv[]) -> int
     signal (SIGINT, sigIntHandler);
     /* Ignore sig pipe */
     signal (SIGPIPE, SIG_IGN);
+    /* Reload the TLS certificates on sighup */
+    signal (SIGHUP, sigHupHandler);
     /* Read config */
     std::string conf_file = (argc > 1 ? std::string(argv[1]) : "/etc/fss/server.json");
     std::ifstream configfile(conf_file);
@@ -479,9 +582,47 @@ main(int argc, char *argv[]) -> int
     Json::Value config;
     configfile >> config;
 
-    /* Connect to database */
-    dbc = std::make_shared<flight_safety_system::server::db_connection>(config["postgres"]["host"].asString(), config["postgres"]["user"].asString(), config["postgres"]["pass"].asString(), config["postgres"]["db"].asString());
+    /* Connect to database, or keep everything in memory */
+    if (config.get("storage", "postgres").asString() == "memory")
+    {
+        dbc = memory_storage_from_config(config["memory"]);
+    }
+    else
+    {
+        dbc = std::make_shared<flight_safety_system::server::db_connection_postgres>(config["postgres"]["host"].asString(), config["postgres"]["user"].asString(), config["postgres"]["pass"].asString(), config["postgres"]["db"].asString(), config["postgres"].get("connections", 1).asUInt());
+#ifndef HAVE_LIBPQ
+        if (config["postgres"].get("connections", 1).asUInt() > 1 || config.isMember("spool"))
+        {
+            std::cerr << "The ECPG database backend uses a single connection and doesn't notice it going away, 'connections' and 'spool' need a server built --with-libpq" << std::endl;
+        }
+#endif
+    }
+    /* Keep telemetry on disk while the database is unavailable, and replay it once it is back */
+    if (config.isMember("spool"))
+    {
+        spool = std::make_shared<flight_safety_system::server::db_spool>(config["spool"]["path"].asString(), config["spool"].get("segment_size", Json::Value::UInt64(flight_safety_system::server::db_spool::default_segment_size)).asUInt64(), config["spool"].get("max_segments", Json::Value::UInt64(flight_safety_system::server::db_spool::default_max_segments)).asUInt64());
+        dbc->setLostWriteHandler([](const flight_safety_system::server::db_record &record) {
+            spool->append(record);
+        });
+        std::weak_ptr<flight_safety_system::server::db_connection> weak_dbc = dbc;
+        spool->startReplay([weak_dbc]() -> bool {
+            auto db = weak_dbc.lock();
+            return db != nullptr && db->recover();
+        }, [weak_dbc](const flight_safety_system::server::db_record &record) -> bool {
+            auto db = weak_dbc.lock();
+            return db != nullptr && db->write(record);
+        });
+    }
     
+    /* Thin out what is written to the database, see db_write_rules */
+    db_rules = db_write_rules_from_config(config["database_writes"]);
+    /* Only store the positions needed to rebuild each track */
+    track_settings->tolerance = config["track"].get("tolerance", 0).asDouble();
+    track_settings->altitude_tolerance = config["track"].get("altitude_tolerance", 0).asDouble();
+    track_settings->turn_angle = config["track"].get("turn_angle", 0).asDouble();
+    track_settings->max_interval = config["track"].get("max_interval", 0).asUInt64();
+    track_settings->max_points = config["track"].get("max_points", Json::Value::UInt64(track_settings->max_points)).asUInt64();
+
     /* Create the clients tracking */
     clients = std::make_shared<server_clients>();
 
@@ -496,7 +637,56 @@ main(int argc, char *argv[]) -> int
         std::cerr << "Missing ssl parameter, all of these are required: 'ca_public_key', 'server_private_key', 'server_public_key'" << std::endl;
         exit(-1);
     }
-    listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(config["port"].asInt(), new_client_connect, config["ssl"]["ca_public_key"].asString(), config["ssl"]["server_private_key"].asString(), config["ssl"]["server_public_key"].asString());
+    /* Session tickets let reconnecting clients skip the full certificate handshake */
+    auto tickets = std::make_shared<flight_safety_system::transport_ssl::fss_session_tickets>(config["ssl"].get("ticket_lifetime", Json::Value::UInt64(flight_safety_system::transport_ssl::fss_session_tickets::default_lifetime)).asUInt64(), config["ssl"].get("ticket_key_rotation", Json::Value::UInt64(flight_safety_system::transport_ssl::fss_session_tickets::default_key_rotation)).asUInt64(), config["ssl"]["early_data"].asBool());
+    /* The certificates are parsed once and shared by all the connections */
+    auto credentials = std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(ca_public_key, server_private_key, server_public_key);
+    /* Relay positions to clients as compact deltas */
+    compact_positions = config["compact_positions"].asBool();
+    /* Record the traffic from every client, so it can be replayed later with fss-replay */
+    if (config.isMember("capture"))
+    {
+        capture = std::make_shared<flight_safety_system::transport::fss_capture>(config["capture"]["path"].asString(), config["capture"].get("rotate_size", Json::Value::UInt64(flight_safety_system::transport::fss_capture::default_rotate_size)).asUInt64());
+    }
+    /* Combine messages sent to a client at the same time into one frame */
+    batch_messages = config["batch_messages"].asBool();
+    auto ssl_listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(config["port"].asInt(), new_client_connect, credentials, tickets);
+    /* Let the kernel encrypt and decrypt the records once connected, where it can */
+    ssl_listen->setKernelTLS(config["ssl"]["kernel_tls"].asBool());
+    listen = ssl_listen;
+    /* Bound the TLS handshakes that can be in flight at once, and how many any one address can hold */
+    if (config.isMember("handshake"))
+    {
+        auto handshake = config["handshake"];
+        listen->setHandshakePool(std::make_shared<flight_safety_system::transport::fss_handshake_pool>(
+            handshake.get("workers", Json::Value::UInt64(flight_safety_system::transport::fss_handshake_pool::default_workers)).asUInt64(),
+            handshake.get("queue", Json::Value::UInt64(flight_safety_system::transport::fss_handshake_pool::default_max_queue)).asUInt64(),
+            handshake.get("per_source", Json::Value::UInt64(flight_safety_system::transport::fss_handshake_pool::default_max_per_source)).asUInt64(),
+            handshake.get("timeout", Json::Value::UInt64(flight_safety_system::transport::fss_handshake_pool::default_timeout)).asUInt64()));
+        /* When everyone reconnects at once, admit new handshakes at this rate and tell the rest when to come back */
+        if (handshake.isMember("rate"))
+        {
+            double rate = handshake["rate"].asDouble();
+            listen->getHandshakePool()->setRateLimit(rate, handshake.get("burst", rate).asDouble());
+        }
+    }
+    /* TCP options for client connections, and how many RTT requests a client can leave unanswered before it is dropped */
+    auto socket_profile = socket_profile_from_config(config["socket"]);
+    listen->setSocketProfile(socket_profile);
+    listen->setMaxPendingConnections(config.get("listen_backlog", flight_safety_system::transport::fss_listen::default_max_pending_conns).asInt());
+    /* Position reports can go over DTLS on this port, so a lost packet doesn't hold up everything behind it */
+    if (config.isMember("datagram_port"))
+    {
+        datagram_listen = std::make_shared<flight_safety_system::transport_ssl::fss_datagram_listen>(config["datagram_port"].asUInt(), credentials);
+    }
+    /* Clients on this host can skip TLS by connecting to a unix socket, the kernel tells us who they are */
+    std::shared_ptr<flight_safety_system::transport::fss_listen_local> local_listen;
+    if (config.isMember("local"))
+    {
+        local_listen = std::make_shared<flight_safety_system::transport::fss_listen_local>(config["local"]["path"].asString(), new_client_connect, local_users(config["local"]["users"]));
+        local_listen->setSocketProfile(socket_profile);
+    }
+    int stats_interval = config.get("stats_interval", 0).asInt();
 
     /* Process client messages:
        - Battery status
@@ -516,6 +706,13 @@ main(int argc, char *argv[]) -> int
     while (running)
     {
         sleep (1);
+        flight_safety_system::fss_clock_tick();
+        if (reload_credentials)
+        {
+            reload_credentials = 0;
+            std::cerr << "Reloading TLS credentials" << std::endl;
+            credentials->reload();
+        }
         clients->cleanupRemovableClients();
         /* Send RTT messages to all clients */
         {
@@ -530,6 +727,28 @@ main(int argc, char *argv[]) -> int
             clients->sendMsg(getServersListMsg());
             clients->sendSMMSettings();
         }
+        if (stats_interval > 0 && (counter % stats_interval) == 0)
+        {
+            auto handshakes = listen->getHandshakePool();
+            if (handshakes != nullptr)
+            {
+                auto stats = handshakes->getStats();
+                std::cerr << "Handshakes: accepted " << stats.accepted << " completed " << stats.completed << " failed " << stats.failed << " rejected (queue full) " << stats.rejected_queue_full << " rejected (per source) " << stats.rejected_per_source << " rejected (busy) " << stats.rejected_busy << " max queue wait " << stats.queue_wait_max << "ms max handshake " << stats.handshake_max << "ms" << std::endl;
+            }
+            if (datagram_listen != nullptr)
+            {
+                std::cerr << "Datagram sessions: " << datagram_listen->getSessionCount() << std::endl;
+            }
+            auto db_stats = dbc->getPoolStats();
+            std::cerr << "Database: connections " << db_stats.connections << " statements " << db_stats.statements << " average wait " << (db_stats.statements > 0 ? db_stats.wait_total_us / db_stats.statements : 0) << "us max wait " << db_stats.wait_max_us << "us utilisation " << static_cast<int>(db_stats.utilisation * 100) << "%" << std::endl;
+            std::cerr << "Database writes: " << db_rules->written << " of " << db_rules->considered << " records" << std::endl;
+            if (spool != nullptr)
+            {
+                auto spool_stats = spool->getStats();
+                std::cerr << "Spool: spooled " << spool_stats.spooled << " replayed " << spool_stats.replayed << " backlog " << spool_stats.backlog << " segments " << spool_stats.segments << " dropped " << spool_stats.dropped << " corrupt " << spool_stats.corrupt << std::endl;
+            }
+            std::cerr << "Tracks: " << track_settings->getCompression() << " points reported per point stored, average error " << track_settings->getErrorAverage() << "m max error " << track_settings->getErrorMax() << "m" << std::endl;
+        }
         counter++;
     }
 }
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "fss-transport.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "transport.hpp"
+
+static auto
+read_fully(int fd, char *buf, size_t length) -> bool
+{
+    size_t got = 0;
+    while (got < length)
+    {
+        ssize_t this_time = read(fd, buf + got, length - got);
+        if (this_time <= 0)
+        {
+            return false;
+        }
+        got += this_time;
+    }
+    return true;
+}
+
+flight_safety_system::transport::fss_capture::fss_capture(std::string t_prefix, size_t t_rotate_size) : prefix(std::move(t_prefix)), rotate_size(std::max(t_rotate_size, magic_size + record_header_size + UINT16_MAX))
+{
+}
+
+flight_safety_system::transport::fss_capture::~fss_capture()
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    this->closeFile();
+}
+
+auto
+flight_safety_system::transport::fss_capture::openFile() -> bool
+{
+    /* Never write over an earlier capture, move on to the next free name */
+    while (this->fd < 0)
+    {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "-%06llu.cap", static_cast<unsigned long long>(this->file_index++));
+        std::string path = this->prefix + suffix;
+        this->fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+        if (this->fd < 0)
+        {
+            if (errno == EEXIST)
+            {
+                continue;
+            }
+            perror(("Failed to create capture file " + path).c_str());
+            return false;
+        }
+        if (ftruncate(this->fd, static_cast<off_t>(this->rotate_size)) < 0)
+        {
+            perror("Failed to size capture file: ");
+            close(this->fd);
+            this->fd = -1;
+            return false;
+        }
+        void *mapped = mmap(nullptr, this->rotate_size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            perror("Failed to map capture file: ");
+            close(this->fd);
+            this->fd = -1;
+            return false;
+        }
+        this->map = static_cast<char *>(mapped);
+        memcpy(this->map, magic, magic_size);
+        this->used = magic_size;
+        this->files.push_back(path);
+    }
+    return true;
+}
+
+void
+flight_safety_system::transport::fss_capture::closeFile()
+{
+    if (this->fd < 0)
+    {
+        return;
+    }
+    munmap(this->map, this->rotate_size);
+    this->map = nullptr;
+    /* Drop the unused tail so the file ends with the last record */
+    if (ftruncate(this->fd, static_cast<off_t>(this->used)) < 0)
+    {
+        perror("Failed to trim capture file: ");
+    }
+    close(this->fd);
+    this->fd = -1;
+}
+
+auto
+flight_safety_system::transport::fss_capture::nextConnectionId() -> uint32_t
+{
+    return this->next_connection++;
+}
+
+void
+flight_safety_system::transport::fss_capture::record(uint32_t t_connection, fss_capture_direction t_direction, const char *t_data, size_t t_length)
+{
+    if (t_length > UINT16_MAX)
+    {
+        return;
+    }
+    uint64_t timestamp = htonll(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    uint32_t connection = htonl(t_connection);
+    uint16_t length = htons(static_cast<uint16_t>(t_length));
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    if (this->fd >= 0 && this->used + record_header_size + t_length > this->rotate_size)
+    {
+        this->closeFile();
+    }
+    if (!this->openFile())
+    {
+        return;
+    }
+    char *dst = this->map + this->used;
+    memcpy(dst, &timestamp, sizeof(timestamp));
+    memcpy(dst + 8, &connection, sizeof(connection));
+    memcpy(dst + 12, &length, sizeof(length));
+    dst[14] = static_cast<char>(t_direction);
+    dst[15] = 0;
+    memcpy(dst + record_header_size, t_data, t_length);
+    this->used += record_header_size + t_length;
+}
+
+auto
+flight_safety_system::transport::fss_capture::getFiles() -> std::vector<std::string>
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->files;
+}
+
+flight_safety_system::transport::fss_capture_reader::fss_capture_reader(const std::string &path) : fd(open(path.c_str(), O_RDONLY | O_CLOEXEC))
+{
+    if (this->fd < 0)
+    {
+        perror(("Failed to open capture file " + path).c_str());
+        return;
+    }
+    char file_magic[fss_capture::magic_size];
+    this->valid = read_fully(this->fd, file_magic, sizeof(file_magic)) && memcmp(file_magic, fss_capture::magic, sizeof(file_magic)) == 0;
+    if (!this->valid)
+    {
+        std::cerr << path << " is not a capture file" << std::endl;
+    }
+}
+
+flight_safety_system::transport::fss_capture_reader::~fss_capture_reader()
+{
+    if (this->fd >= 0)
+    {
+        close(this->fd);
+    }
+}
+
+auto
+flight_safety_system::transport::fss_capture_reader::isValid() -> bool
+{
+    return this->valid;
+}
+
+auto
+flight_safety_system::transport::fss_capture_reader::next(fss_capture_record *t_record) -> bool
+{
+    char header[fss_capture::record_header_size];
+    if (!this->valid || !read_fully(this->fd, header, sizeof(header)))
+    {
+        return false;
+    }
+    uint64_t timestamp;
+    uint32_t connection;
+    uint16_t length;
+    memcpy(&timestamp, header, sizeof(timestamp));
+    memcpy(&connection, header + 8, sizeof(connection));
+    memcpy(&length, header + 12, sizeof(length));
+    /* A capture that wasn't closed cleanly ends in zeros */
+    if (timestamp == 0)
+    {
+        this->valid = false;
+        return false;
+    }
+    t_record->timestamp = ntohll(timestamp);
+    t_record->connection = ntohl(connection);
+    t_record->direction = header[14] == capture_sent ? capture_sent : capture_received;
+    t_record->frame.resize(ntohs(length));
+    if (!t_record->frame.empty() && !read_fully(this->fd, &t_record->frame[0], t_record->frame.size()))
+    {
+        this->valid = false;
+        return false;
+    }
+    return true;
+}
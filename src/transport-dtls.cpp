@@ -0,0 +1,654 @@
+#include "fss-transport-ssl.hpp"
+#include "fss-transport.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <gnutls/gnutls.h>
+#include <gnutls/dtls.h>
+#include <gnutls/gnutlsxx.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+
+/* Datagrams that aren't messages start with sequence number 0 */
+static auto
+bind_record(uint64_t token) -> std::shared_ptr<flight_safety_system::transport::buf_len>
+{
+    uint64_t seq = 0;
+    auto bl = std::make_shared<flight_safety_system::transport::buf_len>();
+    bl->addData((const char *)&seq, sizeof(uint64_t));
+    auto packed = std::make_shared<flight_safety_system::transport::fss_message_datagram_offer>(0, token)->getPacked();
+    bl->addData(packed->getData(), packed->getLength());
+    return bl;
+}
+
+static auto
+record_offer(const char *data, size_t length) -> std::shared_ptr<flight_safety_system::transport::fss_message_datagram_offer>
+{
+    if (length < sizeof(uint64_t) + flight_safety_system::transport::fss_message::header_length)
+    {
+        return nullptr;
+    }
+    uint16_t type = ntohs(*(const uint16_t *)(data + sizeof(uint64_t) + sizeof(uint16_t)));
+    if (type != flight_safety_system::transport::message_type_datagram_offer)
+    {
+        return nullptr;
+    }
+    auto bl = std::make_shared<flight_safety_system::transport::buf_len>(data + sizeof(uint64_t), length - sizeof(uint64_t));
+    auto msg = flight_safety_system::transport::fss_message::decode(bl);
+    if (msg == nullptr || msg->getType() != flight_safety_system::transport::message_type_datagram_offer)
+    {
+        return nullptr;
+    }
+    return std::static_pointer_cast<flight_safety_system::transport::fss_message_datagram_offer>(msg);
+}
+
+/* Bound by reference when made into durations, so they need storage */
+constexpr unsigned int flight_safety_system::transport_ssl::fss_datagram_client::keepalive_interval;
+constexpr uint64_t flight_safety_system::transport_ssl::fss_datagram_listen::offer_lifetime;
+constexpr uint64_t flight_safety_system::transport_ssl::fss_datagram_listen::idle_timeout;
+
+flight_safety_system::transport_ssl::fss_datagram_client::fss_datagram_client(std::shared_ptr<fss_credentials> t_store, std::weak_ptr<flight_safety_system::transport::fss_connection> t_conn) : store(std::move(t_store)), conn(std::move(t_conn)), session(GNUTLS_DATAGRAM)
+{
+}
+
+flight_safety_system::transport_ssl::fss_datagram_client::~fss_datagram_client()
+{
+    this->stop();
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_client::start(const std::string &hostname, uint16_t port, uint64_t token)
+{
+    this->run = true;
+    this->recv_thread = std::thread([this, hostname, port, token]() { this->processDatagrams(hostname, port, token); });
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_client::stop()
+{
+    this->run = false;
+    this->ready = false;
+    if (this->recv_thread.joinable())
+    {
+        if (this->recv_thread.get_id() == std::this_thread::get_id())
+        {
+            this->recv_thread.detach();
+        }
+        else
+        {
+            this->recv_thread.join();
+        }
+    }
+    if (this->fd != -1)
+    {
+        close(this->fd);
+        this->fd = -1;
+    }
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_client::setup(const std::string &hostname, uint16_t port) -> bool
+{
+    for (const auto &sa : flight_safety_system::transport::fss_resolver::getResolver()->resolve(hostname, port))
+    {
+        int new_fd = socket(sa.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+        if (new_fd < 0)
+        {
+            continue;
+        }
+        socklen_t sa_len = sa.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+        if (connect(new_fd, reinterpret_cast<const struct sockaddr *>(&sa), sa_len) == 0)
+        {
+            this->fd = new_fd;
+            break;
+        }
+        close(new_fd);
+    }
+    if (this->fd == -1)
+    {
+        return false;
+    }
+
+    this->session.set_priority(nullptr, nullptr);
+    this->credentials = this->store->get();
+    this->session.set_credentials(*this->credentials);
+    this->session.set_verify_cert(hostname.c_str(), 0);
+    this->session.set_transport_ptr((gnutls_transport_ptr_t)(intptr_t)this->fd);
+    gnutls_dtls_set_timeouts(this->session.ptr(), retransmit_timeout, handshake_timeout);
+
+    int ret = 0;
+    do
+    {
+        ret = gnutls_handshake(this->session.ptr());
+    } while (ret < 0 && gnutls_error_is_fatal(ret) == 0 && this->run);
+    return ret == 0;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_client::bind(uint64_t token) -> bool
+{
+    auto bl = bind_record(token);
+    char buf[max_datagram];
+    gnutls_record_set_timeout(this->session.ptr(), bind_interval);
+    for (unsigned int attempt = 0; attempt < bind_attempts && this->run; attempt++)
+    {
+        {
+            std::lock_guard<std::mutex> lock_holder(this->session_lock);
+            if (gnutls_record_send(this->session.ptr(), bl->getData(), bl->getLength()) < 0)
+            {
+                return false;
+            }
+        }
+        /* The server echoes it back once it has tied us to the connection */
+        ssize_t ret = 0;
+        while ((ret = gnutls_record_recv(this->session.ptr(), buf, sizeof(buf))) > 0)
+        {
+            auto offer = record_offer(buf, ret);
+            if (offer != nullptr && offer->getToken() == token)
+            {
+                return true;
+            }
+        }
+        if (ret != GNUTLS_E_TIMEDOUT && gnutls_error_is_fatal(ret) != 0)
+        {
+            /* e.g. nothing is listening on the port */
+            return false;
+        }
+    }
+    return false;
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_client::processDatagrams(std::string hostname, uint16_t port, uint64_t token)
+{
+    if (!this->setup(hostname, port) || !this->bind(token))
+    {
+        std::cerr << "No datagram channel to " << hostname << ":" << port << ", using TLS only" << std::endl;
+        return;
+    }
+    this->ready = true;
+
+    auto keepalive = bind_record(token);
+    auto last_sent = std::chrono::steady_clock::now();
+    char buf[max_datagram];
+    gnutls_record_set_timeout(this->session.ptr(), record_timeout);
+    while (this->run)
+    {
+        /* Senders share the session, so it is only held while a record is read, never while waiting for one */
+        bool pending = false;
+        {
+            std::lock_guard<std::mutex> lock_holder(this->session_lock);
+            pending = gnutls_record_check_pending(this->session.ptr()) > 0;
+        }
+        struct pollfd pfd = {this->fd, POLLIN, 0};
+        ssize_t ret = GNUTLS_E_TIMEDOUT;
+        if (pending || poll(&pfd, 1, recv_timeout) > 0)
+        {
+            std::lock_guard<std::mutex> lock_holder(this->session_lock);
+            ret = gnutls_record_recv(this->session.ptr(), buf, sizeof(buf));
+        }
+        if (ret > 0)
+        {
+            auto t_conn = this->conn.lock();
+            if (t_conn == nullptr)
+            {
+                break;
+            }
+            t_conn->receiveDatagram(buf, ret);
+        }
+        else if (ret == 0 || (ret != GNUTLS_E_TIMEDOUT && gnutls_error_is_fatal(ret) != 0))
+        {
+            /* Most likely the server has gone, or something started blocking UDP */
+            std::cerr << "Datagram channel to " << hostname << ":" << port << " failed, using TLS only" << std::endl;
+            break;
+        }
+        /* Keep the server (and anything in between) from forgetting about us */
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_sent > std::chrono::milliseconds(keepalive_interval))
+        {
+            std::lock_guard<std::mutex> lock_holder(this->session_lock);
+            gnutls_record_send(this->session.ptr(), keepalive->getData(), keepalive->getLength());
+            last_sent = now;
+        }
+    }
+    this->ready = false;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_client::isReady() -> bool
+{
+    return this->ready;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_client::sendDatagram(const std::shared_ptr<flight_safety_system::transport::buf_len> &bl) -> bool
+{
+    if (!this->ready)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock_holder(this->session_lock);
+    ssize_t ret = gnutls_record_send(this->session.ptr(), bl->getData(), bl->getLength());
+    if (ret < 0 && gnutls_error_is_fatal(ret) != 0)
+    {
+        this->ready = false;
+    }
+    return ret >= 0;
+}
+
+flight_safety_system::transport_ssl::fss_datagram_session::fss_datagram_session(int t_fd, const struct sockaddr_storage &t_peer, socklen_t t_peer_len, std::shared_ptr<gnutls::certificate_credentials> t_credentials, gnutls_dtls_prestate_st *prestate) : fd(t_fd), peer(t_peer), peer_len(t_peer_len), credentials(std::move(t_credentials)), session(GNUTLS_DATAGRAM | GNUTLS_NONBLOCK), created(std::chrono::steady_clock::now()), last_heard(created)
+{
+    this->session.set_priority(nullptr, nullptr);
+    this->session.set_credentials(*this->credentials);
+    this->session.set_certificate_request(GNUTLS_CERT_REQUIRE);
+    /* The client already proved it can receive at its address with the cookie exchange */
+    gnutls_dtls_prestate_set(this->session.ptr(), prestate);
+    gnutls_transport_set_ptr(this->session.ptr(), this);
+    gnutls_transport_set_push_function(this->session.ptr(), pushHook);
+    gnutls_transport_set_pull_function(this->session.ptr(), pullHook);
+    gnutls_transport_set_pull_timeout_function(this->session.ptr(), pullTimeoutHook);
+}
+
+flight_safety_system::transport_ssl::fss_datagram_session::~fss_datagram_session() = default;
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_session::pushHook(gnutls_transport_ptr_t ptr, const void *data, size_t len) -> ssize_t
+{
+    auto s = static_cast<flight_safety_system::transport_ssl::fss_datagram_session *>(ptr);
+    return sendto(s->fd, data, len, 0, reinterpret_cast<const struct sockaddr *>(&s->peer), s->peer_len);
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_session::pullHook(gnutls_transport_ptr_t ptr, void *data, size_t len) -> ssize_t
+{
+    auto s = static_cast<flight_safety_system::transport_ssl::fss_datagram_session *>(ptr);
+    if (s->pending.empty())
+    {
+        gnutls_transport_set_errno(s->session.ptr(), EAGAIN);
+        return -1;
+    }
+    size_t copied = std::min(len, s->pending.front().size());
+    memcpy(data, s->pending.front().data(), copied);
+    s->pending.pop_front();
+    return static_cast<ssize_t>(copied);
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_session::pullTimeoutHook(gnutls_transport_ptr_t ptr, unsigned int ms __attribute__((unused))) -> int
+{
+    auto s = static_cast<flight_safety_system::transport_ssl::fss_datagram_session *>(ptr);
+    return s->pending.empty() ? 0 : 1;
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_session::continueHandshake()
+{
+    int ret = gnutls_handshake(this->session.ptr());
+    if (ret == 0)
+    {
+        this->handshaken = true;
+        this->names = peer_certificate_names(this->session.ptr());
+    }
+    else if (gnutls_error_is_fatal(ret) != 0)
+    {
+        this->closed = true;
+    }
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_session::receive(std::string datagram) -> std::vector<std::string>
+{
+    std::vector<std::string> records;
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    if (this->closed)
+    {
+        return records;
+    }
+    this->last_heard = std::chrono::steady_clock::now();
+    this->pending.push_back(std::move(datagram));
+    if (!this->handshaken)
+    {
+        this->continueHandshake();
+    }
+    while (this->handshaken && !this->closed)
+    {
+        char buf[fss_datagram_listen::max_datagram];
+        ssize_t ret = gnutls_record_recv(this->session.ptr(), buf, sizeof(buf));
+        if (ret > 0)
+        {
+            records.emplace_back(buf, ret);
+        }
+        else if (ret == GNUTLS_E_AGAIN)
+        {
+            break;
+        }
+        else if (ret == 0 || gnutls_error_is_fatal(ret) != 0)
+        {
+            this->closed = true;
+        }
+    }
+    this->pending.clear();
+    return records;
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_session::retransmit()
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    if (!this->handshaken && !this->closed)
+    {
+        this->continueHandshake();
+    }
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_session::bind(const std::shared_ptr<flight_safety_system::transport::fss_connection> &t_conn)
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    this->conn = t_conn;
+    this->bound = true;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_session::getConnection() -> std::shared_ptr<flight_safety_system::transport::fss_connection>
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->conn.lock();
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_session::getNames() -> std::list<std::string>
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->names;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_session::isBound() -> bool
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->bound;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_session::expired(std::chrono::steady_clock::time_point now, std::chrono::milliseconds bind_timeout, std::chrono::milliseconds idle_timeout) -> bool
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->closed || (!this->bound && now - this->created > bind_timeout) || now - this->last_heard > idle_timeout || (this->bound && this->conn.expired());
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_session::close()
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    this->closed = true;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_session::isReady() -> bool
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->bound && !this->closed;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_session::sendDatagram(const std::shared_ptr<flight_safety_system::transport::buf_len> &bl) -> bool
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    if (!this->handshaken || this->closed)
+    {
+        return false;
+    }
+    ssize_t ret = gnutls_record_send(this->session.ptr(), bl->getData(), bl->getLength());
+    if (ret < 0 && gnutls_error_is_fatal(ret) != 0)
+    {
+        this->closed = true;
+    }
+    return ret >= 0;
+}
+
+class cookie_peer {
+public:
+    int fd;
+    const struct sockaddr_storage *peer;
+    socklen_t peer_len;
+};
+
+static auto
+cookie_push(gnutls_transport_ptr_t ptr, const void *data, size_t len) -> ssize_t
+{
+    auto cp = static_cast<cookie_peer *>(ptr);
+    return sendto(cp->fd, data, len, 0, reinterpret_cast<const struct sockaddr *>(cp->peer), cp->peer_len);
+}
+
+flight_safety_system::transport_ssl::fss_datagram_listen::fss_datagram_listen(uint16_t t_port, std::shared_ptr<fss_credentials> t_store) : store(std::move(t_store)), port(t_port)
+{
+    if (gnutls_key_generate(&this->cookie_key, GNUTLS_COOKIE_KEY_SIZE) < 0)
+    {
+        std::cerr << "Failed to generate the DTLS cookie key" << std::endl;
+        return;
+    }
+    this->fd = socket(PF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in6 bind_addr = {};
+    bind_addr.sin6_family = AF_INET6;
+    bind_addr.sin6_port = htons(this->port);
+    if (this->fd < 0 || ::bind(this->fd, reinterpret_cast<struct sockaddr *>(&bind_addr), sizeof(bind_addr)) < 0)
+    {
+        perror("Failed to bind datagram socket: ");
+        return;
+    }
+    socklen_t addr_len = sizeof(bind_addr);
+    if (getsockname(this->fd, reinterpret_cast<struct sockaddr *>(&bind_addr), &addr_len) == 0)
+    {
+        this->port = ntohs(bind_addr.sin6_port);
+    }
+    this->run = true;
+    this->thread = std::thread([this]() { this->processDatagrams(); });
+}
+
+flight_safety_system::transport_ssl::fss_datagram_listen::~fss_datagram_listen()
+{
+    this->run = false;
+    if (this->thread.joinable())
+    {
+        this->thread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        for (auto &it : this->sessions)
+        {
+            it.second->close();
+        }
+        this->sessions.clear();
+    }
+    if (this->fd != -1)
+    {
+        close(this->fd);
+        this->fd = -1;
+    }
+    if (this->cookie_key.data != nullptr)
+    {
+        gnutls_free(this->cookie_key.data);
+        this->cookie_key.data = nullptr;
+    }
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_listen::processDatagrams()
+{
+    std::string buf(max_datagram, '\0');
+    while (this->run)
+    {
+        struct pollfd pfd = {this->fd, POLLIN, 0};
+        if (poll(&pfd, 1, poll_interval) > 0)
+        {
+            struct sockaddr_storage peer = {};
+            socklen_t peer_len = sizeof(peer);
+            ssize_t len = 0;
+            while ((len = recvfrom(this->fd, &buf[0], buf.size(), MSG_DONTWAIT, reinterpret_cast<struct sockaddr *>(&peer), &peer_len)) > 0)
+            {
+                this->receiveDatagram(peer, peer_len, buf.substr(0, len));
+                peer_len = sizeof(peer);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock_holder(this->lock);
+            for (auto &it : this->sessions)
+            {
+                it.second->retransmit();
+            }
+        }
+        this->expireSessions();
+    }
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_listen::receiveDatagram(const struct sockaddr_storage &peer, socklen_t peer_len, std::string datagram)
+{
+    std::string key(reinterpret_cast<const char *>(&peer), peer_len);
+    std::shared_ptr<fss_datagram_session> session;
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        auto it = this->sessions.find(key);
+        if (it != this->sessions.end())
+        {
+            session = it->second;
+        }
+    }
+    if (session == nullptr)
+    {
+        struct sockaddr_storage client = peer;
+        gnutls_dtls_prestate_st prestate = {};
+        if (gnutls_dtls_cookie_verify(&this->cookie_key, &client, peer_len, &datagram[0], datagram.size(), &prestate) < 0)
+        {
+            /* Keep no state until the client shows it can receive at its address */
+            cookie_peer cp = {this->fd, &peer, peer_len};
+            gnutls_dtls_cookie_send(&this->cookie_key, &client, peer_len, &prestate, &cp, cookie_push);
+            return;
+        }
+        session = std::make_shared<fss_datagram_session>(this->fd, peer, peer_len, this->store->get(), &prestate);
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        this->sessions[key] = session;
+    }
+    for (const auto &record : session->receive(std::move(datagram)))
+    {
+        this->handleRecord(session, record);
+    }
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_listen::handleRecord(const std::shared_ptr<fss_datagram_session> &session, const std::string &record)
+{
+    auto offer = record_offer(record.data(), record.size());
+    if (offer != nullptr)
+    {
+        if (!session->isBound())
+        {
+            std::shared_ptr<flight_safety_system::transport::fss_connection> t_conn;
+            {
+                std::lock_guard<std::mutex> lock_holder(this->lock);
+                auto it = this->offers.find(offer->getToken());
+                if (it == this->offers.end())
+                {
+                    return;
+                }
+                t_conn = it->second.first.lock();
+                this->offers.erase(it);
+            }
+            if (t_conn == nullptr)
+            {
+                return;
+            }
+            /* The token could have leaked, so the certificate must match the connection's too. A connection
+               without a client certificate has nothing to match, so stays on TLS */
+            auto conn_names = t_conn->getClientNames();
+            auto session_names = session->getNames();
+            bool matched = false;
+            for (const auto &name : session_names)
+            {
+                matched = matched || std::find(conn_names.begin(), conn_names.end(), name) != conn_names.end();
+            }
+            if (!matched)
+            {
+                session->close();
+                return;
+            }
+            session->bind(t_conn);
+            t_conn->setDatagramChannel(session);
+        }
+        /* Echo binds and keepalives so the client knows the channel works */
+        session->sendDatagram(std::make_shared<flight_safety_system::transport::buf_len>(record.data(), record.size()));
+        return;
+    }
+    auto t_conn = session->getConnection();
+    if (t_conn != nullptr)
+    {
+        t_conn->receiveDatagram(record.data(), record.size());
+    }
+}
+
+void
+flight_safety_system::transport_ssl::fss_datagram_listen::expireSessions()
+{
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    for (auto it = this->sessions.begin(); it != this->sessions.end();)
+    {
+        if (it->second->expired(now, std::chrono::milliseconds(offer_lifetime), std::chrono::milliseconds(idle_timeout)))
+        {
+            it->second->close();
+            it = this->sessions.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    for (auto it = this->offers.begin(); it != this->offers.end();)
+    {
+        if (now - it->second.second > std::chrono::milliseconds(offer_lifetime))
+        {
+            it = this->offers.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_listen::getPort() -> uint16_t
+{
+    return this->port;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_listen::offer(const std::shared_ptr<flight_safety_system::transport::fss_connection> &t_conn) -> uint64_t
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    uint64_t token = 0;
+    while (token == 0 || this->offers.find(token) != this->offers.end())
+    {
+        token = this->random();
+    }
+    this->offers[token] = std::make_pair(std::weak_ptr<flight_safety_system::transport::fss_connection>(t_conn), std::chrono::steady_clock::now());
+    return token;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_datagram_listen::getSessionCount() -> size_t
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->sessions.size();
+}
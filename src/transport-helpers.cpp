@@ -9,62 +9,18 @@
 #include <netdb.h>
 
 auto
-convert_str_to_sa(const std::string &addr, uint16_t port, struct sockaddr_storage *sa) -> bool
+convert_sa_to_str(const struct sockaddr_storage *sa) -> std::string
 {
-    int family = AF_UNSPEC;
-    /* Try converting an IP(v4) address first */
-    if (family == AF_UNSPEC)
-    {
-        struct in_addr ia = {};
-        if (inet_pton(AF_INET, addr.c_str(), &ia) == 1)
-        {
-            family = AF_INET;
-            auto sa_in = (struct sockaddr_in *)sa;
-            memset(sa_in, 0, sizeof(struct sockaddr_in));
-            sa_in->sin_family = AF_INET;
-            sa_in->sin_addr = ia;
-        }
-    }
-    /* Try converting an IPv6 address */
-    if (family == AF_UNSPEC)
-    {
-        struct in6_addr ia = {};
-        if (inet_pton (AF_INET6, addr.c_str(), &ia) == 1)
-        {
-            family = AF_INET6;
-            auto sa_in = (struct sockaddr_in6 *)sa;
-            memset(sa_in, 0, sizeof(struct sockaddr_in6));
-            sa_in->sin6_family = AF_INET6;
-            sa_in->sin6_addr = ia;
-        }
-    }
-    /* Use host name lookup (probably DNS) to resolve the name */
-    if (family == AF_UNSPEC)
-    {
-        struct addrinfo *ai = nullptr;
-        
-        if (getaddrinfo(addr.c_str(), nullptr, nullptr, &ai) == 0)
-        {
-            memcpy (sa, ai->ai_addr, ai->ai_addrlen);
-            family = ai->ai_family;
-        }
-        
-        freeaddrinfo(ai);
-    }
-
-    switch (family)
+    char addr_str[INET6_ADDRSTRLEN] = {};
+    const char *res = nullptr;
+    switch (sa->ss_family)
     {
         case AF_INET:
-        {
-            auto sa_in = (struct sockaddr_in *)sa;
-            sa_in->sin_port = ntohs (port);
-        } break;
+            res = inet_ntop(AF_INET, &(reinterpret_cast<const struct sockaddr_in *>(sa))->sin_addr, addr_str, sizeof(addr_str));
+            break;
         case AF_INET6:
-        {
-            auto sa_in = (struct sockaddr_in6 *)sa;
-            sa_in->sin6_port = ntohs (port);
-        }
+            res = inet_ntop(AF_INET6, &(reinterpret_cast<const struct sockaddr_in6 *>(sa))->sin6_addr, addr_str, sizeof(addr_str));
+            break;
     }
-    
-    return family != AF_UNSPEC;
+    return res != nullptr ? std::string(res) : std::string();
 }
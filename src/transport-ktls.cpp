@@ -0,0 +1,278 @@
+#include "fss-transport-ssl.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <gnutls/gnutls.h>
+#include <gnutls/gnutlsxx.h>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/tcp.h>
+
+#ifdef HAVE_LINUX_TLS_H
+#include <linux/tls.h>
+
+/* TLS record content types */
+static constexpr unsigned char tls_alert = 21;
+static constexpr unsigned char tls_application_data = 23;
+/* A warning level close_notify alert */
+static constexpr unsigned char tls_close_notify[] = {1, 0};
+
+/* Only worth saying once that the kernel can't take the sessions */
+static std::atomic<bool> kernel_tls_warned{false};
+
+static void
+kernel_tls_unavailable(const std::string &reason)
+{
+    if (!kernel_tls_warned.exchange(true))
+    {
+        std::cerr << "Kernel TLS unavailable, staying with GnuTLS: " << reason << std::endl;
+    }
+}
+
+/* TLS 1.3 keeps the whole nonce with the keys, TLS 1.2 only the implicit salt */
+static auto
+kernel_tls_key_sizes(const gnutls_datum_t &iv, const gnutls_datum_t &key, unsigned int iv_size, unsigned int key_size) -> bool
+{
+    if (iv.size < iv_size || key.size != key_size)
+    {
+        kernel_tls_unavailable("unexpected key sizes");
+        return false;
+    }
+    return true;
+}
+
+/* Copies the keys gnutls holds for one direction into the matching kernel structure */
+static auto
+kernel_tls_direction(gnutls_session_t session, int fd, bool read) -> bool
+{
+    gnutls_datum_t iv = {nullptr, 0};
+    gnutls_datum_t key = {nullptr, 0};
+    unsigned char seq[TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE];
+    if (gnutls_record_get_state(session, read ? 1 : 0, nullptr, &iv, &key, seq) < 0)
+    {
+        kernel_tls_unavailable("session keys not available");
+        return false;
+    }
+    bool tls13 = gnutls_protocol_get_version(session) == GNUTLS_TLS1_3;
+    int ret = -1;
+    switch (gnutls_cipher_get(session))
+    {
+    case GNUTLS_CIPHER_AES_128_GCM:
+    {
+        if (!kernel_tls_key_sizes(iv, key, TLS_CIPHER_AES_GCM_128_SALT_SIZE + (tls13 ? TLS_CIPHER_AES_GCM_128_IV_SIZE : 0), TLS_CIPHER_AES_GCM_128_KEY_SIZE))
+        {
+            return false;
+        }
+        struct tls12_crypto_info_aes_gcm_128 info = {};
+        info.info.version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+        info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        /* TLS 1.2 sends the sequence number as the explicit nonce */
+        memcpy(info.salt, iv.data, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+        memcpy(info.iv, tls13 ? iv.data + TLS_CIPHER_AES_GCM_128_SALT_SIZE : seq, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+        memcpy(info.key, key.data, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+        memcpy(info.rec_seq, seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+        ret = setsockopt(fd, SOL_TLS, read ? TLS_RX : TLS_TX, &info, sizeof(info));
+        gnutls_memset(&info, 0, sizeof(info));
+        break;
+    }
+    case GNUTLS_CIPHER_AES_256_GCM:
+    {
+        if (!kernel_tls_key_sizes(iv, key, TLS_CIPHER_AES_GCM_256_SALT_SIZE + (tls13 ? TLS_CIPHER_AES_GCM_256_IV_SIZE : 0), TLS_CIPHER_AES_GCM_256_KEY_SIZE))
+        {
+            return false;
+        }
+        struct tls12_crypto_info_aes_gcm_256 info = {};
+        info.info.version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+        info.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        memcpy(info.salt, iv.data, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+        memcpy(info.iv, tls13 ? iv.data + TLS_CIPHER_AES_GCM_256_SALT_SIZE : seq, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+        memcpy(info.key, key.data, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+        memcpy(info.rec_seq, seq, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+        ret = setsockopt(fd, SOL_TLS, read ? TLS_RX : TLS_TX, &info, sizeof(info));
+        gnutls_memset(&info, 0, sizeof(info));
+        break;
+    }
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case GNUTLS_CIPHER_CHACHA20_POLY1305:
+    {
+        if (!kernel_tls_key_sizes(iv, key, TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE, TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE))
+        {
+            return false;
+        }
+        struct tls12_crypto_info_chacha20_poly1305 info = {};
+        info.info.version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+        info.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+        memcpy(info.iv, iv.data, TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE);
+        memcpy(info.key, key.data, TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE);
+        memcpy(info.rec_seq, seq, TLS_CIPHER_CHACHA20_POLY1305_REC_SEQ_SIZE);
+        ret = setsockopt(fd, SOL_TLS, read ? TLS_RX : TLS_TX, &info, sizeof(info));
+        gnutls_memset(&info, 0, sizeof(info));
+        break;
+    }
+#endif
+    default:
+        kernel_tls_unavailable(std::string("no kernel support for ") + gnutls_cipher_get_name(gnutls_cipher_get(session)));
+        return false;
+    }
+    if (ret != 0)
+    {
+        kernel_tls_unavailable(strerror(errno));
+        return false;
+    }
+    return true;
+}
+#endif
+
+void
+flight_safety_system::transport_ssl::fss_connection::offloadSession(gnutls::session &session __attribute__((unused)), bool send __attribute__((unused)), bool recv __attribute__((unused)))
+{
+#ifdef HAVE_LINUX_TLS_H
+    if (!this->kernel_tls || (!send && !recv))
+    {
+        return;
+    }
+    gnutls_protocol_t version = gnutls_protocol_get_version(session.ptr());
+    if (version != GNUTLS_TLS1_2 && version != GNUTLS_TLS1_3)
+    {
+        kernel_tls_unavailable(std::string("no kernel support for ") + gnutls_protocol_get_name(version));
+        return;
+    }
+    if (!this->kernel_send && !this->kernel_recv)
+    {
+        static const char ulp[] = "tls";
+        if (setsockopt(this->getFd(), SOL_TCP, TCP_ULP, ulp, sizeof(ulp)) != 0)
+        {
+            kernel_tls_unavailable(strerror(errno));
+            return;
+        }
+    }
+    if (send && !this->kernel_send)
+    {
+        this->kernel_send = kernel_tls_direction(session.ptr(), this->getFd(), false);
+    }
+    if (recv && !this->kernel_recv)
+    {
+        this->kernel_recv = kernel_tls_direction(session.ptr(), this->getFd(), true);
+    }
+#endif
+}
+
+auto
+flight_safety_system::transport_ssl::fss_connection::kernelSend(const char *data, size_t length) -> bool
+{
+    size_t sent = 0;
+    while (sent < length)
+    {
+        ssize_t ret = ::send(this->getFd(), data + sent, length - sent, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("send: kernel TLS");
+            return false;
+        }
+        sent += ret;
+    }
+    return true;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_connection::kernelRecv(void *bytes, size_t max_bytes) -> ssize_t
+{
+#ifdef HAVE_LINUX_TLS_H
+    while (true)
+    {
+        char control[CMSG_SPACE(sizeof(unsigned char))];
+        struct iovec iov = {bytes, max_bytes};
+        struct msghdr hdr = {};
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        ssize_t ret = recvmsg(this->getFd(), &hdr, 0);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return ret;
+        }
+        /* The kernel only hands over records other than application data along with their type */
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        if (cmsg == nullptr || cmsg->cmsg_level != SOL_TLS || cmsg->cmsg_type != TLS_GET_RECORD_TYPE)
+        {
+            return ret;
+        }
+        unsigned char record_type = *CMSG_DATA(cmsg);
+        if (record_type == tls_application_data)
+        {
+            return ret;
+        }
+        if (record_type == tls_alert)
+        {
+            /* close_notify, or something fatal, either way the connection is done */
+            return 0;
+        }
+        /* Post-handshake messages (key updates) need GnuTLS, which no longer has the keys */
+        std::cerr << "recv: kernel TLS record type " << static_cast<unsigned int>(record_type) << " not supported, closing" << std::endl;
+        return -1;
+    }
+#else
+    return ::recv(this->getFd(), bytes, max_bytes, 0);
+#endif
+}
+
+void
+flight_safety_system::transport_ssl::fss_connection::closeSession(gnutls::session &session)
+{
+#ifdef HAVE_LINUX_TLS_H
+    if (this->kernel_send)
+    {
+        char control[CMSG_SPACE(sizeof(unsigned char))] = {};
+        struct iovec iov = {const_cast<unsigned char *>(tls_close_notify), sizeof(tls_close_notify)};
+        struct msghdr hdr = {};
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_TLS;
+        cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+        *CMSG_DATA(cmsg) = tls_alert;
+        sendmsg(this->getFd(), &hdr, MSG_NOSIGNAL);
+        return;
+    }
+#endif
+    try
+    {
+        session.bye(GNUTLS_SHUT_WR);
+    }
+    catch (gnutls::exception &ex)
+    {
+        std::cerr << "fss_connection shutdown, gnutls exception during bye" << std::endl;
+    }
+}
+
+void
+flight_safety_system::transport_ssl::fss_connection::setKernelTLS(bool t_kernel_tls)
+{
+    this->kernel_tls = t_kernel_tls;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_connection::kernelSending() -> bool
+{
+    return this->kernel_send;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_connection::kernelReceiving() -> bool
+{
+    return this->kernel_recv;
+}
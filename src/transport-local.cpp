@@ -0,0 +1,178 @@
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "fss-transport.hpp"
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static auto
+local_address(const std::string &path, struct sockaddr_un *addr) -> bool
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr->sun_path))
+    {
+        std::cerr << "Unusable unix socket path '" << path << "'" << std::endl;
+        return false;
+    }
+    memcpy(addr->sun_path, path.data(), path.size());
+    return true;
+}
+
+flight_safety_system::transport::fss_connection_local::fss_connection_local() = default;
+
+flight_safety_system::transport::fss_connection_local::fss_connection_local(int t_fd, const fss_peer_credentials &t_credentials, std::list<std::string> t_names) : fss_connection(), credentials(t_credentials), names(std::move(t_names))
+{
+    this->setFd(t_fd);
+    this->startRecvThread(std::thread([this]() { this->processMessages(); }));
+}
+
+flight_safety_system::transport::fss_connection_local::~fss_connection_local()
+{
+    this->disconnect();
+}
+
+auto
+flight_safety_system::transport::fss_connection_local::connectTo(const std::string &path) -> bool
+{
+    struct sockaddr_un addr = {};
+    if (!local_address(path, &addr))
+    {
+        return false;
+    }
+    int new_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (new_fd < 0)
+    {
+        perror("Failed to create unix socket: ");
+        return false;
+    }
+    if (connect(new_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+        perror(("Failed to connect to " + path).c_str());
+        close(new_fd);
+        return false;
+    }
+    /* The server's credentials, for a client that wants to be sure who it is talking to */
+    fss_listen_local::peerCredentials(new_fd, &this->credentials);
+    this->setFd(new_fd);
+    this->startRecvThread(std::thread([this]() { this->processMessages(); }));
+    return true;
+}
+
+auto
+flight_safety_system::transport::fss_connection_local::connectTo(const std::string &address, uint16_t) -> bool
+{
+    /* There are no ports, the address is the socket path */
+    return this->connectTo(address);
+}
+
+auto
+flight_safety_system::transport::fss_connection_local::getClientNames() -> std::list<std::string>
+{
+    return this->names;
+}
+
+auto
+flight_safety_system::transport::fss_connection_local::getPeerCredentials() -> fss_peer_credentials
+{
+    return this->credentials;
+}
+
+flight_safety_system::transport::fss_listen_local::fss_listen_local(std::string t_path, fss_connect_cb t_cb, std::map<uid_t, std::list<std::string>> t_users) : fss_listen(t_cb), path(std::move(t_path)), users(std::move(t_users))
+{
+    this->startListening();
+}
+
+flight_safety_system::transport::fss_listen_local::~fss_listen_local()
+{
+    this->disconnect();
+    if (this->bound)
+    {
+        unlink(this->path.c_str());
+    }
+}
+
+auto
+flight_safety_system::transport::fss_listen_local::getPath() -> std::string
+{
+    return this->path;
+}
+
+auto
+flight_safety_system::transport::fss_listen_local::peerCredentials(int t_fd, fss_peer_credentials *t_credentials) -> bool
+{
+    struct ucred cred = {};
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(t_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0)
+    {
+        perror("Failed to get peer credentials: ");
+        return false;
+    }
+    t_credentials->pid = cred.pid;
+    t_credentials->uid = cred.uid;
+    t_credentials->gid = cred.gid;
+    return true;
+}
+
+auto
+flight_safety_system::transport::fss_listen_local::newConnection(int t_newfd) -> std::shared_ptr<flight_safety_system::transport::fss_connection>
+{
+    fss_peer_credentials peer;
+    if (!peerCredentials(t_newfd, &peer))
+    {
+        close(t_newfd);
+        return nullptr;
+    }
+    std::list<std::string> names;
+    if (this->users.empty())
+    {
+        /* With nobody configured, only processes running as the server's own user are let in */
+        if (peer.uid != geteuid())
+        {
+            std::cerr << "Refusing local connection from uid " << peer.uid << " (pid " << peer.pid << ")" << std::endl;
+            close(t_newfd);
+            return nullptr;
+        }
+    }
+    else
+    {
+        auto user = this->users.find(peer.uid);
+        if (user == this->users.end())
+        {
+            std::cerr << "Refusing local connection from uid " << peer.uid << " (pid " << peer.pid << ")" << std::endl;
+            close(t_newfd);
+            return nullptr;
+        }
+        names = user->second;
+    }
+    return std::make_shared<fss_connection_local>(t_newfd, peer, names);
+}
+
+auto
+flight_safety_system::transport::fss_listen_local::startListening() -> bool
+{
+    struct sockaddr_un addr = {};
+    if (!local_address(this->path, &addr))
+    {
+        return false;
+    }
+    /* Clear out a socket left behind by a previous run, but never anything else */
+    struct stat st = {};
+    if (lstat(this->path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(this->path.c_str());
+    }
+    this->setFd(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (bind(this->getFd(), reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+        perror(("Failed to bind " + this->path).c_str());
+        return false;
+    }
+    this->bound = true;
+    return this->startAccepting();
+}
@@ -1,5 +1,6 @@
 #include "fss-transport.hpp"
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <memory>
 #if __APPLE__
@@ -55,6 +56,12 @@ flight_safety_system::transport::buf_len::addData(const char *new_data, uint16_t
     return true;
 }
 
+void
+flight_safety_system::transport::buf_len::setData(const char *new_data, uint16_t len)
+{
+    this->data.assign(new_data, len);
+}
+
 auto
 flight_safety_system::transport::buf_len::getData() -> const char *
 {
@@ -71,53 +78,57 @@ flight_safety_system::transport::fss_message_cb::fss_message_cb(std::shared_ptr<
 {
 }
 
-flight_safety_system::transport::fss_message_cb::fss_message_cb(const fss_message_cb &from) = default;
+flight_safety_system::transport::fss_message_cb::fss_message_cb(const fss_message_cb &from) : conn(std::atomic_load(&from.conn))
+{
+}
 
 void
 flight_safety_system::transport::fss_message_cb::setConnection(std::shared_ptr<fss_connection> t_conn)
 {
-    this->conn = std::move(t_conn);
+    std::atomic_store(&this->conn, std::move(t_conn));
 }
 
 void flight_safety_system::transport::fss_message_cb::clearConnection()
 {
-    this->conn = nullptr;
+    std::atomic_store(&this->conn, std::shared_ptr<fss_connection>());
 }
 
 auto flight_safety_system::transport::fss_message_cb::operator=(const flight_safety_system::transport::fss_message_cb& other) -> fss_message_cb&
 {
     if (this != &other)
     {
-        this->conn = other.conn;
+        this->setConnection(std::atomic_load(&other.conn));
     }
     return *this;
 }
 
 auto flight_safety_system::transport::fss_message_cb::getConnection() -> std::shared_ptr<fss_connection>
 {
-    return this->conn;
+    return std::atomic_load(&this->conn);
 }
 auto flight_safety_system::transport::fss_message_cb::connected() -> bool
 {
-    return this->conn != nullptr;
+    return std::atomic_load(&this->conn) != nullptr;
 }
 
 void
 flight_safety_system::transport::fss_message_cb::disconnect()
 {
-    if (this->conn != nullptr)
+    /* Whoever takes the connection out disconnects it, a reconnect may be swapping it underneath */
+    auto old_conn = std::atomic_exchange(&this->conn, std::shared_ptr<fss_connection>());
+    if (old_conn != nullptr)
     {
-        this->conn->disconnect();
-        this->conn = nullptr;
+        old_conn->disconnect();
     }
 }
 
 auto
 flight_safety_system::transport::fss_message_cb::sendMsg(const std::shared_ptr<fss_message> &msg) -> bool
 {
-    if (this->conn != nullptr)
+    auto current = std::atomic_load(&this->conn);
+    if (current != nullptr)
     {
-        return this->conn->sendMsg(msg);
+        return current->sendMsg(msg);
     }
     return false;
 }
@@ -135,7 +146,7 @@ flight_safety_system::transport::fss_message::~fss_message() = default;
 auto
 flight_safety_system::transport::fss_message::headerLength() -> size_t
 {
-    return sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint64_t);
+    return header_length;
 }
 
 void
@@ -893,6 +904,542 @@ flight_safety_system::transport::fss_message_identity_required::fss_message_iden
 {
 }
 
+flight_safety_system::transport::fss_message_busy::fss_message_busy(uint64_t t_retry_after) : fss_message(message_type_busy), retry_after(t_retry_after)
+{
+}
+
+flight_safety_system::transport::fss_message_busy::fss_message_busy(uint64_t t_id, const std::shared_ptr<buf_len> &bl) : fss_message(t_id, message_type_busy), retry_after(0)
+{
+    this->unpackData(bl);
+}
+
+void
+flight_safety_system::transport::fss_message_busy::packData(std::shared_ptr<buf_len> bl)
+{
+    uint64_t data = htonll(this->retry_after);
+    bl->addData((char *)&data, sizeof(uint64_t));
+}
+
+void
+flight_safety_system::transport::fss_message_busy::unpackData(const std::shared_ptr<buf_len> &bl)
+{
+    size_t offset = this->headerLength();
+    const char *data = bl->getData();
+    size_t length = bl->getLength();
+    if (length - offset >= sizeof(uint64_t))
+    {
+        this->retry_after = ntohll(*(uint64_t *)(data + offset));
+    }
+}
+
+auto
+flight_safety_system::transport::fss_message_busy::getRetryAfter() -> uint64_t
+{
+    return this->retry_after;
+}
+
+void
+flight_safety_system::transport::fss_message_datagram_request::packData(std::shared_ptr<buf_len> bl __attribute__((unused)))
+{
+}
+
+flight_safety_system::transport::fss_message_datagram_request::fss_message_datagram_request() : fss_message(message_type_datagram_request)
+{
+}
+
+flight_safety_system::transport::fss_message_datagram_request::fss_message_datagram_request(uint64_t t_id, const std::shared_ptr<buf_len> &bl __attribute__((unused))) : fss_message(t_id, message_type_datagram_request)
+{
+}
+
+flight_safety_system::transport::fss_message_datagram_offer::fss_message_datagram_offer(uint16_t t_port, uint64_t t_token) : fss_message(message_type_datagram_offer), port(t_port), token(t_token)
+{
+}
+
+flight_safety_system::transport::fss_message_datagram_offer::fss_message_datagram_offer(uint64_t t_id, const std::shared_ptr<buf_len> &bl) : fss_message(t_id, message_type_datagram_offer), port(0), token(0)
+{
+    this->unpackData(bl);
+}
+
+void
+flight_safety_system::transport::fss_message_datagram_offer::packData(std::shared_ptr<buf_len> bl)
+{
+    uint64_t token_data = htonll(this->token);
+    bl->addData((char *)&token_data, sizeof(uint64_t));
+    uint16_t port_data = htons(this->port);
+    bl->addData((char *)&port_data, sizeof(uint16_t));
+}
+
+void
+flight_safety_system::transport::fss_message_datagram_offer::unpackData(const std::shared_ptr<buf_len> &bl)
+{
+    size_t offset = this->headerLength();
+    const char *data = bl->getData();
+    size_t length = bl->getLength();
+    if (length - offset >= sizeof(uint64_t) + sizeof(uint16_t))
+    {
+        this->token = ntohll(*(uint64_t *)(data + offset));
+        offset += sizeof(uint64_t);
+        this->port = ntohs(*(uint16_t *)(data + offset));
+    }
+}
+
+auto
+flight_safety_system::transport::fss_message_datagram_offer::getPort() -> uint16_t
+{
+    return this->port;
+}
+
+auto
+flight_safety_system::transport::fss_message_datagram_offer::getToken() -> uint64_t
+{
+    return this->token;
+}
+
+flight_safety_system::transport::fss_message_position_compact::fss_message_position_compact(std::string t_payload) : fss_message(message_type_position_compact), payload(std::move(t_payload))
+{
+}
+
+flight_safety_system::transport::fss_message_position_compact::fss_message_position_compact(uint64_t t_id, const std::shared_ptr<buf_len> &bl) : fss_message(t_id, message_type_position_compact), payload()
+{
+    this->unpackData(bl);
+}
+
+void
+flight_safety_system::transport::fss_message_position_compact::packData(std::shared_ptr<buf_len> bl)
+{
+    bl->addData(this->payload.data(), this->payload.length());
+}
+
+void
+flight_safety_system::transport::fss_message_position_compact::unpackData(const std::shared_ptr<buf_len> &bl)
+{
+    size_t offset = this->headerLength();
+    const char *data = bl->getData();
+    /* The payload ends where the (unpadded) message does */
+    size_t length = std::min(bl->getLength(), static_cast<size_t>(ntohs(*(uint16_t *)data)));
+    if (length > offset)
+    {
+        this->payload.assign(data + offset, length - offset);
+    }
+}
+
+auto
+flight_safety_system::transport::fss_message_position_compact::getPayload() -> const std::string &
+{
+    return this->payload;
+}
+
+flight_safety_system::transport::fss_message_batch::fss_message_batch() : fss_message(message_type_batch)
+{
+}
+
+flight_safety_system::transport::fss_message_batch::fss_message_batch(uint64_t t_id, const std::shared_ptr<buf_len> &bl) : fss_message(t_id, message_type_batch)
+{
+    this->unpackData(bl);
+}
+
+auto
+flight_safety_system::transport::fss_message_batch::add(const std::shared_ptr<fss_message> &msg) -> bool
+{
+    if (msg->getType() == message_type_batch)
+    {
+        return false;
+    }
+    auto bl = msg->getPacked();
+    const char *data = bl->getData();
+    size_t length = ntohs(*(uint16_t *)data);
+    size_t payload_length = length - this->headerLength();
+    if (this->headerLength() + this->entries.length() + sizeof(uint16_t) + sizeof(uint16_t) + payload_length > max_length)
+    {
+        return false;
+    }
+    uint16_t entry_length = htons(payload_length);
+    this->entries.append((const char *)&entry_length, sizeof(uint16_t));
+    /* Type as already packed in the header */
+    this->entries.append(data + sizeof(uint16_t), sizeof(uint16_t));
+    this->entries.append(data + this->headerLength(), payload_length);
+    this->messages.push_back(msg);
+    return true;
+}
+
+void
+flight_safety_system::transport::fss_message_batch::packData(std::shared_ptr<buf_len> bl)
+{
+    bl->addData(this->entries.data(), this->entries.length());
+}
+
+void
+flight_safety_system::transport::fss_message_batch::unpackData(const std::shared_ptr<buf_len> &bl)
+{
+    size_t offset = this->headerLength();
+    const char *data = bl->getData();
+    size_t length = std::min(bl->getLength(), static_cast<size_t>(ntohs(*(uint16_t *)data)));
+    if (length < offset)
+    {
+        return;
+    }
+    uint64_t next_id = this->getId();
+    while (length - offset >= sizeof(uint16_t) + sizeof(uint16_t))
+    {
+        size_t payload_length = ntohs(*(uint16_t *)(data + offset));
+        uint16_t entry_type = *(uint16_t *)(data + offset + sizeof(uint16_t));
+        offset += sizeof(uint16_t) + sizeof(uint16_t);
+        if (payload_length > length - offset)
+        {
+            break;
+        }
+        /* Rebuild the individual message so it can be decoded as normal */
+        auto inner = std::make_shared<buf_len>();
+        uint16_t inner_length = htons(this->headerLength() + payload_length);
+        uint64_t inner_id = htonll(next_id++);
+        inner->addData((const char *)&inner_length, sizeof(uint16_t));
+        inner->addData((const char *)&entry_type, sizeof(uint16_t));
+        inner->addData((const char *)&inner_id, sizeof(uint64_t));
+        inner->addData(data + offset, payload_length);
+        offset += payload_length;
+        if (ntohs(entry_type) == message_type_batch)
+        {
+            continue;
+        }
+        auto msg = fss_message::decode(inner);
+        if (msg != nullptr)
+        {
+            this->messages.push_back(msg);
+        }
+    }
+}
+
+auto
+flight_safety_system::transport::fss_message_batch::getMessages() -> const std::vector<std::shared_ptr<fss_message>> &
+{
+    return this->messages;
+}
+
+/* Compact position fields, in the order they are encoded */
+constexpr uint64_t compact_timestamp = 1 << 0;
+constexpr uint64_t compact_latitude = 1 << 1;
+constexpr uint64_t compact_longitude = 1 << 2;
+constexpr uint64_t compact_altitude = 1 << 3;
+constexpr uint64_t compact_heading = 1 << 4;
+constexpr uint64_t compact_horizontal_velocity = 1 << 5;
+constexpr uint64_t compact_vertical_velocity = 1 << 6;
+constexpr uint64_t compact_squawk = 1 << 7;
+constexpr uint64_t compact_callsign = 1 << 8;
+constexpr uint64_t compact_tslc = 1 << 9;
+constexpr uint64_t compact_flags = 1 << 10;
+constexpr uint64_t compact_altitude_type = 1 << 11;
+constexpr uint64_t compact_emitter_type = 1 << 12;
+constexpr uint64_t compact_all = (1 << 13) - 1;
+
+constexpr uint64_t compact_kind_delta = 0;
+constexpr uint64_t compact_kind_keyframe = 1;
+
+static void
+put_varint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static auto
+get_varint(const std::string &in, size_t &offset, uint64_t &value) -> bool
+{
+    value = 0;
+    for (unsigned int shift = 0; shift < 64 && offset < in.size(); shift += 7)
+    {
+        auto byte = static_cast<uint8_t>(in[offset++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Signed deltas are zigzag encoded so small negative numbers stay small */
+template<typename T> static void
+put_delta(std::string &out, T current, T previous)
+{
+    auto delta = static_cast<int64_t>(current) - static_cast<int64_t>(previous);
+    put_varint(out, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+}
+
+template<typename T> static auto
+get_delta(const std::string &in, size_t &offset, T &value) -> bool
+{
+    uint64_t encoded = 0;
+    if (!get_varint(in, offset, encoded))
+    {
+        return false;
+    }
+    auto delta = static_cast<int64_t>(encoded >> 1) ^ -static_cast<int64_t>(encoded & 1);
+    value = static_cast<T>(static_cast<int64_t>(value) + delta);
+    return true;
+}
+
+template<typename T> static auto
+get_value(const std::string &in, size_t &offset, T &value) -> bool
+{
+    uint64_t encoded = 0;
+    if (!get_varint(in, offset, encoded))
+    {
+        return false;
+    }
+    value = static_cast<T>(encoded);
+    return true;
+}
+
+static auto
+position_state(const std::shared_ptr<flight_safety_system::transport::fss_message_position_report> &msg) -> flight_safety_system::transport::fss_position_state
+{
+    flight_safety_system::transport::fss_position_state state;
+    state.timestamp = msg->getTimeStamp();
+    /* Same fixed point as the full report */
+    state.latitude = (int32_t) (msg->getLatitude() / flt_to_int);
+    state.longitude = (int32_t) (msg->getLongitude() / flt_to_int);
+    state.altitude = msg->getAltitude();
+    state.heading = msg->getHeading();
+    state.horizontal_velocity = msg->getHorzVel();
+    state.vertical_velocity = msg->getVertVel();
+    state.squawk = msg->getSquawk();
+    state.callsign = msg->getCallSign();
+    state.tslc = msg->getTSLC();
+    state.flags = msg->getFlags();
+    state.altitude_type = msg->getAltitudeType();
+    state.emitter_type = msg->getEmitterType();
+    return state;
+}
+
+flight_safety_system::transport::fss_position_encoder::fss_position_encoder(uint64_t t_keyframe_interval) : keyframe_interval(std::max<uint64_t>(t_keyframe_interval, 1))
+{
+}
+
+auto
+flight_safety_system::transport::fss_position_encoder::encode(const std::shared_ptr<fss_message_position_report> &msg) -> std::shared_ptr<fss_message_position_compact>
+{
+    auto current = position_state(msg);
+    uint32_t icao_address = msg->getICAOAddress();
+    auto stream = this->streams.find(icao_address);
+    current.seq = stream == this->streams.end() ? 0 : stream->second.seq + 1;
+    bool keyframe = stream == this->streams.end() || current.seq % this->keyframe_interval == 0;
+    /* Keyframes are a change from nothing */
+    fss_position_state previous;
+    if (!keyframe)
+    {
+        previous = stream->second;
+    }
+
+    uint64_t fields = compact_all;
+    if (!keyframe)
+    {
+        fields = 0;
+        fields |= current.timestamp != previous.timestamp ? compact_timestamp : 0;
+        fields |= current.latitude != previous.latitude ? compact_latitude : 0;
+        fields |= current.longitude != previous.longitude ? compact_longitude : 0;
+        fields |= current.altitude != previous.altitude ? compact_altitude : 0;
+        fields |= current.heading != previous.heading ? compact_heading : 0;
+        fields |= current.horizontal_velocity != previous.horizontal_velocity ? compact_horizontal_velocity : 0;
+        fields |= current.vertical_velocity != previous.vertical_velocity ? compact_vertical_velocity : 0;
+        fields |= current.squawk != previous.squawk ? compact_squawk : 0;
+        fields |= current.callsign != previous.callsign ? compact_callsign : 0;
+        fields |= current.tslc != previous.tslc ? compact_tslc : 0;
+        fields |= current.flags != previous.flags ? compact_flags : 0;
+        fields |= current.altitude_type != previous.altitude_type ? compact_altitude_type : 0;
+        fields |= current.emitter_type != previous.emitter_type ? compact_emitter_type : 0;
+    }
+
+    std::string payload;
+    put_varint(payload, icao_address);
+    put_varint(payload, current.seq);
+    put_varint(payload, keyframe ? compact_kind_keyframe : compact_kind_delta);
+    put_varint(payload, fields);
+    if (fields & compact_timestamp)
+    {
+        put_delta(payload, current.timestamp, previous.timestamp);
+    }
+    if (fields & compact_latitude)
+    {
+        put_delta(payload, current.latitude, previous.latitude);
+    }
+    if (fields & compact_longitude)
+    {
+        put_delta(payload, current.longitude, previous.longitude);
+    }
+    if (fields & compact_altitude)
+    {
+        put_delta(payload, current.altitude, previous.altitude);
+    }
+    if (fields & compact_heading)
+    {
+        put_delta(payload, current.heading, previous.heading);
+    }
+    if (fields & compact_horizontal_velocity)
+    {
+        put_delta(payload, current.horizontal_velocity, previous.horizontal_velocity);
+    }
+    if (fields & compact_vertical_velocity)
+    {
+        put_delta(payload, current.vertical_velocity, previous.vertical_velocity);
+    }
+    if (fields & compact_squawk)
+    {
+        put_varint(payload, current.squawk);
+    }
+    if (fields & compact_callsign)
+    {
+        put_varint(payload, current.callsign.length());
+        payload += current.callsign;
+    }
+    if (fields & compact_tslc)
+    {
+        put_varint(payload, current.tslc);
+    }
+    if (fields & compact_flags)
+    {
+        put_varint(payload, current.flags);
+    }
+    if (fields & compact_altitude_type)
+    {
+        put_varint(payload, current.altitude_type);
+    }
+    if (fields & compact_emitter_type)
+    {
+        put_varint(payload, current.emitter_type);
+    }
+
+    this->streams[icao_address] = current;
+    return std::make_shared<fss_message_position_compact>(payload);
+}
+
+void
+flight_safety_system::transport::fss_position_encoder::reset()
+{
+    this->streams.clear();
+}
+
+auto
+flight_safety_system::transport::fss_position_decoder::decode(const std::shared_ptr<fss_message_position_compact> &msg) -> std::shared_ptr<fss_message_position_report>
+{
+    const std::string &payload = msg->getPayload();
+    size_t offset = 0;
+    uint32_t icao_address = 0;
+    uint64_t seq = 0;
+    uint64_t kind = 0;
+    uint64_t fields = 0;
+    if (!get_value(payload, offset, icao_address) || !get_varint(payload, offset, seq) || !get_varint(payload, offset, kind) || !get_varint(payload, offset, fields))
+    {
+        return nullptr;
+    }
+
+    auto stream = this->streams.find(icao_address);
+    fss_position_state state;
+    if (kind != compact_kind_keyframe)
+    {
+        if (stream == this->streams.end() || seq != stream->second.seq + 1)
+        {
+            /* Missed something, ignore this stream until the next keyframe */
+            this->gaps++;
+            if (stream != this->streams.end())
+            {
+                this->streams.erase(stream);
+            }
+            return nullptr;
+        }
+        state = stream->second;
+    }
+
+    bool valid = true;
+    if (fields & compact_timestamp)
+    {
+        valid = valid && get_delta(payload, offset, state.timestamp);
+    }
+    if (fields & compact_latitude)
+    {
+        valid = valid && get_delta(payload, offset, state.latitude);
+    }
+    if (fields & compact_longitude)
+    {
+        valid = valid && get_delta(payload, offset, state.longitude);
+    }
+    if (fields & compact_altitude)
+    {
+        valid = valid && get_delta(payload, offset, state.altitude);
+    }
+    if (fields & compact_heading)
+    {
+        valid = valid && get_delta(payload, offset, state.heading);
+    }
+    if (fields & compact_horizontal_velocity)
+    {
+        valid = valid && get_delta(payload, offset, state.horizontal_velocity);
+    }
+    if (fields & compact_vertical_velocity)
+    {
+        valid = valid && get_delta(payload, offset, state.vertical_velocity);
+    }
+    if (fields & compact_squawk)
+    {
+        valid = valid && get_value(payload, offset, state.squawk);
+    }
+    if (fields & compact_callsign)
+    {
+        uint64_t len = 0;
+        valid = valid && get_varint(payload, offset, len) && len <= payload.size() - offset;
+        if (valid)
+        {
+            state.callsign = payload.substr(offset, len);
+            offset += len;
+        }
+    }
+    if (fields & compact_tslc)
+    {
+        valid = valid && get_value(payload, offset, state.tslc);
+    }
+    if (fields & compact_flags)
+    {
+        valid = valid && get_value(payload, offset, state.flags);
+    }
+    if (fields & compact_altitude_type)
+    {
+        valid = valid && get_value(payload, offset, state.altitude_type);
+    }
+    if (fields & compact_emitter_type)
+    {
+        valid = valid && get_value(payload, offset, state.emitter_type);
+    }
+    if (!valid)
+    {
+        this->streams.erase(icao_address);
+        return nullptr;
+    }
+
+    state.seq = seq;
+    this->streams[icao_address] = state;
+    auto report = fss_make_pooled<fss_message_position_report>(((double)state.latitude) * flt_to_int, ((double)state.longitude) * flt_to_int, state.altitude,
+                                                                 state.heading, state.horizontal_velocity, state.vertical_velocity,
+                                                                 icao_address, state.callsign, state.squawk, state.tslc, state.flags,
+                                                                 state.altitude_type, state.emitter_type, state.timestamp);
+    report->setId(msg->getId());
+    return report;
+}
+
+void
+flight_safety_system::transport::fss_position_decoder::reset()
+{
+    this->streams.clear();
+}
+
+auto
+flight_safety_system::transport::fss_position_decoder::getGaps() -> uint64_t
+{
+    return this->gaps;
+}
+
 
 auto
 flight_safety_system::transport::fss_message::decode(const std::shared_ptr<buf_len> &bl) -> std::shared_ptr<flight_safety_system::transport::fss_message>
@@ -908,37 +1455,52 @@ flight_safety_system::transport::fss_message::decode(const std::shared_ptr<buf_l
         case message_type_closed:
             break;
         case message_type_identity:
-            msg = std::make_shared<fss_message_identity>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_identity>(msg_id, bl);
             break;
         case message_type_rtt_request:
-            msg = std::make_shared<fss_message_rtt_request>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_rtt_request>(msg_id, bl);
             break;
         case message_type_rtt_response:
-            msg = std::make_shared<fss_message_rtt_response>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_rtt_response>(msg_id, bl);
             break;
         case message_type_position_report:
-            msg = std::make_shared<fss_message_position_report>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_position_report>(msg_id, bl);
             break;
         case message_type_system_status:
-            msg = std::make_shared<fss_message_system_status>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_system_status>(msg_id, bl);
             break;
         case message_type_search_status:
-            msg = std::make_shared<fss_message_search_status>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_search_status>(msg_id, bl);
             break;
         case message_type_command:
-            msg = std::make_shared<fss_message_asset_command>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_asset_command>(msg_id, bl);
             break;
         case message_type_server_list:
-            msg = std::make_shared<fss_message_server_list>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_server_list>(msg_id, bl);
             break;
         case message_type_smm_settings:
-            msg = std::make_shared<fss_message_smm_settings>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_smm_settings>(msg_id, bl);
             break;
         case message_type_identity_non_aircraft:
-            msg = std::make_shared<fss_message_identity_non_aircraft>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_identity_non_aircraft>(msg_id, bl);
             break;
         case message_type_identity_required:
-            msg = std::make_shared<fss_message_identity_required>(msg_id, bl);
+            msg = fss_make_pooled<fss_message_identity_required>(msg_id, bl);
+            break;
+        case message_type_busy:
+            msg = fss_make_pooled<fss_message_busy>(msg_id, bl);
+            break;
+        case message_type_position_compact:
+            msg = fss_make_pooled<fss_message_position_compact>(msg_id, bl);
+            break;
+        case message_type_batch:
+            msg = fss_make_pooled<fss_message_batch>(msg_id, bl);
+            break;
+        case message_type_datagram_request:
+            msg = fss_make_pooled<fss_message_datagram_request>(msg_id, bl);
+            break;
+        case message_type_datagram_offer:
+            msg = fss_make_pooled<fss_message_datagram_offer>(msg_id, bl);
             break;
     }
     
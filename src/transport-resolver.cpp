@@ -0,0 +1,232 @@
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "fss-transport.hpp"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+static auto
+lookup_addresses(const std::string &name, int flags) -> std::vector<struct sockaddr_storage>
+{
+    std::vector<struct sockaddr_storage> addresses;
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = flags;
+    struct addrinfo *ai = nullptr;
+
+    if (getaddrinfo(name.c_str(), nullptr, &hints, &ai) == 0)
+    {
+        for (auto cur = ai; cur != nullptr; cur = cur->ai_next)
+        {
+            if (cur->ai_family != AF_INET && cur->ai_family != AF_INET6)
+            {
+                continue;
+            }
+            struct sockaddr_storage sa = {};
+            memcpy(&sa, cur->ai_addr, cur->ai_addrlen);
+            addresses.push_back(sa);
+        }
+        freeaddrinfo(ai);
+    }
+
+    return addresses;
+}
+
+static void
+set_port(std::vector<struct sockaddr_storage> &addresses, uint16_t port)
+{
+    for (auto &sa : addresses)
+    {
+        switch (sa.ss_family)
+        {
+            case AF_INET:
+            {
+                auto sa_in = reinterpret_cast<struct sockaddr_in *>(&sa);
+                sa_in->sin_port = htons(port);
+            } break;
+            case AF_INET6:
+            {
+                auto sa_in = reinterpret_cast<struct sockaddr_in6 *>(&sa);
+                sa_in->sin6_port = htons(port);
+            } break;
+        }
+    }
+}
+
+/* Passed by reference through make_shared, so they need storage */
+constexpr size_t flight_safety_system::transport::fss_resolver::default_workers;
+constexpr uint64_t flight_safety_system::transport::fss_resolver::default_ttl;
+constexpr uint64_t flight_safety_system::transport::fss_resolver::default_negative_ttl;
+
+auto
+flight_safety_system::transport::fss_resolver::getResolver() -> std::shared_ptr<fss_resolver>
+{
+    static auto resolver = std::make_shared<fss_resolver>(default_workers, default_ttl, default_negative_ttl);
+    return resolver;
+}
+
+flight_safety_system::transport::fss_resolver::fss_resolver(size_t t_workers, uint64_t t_ttl, uint64_t t_negative_ttl) : ttl(t_ttl), negative_ttl(t_negative_ttl)
+{
+    for (size_t i = 0; i < t_workers; i++)
+    {
+        this->workers.emplace_back([this]() { this->processLookups(); });
+    }
+}
+
+flight_safety_system::transport::fss_resolver::~fss_resolver()
+{
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        this->run = false;
+    }
+    this->work.notify_all();
+    for (auto &worker : this->workers)
+    {
+        worker.join();
+    }
+}
+
+void
+flight_safety_system::transport::fss_resolver::queueLookup(const std::string &name, entry &e)
+{
+    if (!e.queued)
+    {
+        e.queued = true;
+        this->queue.push_back(name);
+        this->work.notify_one();
+    }
+}
+
+void
+flight_safety_system::transport::fss_resolver::processLookups()
+{
+    std::unique_lock<std::mutex> lock_holder(this->lock);
+    while (this->run)
+    {
+        if (this->queue.empty())
+        {
+            this->work.wait(lock_holder);
+            continue;
+        }
+        auto name = this->queue.front();
+        this->queue.pop_front();
+
+        lock_holder.unlock();
+        auto addresses = lookup_addresses(name, 0);
+        lock_holder.lock();
+
+        auto now = std::chrono::steady_clock::now();
+        auto &e = this->cache[name];
+        e.queued = false;
+        e.resolved = true;
+        if (addresses.empty())
+        {
+            /* Keep any previous answer, it is better than nothing while the resolver is down */
+            this->stats.failures++;
+            e.expires = now + this->negative_ttl;
+            e.refresh = e.expires;
+        }
+        else
+        {
+            e.addresses = addresses;
+            e.expires = now + this->ttl;
+            /* Refresh a little before expiry so users never see the entry lapse */
+            e.refresh = now + this->ttl - this->ttl / 4;
+        }
+        this->done.notify_all();
+    }
+}
+
+auto
+flight_safety_system::transport::fss_resolver::resolve(const std::string &name, uint16_t port, uint64_t wait) -> std::vector<struct sockaddr_storage>
+{
+    /* Literal addresses don't need the cache */
+    auto addresses = lookup_addresses(name, AI_NUMERICHOST);
+    if (addresses.empty())
+    {
+        std::unique_lock<std::mutex> lock_holder(this->lock);
+        auto now = std::chrono::steady_clock::now();
+        this->stats.lookups++;
+        auto &e = this->cache[name];
+        if (e.resolved)
+        {
+            if (now >= e.refresh)
+            {
+                this->queueLookup(name, e);
+            }
+            if (e.addresses.empty())
+            {
+                this->stats.negative_hits++;
+            }
+            else if (now >= e.expires)
+            {
+                this->stats.stale_hits++;
+            }
+            else
+            {
+                this->stats.cache_hits++;
+            }
+        }
+        else
+        {
+            this->stats.misses++;
+            this->queueLookup(name, e);
+            this->done.wait_for(lock_holder, std::chrono::milliseconds(wait), [this, &name]() {
+                auto it = this->cache.find(name);
+                return it != this->cache.end() && it->second.resolved;
+            });
+        }
+        auto it = this->cache.find(name);
+        if (it != this->cache.end())
+        {
+            addresses = it->second.addresses;
+        }
+    }
+    set_port(addresses, port);
+    return addresses;
+}
+
+void
+flight_safety_system::transport::fss_resolver::prefetch(const std::string &name)
+{
+    if (!lookup_addresses(name, AI_NUMERICHOST).empty())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    auto &e = this->cache[name];
+    if (!e.resolved || std::chrono::steady_clock::now() >= e.refresh)
+    {
+        this->queueLookup(name, e);
+    }
+}
+
+void
+flight_safety_system::transport::fss_resolver::flush()
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    for (auto it = this->cache.begin(); it != this->cache.end();)
+    {
+        if (it->second.queued)
+        {
+            ++it;
+        }
+        else
+        {
+            it = this->cache.erase(it);
+        }
+    }
+}
+
+auto
+flight_safety_system::transport::fss_resolver::getStats() -> fss_resolver_stats
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->stats;
+}
@@ -1,16 +1,61 @@
 #include "fss-transport-ssl.hpp"
 #include "fss-transport.hpp"
+#include "fss.hpp"
 #include "transport.hpp"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <gnutls/gnutls.h>
 #include <gnutls/gnutlsxx.h>
 #include <gnutls/x509.h>
 #include <memory>
 #include <ostream>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <thread>
 #include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <cerrno>
+
+auto
+flight_safety_system::transport_ssl::peer_certificate_names(gnutls_session_t session) -> std::list<std::string>
+{
+    std::list<std::string> names;
+    unsigned int cert_count = 0;
+    const gnutls_datum_t *cert_list = gnutls_certificate_get_peers(session, &cert_count);
+
+    for (unsigned int idx = 0; cert_list != nullptr && idx < cert_count; idx++)
+    {
+        gnutls_x509_crt_t cert_data = {};
+
+        gnutls_x509_crt_init(&cert_data);
+
+        gnutls_x509_crt_import(cert_data, &cert_list[idx], GNUTLS_X509_FMT_DER);
+
+        const size_t dn_max_len = 512;
+        char name_buf[dn_max_len];
+        size_t dn_len = dn_max_len;
+        gnutls_x509_crt_get_dn (cert_data, name_buf, &dn_len);
+        std::string name = std::string(name_buf);
+        /* Locate the CN=<name> section */
+        std::size_t found = name.find("CN=");
+        if (found != std::string::npos)
+        {
+            name.erase(0, found+3);
+            /* Strip off any extra data (like ,O=...) */
+            found = name.find(',');
+            if (found != std::string::npos)
+            {
+                name.erase(found);
+            }
+            names.push_back(name);
+        }
+        gnutls_x509_crt_deinit(cert_data);
+    }
+    return names;
+}
 
 static void
 recv_msg_thread(flight_safety_system::transport_ssl::fss_connection *conn)
@@ -18,28 +63,215 @@ recv_msg_thread(flight_safety_system::transport_ssl::fss_connection *conn)
     conn->processMessages();
 }
 
-flight_safety_system::transport_ssl::fss_connection::fss_connection(std::string t_ca, std::string t_private_key, std::string t_public_key) : flight_safety_system::transport::fss_connection(), ca_file(std::move(t_ca)), private_key_file(std::move(t_private_key)), public_key_file(std::move(t_public_key))
+flight_safety_system::transport_ssl::fss_session_tickets::fss_session_tickets(uint64_t t_lifetime, uint64_t t_key_rotation, bool t_early_data) : lifetime(t_lifetime), key_rotation(t_key_rotation), early_data(t_early_data)
 {
+    if (this->early_data)
+    {
+        /* 0-RTT data can be replayed, so gnutls requires an anti-replay database before accepting it */
+        if (gnutls_anti_replay_init(&this->anti_replay) < 0)
+        {
+            std::cerr << "Failed to setup anti-replay, early data disabled" << std::endl;
+            this->anti_replay = nullptr;
+            this->early_data = false;
+        }
+        else
+        {
+            gnutls_anti_replay_set_add_function(this->anti_replay, antiReplayAdd);
+            gnutls_anti_replay_set_ptr(this->anti_replay, this);
+        }
+    }
 }
 
-flight_safety_system::transport_ssl::fss_connection::fss_connection(int t_fd, std::string t_ca, std::string t_private_key, std::string t_public_key) : flight_safety_system::transport::fss_connection(t_fd), ca_file(std::move(t_ca)), private_key_file(std::move(t_private_key)), public_key_file(std::move(t_public_key))
+flight_safety_system::transport_ssl::fss_session_tickets::~fss_session_tickets()
 {
+    if (this->key.data != nullptr)
+    {
+        gnutls_memset(this->key.data, 0, this->key.size);
+        gnutls_free(this->key.data);
+        this->key.data = nullptr;
+    }
+    if (this->anti_replay != nullptr)
+    {
+        gnutls_anti_replay_deinit(this->anti_replay);
+        this->anti_replay = nullptr;
+    }
 }
 
-flight_safety_system::transport_ssl::fss_connection::~fss_connection() = default;
+auto
+flight_safety_system::transport_ssl::fss_session_tickets::antiReplayAdd(void *ptr, time_t exp_time, const gnutls_datum_t *t_key, const gnutls_datum_t *data __attribute__((unused))) -> int
+{
+    auto tickets = static_cast<flight_safety_system::transport_ssl::fss_session_tickets *>(ptr);
+    std::lock_guard<std::mutex> lock_holder(tickets->lock);
+    time_t now = time(nullptr);
+    for (auto it = tickets->seen_early_data.begin(); it != tickets->seen_early_data.end();)
+    {
+        if (it->second < now)
+        {
+            it = tickets->seen_early_data.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    std::string entry(reinterpret_cast<const char *>(t_key->data), t_key->size);
+    if (tickets->seen_early_data.find(entry) != tickets->seen_early_data.end())
+    {
+        return GNUTLS_E_DB_ENTRY_EXISTS;
+    }
+    tickets->seen_early_data[entry] = exp_time;
+    return 0;
+}
 
-flight_safety_system::transport_ssl::fss_connection_client::~fss_connection_client()
+void
+flight_safety_system::transport_ssl::fss_session_tickets::rotateKey(uint64_t ts)
 {
-    if (this->usable)
+    if (this->key.data != nullptr)
     {
-        try
+        gnutls_memset(this->key.data, 0, this->key.size);
+        gnutls_free(this->key.data);
+        this->key.data = nullptr;
+        this->key.size = 0;
+    }
+    if (gnutls_session_ticket_key_generate(&this->key) < 0)
+    {
+        std::cerr << "Failed to generate session ticket key" << std::endl;
+        this->key.data = nullptr;
+        this->key.size = 0;
+    }
+    this->key_generated = ts;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_session_tickets::earlyData() -> bool
+{
+    return this->early_data;
+}
+
+void
+flight_safety_system::transport_ssl::fss_session_tickets::enable(gnutls_session_t session)
+{
+    constexpr uint64_t sec_to_msec = 1000;
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    uint64_t ts = fss_monotonic_timestamp();
+    /* gnutls rotates the keys it derives from the master key every ticket lifetime,
+       replacing the master key as well invalidates every ticket issued so far */
+    if (this->key.data == nullptr || (this->key_rotation != 0 && ts - this->key_generated > this->key_rotation * sec_to_msec))
+    {
+        this->rotateKey(ts);
+    }
+    if (this->key.data == nullptr)
+    {
+        return;
+    }
+    /* The key is copied into the session */
+    gnutls_session_ticket_enable_server(session, &this->key);
+    gnutls_db_set_cache_expiration(session, this->lifetime);
+    if (this->early_data)
+    {
+        gnutls_record_set_max_early_data_size(session, max_early_data_size);
+        gnutls_anti_replay_enable(session, this->anti_replay);
+    }
+}
+
+flight_safety_system::transport_ssl::fss_credentials::fss_credentials(std::string t_ca, std::string t_private_key, std::string t_public_key) : ca_file(std::move(t_ca)), private_key_file(std::move(t_private_key)), public_key_file(std::move(t_public_key))
+{
+    if (!this->reload())
+    {
+        /* Handshakes will fail until the files can be loaded */
+        this->current = std::make_shared<gnutls::certificate_credentials>();
+    }
+}
+
+flight_safety_system::transport_ssl::fss_credentials::~fss_credentials() = default;
+
+auto
+flight_safety_system::transport_ssl::fss_credentials::filesState() -> std::string
+{
+    std::string state;
+    for (const auto &file : {this->ca_file, this->private_key_file, this->public_key_file})
+    {
+        struct stat st = {};
+        if (stat(file.c_str(), &st) == 0)
         {
-            this->session.bye(GNUTLS_SHUT_WR);
+            /* Replacing a file by renaming over it changes the inode */
+            state += std::to_string(st.st_ino) + ":" + std::to_string(st.st_mtime) + ":" + std::to_string(st.st_size) + ";";
         }
-        catch (gnutls::exception &ex)
+        else
+        {
+            state += "-;";
+        }
+    }
+    return state;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_credentials::reload() -> bool
+{
+    std::string state = this->filesState();
+    auto creds = std::make_shared<gnutls::certificate_credentials>();
+    try
+    {
+        creds->set_x509_trust_file(this->ca_file.c_str(), GNUTLS_X509_FMT_PEM);
+        creds->set_x509_key_file(this->public_key_file.c_str(), this->private_key_file.c_str(), GNUTLS_X509_FMT_PEM);
+    }
+    catch (gnutls::exception &e)
+    {
+        std::cerr << "Failed to load TLS credentials: " << e.what() << std::endl;
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        /* Don't retry until the files change again */
+        this->files_state = state;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    this->current = std::move(creds);
+    this->files_state = state;
+    return true;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_credentials::get() -> std::shared_ptr<gnutls::certificate_credentials>
+{
+    uint64_t ts = fss_monotonic_timestamp();
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        if (ts - this->last_checked > check_interval)
         {
-            std::cerr << "fss_connection shutdown, gnutls exception during bye" << std::endl;
+            this->last_checked = ts;
+            changed = this->filesState() != this->files_state;
         }
+    }
+    if (changed)
+    {
+        this->reload();
+    }
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->current;
+}
+
+constexpr unsigned int flight_safety_system::transport_ssl::fss_connection::default_handshake_timeout;
+constexpr unsigned int flight_safety_system::transport_ssl::fss_connection::max_retries;
+
+flight_safety_system::transport_ssl::fss_connection::fss_connection(std::string t_ca, std::string t_private_key, std::string t_public_key) : fss_connection(std::make_shared<fss_credentials>(std::move(t_ca), std::move(t_private_key), std::move(t_public_key)))
+{
+}
+
+flight_safety_system::transport_ssl::fss_connection::fss_connection(int t_fd, std::string t_ca, std::string t_private_key, std::string t_public_key) : flight_safety_system::transport::fss_connection(t_fd), store(std::make_shared<fss_credentials>(std::move(t_ca), std::move(t_private_key), std::move(t_public_key)))
+{
+}
+
+flight_safety_system::transport_ssl::fss_connection::fss_connection(std::shared_ptr<fss_credentials> t_store) : flight_safety_system::transport::fss_connection(), store(std::move(t_store))
+{
+}
+
+flight_safety_system::transport_ssl::fss_connection::~fss_connection() = default;
+
+flight_safety_system::transport_ssl::fss_connection_client::~fss_connection_client()
+{
+    if (this->usable)
+    {
+        this->closeSession(this->session);
         this->usable = false;
     }
     this->disconnect();
@@ -49,22 +281,20 @@ flight_safety_system::transport_ssl::fss_connection_server::~fss_connection_serv
 {
     if (this->usable)
     {
-        try
-        {
-            this->session.bye(GNUTLS_SHUT_WR);
-        }
-        catch (gnutls::exception &ex)
-        {
-            std::cerr << "fss_connection shutdown, gnutls exception during bye" << std::endl;
-        }
+        this->closeSession(this->session);
         this->usable = false;
     }
     this->disconnect();
 }
 
-flight_safety_system::transport_ssl::fss_connection_server::fss_connection_server(int t_fd, std::string t_ca, std::string t_private_key, std::string t_public_key) : flight_safety_system::transport_ssl::fss_connection(std::move(t_ca), std::move(t_private_key), std::move(t_public_key))
+flight_safety_system::transport_ssl::fss_connection_server::fss_connection_server(int t_fd, std::string t_ca, std::string t_private_key, std::string t_public_key) : fss_connection_server(t_fd, std::make_shared<fss_credentials>(std::move(t_ca), std::move(t_private_key), std::move(t_public_key)), nullptr)
+{
+}
+
+flight_safety_system::transport_ssl::fss_connection_server::fss_connection_server(int t_fd, std::shared_ptr<fss_credentials> t_store, std::shared_ptr<fss_session_tickets> t_tickets, unsigned int t_handshake_timeout, bool t_kernel_tls) : flight_safety_system::transport_ssl::fss_connection(std::move(t_store)), session(t_tickets != nullptr && t_tickets->earlyData() ? GNUTLS_ENABLE_EARLY_DATA : 0), tickets(std::move(t_tickets)), handshake_timeout(t_handshake_timeout)
 {
     this->setFd(t_fd);
+    this->kernel_tls = t_kernel_tls;
     this->usable = this->setupSSL();
     if (this->usable)
     {
@@ -72,40 +302,135 @@ flight_safety_system::transport_ssl::fss_connection_server::fss_connection_serve
     }
 }
 
-flight_safety_system::transport_ssl::fss_connection_client::fss_connection_client(std::string t_ca, std::string t_private_key, std::string t_public_key) : fss_connection(std::move(t_ca), std::move(t_private_key), std::move(t_public_key)), session{}
+flight_safety_system::transport_ssl::fss_connection_client::fss_connection_client(std::string t_ca, std::string t_private_key, std::string t_public_key, bool t_early_data) : fss_connection_client(std::make_shared<fss_credentials>(std::move(t_ca), std::move(t_private_key), std::move(t_public_key)), t_early_data)
 {
 }
 
+flight_safety_system::transport_ssl::fss_connection_client::fss_connection_client(std::shared_ptr<fss_credentials> t_store, bool t_early_data) : fss_connection(std::move(t_store)), session(t_early_data ? GNUTLS_ENABLE_EARLY_DATA : 0)
+{
+    this->session.set_user_ptr(this);
+    gnutls_handshake_set_hook_function(this->session.ptr(), GNUTLS_HANDSHAKE_NEW_SESSION_TICKET, GNUTLS_HOOK_POST, ticketHook);
+}
+
 auto
-flight_safety_system::transport_ssl::fss_connection_client::connectTo(const std::string &address, uint16_t port) -> bool
+flight_safety_system::transport_ssl::fss_connection_client::ticketHook(gnutls_session_t t_session, unsigned int htype __attribute__((unused)), unsigned when __attribute__((unused)), unsigned int incoming, const gnutls_datum_t *msg __attribute__((unused))) -> int
 {
-    this->hostname = address;
-    struct sockaddr_storage remote = {};
-    if (!convert_str_to_sa (address, port, &remote))
+    auto conn = static_cast<flight_safety_system::transport_ssl::fss_connection_client *>(gnutls_session_get_ptr(t_session));
+    if (conn != nullptr && incoming)
     {
-        std::cerr << "Failed to convert '" << address << "' to a usable address\n";
-        return false;
+        conn->ticket_received = true;
+    }
+    return 0;
+}
+
+/* change_cipher_spec, the lowest TLS record content type */
+static constexpr unsigned char tls_min_content_type = 20;
+
+auto
+flight_safety_system::transport_ssl::fss_connection_client::pullHook(gnutls_transport_ptr_t ptr, void *data, size_t len) -> ssize_t
+{
+    return static_cast<flight_safety_system::transport_ssl::fss_connection_client *>(ptr)->pullBytes(data, len);
+}
+
+auto
+flight_safety_system::transport_ssl::fss_connection_client::pullTimeoutHook(gnutls_transport_ptr_t ptr, unsigned int ms) -> int
+{
+    auto conn = static_cast<flight_safety_system::transport_ssl::fss_connection_client *>(ptr);
+    struct pollfd pfd = {conn->getFd(), POLLIN, 0};
+    return poll(&pfd, 1, ms == GNUTLS_INDEFINITE_TIMEOUT ? -1 : static_cast<int>(ms));
+}
+
+auto
+flight_safety_system::transport_ssl::fss_connection_client::pullBytes(void *data, size_t len) -> ssize_t
+{
+    if (!this->checked_reply)
+    {
+        this->checked_reply = true;
+        /* TLS records start with a content type of at least 20,
+           a server turning us away sends a plain fss message instead */
+        unsigned char first = 0;
+        if (recv(this->getFd(), &first, 1, MSG_PEEK) == 1 && first < tls_min_content_type)
+        {
+            std::string frame(sizeof(uint16_t), '\0');
+            if (recv(this->getFd(), &frame[0], frame.size(), MSG_WAITALL) == static_cast<ssize_t>(frame.size()))
+            {
+                size_t length = ntohs(*reinterpret_cast<const uint16_t *>(frame.data()));
+                if (length % sizeof(uint64_t) != 0)
+                {
+                    length += sizeof(uint64_t) - (length % sizeof(uint64_t));
+                }
+                frame.resize(length);
+                if (length >= flight_safety_system::transport::fss_message::header_length && recv(this->getFd(), &frame[sizeof(uint16_t)], length - sizeof(uint16_t), MSG_WAITALL) == static_cast<ssize_t>(length - sizeof(uint16_t)))
+                {
+                    auto bl = std::make_shared<flight_safety_system::transport::buf_len>();
+                    bl->addData(frame.data(), frame.size());
+                    auto msg = flight_safety_system::transport::fss_message::decode(bl);
+                    if (msg != nullptr && msg->getType() == flight_safety_system::transport::message_type_busy)
+                    {
+                        this->retry_after = std::static_pointer_cast<flight_safety_system::transport::fss_message_busy>(msg)->getRetryAfter();
+                    }
+                }
+            }
+            errno = ECONNREFUSED;
+            return -1;
+        }
     }
+    return recv(this->getFd(), data, len, 0);
+}
 
-#ifdef DEBUG
-        char addr_str[INET6_ADDRSTRLEN];
-        uint16_t client_port;
-        inet_ntop_stor(&remote, addr_str, INET6_ADDRSTRLEN, &client_port);
-        std::cout << "Trying to connect to " << address << " (" << addr_str << "):" << port << std::endl;
-#endif
+auto
+flight_safety_system::transport_ssl::fss_connection_client::getRetryAfter() -> uint64_t
+{
+    return this->retry_after;
+}
 
-    if (this->getFd() == -1)
+void
+flight_safety_system::transport_ssl::fss_connection_client::setResumeData(const std::string &data)
+{
+    this->resume_data = data;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_connection_client::getResumeData() -> std::string
+{
+    /* Only ask gnutls once a ticket has arrived, otherwise it would wait for one on the socket */
+    if (this->ticket_received)
     {
-        this->setFd(socket(remote.ss_family == AF_INET ? PF_INET : PF_INET6, SOCK_STREAM, IPPROTO_TCP));
+        gnutls_datum_t data = {nullptr, 0};
+        if (gnutls_session_get_data2(this->session.ptr(), &data) == 0)
+        {
+            this->resume_data.assign(reinterpret_cast<const char *>(data.data), data.size);
+            gnutls_free(data.data);
+        }
     }
+    return this->resume_data;
+}
 
-    // Limit the total number of SYN's that are sent
-    int synRetries = 2;
-    setsockopt(this->getFd(), IPPROTO_TCP, TCP_SYNCNT, &synRetries, sizeof(synRetries));
+void
+flight_safety_system::transport_ssl::fss_connection_client::setEarlyMsg(const std::shared_ptr<flight_safety_system::transport::fss_message> &msg)
+{
+    msg->setId(this->getMessageId());
+    this->early_data = msg->getPacked();
+}
 
-    if (connect(this->getFd(), reinterpret_cast<struct sockaddr *>(&remote), remote.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6)) < 0)
+auto
+flight_safety_system::transport_ssl::fss_connection_client::isResumed() -> bool
+{
+    return this->usable && gnutls_session_is_resumed(this->session.ptr()) != 0;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_connection_client::earlyDataAccepted() -> bool
+{
+    return this->usable && this->early_data != nullptr && (gnutls_session_get_flags(this->session.ptr()) & GNUTLS_SFLAGS_EARLY_DATA) != 0;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_connection_client::connectTo(const std::string &address, uint16_t port) -> bool
+{
+    this->hostname = address;
+    if (!this->connectSocket(address, port))
     {
-        perror(("Failed to connect to " + address).c_str());
         return false;
     }
 
@@ -124,13 +449,61 @@ flight_safety_system::transport_ssl::fss_connection::setupSession(gnutls::sessio
 {
     session.set_priority (nullptr, nullptr);
 
-    this->credentials.set_x509_trust_file(this->ca_file.c_str(), GNUTLS_X509_FMT_PEM);
-    this->credentials.set_x509_key_file(this->public_key_file.c_str(), this->private_key_file.c_str(), GNUTLS_X509_FMT_PEM);
-    session.set_credentials(this->credentials);
+    /* Hold on to this set of credentials for the life of the session */
+    if (this->store != nullptr)
+    {
+        this->credentials = this->store->get();
+        session.set_credentials(*this->credentials);
+    }
 
     session.set_transport_ptr((gnutls_transport_ptr_t)(intptr_t)this->getFd());
 }
 
+auto
+flight_safety_system::transport_ssl::fss_connection::handshakeSession(gnutls::session &session, unsigned int timeout) -> int
+{
+    if (timeout == 0)
+    {
+        timeout = default_handshake_timeout;
+    }
+    /* GnuTLS enforces this while it waits for the peer, the deadline covers the calls between */
+    gnutls_handshake_set_timeout(session.ptr(), timeout);
+    uint64_t deadline = fss_monotonic_timestamp() + timeout;
+    unsigned int retries = 0;
+    int ret = -1;
+    bool retry = true;
+    while (retry)
+    {
+        retry = false;
+        try
+        {
+            ret = session.handshake();
+        }
+        catch (gnutls::exception &e)
+        {
+            /* A server accepting early data returns to the caller part way through the handshake */
+            if (e.get_code() == GNUTLS_E_AGAIN || e.get_code() == GNUTLS_E_INTERRUPTED)
+            {
+                if (++retries > max_retries || fss_monotonic_timestamp() > deadline)
+                {
+                    std::cerr << "TLS error: handshake stalled" << std::endl;
+                    ret = GNUTLS_E_TIMEDOUT;
+                }
+                else
+                {
+                    retry = true;
+                }
+            }
+            else
+            {
+                std::cerr << "TLS error: " << e.what() << std::endl;
+                ret = e.get_code();
+            }
+        }
+    }
+    return ret;
+}
+
 auto
 flight_safety_system::transport_ssl::fss_connection_client::setupSSL() -> bool
 {
@@ -138,21 +511,47 @@ flight_safety_system::transport_ssl::fss_connection_client::setupSSL() -> bool
 
     this->session.set_verify_cert(this->hostname.c_str(), 0);
 
-    int ret = -2;
-    try
-    {
-        ret = this->session.handshake();
-    }
-    catch (gnutls::exception &e)
+    /* Read through pullBytes so a busy reply from the server can be recognised */
+    gnutls_transport_set_ptr2(this->session.ptr(), this, (gnutls_transport_ptr_t)(intptr_t)this->getFd());
+    gnutls_transport_set_pull_function(this->session.ptr(), pullHook);
+    gnutls_transport_set_pull_timeout_function(this->session.ptr(), pullTimeoutHook);
+
+    if (!this->resume_data.empty())
     {
-        std::cerr << "TLS error: " << e.what() << std::endl;
+        try
+        {
+            this->session.set_data(this->resume_data.data(), this->resume_data.size());
+            if (this->early_data != nullptr)
+            {
+                gnutls_record_send_early_data(this->session.ptr(), this->early_data->getData(), this->early_data->getLength());
+            }
+        }
+        catch (gnutls::exception &e)
+        {
+            /* Fall back to a full handshake */
+            std::cerr << "TLS resume error: " << e.what() << std::endl;
+        }
     }
+
+    int ret = this->handshakeSession(this->session, 0);
     if (ret < 0)
     {
-        std::cerr << "Failed to hand shake: " << ret << std::endl;
+        if (this->retry_after != 0)
+        {
+            std::cerr << "Server busy, retry after " << this->retry_after << "ms" << std::endl;
+        }
+        else
+        {
+            std::cerr << "Failed to hand shake: " << ret << std::endl;
+        }
         return false;
     }
 
+    /* Under TLS 1.3 the session tickets follow the handshake, so GnuTLS keeps
+       reading until the first of the server's own records has arrived */
+    this->offload_recv_pending = gnutls_protocol_get_version(this->session.ptr()) == GNUTLS_TLS1_3;
+    this->offloadSession(this->session, true, !this->offload_recv_pending);
+
     return true;
 }
 
@@ -163,56 +562,42 @@ flight_safety_system::transport_ssl::fss_connection_server::setupSSL() -> bool
 
     this->session.set_certificate_request(GNUTLS_CERT_REQUIRE);
 
-    int ret = -1;
-    try
-    {
-        ret = this->session.handshake();
-    }
-    catch(gnutls::exception &e)
+    if (this->tickets != nullptr)
     {
-        std::cerr << "TLS error: " << e.what() << std::endl;
+        this->tickets->enable(this->session.ptr());
     }
+
+    int ret = this->handshakeSession(this->session, this->handshake_timeout);
     if (ret < 0)
     {
         std::cerr << "Failed to hand shake: " << ret << std::endl;
         return false;
     }
 
-    std::vector<gnutls_datum_t> cert_list;
+    this->readEarlyData();
 
-    if (this->session.get_peers_certificate(cert_list))
-    {
-        for (auto cert : cert_list)
-        {
-            gnutls_x509_crt_t cert_data = {};
+    /* Anything the client sent straight after the handshake has to be taken from GnuTLS first */
+    this->offloadSession(this->session, true, gnutls_record_check_pending(this->session.ptr()) == 0);
 
-            gnutls_x509_crt_init(&cert_data);
+    this->possible_names = peer_certificate_names(this->session.ptr());
 
-            gnutls_x509_crt_import(cert_data, &cert, GNUTLS_X509_FMT_DER);
+    return true;
+}
 
-            const size_t dn_max_len = 512;
-            char name_buf[dn_max_len];
-            size_t dn_len = dn_max_len;
-            gnutls_x509_crt_get_dn (cert_data, name_buf, &dn_len);
-            std::string name = std::string(name_buf);
-            /* Locate the CN=<name> section */
-            std::size_t found = name.find("CN=");
-            if (found != std::string::npos)
-            {
-                name.erase(0, found+3);
-                /* Strip off any extra data (like ,O=...) */
-                found = name.find(',');
-                if (found != std::string::npos)
-                {
-                    name.erase(found);
-                }
-                this->possible_names.push_back(name);
-            }
-            gnutls_x509_crt_deinit(cert_data);
-        }
+void
+flight_safety_system::transport_ssl::fss_connection_server::readEarlyData()
+{
+    if ((gnutls_session_get_flags(this->session.ptr()) & GNUTLS_SFLAGS_EARLY_DATA) == 0)
+    {
+        return;
+    }
+    /* Early data is queued ahead of the normal records, so it is consumed by recvBytes first */
+    char buf[fss_session_tickets::max_early_data_size];
+    ssize_t ret = 0;
+    while ((ret = gnutls_record_recv_early_data(this->session.ptr(), buf, sizeof(buf))) > 0)
+    {
+        this->early_data.append(buf, ret);
     }
-
-    return true;
 }
 
 auto
@@ -225,6 +610,10 @@ flight_safety_system::transport_ssl::fss_connection::sendSessionMsg(gnutls::sess
     }
     size_t to_send = bl->getLength();
     const char *data = bl->getData();
+    if (this->kernel_send)
+    {
+        return this->kernelSend(data, to_send);
+    }
     try
     {
         session.send(data, to_send);
@@ -256,14 +645,40 @@ flight_safety_system::transport_ssl::fss_connection::recvSessionBytes(gnutls::se
         std::cerr << "Attempt to recv on unusable transport_ssl::fss_connection" << std::endl;
         return -1;
     }
-    ssize_t bytes_recved = -1;
-    try
+    if (this->kernel_recv)
     {
-        bytes_recved = session.recv(t_bytes, t_max_bytes);
+        return this->kernelRecv(t_bytes, t_max_bytes);
     }
-    catch (gnutls::exception &ex)
+    ssize_t bytes_recved = -1;
+    unsigned int retries = 0;
+    bool retry = true;
+    while (retry)
     {
-        std::cerr << "recv: caught gnutls exception: " << ex.get_code() << ", " << ex.what() << std::endl;
+        retry = false;
+        try
+        {
+            bytes_recved = session.recv(t_bytes, t_max_bytes);
+        }
+        catch (gnutls::exception &ex)
+        {
+            /* Post-handshake messages (e.g. TLS1.3 session tickets) are consumed and reported as try again,
+               but a peer sending nothing else is going nowhere */
+            if (ex.get_code() == GNUTLS_E_AGAIN || ex.get_code() == GNUTLS_E_INTERRUPTED)
+            {
+                if (++retries > max_retries)
+                {
+                    std::cerr << "recv: no data after " << max_retries << " retries" << std::endl;
+                }
+                else
+                {
+                    retry = true;
+                }
+            }
+            else
+            {
+                std::cerr << "recv: caught gnutls exception: " << ex.get_code() << ", " << ex.what() << std::endl;
+            }
+        }
     }
     return bytes_recved;
 }
@@ -271,25 +686,75 @@ flight_safety_system::transport_ssl::fss_connection::recvSessionBytes(gnutls::se
 auto
 flight_safety_system::transport_ssl::fss_connection_client::recvBytes(void *t_bytes, size_t t_max_bytes) -> ssize_t
 {
-    return this->recvSessionBytes(this->session, t_bytes, t_max_bytes);
+    ssize_t bytes_recved = this->recvSessionBytes(this->session, t_bytes, t_max_bytes);
+    if (this->offload_recv_pending && bytes_recved > 0 && gnutls_record_check_pending(this->session.ptr()) == 0)
+    {
+        this->offload_recv_pending = false;
+        this->offloadSession(this->session, false, true);
+    }
+    return bytes_recved;
 }
 
 auto
 flight_safety_system::transport_ssl::fss_connection_server::recvBytes(void *t_bytes, size_t t_max_bytes) -> ssize_t
 {
+    if (this->early_data_offset < this->early_data.size())
+    {
+        size_t len = std::min(t_max_bytes, this->early_data.size() - this->early_data_offset);
+        memcpy(t_bytes, this->early_data.data() + this->early_data_offset, len);
+        this->early_data_offset += len;
+        return static_cast<ssize_t>(len);
+    }
     return this->recvSessionBytes(this->session, t_bytes, t_max_bytes);
 }
+
 auto
 flight_safety_system::transport_ssl::fss_listen::newConnection(int t_newfd) -> std::shared_ptr<flight_safety_system::transport::fss_connection>
 {
-    return std::make_shared<flight_safety_system::transport_ssl::fss_connection_server>(t_newfd, this->ca_file, this->private_key_file, this->public_key_file);
+    auto handshakes = this->getHandshakePool();
+    return std::make_shared<flight_safety_system::transport_ssl::fss_connection_server>(t_newfd, this->store, this->tickets, handshakes != nullptr ? handshakes->getTimeout() : 0, this->kernel_tls);
+}
+
+flight_safety_system::transport_ssl::fss_listen::fss_listen(uint16_t t_port, flight_safety_system::transport::fss_connect_cb t_cb, std::string t_ca, std::string t_private_key, std::string t_public_key) : fss_listen(t_port, t_cb, std::move(t_ca), std::move(t_private_key), std::move(t_public_key), nullptr)
+{
+}
+
+flight_safety_system::transport_ssl::fss_listen::fss_listen(uint16_t t_port, flight_safety_system::transport::fss_connect_cb t_cb, std::string t_ca, std::string t_private_key, std::string t_public_key, std::shared_ptr<fss_session_tickets> t_tickets) : fss_listen(t_port, t_cb, std::make_shared<fss_credentials>(std::move(t_ca), std::move(t_private_key), std::move(t_public_key)), std::move(t_tickets))
+{
+}
+
+flight_safety_system::transport_ssl::fss_listen::fss_listen(uint16_t t_port, flight_safety_system::transport::fss_connect_cb t_cb, std::shared_ptr<fss_credentials> t_store, std::shared_ptr<fss_session_tickets> t_tickets) : flight_safety_system::transport::fss_listen(t_port, t_cb), store(std::move(t_store)), tickets(std::move(t_tickets))
+{
+    /* Keep the TLS handshakes out of the accept loop */
+    this->setHandshakePool(std::make_shared<flight_safety_system::transport::fss_handshake_pool>(flight_safety_system::transport::fss_handshake_pool::default_workers, flight_safety_system::transport::fss_handshake_pool::default_max_queue, flight_safety_system::transport::fss_handshake_pool::default_max_per_source, flight_safety_system::transport::fss_handshake_pool::default_timeout));
+}
+
+flight_safety_system::transport_ssl::fss_listen::~fss_listen()
+{
+    /* Stop any handshakes before the credentials and tickets go away */
+    this->disconnect();
+    this->stopHandshakePool();
+}
+
+auto
+flight_safety_system::transport_ssl::fss_listen::getCredentials() -> std::shared_ptr<fss_credentials>
+{
+    return this->store;
 }
 
-flight_safety_system::transport_ssl::fss_listen::fss_listen(uint16_t t_port, flight_safety_system::transport::fss_connect_cb t_cb, std::string t_ca, std::string t_private_key, std::string t_public_key) : flight_safety_system::transport::fss_listen(t_port, t_cb), ca_file(std::move(t_ca)), private_key_file(std::move(t_private_key)), public_key_file(std::move(t_public_key))
+void
+flight_safety_system::transport_ssl::fss_listen::setKernelTLS(bool t_kernel_tls)
 {
+    this->kernel_tls = t_kernel_tls;
 }
 
 auto flight_safety_system::transport_ssl::fss_connection_server::getClientNames() -> std::list<std::string>
 {
     return this->possible_names;
+}
+
+auto
+flight_safety_system::transport_ssl::fss_connection_server::handshakeComplete() -> bool
+{
+    return this->usable;
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include <bits/stdint-uintn.h>
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -12,6 +14,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <cstring>
 
@@ -67,6 +70,8 @@ flight_safety_system::transport::fss_connection::disconnect()
     {
         this->recv_thread.join();
     }
+    std::lock_guard<std::mutex> lock_holder(this->datagram_lock);
+    this->datagram_channel = nullptr;
 }
 
 flight_safety_system::transport::fss_connection::~fss_connection()
@@ -79,9 +84,9 @@ flight_safety_system::transport::fss_connection::~fss_connection()
     }
 }
 
-auto flight_safety_system::transport::fss_connection::getMessageId() -> uint64_t
+auto flight_safety_system::transport::fss_connection::getMessageId(uint64_t count) -> uint64_t
 {
-    return ++this->last_msg_id;
+    return (this->last_msg_id += count) - count + 1;
 }
 
 void
@@ -91,24 +96,61 @@ flight_safety_system::transport::fss_connection::processMessages()
     while (this->run)
     {
         auto msg = this->recvMsg();
-        if (msg == nullptr)
-        {
-            std::cerr << "Got a null msg" << std::endl;
-        }
-        if (msg && msg->getType() == message_type_closed)
-        {
-            std::cerr << "Remote closed the connection" << std::endl;
-            this->run = false;
-        }
-        if (this->handler != nullptr)
+        if (msg != nullptr && msg->getType() == message_type_batch)
         {
-            this->handler->processMessage(msg);
+            for (const auto &inner : std::static_pointer_cast<fss_message_batch>(msg)->getMessages())
+            {
+                this->deliverMsg(inner);
+            }
+            continue;
         }
-        else
+        this->deliverMsg(std::move(msg));
+    }
+}
+
+void
+flight_safety_system::transport::fss_connection::deliverMsg(std::shared_ptr<fss_message> msg)
+{
+    if (msg == nullptr)
+    {
+        std::cerr << "Got a null msg" << std::endl;
+    }
+    else if (msg->getType() == message_type_position_compact)
+    {
+        msg = this->position_decoder.decode(std::static_pointer_cast<fss_message_position_compact>(msg));
+        if (msg == nullptr)
         {
-            this->messages.push(msg);
+            /* Nothing to deliver until the next keyframe */
+            return;
         }
     }
+    if (msg && msg->getType() == message_type_rtt_response)
+    {
+        this->rtt_unanswered = 0;
+    }
+    if (msg && msg->getType() == message_type_closed)
+    {
+        std::cerr << "Remote closed the connection" << std::endl;
+        this->run = false;
+    }
+    /* Messages can arrive over the datagram channel at the same time */
+    std::lock_guard<std::mutex> lock_holder(this->deliver_lock);
+    if (this->handler != nullptr)
+    {
+        this->handler->processMessage(std::move(msg));
+    }
+    else
+    {
+        this->messages.push(std::move(msg));
+    }
+}
+
+void
+flight_safety_system::transport::fss_connection::setCompactPositions(bool t_compact_positions)
+{
+    std::lock_guard<std::mutex> lock_holder(this->send_lock);
+    this->compact_positions = t_compact_positions;
+    this->position_encoder.reset();
 }
 
 auto
@@ -118,11 +160,12 @@ flight_safety_system::transport::fss_connection::getMsg() -> std::shared_ptr<fli
     {
         if (!this->messages.empty())
         {
-            auto msg = this->messages.front();
-            if (msg != nullptr)
+            if (this->messages.front() == nullptr)
             {
-                this->messages.pop();
+                return nullptr;
             }
+            auto msg = std::move(this->messages.front());
+            this->messages.pop();
             return msg;
         }
     }
@@ -130,34 +173,49 @@ flight_safety_system::transport::fss_connection::getMsg() -> std::shared_ptr<fli
 }
 
 auto
-flight_safety_system::transport::fss_connection::connectTo(const std::string &address, uint16_t port) -> bool
+flight_safety_system::transport::fss_connection::connectSocket(const std::string &address, uint16_t port) -> bool
 {
-    struct sockaddr_storage remote = {};
-    if (!convert_str_to_sa (address, port, &remote))
+    auto addresses = fss_resolver::getResolver()->resolve(address, port);
+    if (addresses.empty())
     {
         std::cerr << "Failed to convert '" << address << "' to a usable address\n";
         return false;
     }
 
+    /* Try each address in turn until one accepts the connection */
+    for (auto &remote : addresses)
+    {
 #ifdef DEBUG
-        char addr_str[INET6_ADDRSTRLEN];
-        uint16_t client_port;
-        inet_ntop_stor(&remote, addr_str, INET6_ADDRSTRLEN, &client_port);
-        std::cout << "Trying to connect to " << address << " (" << addr_str << "):" << port << std::endl;
+        std::cout << "Trying to connect to " << address << " (" << convert_sa_to_str(&remote) << "):" << port << std::endl;
 #endif
 
-    if (this->fd == -1)
-    {
-        this->fd = socket(remote.ss_family == AF_INET ? PF_INET : PF_INET6, SOCK_STREAM, IPPROTO_TCP);
+        if (this->fd == -1)
+        {
+            this->fd = socket(remote.ss_family == AF_INET ? PF_INET : PF_INET6, SOCK_STREAM, IPPROTO_TCP);
+        }
+
+        // Limit the total number of SYN's that are sent
+        int synRetries = 2;
+        setsockopt(this->fd, IPPROTO_TCP, TCP_SYNCNT, &synRetries, sizeof(synRetries));
+        this->getSocketProfile().apply(this->fd);
+
+        if (connect(this->fd, reinterpret_cast<struct sockaddr *>(&remote), remote.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6)) == 0)
+        {
+            return true;
+        }
+        perror(("Failed to connect to " + address).c_str());
+        close(this->fd);
+        this->fd = -1;
     }
 
-    // Limit the total number of SYN's that are sent
-    int synRetries = 2;
-    setsockopt(this->fd, IPPROTO_TCP, TCP_SYNCNT, &synRetries, sizeof(synRetries));
+    return false;
+}
 
-    if (connect(this->fd, reinterpret_cast<struct sockaddr *>(&remote), remote.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6)) < 0)
+auto
+flight_safety_system::transport::fss_connection::connectTo(const std::string &address, uint16_t port) -> bool
+{
+    if (!this->connectSocket(address, port))
     {
-        perror(("Failed to connect to " + address).c_str());
         return false;
     }
 
@@ -169,8 +227,153 @@ flight_safety_system::transport::fss_connection::connectTo(const std::string &ad
 auto
 flight_safety_system::transport::fss_connection::sendMsg(const std::shared_ptr<fss_message> &msg) -> bool
 {
-    std::lock_guard<std::mutex> lock_holder(this->send_lock);
-    msg->setId(this->getMessageId());
+    /* A late position report is worth less than the next one, so they go without retransmission when possible */
+    if (msg->getType() == message_type_position_report && this->sendDatagram(msg))
+    {
+        return true;
+    }
+    if (!this->batching)
+    {
+        std::lock_guard<std::mutex> lock_holder(this->send_lock);
+        return this->sendQueued({msg});
+    }
+
+    /* Whoever finds nobody sending sends everything queued up in the meantime,
+       everyone else waits for their message to go out with it */
+    std::unique_lock<std::mutex> queue_holder(this->queue_lock);
+    this->send_queue.push_back(msg);
+    uint64_t ticket = ++this->queued_count;
+    if (this->sending)
+    {
+        this->queue_sent.wait(queue_holder, [this, ticket]() { return this->sent_count >= ticket; });
+        auto generation = std::find_if(this->send_results.begin(), this->send_results.end(), [ticket](const send_generation &sent) { return sent.last_ticket >= ticket; });
+        bool result = generation->result;
+        if (--generation->waiters == 0)
+        {
+            this->send_results.erase(generation);
+        }
+        return result;
+    }
+    this->sending = true;
+    /* Our own message always goes out in the first flush */
+    bool own_result = true;
+    bool first = true;
+    while (!this->send_queue.empty())
+    {
+        std::vector<std::shared_ptr<fss_message>> pending;
+        pending.swap(this->send_queue);
+        uint64_t queued = this->queued_count;
+        queue_holder.unlock();
+        bool result;
+        {
+            std::lock_guard<std::mutex> lock_holder(this->send_lock);
+            result = this->sendQueued(pending);
+        }
+        if (first)
+        {
+            own_result = result;
+        }
+        queue_holder.lock();
+        /* Everyone in this flush but ourselves is waiting for its result */
+        size_t waiters = queued - this->sent_count - (first ? 1 : 0);
+        first = false;
+        if (waiters > 0)
+        {
+            this->send_results.push_back(send_generation{queued, result, waiters});
+        }
+        this->sent_count = queued;
+        this->queue_sent.notify_all();
+    }
+    this->sending = false;
+    return own_result;
+}
+
+auto
+flight_safety_system::transport::fss_connection::sendQueued(const std::vector<std::shared_ptr<fss_message>> &pending) -> bool
+{
+    /* Unpack any batches, they are rebuilt below if the remote end understands them */
+    std::vector<std::shared_ptr<fss_message>> outgoing;
+    for (const auto &msg : pending)
+    {
+        if (msg->getType() == message_type_batch)
+        {
+            auto &inner = std::static_pointer_cast<fss_message_batch>(msg)->getMessages();
+            outgoing.insert(outgoing.end(), inner.begin(), inner.end());
+        }
+        else
+        {
+            outgoing.push_back(msg);
+        }
+    }
+    /* Counted once unpacked, so the watchdog sees requests carried inside batches too */
+    for (const auto &msg : outgoing)
+    {
+        if (msg->getType() == message_type_rtt_request)
+        {
+            this->rttRequestSent();
+        }
+    }
+    if (this->compact_positions)
+    {
+        /* Encoded under the send lock so the stream sequence matches the order on the wire */
+        for (auto &msg : outgoing)
+        {
+            if (msg->getType() == message_type_position_report)
+            {
+                msg = this->position_encoder.encode(std::static_pointer_cast<fss_message_position_report>(msg));
+            }
+        }
+    }
+
+    bool ret = true;
+    size_t idx = 0;
+    while (idx < outgoing.size())
+    {
+        if (!this->batching || idx + 1 == outgoing.size())
+        {
+            ret = this->sendFrame(outgoing[idx++]) && ret;
+            continue;
+        }
+        auto batch = std::make_shared<fss_message_batch>();
+        while (idx < outgoing.size() && batch->add(outgoing[idx]))
+        {
+            idx++;
+        }
+        switch (batch->getMessages().size())
+        {
+            case 0:
+                /* Too big to go in a batch */
+                ret = this->sendFrame(outgoing[idx++]) && ret;
+                break;
+            case 1:
+                ret = this->sendFrame(batch->getMessages().front()) && ret;
+                break;
+            default:
+                ret = this->sendFrame(batch) && ret;
+                break;
+        }
+    }
+    return ret;
+}
+
+auto
+flight_safety_system::transport::fss_connection::sendFrame(const std::shared_ptr<fss_message> &msg) -> bool
+{
+    if (msg->getType() == message_type_batch)
+    {
+        /* The messages in the batch take the ids following the batch's own */
+        auto &inner = std::static_pointer_cast<fss_message_batch>(msg)->getMessages();
+        uint64_t id = this->getMessageId(inner.size());
+        msg->setId(id);
+        for (const auto &inner_msg : inner)
+        {
+            inner_msg->setId(id++);
+        }
+    }
+    else
+    {
+        msg->setId(this->getMessageId());
+    }
     auto bl = msg->getPacked();
 #ifdef DEBUG
     std::cout << "Sending message (len=" << bl->getLength() << ") to " << this->fd << std::endl;
@@ -179,10 +382,251 @@ flight_safety_system::transport::fss_connection::sendMsg(const std::shared_ptr<f
     {
         return false;
     }
+    this->captureFrame(capture_sent, bl->getData(), bl->getLength());
     bool ret = this->sendMsg(bl);
     return ret;
 }
 
+auto
+flight_safety_system::transport::fss_connection::sendDatagram(const std::shared_ptr<fss_message> &msg) -> bool
+{
+    std::shared_ptr<fss_datagram_channel> channel;
+    uint64_t seq;
+    {
+        std::lock_guard<std::mutex> lock_holder(this->datagram_lock);
+        if (this->datagram_channel == nullptr || !this->datagram_channel->isReady())
+        {
+            return false;
+        }
+        channel = this->datagram_channel;
+        seq = htonll(this->datagram_sequence.next());
+    }
+    msg->setId(this->getMessageId());
+    auto bl = std::make_shared<buf_len>();
+    bl->addData((const char *)&seq, sizeof(uint64_t));
+    auto packed = msg->getPacked();
+    bl->addData(packed->getData(), packed->getLength());
+    this->captureFrame(capture_sent, packed->getData(), packed->getLength());
+    return channel->sendDatagram(bl);
+}
+
+void
+flight_safety_system::transport::fss_connection::receiveDatagram(const char *data, size_t length)
+{
+    /* A sequence number then at least a whole message header */
+    if (length < sizeof(uint64_t) + fss_message::header_length)
+    {
+        return;
+    }
+    uint64_t seq = ntohll(*(const uint64_t *)data);
+    auto bl = std::make_shared<buf_len>(data + sizeof(uint64_t), length - sizeof(uint64_t));
+    auto msg = fss_message::decode(bl);
+    /* Anything that needs to arrive stays on the connection */
+    if (msg == nullptr || msg->getType() != message_type_position_report)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock_holder(this->datagram_lock);
+        if (!this->datagram_sequence.accept(seq))
+        {
+            return;
+        }
+    }
+    this->captureFrame(capture_received, bl->getData(), bl->getLength());
+    this->deliverMsg(msg);
+}
+
+void
+flight_safety_system::transport::fss_connection::setDatagramChannel(std::shared_ptr<fss_datagram_channel> channel)
+{
+    std::lock_guard<std::mutex> lock_holder(this->datagram_lock);
+    this->datagram_channel = std::move(channel);
+}
+
+auto
+flight_safety_system::transport::fss_connection::getDatagramChannel() -> std::shared_ptr<fss_datagram_channel>
+{
+    std::lock_guard<std::mutex> lock_holder(this->datagram_lock);
+    return this->datagram_channel;
+}
+
+auto
+flight_safety_system::transport::fss_connection::getDatagramStats() -> fss_datagram_stats
+{
+    std::lock_guard<std::mutex> lock_holder(this->datagram_lock);
+    return this->datagram_sequence.getStats();
+}
+
+flight_safety_system::transport::fss_datagram_channel::~fss_datagram_channel() = default;
+
+auto
+flight_safety_system::transport::fss_datagram_sequence::next() -> uint64_t
+{
+    this->stats.sent++;
+    return this->next_seq++;
+}
+
+auto
+flight_safety_system::transport::fss_datagram_sequence::accept(uint64_t seq) -> bool
+{
+    if (seq == 0)
+    {
+        return false;
+    }
+    if (seq > this->highest)
+    {
+        uint64_t shift = seq - this->highest;
+        /* Everything skipped over is lost, unless it turns up later */
+        if (this->highest != 0)
+        {
+            this->stats.lost += shift - 1;
+        }
+        this->window = shift >= window_size ? 0 : this->window << shift;
+        this->window |= 1;
+        this->highest = seq;
+        this->stats.received++;
+        return true;
+    }
+    uint64_t behind = this->highest - seq;
+    if (behind >= window_size)
+    {
+        this->stats.late++;
+        return false;
+    }
+    uint64_t bit = (uint64_t)(1) << behind;
+    if ((this->window & bit) != 0)
+    {
+        this->stats.duplicate++;
+        return false;
+    }
+    this->window |= bit;
+    this->stats.received++;
+    this->stats.reordered++;
+    if (this->stats.lost > 0)
+    {
+        this->stats.lost--;
+    }
+    return true;
+}
+
+auto
+flight_safety_system::transport::fss_datagram_sequence::getStats() -> fss_datagram_stats
+{
+    return this->stats;
+}
+
+void
+flight_safety_system::transport::fss_connection::setCapture(std::shared_ptr<fss_capture> t_capture)
+{
+    if (t_capture != nullptr)
+    {
+        this->capture_id = t_capture->nextConnectionId();
+    }
+    /* The receive thread may already be running */
+    std::atomic_store(&this->capture, std::move(t_capture));
+}
+
+void
+flight_safety_system::transport::fss_connection::setSocketProfile(const fss_socket_profile &t_profile)
+{
+    std::lock_guard<std::mutex> lock_holder(this->profile_lock);
+    this->socket_profile = t_profile;
+}
+
+auto
+flight_safety_system::transport::fss_connection::getSocketProfile() -> fss_socket_profile
+{
+    std::lock_guard<std::mutex> lock_holder(this->profile_lock);
+    return this->socket_profile;
+}
+
+void
+flight_safety_system::transport::fss_connection::rttRequestSent()
+{
+    unsigned int max_missed = this->getSocketProfile().max_missed_rtt;
+    if (max_missed != 0 && this->rtt_unanswered++ >= max_missed)
+    {
+        /* The peer has stopped answering, however healthy the socket looks. The receive thread sees the
+           connection close and cleans up as if the peer had gone */
+        std::cerr << "No response to " << max_missed << " RTT requests, closing the connection" << std::endl;
+        shutdown(this->fd, SHUT_RDWR);
+    }
+}
+
+static auto
+set_socket_option(int fd, int level, int option, int value, const char *name) -> bool
+{
+    if (setsockopt(fd, level, option, &value, sizeof(value)) < 0)
+    {
+        perror((std::string("Failed to set ") + name).c_str());
+        return false;
+    }
+    return true;
+}
+
+auto
+flight_safety_system::transport::fss_socket_profile::apply(int fd) const -> bool
+{
+    int domain = 0;
+    socklen_t domain_len = sizeof(domain);
+    if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &domain_len) < 0 || (domain != AF_INET && domain != AF_INET6))
+    {
+        return true;
+    }
+    bool ok = true;
+    if (this->nodelay)
+    {
+        ok = set_socket_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY") && ok;
+    }
+    if (this->send_buffer > 0)
+    {
+        ok = set_socket_option(fd, SOL_SOCKET, SO_SNDBUF, this->send_buffer, "SO_SNDBUF") && ok;
+    }
+    if (this->recv_buffer > 0)
+    {
+        ok = set_socket_option(fd, SOL_SOCKET, SO_RCVBUF, this->recv_buffer, "SO_RCVBUF") && ok;
+    }
+    if (this->keepalive)
+    {
+        ok = set_socket_option(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE") && ok;
+        if (this->keepalive_idle > 0)
+        {
+            ok = set_socket_option(fd, IPPROTO_TCP, TCP_KEEPIDLE, this->keepalive_idle, "TCP_KEEPIDLE") && ok;
+        }
+        if (this->keepalive_interval > 0)
+        {
+            ok = set_socket_option(fd, IPPROTO_TCP, TCP_KEEPINTVL, this->keepalive_interval, "TCP_KEEPINTVL") && ok;
+        }
+        if (this->keepalive_count > 0)
+        {
+            ok = set_socket_option(fd, IPPROTO_TCP, TCP_KEEPCNT, this->keepalive_count, "TCP_KEEPCNT") && ok;
+        }
+    }
+    if (this->user_timeout > 0)
+    {
+        ok = set_socket_option(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, static_cast<int>(this->user_timeout), "TCP_USER_TIMEOUT") && ok;
+    }
+    return ok;
+}
+
+void
+flight_safety_system::transport::fss_connection::captureFrame(fss_capture_direction direction, const char *data, size_t length)
+{
+    auto current = std::atomic_load(&this->capture);
+    if (current != nullptr)
+    {
+        current->record(this->capture_id, direction, data, length);
+    }
+}
+
+void
+flight_safety_system::transport::fss_connection::setBatching(bool t_batching)
+{
+    std::lock_guard<std::mutex> lock_holder(this->queue_lock);
+    this->batching = t_batching;
+}
+
 #ifdef DEBUG
 static void
 print_bl(std::shared_ptr<flight_safety_system::transport::buf_len> bl)
@@ -226,9 +670,9 @@ flight_safety_system::transport::fss_connection::setHandler(fss_message_cb *cb)
     {
         while(!this->messages.empty())
         {
-            auto msg = this->messages.front();
+            auto msg = std::move(this->messages.front());
             this->messages.pop();
-            cb->processMessage(msg);
+            cb->processMessage(std::move(msg));
         }
     }
 }
@@ -262,9 +706,15 @@ auto
 flight_safety_system::transport::fss_connection::recvMsg() -> std::shared_ptr<flight_safety_system::transport::fss_message>
 {
     std::shared_ptr<flight_safety_system::transport::fss_message> msg = nullptr;
-    std::string data;
+    std::string &data = this->recv_data;
     data.resize(sizeof (uint16_t));
     ssize_t received = this->recvBytes(&data[0], data.size());
+    if (received == 1)
+    {
+        /* The length can be split across reads when the stream is busy */
+        ssize_t this_time = this->recvBytes(&data[1], 1);
+        received = this_time > 0 ? received + this_time : this_time;
+    }
     if (received == static_cast<ssize_t>(data.size()))
     {
         uint16_t data_length = ntohs((reinterpret_cast<const uint16_t *>(data.data()))[0]);
@@ -287,7 +737,14 @@ flight_safety_system::transport::fss_connection::recvMsg() -> std::shared_ptr<fl
         }
         if (received == total_length)
         {
-            auto bl = std::make_shared<buf_len>(data.data(), data_length);
+            /* Decoded messages copy out what they need, so the frame can be refilled next time unless something kept it */
+            if (this->recv_frame == nullptr || this->recv_frame.use_count() != 1)
+            {
+                this->recv_frame = std::make_shared<buf_len>();
+            }
+            this->recv_frame->setData(data.data(), data_length);
+            const auto &bl = this->recv_frame;
+            this->captureFrame(capture_received, data.data(), data_length);
 #ifdef DEBUG
             printf("Message reads: \n");
             print_bl(bl);
@@ -318,14 +775,354 @@ flight_safety_system::transport::fss_connection::getClientNames() -> std::list<s
     return ret;
 }
 
+auto
+flight_safety_system::transport::fss_connection::handshakeComplete() -> bool
+{
+    return true;
+}
+
+/* Passed by reference through make_shared, so they need storage */
+constexpr size_t flight_safety_system::transport::fss_handshake_pool::default_workers;
+constexpr size_t flight_safety_system::transport::fss_handshake_pool::default_max_queue;
+constexpr size_t flight_safety_system::transport::fss_handshake_pool::default_max_per_source;
+constexpr uint64_t flight_safety_system::transport::fss_handshake_pool::default_timeout;
+constexpr int flight_safety_system::transport::fss_handshake_pool::reject_wait;
+constexpr size_t flight_safety_system::transport::fss_handshake_pool::max_rejects;
+constexpr uint64_t flight_safety_system::transport::fss_handshake_pool::min_retry_after;
+
+flight_safety_system::transport::fss_handshake_pool::fss_handshake_pool(size_t t_workers, size_t t_max_queue, size_t t_max_per_source, uint64_t t_timeout) : num_workers(t_workers), max_queue(t_max_queue), max_per_source(t_max_per_source), timeout(t_timeout)
+{
+}
+
+flight_safety_system::transport::fss_handshake_pool::~fss_handshake_pool()
+{
+    this->stop();
+}
+
+void
+flight_safety_system::transport::fss_handshake_pool::start(std::function<bool(int)> t_handler, std::function<void(int, uint64_t)> t_busy)
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    if (this->run)
+    {
+        return;
+    }
+    this->handler = std::move(t_handler);
+    this->busy = std::move(t_busy);
+    this->run = true;
+    for (size_t i = 0; i < this->num_workers; i++)
+    {
+        this->workers.emplace_back([this]() { this->processHandshakes(); });
+    }
+    this->rejecter = std::thread([this]() { this->processRejects(); });
+}
+
+void
+flight_safety_system::transport::fss_handshake_pool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock_holder(this->lock);
+        this->run = false;
+        /* Drop anything that hasn't been started */
+        while (!this->queue.empty())
+        {
+            close(this->queue.front().fd);
+            this->queue.pop_front();
+        }
+        this->per_source.clear();
+    }
+    this->work.notify_all();
+    this->reject_work.notify_all();
+    for (auto &worker : this->workers)
+    {
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+    this->workers.clear();
+    if (this->rejecter.joinable())
+    {
+        this->rejecter.join();
+    }
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    while (!this->rejects.empty())
+    {
+        close(this->rejects.front().fd);
+        this->rejects.pop_front();
+    }
+}
+
+auto
+flight_safety_system::transport::fss_handshake_pool::submit(int t_fd, const std::string &t_source) -> bool
+{
+    std::unique_lock<std::mutex> lock_holder(this->lock);
+    if (!this->run)
+    {
+        close(t_fd);
+        return false;
+    }
+    if (this->queue.size() >= this->max_queue)
+    {
+        this->stats.rejected_queue_full++;
+        this->reject(t_fd, this->backlogWait(this->queue.size() + 1));
+        return false;
+    }
+    auto source = this->per_source.find(t_source);
+    if (source != this->per_source.end() && source->second >= this->max_per_source)
+    {
+        this->stats.rejected_per_source++;
+        this->reject(t_fd, this->backlogWait(source->second));
+        return false;
+    }
+    /* Decided before queueing, so a storm of clients that will be turned away doesn't fill the queue */
+    if (this->admission != nullptr && !this->admission->take())
+    {
+        this->stats.rejected_busy++;
+        this->reject(t_fd, this->backlogWait(this->queue.size() + 1));
+        return false;
+    }
+    this->per_source[t_source]++;
+    this->stats.accepted++;
+    this->queue.push_back(pending{t_fd, t_source, std::chrono::steady_clock::now()});
+    lock_holder.unlock();
+    this->work.notify_one();
+    return true;
+}
+
+void
+flight_safety_system::transport::fss_handshake_pool::processHandshakes()
+{
+    std::unique_lock<std::mutex> lock_holder(this->lock);
+    while (this->run)
+    {
+        if (this->queue.empty())
+        {
+            this->work.wait(lock_holder);
+            continue;
+        }
+        auto next = this->queue.front();
+        this->queue.pop_front();
+        lock_holder.unlock();
+
+        auto started = std::chrono::steady_clock::now();
+        bool success = this->handler(next.fd);
+        auto finished = std::chrono::steady_clock::now();
+
+        lock_holder.lock();
+        auto queue_wait = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(started - next.queued).count());
+        auto duration = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(finished - started).count());
+        this->stats.queue_wait_total += queue_wait;
+        this->stats.queue_wait_max = std::max(this->stats.queue_wait_max, queue_wait);
+        this->stats.handshake_total += duration;
+        this->stats.handshake_max = std::max(this->stats.handshake_max, duration);
+        if (success)
+        {
+            this->stats.completed++;
+        }
+        else
+        {
+            this->stats.failed++;
+        }
+        this->releaseSource(next.source);
+    }
+}
+
+void
+flight_safety_system::transport::fss_handshake_pool::processRejects()
+{
+    std::unique_lock<std::mutex> lock_holder(this->lock);
+    while (this->run)
+    {
+        if (this->rejects.empty())
+        {
+            this->reject_work.wait(lock_holder);
+            continue;
+        }
+        /* Only this thread removes rejects, so the first count entries stay put while unlocked */
+        size_t count = this->rejects.size();
+        std::vector<struct pollfd> pfds;
+        auto now = std::chrono::steady_clock::now();
+        auto until = this->rejects.front().until;
+        for (const auto &rejected : this->rejects)
+        {
+            pfds.push_back({rejected.fd, POLLIN, 0});
+            until = std::min(until, rejected.until);
+        }
+        auto wait = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count());
+        lock_holder.unlock();
+        poll(pfds.data(), pfds.size(), static_cast<int>(wait));
+        lock_holder.lock();
+
+        now = std::chrono::steady_clock::now();
+        std::vector<rejecting> ready;
+        for (size_t i = count; i-- > 0;)
+        {
+            if (pfds[i].revents != 0 || this->rejects[i].until <= now)
+            {
+                ready.push_back(this->rejects[i]);
+                this->rejects.erase(this->rejects.begin() + static_cast<std::ptrdiff_t>(i));
+            }
+        }
+        lock_holder.unlock();
+        for (const auto &rejected : ready)
+        {
+            this->busy(rejected.fd, rejected.retry_after);
+        }
+        lock_holder.lock();
+    }
+}
+
+/* Called with the lock held */
+void
+flight_safety_system::transport::fss_handshake_pool::reject(int t_fd, uint64_t t_retry_after)
+{
+    if (this->rejects.size() >= max_rejects)
+    {
+        /* Too many waiting already, reply straight away even if the client's opening bytes get a reset */
+        this->busy(t_fd, t_retry_after);
+        return;
+    }
+    this->rejects.push_back(rejecting{t_fd, t_retry_after, std::chrono::steady_clock::now() + std::chrono::milliseconds(reject_wait)});
+    this->reject_work.notify_one();
+}
+
+/* Called with the lock held */
+auto
+flight_safety_system::transport::fss_handshake_pool::backlogWait(size_t ahead) -> uint64_t
+{
+    uint64_t finished = this->stats.completed + this->stats.failed;
+    uint64_t average = finished > 0 ? this->stats.handshake_total / finished : min_retry_after;
+    uint64_t wait = average * ahead / std::max<size_t>(this->num_workers, 1);
+    if (this->admission != nullptr)
+    {
+        /* Come back once the tokens for the queue ahead have been earned */
+        wait = std::max(wait, this->admission->waitTime(ahead));
+    }
+    return std::max(wait, min_retry_after);
+}
+
+void
+flight_safety_system::transport::fss_handshake_pool::releaseSource(const std::string &t_source)
+{
+    auto source = this->per_source.find(t_source);
+    if (source != this->per_source.end())
+    {
+        if (--source->second == 0)
+        {
+            this->per_source.erase(source);
+        }
+    }
+}
+
+void
+flight_safety_system::transport::fss_handshake_pool::setRateLimit(double rate, double burst)
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    this->admission = rate > 0 ? std::make_shared<fss_token_bucket>(rate, burst) : nullptr;
+}
+
+auto
+flight_safety_system::transport::fss_handshake_pool::getTimeout() -> uint64_t
+{
+    return this->timeout;
+}
+
+auto
+flight_safety_system::transport::fss_handshake_pool::getStats() -> fss_handshake_stats
+{
+    std::lock_guard<std::mutex> lock_holder(this->lock);
+    return this->stats;
+}
+
+flight_safety_system::transport::fss_token_bucket::fss_token_bucket(double t_rate, double t_burst) : rate(t_rate), burst(std::max(t_burst, 1.0)), tokens(burst), last(std::chrono::steady_clock::now())
+{
+}
+
+void
+flight_safety_system::transport::fss_token_bucket::refill()
+{
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - this->last;
+    this->last = now;
+    this->tokens = std::min(this->burst, this->tokens + elapsed.count() * this->rate);
+}
+
+auto
+flight_safety_system::transport::fss_token_bucket::take() -> bool
+{
+    this->refill();
+    if (this->tokens < 1)
+    {
+        return false;
+    }
+    this->tokens -= 1;
+    return true;
+}
+
+auto
+flight_safety_system::transport::fss_token_bucket::waitTime(size_t count) -> uint64_t
+{
+    this->refill();
+    double needed = static_cast<double>(count) - this->tokens;
+    if (needed <= 0)
+    {
+        return 0;
+    }
+    return static_cast<uint64_t>(std::ceil(needed * 1000 / this->rate));
+}
+
+flight_safety_system::transport::fss_backoff::fss_backoff(uint64_t t_base, uint64_t t_cap) : base(t_base), cap(t_cap), current(t_base), random(std::random_device()())
+{
+}
+
+auto
+flight_safety_system::transport::fss_backoff::between(uint64_t low, uint64_t high) -> uint64_t
+{
+    if (high <= low)
+    {
+        return low;
+    }
+    return std::uniform_int_distribution<uint64_t>(low, high)(this->random);
+}
+
+auto
+flight_safety_system::transport::fss_backoff::spread() -> uint64_t
+{
+    return this->between(0, this->base);
+}
+
+auto
+flight_safety_system::transport::fss_backoff::next(uint64_t hint) -> uint64_t
+{
+    this->current = std::min(this->cap, this->between(this->base, this->current * 3));
+    if (hint > this->current)
+    {
+        /* Jitter the hint as well, so clients told the same thing don't come back together */
+        return this->between(hint, hint + hint / 4);
+    }
+    return this->current;
+}
+
+void
+flight_safety_system::transport::fss_backoff::reset()
+{
+    this->current = this->base;
+}
+
 flight_safety_system::transport::fss_listen::fss_listen(uint16_t t_port, fss_connect_cb t_cb) : fss_connection(), port(t_port), cb(t_cb)
 {
     this->startListening();
 }
 
+flight_safety_system::transport::fss_listen::fss_listen(fss_connect_cb t_cb) : fss_connection(), port(0), cb(t_cb)
+{
+}
+
 flight_safety_system::transport::fss_listen::~fss_listen()
 {
     this->disconnect();
+    this->stopHandshakePool();
 }
 
 static void
@@ -351,6 +1148,7 @@ flight_safety_system::transport::fss_listen::processMessages()
             perror("Failed to accept: ");
             continue;
         }
+        this->getSocketProfile().apply(newfd);
 #ifdef DEBUG
         char addr_str[INET6_ADDRSTRLEN];
         uint16_t client_port;
@@ -359,8 +1157,16 @@ flight_safety_system::transport::fss_listen::processMessages()
 #endif
         if (this->cb != nullptr)
         {
-            auto conn = this->newConnection(newfd);
-            this->cb(conn);
+            auto handshakes = this->getHandshakePool();
+            if (handshakes == nullptr)
+            {
+                this->acceptConnection(newfd);
+            }
+            else
+            {
+                /* Too busy, or too many from this source, and the pool tells the client when to retry */
+                handshakes->submit(newfd, convert_sa_to_str(&sa));
+            }
         }
         else
         {
@@ -376,6 +1182,81 @@ flight_safety_system::transport::fss_listen::newConnection(int t_newfd) -> std::
     return std::make_shared<flight_safety_system::transport::fss_connection>(t_newfd);
 }
 
+auto
+flight_safety_system::transport::fss_listen::acceptConnection(int t_newfd) -> bool
+{
+    auto conn = this->newConnection(t_newfd);
+    if (conn == nullptr || !conn->handshakeComplete())
+    {
+        return false;
+    }
+    conn->setSocketProfile(this->getSocketProfile());
+    this->cb(conn);
+    return true;
+}
+
+void
+flight_safety_system::transport::fss_listen::rejectConnection(int t_newfd, uint64_t t_retry_after)
+{
+    /* Read the client's opening bytes (i.e. a TLS client hello), which the pool has waited briefly for, so closing doesn't reset the connection */
+    char discard[4096];
+    while (recv(t_newfd, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+    {
+    }
+    /* Sent in the clear, TLS clients recognise it before attempting the handshake */
+    auto msg = std::make_shared<fss_message_busy>(t_retry_after);
+    auto bl = msg->getPacked();
+    if (send(t_newfd, bl->getData(), bl->getLength(), MSG_NOSIGNAL) < 0)
+    {
+        perror("Failed to send busy: ");
+    }
+    shutdown(t_newfd, SHUT_WR);
+    close(t_newfd);
+}
+
+void
+flight_safety_system::transport::fss_listen::setMaxPendingConnections(int t_max_pending_connections)
+{
+    this->max_pending_connections = t_max_pending_connections;
+    /* listen() can be called again to change the backlog of a listening socket */
+    if (this->getFd() >= 0 && listen(this->getFd(), this->max_pending_connections) < 0)
+    {
+        perror("Failed to set listen backlog: ");
+    }
+}
+
+void
+flight_safety_system::transport::fss_listen::setHandshakePool(std::shared_ptr<fss_handshake_pool> t_pool)
+{
+    if (t_pool != nullptr)
+    {
+        t_pool->start([this](int t_fd) { return this->acceptConnection(t_fd); }, [this](int t_fd, uint64_t t_retry_after) { this->rejectConnection(t_fd, t_retry_after); });
+    }
+    std::shared_ptr<fss_handshake_pool> old_pool;
+    {
+        std::lock_guard<std::mutex> lock_holder(this->pool_lock);
+        old_pool = std::move(this->pool);
+        this->pool = std::move(t_pool);
+    }
+    if (old_pool != nullptr)
+    {
+        old_pool->stop();
+    }
+}
+
+auto
+flight_safety_system::transport::fss_listen::getHandshakePool() -> std::shared_ptr<fss_handshake_pool>
+{
+    std::lock_guard<std::mutex> lock_holder(this->pool_lock);
+    return this->pool;
+}
+
+void
+flight_safety_system::transport::fss_listen::stopHandshakePool()
+{
+    this->setHandshakePool(nullptr);
+}
+
 auto
 flight_safety_system::transport::fss_listen::startListening() -> bool
 {
@@ -388,11 +1269,20 @@ flight_safety_system::transport::fss_listen::startListening() -> bool
     memset(&bind_addr, 0, sizeof (struct sockaddr_in6));
     bind_addr.sin6_family = AF_INET6;
     bind_addr.sin6_port = htons(this->port);
+    /* Restarting shouldn't have to wait for the last run's connections to leave TIME_WAIT */
+    int reuse = 1;
+    setsockopt(this->getFd(), SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
     if (bind(this->getFd(), reinterpret_cast<struct sockaddr *>(&bind_addr), sizeof(bind_addr)) < 0)
     {
         perror("Failed to bind socket: ");
         return false;
     }
+    return this->startAccepting();
+}
+
+auto
+flight_safety_system::transport::fss_listen::startAccepting() -> bool
+{
     if(listen(this->getFd(), this->max_pending_connections) < 0)
     {
         perror("Failed to listen on socket: ");
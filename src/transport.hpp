@@ -8,4 +8,4 @@ static inline auto ntohll(uint64_t x) -> uint64_t { return be64toh(x); }
 static inline auto htonll(uint64_t x) -> uint64_t { return htobe64(x); }
 #endif
 
-auto convert_str_to_sa(const std::string &addr, uint16_t port, struct sockaddr_storage *sa) -> bool;
+auto convert_sa_to_str(const struct sockaddr_storage *sa) -> std::string;
@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #ifdef HAVE_CATCH2_CATCH_HPP
 #include <catch2/catch.hpp>
 #elif HAVE_CATCH_CATCH_HPP
@@ -9,6 +16,8 @@
 #error No catch header
 #endif
 
+#include <ctime>
+
 #include <unistd.h>
 
 #include "fss-transport.hpp"
@@ -42,3 +51,340 @@ TEST_CASE("Client Base") {
 
     client_conn = nullptr;
 }
+
+TEST_CASE("Client Server Set") {
+    constexpr int listen_port = 20403;
+    auto listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port, test_client_connect_cb, CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE);
+    auto client = std::make_shared<flight_safety_system::client_ssl::fss_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    client->connectTo("localhost", listen_port, true);
+    auto before = client->getServers();
+    REQUIRE(before->connected.size() == 1);
+    REQUIRE(before->reconnect.empty());
+
+    /* Several servers naming the same servers at once, while telemetry is being sent */
+    auto list = std::make_shared<flight_safety_system::transport::fss_message_server_list>();
+    for (uint16_t port = 1; port <= 20; port++)
+    {
+        list->addServer("localhost", port);
+    }
+    list->addServer("localhost", listen_port);
+    std::atomic<bool> sending{true};
+    std::thread sender([&client, &sending]() {
+        while (sending)
+        {
+            client->sendMsgAll(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>());
+        }
+    });
+    std::vector<std::thread> updaters;
+    for (int i = 0; i < 4; i++)
+    {
+        updaters.emplace_back([&client, &list]() {
+            client->updateServers(list);
+        });
+    }
+    for (auto &updater : updaters)
+    {
+        updater.join();
+    }
+    auto after = client->getServers();
+    REQUIRE(after->connected.size() == 1);
+    REQUIRE(after->reconnect.size() == 20);
+
+    /* A server going away doesn't change a set already taken */
+    auto server = after->connected.front();
+    client->serverRequiresReconnect(server.get());
+    sending = false;
+    sender.join();
+    REQUIRE(client->getServers()->connected.empty());
+    REQUIRE(client->getServers()->reconnect.size() == 21);
+    REQUIRE(before->connected.size() == 1);
+    REQUIRE(before->reconnect.empty());
+    REQUIRE(after->connected.front() == server);
+    REQUIRE(client->getServers()->find("localhost", listen_port) == server);
+
+    client_conn = nullptr;
+}
+
+TEST_CASE("Client Reconnect While Sending") {
+    constexpr int listen_port = 20406;
+    constexpr int reconnects = 5;
+    constexpr int max_attempts = 1000;
+    auto listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port, test_client_connect_cb, CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE);
+    auto client = std::make_shared<flight_safety_system::client_ssl::fss_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    client->connectTo("localhost", listen_port, true);
+    auto server = client->getServers()->connected.front();
+
+    /* Telemetry keeps going out while the server's connection is replaced underneath it */
+    std::atomic<bool> sending{true};
+    std::thread sender([&client, &server, &sending]() {
+        while (sending)
+        {
+            client->sendMsgAll(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>());
+            server->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>());
+        }
+    });
+    /* Each old connection closing asks for a (spread out) reconnect, so keep trying until it is due */
+    int reconnected = 0;
+    for (int attempt = 0; attempt < max_attempts && reconnected < reconnects; attempt++)
+    {
+        if (server->reconnect())
+        {
+            reconnected++;
+        }
+        else
+        {
+            usleep(10000);
+        }
+    }
+    sending = false;
+    sender.join();
+    REQUIRE(reconnected == reconnects);
+    REQUIRE(server->connected());
+    REQUIRE(server->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>()));
+
+    server = nullptr;
+    client_conn = nullptr;
+}
+
+/* A server end that counts what it is sent, and answers RTT requests while told to */
+class selection_server_cb: public flight_safety_system::transport::fss_message_cb
+{
+    public:
+        std::atomic<bool> answering{true};
+        std::atomic<int> positions{0};
+        std::atomic<int> statuses{0};
+        explicit selection_server_cb(std::shared_ptr<flight_safety_system::transport::fss_connection> t_conn) : fss_message_cb(std::move(t_conn)) {};
+        void processMessage(std::shared_ptr<flight_safety_system::transport::fss_message> message) override {
+            /* The connection closing */
+            if (message == nullptr)
+            {
+                return;
+            }
+            switch (message->getType())
+            {
+                case flight_safety_system::transport::message_type_rtt_request:
+                    if (this->answering)
+                    {
+                        this->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_response>(message->getId()));
+                    }
+                    break;
+                case flight_safety_system::transport::message_type_position_report:
+                    this->positions++;
+                    break;
+                case flight_safety_system::transport::message_type_system_status:
+                    this->statuses++;
+                    break;
+                default:
+                    break;
+            }
+        }
+};
+
+static std::array<std::shared_ptr<selection_server_cb>, 2> selection_servers{};
+static auto selection_connect(size_t index, const std::shared_ptr<flight_safety_system::transport::fss_connection> &new_conn) -> bool
+{
+    selection_servers[index] = std::make_shared<selection_server_cb>(new_conn);
+    new_conn->setHandler(selection_servers[index].get());
+    return true;
+}
+static auto selection_connect_a (std::shared_ptr<flight_safety_system::transport::fss_connection> new_conn) -> bool
+{
+    return selection_connect(0, new_conn);
+}
+static auto selection_connect_b (std::shared_ptr<flight_safety_system::transport::fss_connection> new_conn) -> bool
+{
+    return selection_connect(1, new_conn);
+}
+
+static auto
+selection_position() -> std::shared_ptr<flight_safety_system::transport::fss_message_position_report>
+{
+    return std::make_shared<flight_safety_system::transport::fss_message_position_report>(-43.4, 172.4, 1000, 90, 50, 0, 0, "RESCUE1", 1200, 0, 0, 0, 0, 1600000000000);
+}
+
+TEST_CASE("Client Server Selection") {
+    constexpr int listen_port_a = 20404;
+    constexpr int listen_port_b = 20405;
+    auto listen_a = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port_a, selection_connect_a, CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE);
+    auto listen_b = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port_b, selection_connect_b, CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE);
+    auto client = std::make_shared<flight_safety_system::client_ssl::fss_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    flight_safety_system::client_ssl::fss_server_selection selection;
+    selection.position.best_only = true;
+    selection.position.copy_interval = 60000;
+    selection.probe_interval = 0;
+    selection.max_rtt = 100;
+    client->setServerSelection(selection);
+    client->connectTo("localhost", listen_port_a, true);
+    client->connectTo("localhost", listen_port_b, true);
+    sleep(1);
+    REQUIRE(client->getServers()->connected.size() == 2);
+    REQUIRE(selection_servers[0] != nullptr);
+    REQUIRE(selection_servers[1] != nullptr);
+
+    /* Nothing is measured yet, so there is no primary and everything goes everywhere */
+    client->selectPrimary();
+    REQUIRE(client->getPrimary() == nullptr);
+    client->sendMsgAll(selection_position());
+    usleep(200000);
+    REQUIRE(selection_servers[0]->positions == 1);
+    REQUIRE(selection_servers[1]->positions == 1);
+
+    client->probeServers();
+    usleep(200000);
+    client->selectPrimary();
+    auto primary = client->getPrimary();
+    REQUIRE(primary != nullptr);
+    REQUIRE(primary->getLink().responses == 1);
+    size_t best = primary == client->getServers()->find("localhost", listen_port_a) ? 0 : 1;
+    size_t other = 1 - best;
+
+    /* Positions only go to the primary, apart from the first copy; status still goes everywhere */
+    for (int i = 0; i < 10; i++)
+    {
+        client->sendMsgAll(selection_position());
+    }
+    client->sendMsgAll(std::make_shared<flight_safety_system::transport::fss_message_system_status>(50, 1000));
+    auto batch = std::make_shared<flight_safety_system::transport::fss_message_batch>();
+    batch->add(selection_position());
+    batch->add(std::make_shared<flight_safety_system::transport::fss_message_system_status>(50, 1000));
+    client->sendMsgAll(batch);
+    usleep(200000);
+    REQUIRE(selection_servers[best]->positions == 12);
+    REQUIRE(selection_servers[other]->positions == 2);
+    REQUIRE(selection_servers[best]->statuses == 2);
+    REQUIRE(selection_servers[other]->statuses == 2);
+
+    /* The primary going quiet for longer than max_rtt is failed over from */
+    selection_servers[best]->answering = false;
+    client->probeServers();
+    usleep(300000);
+    client->selectPrimary();
+    REQUIRE(client->getPrimary() != nullptr);
+    REQUIRE(client->getPrimary() != primary);
+    REQUIRE(primary->getLink().waiting >= 300);
+
+    /* And losing the primary falls back to sending everywhere */
+    auto failover = client->getPrimary();
+    client->serverRequiresReconnect(failover.get());
+    REQUIRE(client->getPrimary() == nullptr);
+    client->sendMsgAll(selection_position());
+    usleep(200000);
+    REQUIRE(selection_servers[best]->positions == 13);
+
+    /* Servers don't outlive their client */
+    primary = nullptr;
+    failover = nullptr;
+    client = nullptr;
+    selection_servers = {};
+}
+
+static auto
+traffic_target(uint32_t icao_address, const std::string &callsign, double latitude) -> flight_safety_system::client_ssl::fss_traffic_target
+{
+    flight_safety_system::client_ssl::fss_traffic_target target;
+    target.icao_address = icao_address;
+    memcpy(target.callsign.data(), callsign.data(), std::min(callsign.size(), target.callsign.size() - 1));
+    target.latitude = latitude;
+    target.longitude = latitude;
+    return target;
+}
+
+TEST_CASE("Traffic Table") {
+    flight_safety_system::client_ssl::fss_traffic_table traffic(4, 100);
+    flight_safety_system::client_ssl::fss_traffic_target found;
+
+    REQUIRE(traffic.update(traffic_target(0x7C0001, "ZK-ABC", -43.5)));
+    REQUIRE(traffic.update(traffic_target(0, "RESCUE1", -43.6)));
+    /* Neither an address nor a callsign */
+    REQUIRE(!traffic.update(traffic_target(0, "", -43.7)));
+    /* A newer report replaces the old one */
+    REQUIRE(traffic.update(traffic_target(0x7C0001, "ZK-ABC", -43.55)));
+    REQUIRE(traffic.snapshot().size() == 2);
+    REQUIRE(traffic.find(0x7C0001, found));
+    REQUIRE(found.latitude == -43.55);
+    REQUIRE(found.getCallSign() == "ZK-ABC");
+    REQUIRE(traffic.find("RESCUE1", found));
+    REQUIRE(found.latitude == -43.6);
+    REQUIRE(!traffic.find(0x7C0002, found));
+    REQUIRE(!traffic.find("NOBODY", found));
+
+    /* Callsigns are cut to fit */
+    auto message = std::make_shared<flight_safety_system::transport::fss_message_position_report>(-43.4, 172.4, 1000, 90, 50, 0, 0, "LONGCALLSIGN", 1200, 0, 0, 0, 0, 1600000000000);
+    REQUIRE(traffic.update(*message));
+    REQUIRE(traffic.find("LONGCALL", found));
+    REQUIRE(found.altitude == 1000);
+    REQUIRE(found.timestamp == 1600000000000);
+
+    /* Full of live targets */
+    REQUIRE(traffic.update(traffic_target(0x7C0003, "", 1)));
+    REQUIRE(!traffic.update(traffic_target(0x7C0004, "", 1)));
+    REQUIRE(traffic.getDropped() == 1);
+
+    /* Targets not heard from age out, and their slots are reused */
+    usleep(150000);
+    REQUIRE(traffic.snapshot().empty());
+    REQUIRE(!traffic.find(0x7C0001, found));
+    REQUIRE(traffic.update(traffic_target(0x7C0004, "", 1)));
+    REQUIRE(traffic.update(traffic_target(0x7C0005, "", 1)));
+    REQUIRE(traffic.snapshot().size() == 2);
+    REQUIRE(traffic.find(0x7C0004, found));
+}
+
+TEST_CASE("Traffic Table - Concurrent") {
+    flight_safety_system::client_ssl::fss_traffic_table traffic;
+    std::atomic<bool> running{true};
+    /* Two servers relaying the same aircraft, and others */
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 2; w++)
+    {
+        writers.emplace_back([&traffic, &running, w]() {
+            for (int i = 0; running; i++)
+            {
+                traffic.update(traffic_target(0x7C0000 + static_cast<uint32_t>(i % 16) * (w + 1), "", i));
+            }
+        });
+    }
+    std::vector<flight_safety_system::client_ssl::fss_traffic_target> targets;
+    size_t seen = 0;
+    for (int i = 0; i < 20000; i++)
+    {
+        traffic.snapshot(targets);
+        for (const auto &target : targets)
+        {
+            /* Never half of one update and half of another */
+            REQUIRE(target.latitude == target.longitude);
+        }
+        seen += targets.size();
+    }
+    running = false;
+    for (auto &writer : writers)
+    {
+        writer.join();
+    }
+    REQUIRE(seen > 0);
+    REQUIRE(traffic.snapshot().size() == 24);
+}
+
+TEST_CASE("Clocks") {
+    constexpr uint64_t sec_to_msec = 1000;
+    uint64_t wall = flight_safety_system::fss_current_timestamp();
+    REQUIRE(wall / sec_to_msec >= static_cast<uint64_t>(time(nullptr)) - 1);
+    REQUIRE(wall / sec_to_msec <= static_cast<uint64_t>(time(nullptr)));
+
+    uint64_t before = flight_safety_system::fss_monotonic_timestamp();
+    usleep(20000);
+    uint64_t after = flight_safety_system::fss_monotonic_timestamp();
+    REQUIRE(after >= before + 20);
+
+    /* The coarse clocks only move when ticked */
+    flight_safety_system::fss_clock_tick();
+    uint64_t coarse = flight_safety_system::fss_coarse_monotonic_timestamp();
+    uint64_t coarse_wall = flight_safety_system::fss_coarse_timestamp();
+    REQUIRE(coarse >= after);
+    REQUIRE(coarse_wall >= wall);
+    usleep(20000);
+    REQUIRE(flight_safety_system::fss_coarse_monotonic_timestamp() == coarse);
+    REQUIRE(flight_safety_system::fss_coarse_timestamp() == coarse_wall);
+    flight_safety_system::fss_clock_tick();
+    REQUIRE(flight_safety_system::fss_coarse_monotonic_timestamp() >= coarse + 20);
+}
@@ -123,3 +123,295 @@ TEST_CASE("SSL - Listen - Callback")
 
     client_conn = nullptr;
 }
+
+TEST_CASE("SSL - Session Resumption")
+{
+    constexpr int listen_port = 20304;
+    constexpr uint64_t ticket_lifetime = 60;
+    constexpr uint64_t ticket_key_rotation = 120;
+
+    auto tickets = std::make_shared<flight_safety_system::transport_ssl::fss_session_tickets>(ticket_lifetime, ticket_key_rotation, true);
+    auto listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port, test_client_connect_cb, CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE, tickets);
+    REQUIRE(listen != nullptr);
+
+    auto conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    REQUIRE(conn->connectTo("localhost", listen_port));
+    REQUIRE(!conn->isResumed());
+
+    sleep(1);
+
+    REQUIRE(client_conn != nullptr);
+    /* Give the client something to receive so the session ticket is processed */
+    client_conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>());
+
+    sleep(1);
+
+    auto resume_data = conn->getResumeData();
+    REQUIRE(!resume_data.empty());
+    conn = nullptr;
+    client_conn = nullptr;
+
+    /* Reconnect with the ticket and the identity as early data */
+    conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE, true);
+    conn->setResumeData(resume_data);
+    conn->setEarlyMsg(std::make_shared<flight_safety_system::transport::fss_message_identity>("client"));
+    REQUIRE(conn->connectTo("localhost", listen_port));
+    REQUIRE(conn->isResumed());
+    REQUIRE(conn->earlyDataAccepted());
+
+    sleep(1);
+
+    REQUIRE(client_conn != nullptr);
+    auto msg = client_conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_identity);
+
+    conn = nullptr;
+    client_conn = nullptr;
+}
+
+TEST_CASE("SSL - Shared Credentials")
+{
+    constexpr int listen_port = 20305;
+
+    auto credentials = std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE);
+    auto first = credentials->get();
+    REQUIRE(first != nullptr);
+    REQUIRE(credentials->get() == first);
+
+    auto listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port, test_client_connect_cb, credentials, nullptr);
+    REQUIRE(listen->getCredentials() == credentials);
+
+    auto conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    REQUIRE(conn->connectTo("localhost", listen_port));
+
+    sleep(1);
+
+    REQUIRE(client_conn != nullptr);
+
+    /* Reloading swaps the credentials without dropping the existing session */
+    REQUIRE(credentials->reload());
+    REQUIRE(credentials->get() != first);
+
+    std::static_pointer_cast<flight_safety_system::transport::fss_connection>(conn)->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_identity>("client"));
+
+    sleep(1);
+
+    auto msg = client_conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_identity);
+
+    conn = nullptr;
+    client_conn = nullptr;
+}
+
+TEST_CASE("SSL - Handshake Pool")
+{
+    constexpr int listen_port = 20306;
+    constexpr uint64_t handshake_timeout = 2000;
+
+    auto listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port, test_client_connect_cb, CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE);
+    REQUIRE(listen->getHandshakePool() != nullptr);
+
+    auto pool = std::make_shared<flight_safety_system::transport::fss_handshake_pool>(1, 4, 1, handshake_timeout);
+    listen->setHandshakePool(pool);
+    REQUIRE(listen->getHandshakePool() == pool);
+
+    /* A plain TCP client never starts the TLS handshake, so it holds the only worker */
+    auto stalled = std::make_shared<flight_safety_system::transport::fss_connection>();
+    REQUIRE(stalled->connectTo("127.0.0.1", listen_port));
+
+    /* The same address can't queue a second handshake */
+    auto rejected = std::make_shared<flight_safety_system::transport::fss_connection>();
+    REQUIRE(rejected->connectTo("127.0.0.1", listen_port));
+    sleep(1);
+    REQUIRE(pool->getStats().rejected_per_source == 1);
+    /* It is told when to come back rather than just being closed */
+    auto busy = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_busy>(rejected->getMsg());
+    REQUIRE(busy != nullptr);
+    REQUIRE(busy->getRetryAfter() >= flight_safety_system::transport::fss_handshake_pool::min_retry_after);
+
+    /* Once the stalled handshake times out a real client gets through */
+    sleep(2);
+    auto conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    REQUIRE(conn->connectTo("localhost", listen_port));
+    sleep(1);
+
+    REQUIRE(client_conn != nullptr);
+    auto stats = pool->getStats();
+    REQUIRE(stats.failed >= 1);
+    REQUIRE(stats.completed == 1);
+
+    stalled = nullptr;
+    rejected = nullptr;
+    conn = nullptr;
+    client_conn = nullptr;
+}
+
+TEST_CASE("SSL - Busy Server")
+{
+    constexpr int listen_port = 20307;
+    constexpr double rate = 0.5;
+
+    auto listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port, test_client_connect_cb, CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE);
+    listen->setMaxPendingConnections(128);
+    auto pool = listen->getHandshakePool();
+    REQUIRE(pool != nullptr);
+    pool->setRateLimit(rate, 1);
+
+    auto conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    REQUIRE(conn->connectTo("localhost", listen_port));
+    REQUIRE(conn->getRetryAfter() == 0);
+
+    /* The only token has been used, so the next client is told when to come back */
+    auto rejected = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    REQUIRE(!rejected->connectTo("localhost", listen_port));
+    REQUIRE(rejected->getRetryAfter() > 0);
+    REQUIRE(rejected->getRetryAfter() <= 2000);
+    REQUIRE(pool->getStats().rejected_busy == 1);
+
+    conn = nullptr;
+    rejected = nullptr;
+    client_conn = nullptr;
+}
+
+TEST_CASE("SSL - Datagram Channel")
+{
+    constexpr int listen_port = 20308;
+    constexpr int reports = 5;
+    constexpr int wait_attempts = 50;
+    constexpr uint32_t icao_address = 0x00C81234;
+
+    auto server_credentials = std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE);
+    auto client_credentials = std::make_shared<flight_safety_system::transport_ssl::fss_credentials>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    auto listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port, test_client_connect_cb, server_credentials, nullptr);
+    auto datagram_listen = std::make_shared<flight_safety_system::transport_ssl::fss_datagram_listen>(0, server_credentials);
+    REQUIRE(datagram_listen->getPort() != 0);
+
+    std::shared_ptr<flight_safety_system::transport::fss_connection> conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(client_credentials);
+    REQUIRE(conn->connectTo("localhost", listen_port));
+    sleep(1);
+    REQUIRE(client_conn != nullptr);
+    auto server_conn = client_conn;
+
+    /* A token that wasn't offered can't bind, so everything stays on TLS */
+    auto unbound = std::make_shared<flight_safety_system::transport_ssl::fss_datagram_client>(client_credentials, conn);
+    conn->setDatagramChannel(unbound);
+    unbound->start("localhost", datagram_listen->getPort(), 1);
+    sleep(2);
+    REQUIRE_FALSE(unbound->isReady());
+    conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_position_report>(-43.5, 172.0, 100, 0, 0, 0, icao_address, "ZK-ABC", 0, 0, 0, 0, 0, 0));
+    sleep(1);
+    auto msg = server_conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_position_report);
+    REQUIRE(server_conn->getDatagramStats().received == 0);
+    unbound->stop();
+
+    /* Nor can a token offered to a connection whose certificate names nobody */
+    auto anonymous = std::make_shared<flight_safety_system::transport::fss_connection>();
+    auto mismatched = std::make_shared<flight_safety_system::transport_ssl::fss_datagram_client>(client_credentials, conn);
+    mismatched->start("localhost", datagram_listen->getPort(), datagram_listen->offer(anonymous));
+    sleep(2);
+    REQUIRE_FALSE(mismatched->isReady());
+    REQUIRE(anonymous->getDatagramChannel() == nullptr);
+    mismatched->stop();
+
+    auto datagram = std::make_shared<flight_safety_system::transport_ssl::fss_datagram_client>(client_credentials, conn);
+    conn->setDatagramChannel(datagram);
+    datagram->start("localhost", datagram_listen->getPort(), datagram_listen->offer(server_conn));
+    for (int i = 0; i < wait_attempts && !datagram->isReady(); i++)
+    {
+        usleep(100000);
+    }
+    REQUIRE(datagram->isReady());
+    /* The session that couldn't bind is kept until the offer would have expired */
+    REQUIRE(datagram_listen->getSessionCount() == 2);
+    REQUIRE(server_conn->getDatagramChannel() != nullptr);
+    REQUIRE(server_conn->getDatagramChannel()->isReady());
+
+    /* Position reports go over DTLS in both directions */
+    for (int i = 0; i < reports; i++)
+    {
+        REQUIRE(conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_position_report>(-43.5, 172.0, 100 + i, 0, 0, 0, icao_address, "ZK-ABC", 0, 0, 0, 0, 0, i)));
+    }
+    REQUIRE(server_conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_position_report>(-43.5, 172.0, 200, 0, 0, 0, icao_address, "ZK-DEF", 0, 0, 0, 0, 0, 0)));
+    sleep(1);
+    for (int i = 0; i < reports; i++)
+    {
+        msg = server_conn->getMsg();
+        REQUIRE(msg != nullptr);
+        REQUIRE(msg->getType() == flight_safety_system::transport::message_type_position_report);
+        REQUIRE(std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_position_report>(msg)->getAltitude() == static_cast<uint32_t>(100 + i));
+    }
+    REQUIRE(server_conn->getDatagramStats().received == reports);
+    REQUIRE(server_conn->getDatagramStats().lost == 0);
+    REQUIRE(conn->getDatagramStats().sent == reports);
+    msg = conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_position_report>(msg)->getCallSign() == "ZK-DEF");
+    REQUIRE(conn->getDatagramStats().received == 1);
+
+    /* Everything else stays on TLS */
+    conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_identity>("testClient"));
+    sleep(1);
+    msg = server_conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_identity);
+    REQUIRE(server_conn->getDatagramStats().received == reports);
+
+    datagram->stop();
+    REQUIRE_FALSE(datagram->isReady());
+    conn = nullptr;
+    server_conn = nullptr;
+    client_conn = nullptr;
+}
+
+TEST_CASE("SSL - Kernel TLS")
+{
+    constexpr int listen_port = 20309;
+    constexpr uint64_t ticket_lifetime = 60;
+    constexpr uint64_t ticket_key_rotation = 120;
+
+    auto tickets = std::make_shared<flight_safety_system::transport_ssl::fss_session_tickets>(ticket_lifetime, ticket_key_rotation, false);
+    auto listen = std::make_shared<flight_safety_system::transport_ssl::fss_listen>(listen_port, test_client_connect_cb, CA_PUBLIC_FILE, SERVER_PRIVATE_FILE, SERVER_PUBLIC_FILE, tickets);
+    listen->setKernelTLS(true);
+
+    /* Messages have to get through whether or not the kernel can take the session */
+    auto conn = std::make_shared<flight_safety_system::transport_ssl::fss_connection_client>(CA_PUBLIC_FILE, CLIENT_PRIVATE_FILE, CLIENT_PUBLIC_FILE);
+    conn->setKernelTLS(true);
+    REQUIRE(conn->connectTo("localhost", listen_port));
+    REQUIRE(!conn->kernelReceiving());
+    std::shared_ptr<flight_safety_system::transport::fss_connection> sender = conn;
+
+    for (int round = 0; round < 2; round++)
+    {
+        sender->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_identity>("client"));
+
+        sleep(1);
+
+        REQUIRE(client_conn != nullptr);
+        auto msg = client_conn->getMsg();
+        REQUIRE(msg != nullptr);
+        REQUIRE(msg->getType() == flight_safety_system::transport::message_type_identity);
+
+        client_conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>());
+
+        sleep(1);
+
+        msg = conn->getMsg();
+        REQUIRE(msg != nullptr);
+        REQUIRE(msg->getType() == flight_safety_system::transport::message_type_rtt_request);
+    }
+
+    /* The session ticket is read by GnuTLS before the client hands over receiving */
+    REQUIRE(!conn->getResumeData().empty());
+    auto server_side = std::dynamic_pointer_cast<flight_safety_system::transport_ssl::fss_connection>(client_conn);
+    REQUIRE(server_side != nullptr);
+    REQUIRE(server_side->kernelSending() == conn->kernelReceiving());
+
+    sender = nullptr;
+    conn = nullptr;
+    server_side = nullptr;
+    client_conn = nullptr;
+}
@@ -1,5 +1,11 @@
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <map>
 #include <cstddef>
 #include <memory>
+#include <thread>
+#include <vector>
 #ifdef HAVE_CATCH2_CATCH_HPP
 #include <catch2/catch.hpp>
 #elif HAVE_CATCH_CATCH_HPP
@@ -11,6 +17,9 @@
 #endif
 
 #include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
 
 #include "fss-transport.hpp"
 
@@ -25,6 +34,80 @@ TEST_CASE("Connection Create (failure)") {
     REQUIRE(!conn->connectTo("this.host.does.not.exist", 1));
 }
 
+TEST_CASE("Resolver") {
+    constexpr uint16_t port = 20202;
+    auto resolver = std::make_shared<flight_safety_system::transport::fss_resolver>(1, 60, 60);
+
+    /* Literal addresses are never looked up */
+    auto addresses = resolver->resolve("127.0.0.1", port);
+    REQUIRE(addresses.size() == 1);
+    REQUIRE(addresses[0].ss_family == AF_INET);
+    REQUIRE(ntohs(reinterpret_cast<struct sockaddr_in *>(&addresses[0])->sin_port) == port);
+    addresses = resolver->resolve("::1", port);
+    REQUIRE(addresses.size() == 1);
+    REQUIRE(addresses[0].ss_family == AF_INET6);
+    REQUIRE(resolver->getStats().lookups == 0);
+
+    addresses = resolver->resolve("localhost", port);
+    REQUIRE(!addresses.empty());
+    REQUIRE(resolver->getStats().misses == 1);
+    addresses = resolver->resolve("localhost", port);
+    REQUIRE(!addresses.empty());
+    REQUIRE(resolver->getStats().cache_hits == 1);
+
+    /* Failures are remembered too */
+    REQUIRE(resolver->resolve("this.host.does.not.exist", port).empty());
+    REQUIRE(resolver->resolve("this.host.does.not.exist", port).empty());
+    auto stats = resolver->getStats();
+    REQUIRE(stats.failures == 1);
+    REQUIRE(stats.negative_hits == 1);
+
+    resolver->flush();
+    resolver->prefetch("localhost");
+    REQUIRE(!resolver->resolve("localhost", port).empty());
+}
+
+TEST_CASE("Token Bucket") {
+    constexpr double rate = 10;
+    constexpr double burst = 3;
+    flight_safety_system::transport::fss_token_bucket bucket(rate, burst);
+
+    /* A full bucket allows a burst, then has to wait for the rate */
+    REQUIRE(bucket.take());
+    REQUIRE(bucket.take());
+    REQUIRE(bucket.take());
+    REQUIRE(!bucket.take());
+    auto wait = bucket.waitTime(1);
+    REQUIRE(wait > 0);
+    REQUIRE(wait <= 100);
+    REQUIRE(bucket.waitTime(10) > 900);
+    usleep(150000);
+    REQUIRE(bucket.take());
+}
+
+TEST_CASE("Backoff") {
+    constexpr uint64_t base = 100;
+    constexpr uint64_t cap = 1000;
+    constexpr uint64_t hint = 5000;
+    flight_safety_system::transport::fss_backoff backoff(base, cap);
+
+    REQUIRE(backoff.spread() <= base);
+    uint64_t delay = base;
+    for (int i = 0; i < 20; i++)
+    {
+        auto next = backoff.next();
+        REQUIRE(next >= base);
+        REQUIRE(next <= std::min(cap, delay * 3));
+        delay = next;
+    }
+    /* The server hint wins over a shorter delay */
+    auto hinted = backoff.next(hint);
+    REQUIRE(hinted >= hint);
+    REQUIRE(hinted <= hint + hint / 4);
+    backoff.reset();
+    REQUIRE(backoff.next() <= base * 3);
+}
+
 static std::shared_ptr<flight_safety_system::transport::fss_connection> client_conn = nullptr;
 static auto test_client_connect_cb (std::shared_ptr<flight_safety_system::transport::fss_connection> new_conn) -> bool
 {
@@ -33,6 +116,31 @@ static auto test_client_connect_cb (std::shared_ptr<flight_safety_system::transp
 }
 
 
+TEST_CASE("Datagram Sequence") {
+    flight_safety_system::transport::fss_datagram_sequence sender;
+    REQUIRE(sender.next() == 1);
+    REQUIRE(sender.next() == 2);
+    REQUIRE(sender.getStats().sent == 2);
+
+    flight_safety_system::transport::fss_datagram_sequence receiver;
+    REQUIRE(receiver.accept(1));
+    REQUIRE(receiver.accept(2));
+    /* 3 and 4 go missing */
+    REQUIRE(receiver.accept(5));
+    REQUIRE(receiver.getStats().lost == 2);
+    /* 4 was only late */
+    REQUIRE(receiver.accept(4));
+    REQUIRE(receiver.getStats().lost == 1);
+    REQUIRE(receiver.getStats().reordered == 1);
+    REQUIRE_FALSE(receiver.accept(4));
+    REQUIRE(receiver.getStats().duplicate == 1);
+    /* Too far behind the newest to be useful */
+    REQUIRE(receiver.accept(5 + flight_safety_system::transport::fss_datagram_sequence::window_size));
+    REQUIRE_FALSE(receiver.accept(3));
+    REQUIRE(receiver.getStats().late == 1);
+    REQUIRE(receiver.getStats().received == 5);
+}
+
 TEST_CASE("Listen Socket") {
     constexpr int listen_port = 20202;
     auto listen = std::make_shared<flight_safety_system::transport::fss_listen>(listen_port, test_client_connect_cb);
@@ -64,6 +172,292 @@ TEST_CASE("Listen Socket") {
     client_conn = nullptr;
 }
 
+static auto
+socket_option(int fd, int level, int option) -> int
+{
+    int value = 0;
+    socklen_t value_len = sizeof(value);
+    getsockopt(fd, level, option, &value, &value_len);
+    return value;
+}
+
+TEST_CASE("Socket Profile") {
+    flight_safety_system::transport::fss_socket_profile profile;
+    profile.send_buffer = 65536;
+    profile.keepalive = true;
+    profile.keepalive_idle = 30;
+    profile.keepalive_interval = 5;
+    profile.keepalive_count = 3;
+    profile.user_timeout = 20000;
+    int fd = socket(PF_INET6, SOCK_STREAM, IPPROTO_TCP);
+    REQUIRE(profile.apply(fd));
+    REQUIRE(socket_option(fd, IPPROTO_TCP, TCP_NODELAY) == 1);
+    REQUIRE(socket_option(fd, SOL_SOCKET, SO_SNDBUF) >= 65536);
+    REQUIRE(socket_option(fd, SOL_SOCKET, SO_KEEPALIVE) == 1);
+    REQUIRE(socket_option(fd, IPPROTO_TCP, TCP_KEEPIDLE) == 30);
+    REQUIRE(socket_option(fd, IPPROTO_TCP, TCP_KEEPINTVL) == 5);
+    REQUIRE(socket_option(fd, IPPROTO_TCP, TCP_KEEPCNT) == 3);
+    REQUIRE(socket_option(fd, IPPROTO_TCP, TCP_USER_TIMEOUT) == 20000);
+    close(fd);
+
+    /* Unix sockets don't take TCP options */
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE(profile.apply(fd));
+    close(fd);
+}
+
+TEST_CASE("Listen Socket - Liveness") {
+    constexpr int listen_port = 20208;
+    auto listen = std::make_shared<flight_safety_system::transport::fss_listen>(listen_port, test_client_connect_cb);
+    flight_safety_system::transport::fss_socket_profile profile;
+    profile.max_missed_rtt = 2;
+    listen->setSocketProfile(profile);
+
+    auto conn = std::make_shared<flight_safety_system::transport::fss_connection>();
+    REQUIRE(conn->connectTo("localhost", listen_port));
+    conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_identity>("testClient"));
+    sleep(1);
+    REQUIRE(client_conn != nullptr);
+    REQUIRE(client_conn->getSocketProfile().max_missed_rtt == 2);
+
+    /* An answer clears the requests before it */
+    client_conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>());
+    client_conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>());
+    conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_response>(1));
+    usleep(200000);
+    client_conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>());
+    client_conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>());
+    usleep(200000);
+    auto msg = client_conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_identity);
+    msg = client_conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_rtt_response);
+    REQUIRE(client_conn->getMsg() == nullptr);
+
+    /* The next one with two still unanswered closes the connection, even carried in a batch */
+    client_conn->setBatching(true);
+    auto batch = std::make_shared<flight_safety_system::transport::fss_message_batch>();
+    REQUIRE(batch->add(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>()));
+    client_conn->sendMsg(batch);
+    usleep(200000);
+    msg = client_conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_closed);
+
+    conn = nullptr;
+    client_conn = nullptr;
+}
+
+TEST_CASE("Listen Socket - Compact Positions") {
+    constexpr int listen_port = 20205;
+    constexpr double pos_lat = -43.5;
+    constexpr double pos_lng = 172.0;
+    constexpr uint32_t icao_address = 0x00C81234;
+    constexpr int reports = 3;
+    auto listen = std::make_shared<flight_safety_system::transport::fss_listen>(listen_port, test_client_connect_cb);
+
+    auto conn = std::make_shared<flight_safety_system::transport::fss_connection>();
+    REQUIRE(conn->connectTo("localhost", listen_port));
+    conn->setCompactPositions(true);
+    for (int i = 0; i < reports; i++)
+    {
+        conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_position_report>(pos_lat, pos_lng, 100 + i, 0, 0, 0, icao_address, "ZK-ABC", 0, 0, 0, 0, 0, i));
+    }
+
+    sleep(1);
+
+    /* The receiver sees ordinary position reports */
+    REQUIRE(client_conn != nullptr);
+    for (int i = 0; i < reports; i++)
+    {
+        auto msg = client_conn->getMsg();
+        REQUIRE(msg != nullptr);
+        REQUIRE(msg->getType() == flight_safety_system::transport::message_type_position_report);
+        auto position = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_position_report>(msg);
+        REQUIRE(position->getAltitude() == static_cast<uint32_t>(100 + i));
+        REQUIRE(position->getCallSign() == "ZK-ABC");
+    }
+
+    conn = nullptr;
+    client_conn = nullptr;
+}
+
+TEST_CASE("Listen Socket - Batching") {
+    constexpr int listen_port = 20206;
+    constexpr int senders = 4;
+    constexpr int per_sender = 50;
+    auto listen = std::make_shared<flight_safety_system::transport::fss_listen>(listen_port, test_client_connect_cb);
+
+    auto conn = std::make_shared<flight_safety_system::transport::fss_connection>();
+    REQUIRE(conn->connectTo("localhost", listen_port));
+    conn->setBatching(true);
+    /* Several threads sending at once get combined into batches */
+    std::vector<std::thread> threads;
+    std::atomic<int> failed{0};
+    for (int t = 0; t < senders; t++)
+    {
+        threads.emplace_back([&conn, &failed, t]() {
+            for (int i = 0; i < per_sender; i++)
+            {
+                if (!conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_search_status>(t, i, static_cast<uint64_t>(per_sender))))
+                {
+                    failed++;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    /* Every sender hears how its own message went */
+    REQUIRE(failed == 0);
+    /* An explicit batch arrives as its individual messages */
+    auto batch = std::make_shared<flight_safety_system::transport::fss_message_batch>();
+    REQUIRE(batch->add(std::make_shared<flight_safety_system::transport::fss_message_identity>("testClient")));
+    REQUIRE(batch->add(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>()));
+    REQUIRE(conn->sendMsg(batch));
+
+    sleep(1);
+
+    REQUIRE(client_conn != nullptr);
+    std::vector<uint64_t> next(senders, 0);
+    uint64_t last_id = 0;
+    for (int i = 0; i < senders * per_sender; i++)
+    {
+        auto msg = client_conn->getMsg();
+        REQUIRE(msg != nullptr);
+        REQUIRE(msg->getType() == flight_safety_system::transport::message_type_search_status);
+        REQUIRE(msg->getId() > last_id);
+        last_id = msg->getId();
+        auto search = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_search_status>(msg);
+        /* Each sender's messages stay in order */
+        REQUIRE(search->getSearchCompleted() == next[search->getSearchId()]);
+        next[search->getSearchId()]++;
+    }
+    auto msg = client_conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_identity);
+    REQUIRE(msg->getId() == batch->getMessages()[0]->getId());
+    msg = client_conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_rtt_request);
+    REQUIRE(msg->getId() == batch->getMessages()[0]->getId() + 1);
+
+    conn = nullptr;
+    client_conn = nullptr;
+}
+
+TEST_CASE("Local Socket") {
+    const std::string path = "fss-test-local.sock";
+    auto listen = std::make_shared<flight_safety_system::transport::fss_listen_local>(path, test_client_connect_cb, std::map<uid_t, std::list<std::string>>{{getuid(), {"testClient"}}});
+
+    auto conn = std::make_shared<flight_safety_system::transport::fss_connection_local>();
+    REQUIRE(conn->connectTo(path));
+    REQUIRE(conn->getPeerCredentials().pid == getpid());
+    conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_identity>("testClient"));
+
+    sleep(1);
+
+    /* The server end knows who connected without any certificates */
+    REQUIRE(client_conn != nullptr);
+    auto local = std::dynamic_pointer_cast<flight_safety_system::transport::fss_connection_local>(client_conn);
+    REQUIRE(local != nullptr);
+    REQUIRE(local->getPeerCredentials().uid == getuid());
+    REQUIRE(local->getPeerCredentials().pid == getpid());
+    REQUIRE(client_conn->getClientNames() == std::list<std::string>{"testClient"});
+    auto msg = client_conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_identity);
+
+    conn = nullptr;
+    client_conn = nullptr;
+    listen = nullptr;
+    REQUIRE(access(path.c_str(), F_OK) != 0);
+
+    /* Anyone not listed is turned away */
+    listen = std::make_shared<flight_safety_system::transport::fss_listen_local>(path, test_client_connect_cb, std::map<uid_t, std::list<std::string>>{{getuid() + 1, {}}});
+    conn = std::make_shared<flight_safety_system::transport::fss_connection_local>();
+    REQUIRE(conn->connectTo(path));
+
+    sleep(1);
+
+    REQUIRE(client_conn == nullptr);
+    msg = conn->getMsg();
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_closed);
+}
+
+TEST_CASE("Capture") {
+    const std::string prefix = "fss-test-capture";
+    constexpr size_t frame_size = 30000;
+    constexpr int frames = 5;
+    {
+        /* Small enough that the frames need more than one file */
+        auto capture = std::make_shared<flight_safety_system::transport::fss_capture>(prefix, 1);
+        std::string frame(frame_size, 'x');
+        for (int i = 0; i < frames; i++)
+        {
+            frame[0] = static_cast<char>(i);
+            capture->record(7, i % 2 == 0 ? flight_safety_system::transport::capture_received : flight_safety_system::transport::capture_sent, frame.data(), frame.size());
+        }
+        REQUIRE(capture->getFiles().size() > 1);
+        for (const auto &file : capture->getFiles())
+        {
+            unlink(file.c_str());
+        }
+    }
+    auto capture = std::make_shared<flight_safety_system::transport::fss_capture>(prefix);
+
+    /* Both ends of a connection tee into the same capture */
+    constexpr int listen_port = 20207;
+    auto listen = std::make_shared<flight_safety_system::transport::fss_listen>(listen_port, test_client_connect_cb);
+    auto conn = std::make_shared<flight_safety_system::transport::fss_connection>();
+    REQUIRE(conn->connectTo("localhost", listen_port));
+    conn->setCapture(capture);
+    conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_identity>("testClient"));
+
+    sleep(1);
+
+    REQUIRE(client_conn != nullptr);
+    client_conn->setCapture(capture);
+    client_conn->sendMsg(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>());
+
+    sleep(1);
+
+    conn = nullptr;
+    client_conn = nullptr;
+    auto files = capture->getFiles();
+    capture = nullptr;
+    REQUIRE(files.size() == 1);
+
+    flight_safety_system::transport::fss_capture_reader reader(files[0]);
+    REQUIRE(reader.isValid());
+    std::vector<flight_safety_system::transport::fss_capture_record> records;
+    flight_safety_system::transport::fss_capture_record record;
+    while (reader.next(&record))
+    {
+        records.push_back(record);
+    }
+    /* The identity (sent by the client), then the rtt request sent and received */
+    REQUIRE(records.size() == 3);
+    REQUIRE(records[0].direction == flight_safety_system::transport::capture_sent);
+    REQUIRE(records[1].direction == flight_safety_system::transport::capture_sent);
+    REQUIRE(records[2].direction == flight_safety_system::transport::capture_received);
+    REQUIRE(records[0].connection != records[1].connection);
+    REQUIRE(records[1].connection != records[2].connection);
+    REQUIRE(records[0].timestamp <= records[1].timestamp);
+    auto msg = flight_safety_system::transport::fss_message::decode(std::make_shared<flight_safety_system::transport::buf_len>(records[0].frame.data(), records[0].frame.size()));
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_identity);
+    msg = flight_safety_system::transport::fss_message::decode(std::make_shared<flight_safety_system::transport::buf_len>(records[2].frame.data(), records[2].frame.size()));
+    REQUIRE(msg != nullptr);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_rtt_request);
+    unlink(files[0].c_str());
+}
+
 class test_message_cb: public flight_safety_system::transport::fss_message_cb
 {
     private:
@@ -1,4 +1,4 @@
-#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#define CATCH_CONFIG_RUNNER
 #ifdef HAVE_CATCH2_CATCH_HPP
 #include <catch2/catch.hpp>
 #elif HAVE_CATCH_CATCH_HPP
@@ -9,3 +9,12 @@
 #error No catch header
 #endif
 
+#include <csignal>
+
+auto
+main(int argc, char *argv[]) -> int
+{
+    /* As in fss-server, writing to a connection the other end has closed shouldn't kill the tests */
+    signal(SIGPIPE, SIG_IGN);
+    return Catch::Session().run(argc, argv);
+}
@@ -1,5 +1,9 @@
 #include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #ifdef HAVE_CATCH2_CATCH_HPP
 #include <catch2/catch.hpp>
@@ -12,6 +16,7 @@
 #endif
 
 #include <cmath>
+#include <arpa/inet.h>
 
 #include "fss-transport.hpp"
 
@@ -485,3 +490,249 @@ TEST_CASE("Identity (Non-Aircraft) Message Check") {
     REQUIRE(decoded_generic->getType() == flight_safety_system::transport::message_type_identity_non_aircraft);
     REQUIRE(decoded_generic->getId() == msg_id);
 }
+
+TEST_CASE("Busy Message Check") {
+    auto msg_id = static_cast<uint64_t>(random());
+    auto retry_after = static_cast<uint64_t>(random());
+
+    auto msg = std::make_shared<flight_safety_system::transport::fss_message_busy>(retry_after);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_busy);
+    REQUIRE(msg->getRetryAfter() == retry_after);
+    msg->setId(msg_id);
+    auto bl = msg->getPacked();
+    REQUIRE(bl != nullptr);
+    /* The first byte must not look like a TLS record */
+    REQUIRE(static_cast<unsigned char>(bl->getData()[0]) < 20);
+    auto decoded_generic = flight_safety_system::transport::fss_message::decode(bl);
+    REQUIRE(decoded_generic->getType() == flight_safety_system::transport::message_type_busy);
+    REQUIRE(decoded_generic->getId() == msg_id);
+    auto decoded = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_busy>(decoded_generic);
+    REQUIRE(decoded != nullptr);
+    REQUIRE(decoded->getRetryAfter() == retry_after);
+}
+
+TEST_CASE("Datagram Offer Message Check") {
+    auto msg_id = static_cast<uint64_t>(random());
+    auto port = static_cast<uint16_t>(random());
+    auto token = static_cast<uint64_t>(random()) << 32 | static_cast<uint64_t>(random());
+
+    auto msg = std::make_shared<flight_safety_system::transport::fss_message_datagram_offer>(port, token);
+    REQUIRE(msg->getType() == flight_safety_system::transport::message_type_datagram_offer);
+    msg->setId(msg_id);
+    auto decoded_generic = flight_safety_system::transport::fss_message::decode(msg->getPacked());
+    REQUIRE(decoded_generic->getType() == flight_safety_system::transport::message_type_datagram_offer);
+    REQUIRE(decoded_generic->getId() == msg_id);
+    auto decoded = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_datagram_offer>(decoded_generic);
+    REQUIRE(decoded != nullptr);
+    REQUIRE(decoded->getPort() == port);
+    REQUIRE(decoded->getToken() == token);
+
+    auto request = std::make_shared<flight_safety_system::transport::fss_message_datagram_request>();
+    request->setId(msg_id);
+    auto decoded_request = flight_safety_system::transport::fss_message::decode(request->getPacked());
+    REQUIRE(decoded_request->getType() == flight_safety_system::transport::message_type_datagram_request);
+    REQUIRE(decoded_request->getId() == msg_id);
+}
+
+TEST_CASE("Compact Position Message Check") {
+    constexpr double pos_lat = -43.5;
+    constexpr double pos_lng = 172.0;
+    constexpr uint32_t altitude = 1500;
+    constexpr uint32_t icao_address = 0x00C81234;
+    constexpr uint16_t heading = 9000;
+    constexpr uint16_t hor_vel = 50;
+    constexpr int16_t vert_vel = -2;
+    constexpr uint16_t vfr_squawk = 01200;
+    constexpr uint16_t flags = 0xAA55;
+    constexpr uint8_t emitter_type = 14;
+    constexpr uint64_t timestamp = 1600000000000;
+    constexpr uint64_t keyframe_interval = 4;
+    constexpr double step = 0.0001;
+    constexpr uint64_t interval = 1000;
+
+    flight_safety_system::transport::fss_position_encoder encoder(keyframe_interval);
+    flight_safety_system::transport::fss_position_decoder decoder;
+    size_t keyframe_length = 0;
+    for (uint64_t i = 0; i < keyframe_interval * 2; i++)
+    {
+        auto msg = std::make_shared<flight_safety_system::transport::fss_message_position_report>(pos_lat + step * i, pos_lng - step * i, altitude + i, heading, hor_vel, vert_vel, icao_address, "ZK-ABC", vfr_squawk, 0, flags, 1, emitter_type, timestamp + interval * i);
+        auto compact = encoder.encode(msg);
+        REQUIRE(compact->getType() == flight_safety_system::transport::message_type_position_compact);
+        compact->setId(i);
+        auto bl = compact->getPacked();
+        if (i % keyframe_interval == 0)
+        {
+            keyframe_length = bl->getLength();
+        }
+        else
+        {
+            /* Unchanged fields such as the callsign are left out */
+            REQUIRE(bl->getLength() < keyframe_length);
+            REQUIRE(bl->getLength() < msg->getPacked()->getLength());
+        }
+        auto decoded_generic = flight_safety_system::transport::fss_message::decode(bl);
+        REQUIRE(decoded_generic->getType() == flight_safety_system::transport::message_type_position_compact);
+        auto decoded = decoder.decode(std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_position_compact>(decoded_generic));
+        REQUIRE(decoded != nullptr);
+        REQUIRE(decoded->getId() == i);
+        /* Same precision as the full report */
+        auto full = std::make_shared<flight_safety_system::transport::fss_message_position_report>(0, msg->getPacked());
+        REQUIRE(decoded->getLatitude() == full->getLatitude());
+        REQUIRE(decoded->getLongitude() == full->getLongitude());
+        REQUIRE(decoded->getAltitude() == altitude + i);
+        REQUIRE(decoded->getTimeStamp() == timestamp + interval * i);
+        REQUIRE(decoded->getICAOAddress() == icao_address);
+        REQUIRE(decoded->getHeading() == heading);
+        REQUIRE(decoded->getHorzVel() == hor_vel);
+        REQUIRE(decoded->getVertVel() == vert_vel);
+        REQUIRE(decoded->getCallSign() == "ZK-ABC");
+        REQUIRE(decoded->getSquawk() == vfr_squawk);
+        REQUIRE(decoded->getFlags() == flags);
+        REQUIRE(decoded->getAltitudeType() == 1);
+        REQUIRE(decoded->getEmitterType() == emitter_type);
+    }
+
+    /* A lost change is noticed, and nothing is delivered until the next keyframe */
+    auto report = [&](uint64_t i) {
+        return std::make_shared<flight_safety_system::transport::fss_message_position_report>(pos_lat, pos_lng, altitude, heading, hor_vel, vert_vel, icao_address, "ZK-ABC", vfr_squawk, 0, flags, 1, emitter_type, timestamp + interval * i);
+    };
+    REQUIRE(decoder.decode(encoder.encode(report(8))) != nullptr);
+    encoder.encode(report(9));
+    REQUIRE(decoder.decode(encoder.encode(report(10))) == nullptr);
+    REQUIRE(decoder.getGaps() == 1);
+    REQUIRE(decoder.decode(encoder.encode(report(11))) == nullptr);
+    auto resync = decoder.decode(encoder.encode(report(12)));
+    REQUIRE(resync != nullptr);
+    REQUIRE(resync->getTimeStamp() == timestamp + interval * 12);
+}
+
+TEST_CASE("Batch Message Check") {
+    constexpr uint64_t batch_id = 100;
+    constexpr uint16_t search_id = 7;
+    constexpr uint64_t search_point = 12;
+    constexpr uint64_t search_total = 40;
+    auto batch = std::make_shared<flight_safety_system::transport::fss_message_batch>();
+    REQUIRE(batch->add(std::make_shared<flight_safety_system::transport::fss_message_identity>("testClient")));
+    REQUIRE(batch->add(std::make_shared<flight_safety_system::transport::fss_message_search_status>(search_id, search_point, search_total)));
+    REQUIRE(batch->add(std::make_shared<flight_safety_system::transport::fss_message_rtt_request>()));
+    /* Batches don't nest */
+    REQUIRE_FALSE(batch->add(std::make_shared<flight_safety_system::transport::fss_message_batch>()));
+    batch->setId(batch_id);
+
+    auto bl = batch->getPacked();
+    REQUIRE(bl->isValid());
+    auto decoded_generic = flight_safety_system::transport::fss_message::decode(bl);
+    REQUIRE(decoded_generic->getType() == flight_safety_system::transport::message_type_batch);
+    REQUIRE(decoded_generic->getId() == batch_id);
+    auto decoded = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_batch>(decoded_generic);
+    auto &messages = decoded->getMessages();
+    REQUIRE(messages.size() == 3);
+    /* The messages take the ids following the batch's */
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        REQUIRE(messages[i]->getId() == batch_id + i);
+    }
+    REQUIRE(messages[0]->getType() == flight_safety_system::transport::message_type_identity);
+    REQUIRE(std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_identity>(messages[0])->getName() == "testClient");
+    auto search = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_search_status>(messages[1]);
+    REQUIRE(search != nullptr);
+    REQUIRE(search->getSearchId() == search_id);
+    REQUIRE(search->getSearchCompleted() == search_point);
+    REQUIRE(search->getSearchTotal() == search_total);
+    REQUIRE(messages[2]->getType() == flight_safety_system::transport::message_type_rtt_request);
+
+    /* One header replaces three, and the padding after each */
+    size_t separate = 0;
+    for (auto &msg : batch->getMessages())
+    {
+        separate += msg->getPacked()->getLength();
+    }
+    REQUIRE(bl->getLength() < separate);
+
+    /* Stops accepting messages once the frame is full */
+    auto full = std::make_shared<flight_safety_system::transport::fss_message_batch>();
+    size_t added = 0;
+    while (full->add(std::make_shared<flight_safety_system::transport::fss_message_identity>(std::string(200, 'x'))))
+    {
+        added++;
+    }
+    REQUIRE(added > 0);
+    REQUIRE(full->getMessages().size() == added);
+    constexpr size_t max_length = flight_safety_system::transport::fss_message_batch::max_length;
+    REQUIRE(full->getPacked()->getLength() <= max_length);
+
+    /* A length field shorter than the header, or an entry running past the frame, yields no messages */
+    constexpr size_t header_length = sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint64_t);
+    std::string frame(bl->getData(), bl->getLength());
+    uint16_t short_length = htons(4);
+    memcpy(&frame[0], &short_length, sizeof(uint16_t));
+    auto short_frame = std::make_shared<flight_safety_system::transport::buf_len>(frame.data(), frame.size());
+    auto short_batch = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_batch>(flight_safety_system::transport::fss_message::decode(short_frame));
+    REQUIRE(short_batch != nullptr);
+    REQUIRE(short_batch->getMessages().empty());
+    frame.assign(bl->getData(), bl->getLength());
+    uint16_t entry_length = htons(0xffff);
+    memcpy(&frame[header_length], &entry_length, sizeof(uint16_t));
+    auto overrun_frame = std::make_shared<flight_safety_system::transport::buf_len>(frame.data(), frame.size());
+    auto overrun_batch = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_batch>(flight_safety_system::transport::fss_message::decode(overrun_frame));
+    REQUIRE(overrun_batch != nullptr);
+    REQUIRE(overrun_batch->getMessages().empty());
+}
+
+/* Records which overload each message reached */
+class dispatch_recorder {
+public:
+    std::vector<std::string> seen{};
+    void handleMessage(flight_safety_system::transport::fss_message &msg __attribute__((unused)), const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused))) {
+        this->seen.emplace_back("other");
+    }
+    void handleMessage(flight_safety_system::transport::fss_message_identity &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner __attribute__((unused))) {
+        this->seen.push_back("identity " + msg.getName());
+    }
+    void handleMessage(flight_safety_system::transport::fss_message_rtt_response &msg, const std::shared_ptr<flight_safety_system::transport::fss_message> &owner) {
+        REQUIRE(owner.get() == &msg);
+        this->seen.push_back("rtt " + std::to_string(msg.getRequestId()));
+    }
+};
+
+TEST_CASE("Message Dispatch") {
+    dispatch_recorder recorder;
+    std::shared_ptr<flight_safety_system::transport::fss_message> identity = std::make_shared<flight_safety_system::transport::fss_message_identity>("testClient");
+    std::shared_ptr<flight_safety_system::transport::fss_message> rtt = std::make_shared<flight_safety_system::transport::fss_message_rtt_response>(12);
+    std::shared_ptr<flight_safety_system::transport::fss_message> busy = std::make_shared<flight_safety_system::transport::fss_message_busy>(1000);
+    for (auto &msg : { identity, rtt, busy })
+    {
+        flight_safety_system::transport::fss_message_dispatch(flight_safety_system::transport::fss_message::decode(msg->getPacked()), recorder);
+    }
+    REQUIRE(recorder.seen.size() == 3);
+    REQUIRE(recorder.seen[0] == "identity testClient");
+    REQUIRE(recorder.seen[1] == "rtt 12");
+    /* Types without their own overload fall back to the base one */
+    REQUIRE(recorder.seen[2] == "other");
+}
+
+TEST_CASE("Message Pool") {
+    auto report = std::make_shared<flight_safety_system::transport::fss_message_position_report>(-43.5, 172.5, 300, 1800, 200, 0, 0xC80000, "ZK-ABC", 01200, 0, 0, 1, 1, 1234);
+    auto bl = report->getPacked();
+    auto first = flight_safety_system::transport::fss_message::decode(bl);
+    REQUIRE(first != nullptr);
+    auto *first_address = first.get();
+    first = nullptr;
+    /* A freed message's block is the next one handed out for that type */
+    auto second = flight_safety_system::transport::fss_message::decode(bl);
+    REQUIRE(second.get() == first_address);
+    auto position = std::dynamic_pointer_cast<flight_safety_system::transport::fss_message_position_report>(second);
+    REQUIRE(position != nullptr);
+    REQUIRE(position->getTimeStamp() == 1234);
+    REQUIRE(position->getCallSign() == "ZK-ABC");
+
+    /* Blocks freed on another thread come back through the shared depot */
+    std::vector<std::shared_ptr<flight_safety_system::transport::fss_message>> decoded;
+    for (size_t i = 0; i < 1000; i++)
+    {
+        decoded.push_back(flight_safety_system::transport::fss_message::decode(bl));
+    }
+    std::thread releaser([&decoded]() { decoded.clear(); });
+    releaser.join();
+    REQUIRE(flight_safety_system::transport::fss_message::decode(bl) != nullptr);
+}
@@ -0,0 +1,447 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+#ifdef HAVE_CATCH2_CATCH_HPP
+#include <catch2/catch.hpp>
+#elif HAVE_CATCH_CATCH_HPP
+#include <catch/catch.hpp>
+#elif HAVE_CATCH_HPP
+#include <catch.hpp>
+#else
+#error No catch header
+#endif
+
+#include "fss-server.hpp"
+
+TEST_CASE("Database Write Filter - Defaults") {
+    auto rules = std::make_shared<flight_safety_system::server::db_write_rules>();
+    flight_safety_system::server::db_write_filter filter(rules);
+
+    /* Without any rules every record is written, even when nothing changed */
+    for (uint64_t now = 0; now < 10; now++)
+    {
+        REQUIRE(filter.allowPosition(now, -43.5, 172.5, 300));
+        REQUIRE(filter.allowStatus(now, 75, 11.4));
+        REQUIRE(filter.allowSearchStatus(now, 1, 5, 10));
+        REQUIRE(filter.allowRtt(now, 20));
+    }
+    REQUIRE(rules->considered == 40);
+    REQUIRE(rules->written == 40);
+}
+
+TEST_CASE("Database Write Filter - Decimation") {
+    auto rules = std::make_shared<flight_safety_system::server::db_write_rules>();
+    rules->position.min_interval = 1000;
+    rules->position.max_interval = 10000;
+    rules->position_distance = 10;
+    rules->position_altitude = 5;
+    rules->status.min_interval = 1000;
+    rules->status_percent = 1;
+    rules->status_voltage = 0.5;
+    rules->status_low_percent = 20;
+    rules->search_status.min_interval = 5000;
+    rules->search_completed = 1;
+    flight_safety_system::server::db_write_filter filter(rules);
+
+    /* The first position is always written */
+    REQUIRE(filter.allowPosition(0, -43.5, 172.5, 300));
+    /* Moved far enough, but too soon */
+    REQUIRE(!filter.allowPosition(500, -43.6, 172.5, 300));
+    /* Not moved far enough (about 1m) */
+    REQUIRE(!filter.allowPosition(2000, -43.50001, 172.5, 300));
+    /* Climbed */
+    REQUIRE(filter.allowPosition(3000, -43.5, 172.5, 310));
+    /* Moved about 80m east */
+    REQUIRE(filter.allowPosition(4000, -43.5, 172.501, 310));
+    /* Sitting still, but written once max_interval has passed */
+    REQUIRE(!filter.allowPosition(13000, -43.5, 172.501, 310));
+    REQUIRE(filter.allowPosition(14000, -43.5, 172.501, 310));
+
+    REQUIRE(filter.allowStatus(0, 50, 11.4));
+    REQUIRE(!filter.allowStatus(2000, 50, 11.3));
+    REQUIRE(filter.allowStatus(3000, 49, 11.3));
+    /* Falling below the low level is written straight away */
+    REQUIRE(filter.allowStatus(3100, 19, 10.8));
+    REQUIRE(!filter.allowStatus(3200, 18, 10.8));
+    REQUIRE(filter.allowStatus(5000, 18, 10.8));
+    REQUIRE(!filter.allowStatus(7000, 18, 10.7));
+
+    REQUIRE(filter.allowSearchStatus(0, 1, 0, 10));
+    REQUIRE(!filter.allowSearchStatus(1000, 1, 2, 10));
+    REQUIRE(filter.allowSearchStatus(6000, 1, 3, 10));
+    /* A new search, and finishing one, are written however soon */
+    REQUIRE(filter.allowSearchStatus(6100, 2, 0, 20));
+    REQUIRE(!filter.allowSearchStatus(6200, 2, 19, 20));
+    REQUIRE(filter.allowSearchStatus(6300, 2, 20, 20));
+    REQUIRE(!filter.allowSearchStatus(6400, 2, 20, 20));
+
+    REQUIRE(rules->written < rules->considered);
+}
+
+static auto
+make_point(uint64_t when, double latitude, double longitude, uint16_t altitude) -> flight_safety_system::server::track_point
+{
+    flight_safety_system::server::track_point point;
+    point.when = when;
+    point.timestamp = 1600000000000 + when;
+    point.latitude = latitude;
+    point.longitude = longitude;
+    point.altitude = altitude;
+    return point;
+}
+
+TEST_CASE("Track Simplification") {
+    auto rules = std::make_shared<flight_safety_system::server::track_rules>();
+    rules->tolerance = 10;
+    rules->altitude_tolerance = 5;
+    rules->turn_angle = 45;
+    std::vector<flight_safety_system::server::track_point> stored;
+    auto store = [&stored](const flight_safety_system::server::track_point &point) { stored.push_back(point); };
+    flight_safety_system::server::track_simplifier track(rules);
+
+    /* North for 50 points about 11m apart, with a little wander, then east for 50 */
+    uint64_t when = 0;
+    for (int i = 0; i < 50; i++, when += 1000)
+    {
+        track.addPoint(make_point(when, -43.5 + i * 0.0001, 172.5 + (i % 2) * 0.00003, 300), store);
+    }
+    for (int i = 1; i <= 50; i++, when += 1000)
+    {
+        track.addPoint(make_point(when, -43.5 + 49 * 0.0001, 172.5 + i * 0.00014, 300), store);
+    }
+    track.flush(store);
+
+    /* The start, the corner and the end */
+    REQUIRE(stored.size() == 3);
+    REQUIRE(stored[0].when == 0);
+    REQUIRE(stored[1].when == 49000);
+    REQUIRE(stored[1].timestamp == 1600000049000);
+    REQUIRE(stored[2].when == 99000);
+    REQUIRE(rules->getCompression() == Approx(100.0 / 3));
+    REQUIRE(rules->getErrorMax() <= rules->tolerance);
+    REQUIRE(rules->getErrorMax() > 0);
+
+    /* A climb part way along a straight leg is kept */
+    stored.clear();
+    flight_safety_system::server::track_simplifier climbing(rules);
+    for (int i = 0; i < 20; i++)
+    {
+        climbing.addPoint(make_point(i * 1000, -43.5 + i * 0.0001, 172.5, i < 10 ? 300 : 400), store);
+    }
+    climbing.flush(store);
+    REQUIRE(stored.size() == 4);
+
+    /* Points are never held back for longer than max_interval */
+    stored.clear();
+    rules->max_interval = 5000;
+    flight_safety_system::server::track_simplifier slow(rules);
+    for (int i = 0; i <= 20; i++)
+    {
+        slow.addPoint(make_point(i * 1000, -43.5 + i * 0.0001, 172.5, 300), store);
+    }
+    REQUIRE(stored.size() == 5);
+    REQUIRE(stored.back().when == 20000);
+}
+
+TEST_CASE("Track Simplification - Disabled") {
+    auto rules = std::make_shared<flight_safety_system::server::track_rules>();
+    std::vector<flight_safety_system::server::track_point> stored;
+    flight_safety_system::server::track_simplifier track(rules);
+    for (int i = 0; i < 10; i++)
+    {
+        track.addPoint(make_point(i * 1000, -43.5, 172.5, 300), [&stored](const flight_safety_system::server::track_point &point) { stored.push_back(point); });
+    }
+    REQUIRE(stored.size() == 10);
+    REQUIRE(rules->getCompression() == Approx(1));
+}
+
+static auto
+spool_directory() -> std::string
+{
+    char path[] = "/tmp/fss-spool-XXXXXX";
+    REQUIRE(mkdtemp(path) != nullptr);
+    return path;
+}
+
+static void
+remove_directory(const std::string &path)
+{
+    DIR *dir = opendir(path.c_str());
+    REQUIRE(dir != nullptr);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+        {
+            unlink((path + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(path.c_str());
+}
+
+static auto
+spool_record(uint64_t i) -> flight_safety_system::server::db_record
+{
+    flight_safety_system::server::db_record record;
+    record.kind = static_cast<flight_safety_system::server::db_record_kind>(flight_safety_system::server::db_record_rtt + i % 4);
+    record.asset_name = "asset" + std::to_string(i % 3);
+    record.timestamp = 1600000000000 + i;
+    record.rtt = i;
+    record.bat_percent = static_cast<uint8_t>(i % 100);
+    record.bat_mah_used = static_cast<uint32_t>(i * 10);
+    record.bat_voltage = 11.1;
+    record.search_id = i;
+    record.search_completed = i / 2;
+    record.search_total = i;
+    record.latitude = -43.5;
+    record.longitude = 172.5 + static_cast<double>(i) / 1000;
+    record.altitude = static_cast<uint16_t>(i);
+    return record;
+}
+
+static void
+check_record(const flight_safety_system::server::db_record &record, uint64_t i)
+{
+    auto expected = spool_record(i);
+    REQUIRE(record.kind == expected.kind);
+    REQUIRE(record.asset_name == expected.asset_name);
+    REQUIRE(record.timestamp == expected.timestamp);
+    REQUIRE(record.rtt == expected.rtt);
+    REQUIRE(record.bat_percent == expected.bat_percent);
+    REQUIRE(record.bat_mah_used == expected.bat_mah_used);
+    REQUIRE(record.bat_voltage == expected.bat_voltage);
+    REQUIRE(record.search_completed == expected.search_completed);
+    REQUIRE(record.longitude == expected.longitude);
+    REQUIRE(record.altitude == expected.altitude);
+}
+
+TEST_CASE("Database Spool") {
+    auto path = spool_directory();
+    std::vector<flight_safety_system::server::db_record> written;
+    auto write = [&written](const flight_safety_system::server::db_record &record) -> bool {
+        written.push_back(record);
+        return true;
+    };
+    {
+        flight_safety_system::server::db_spool spool(path);
+        REQUIRE(!spool.pending());
+        REQUIRE(spool.replay(10, write) == 0);
+        for (uint64_t i = 0; i < 10; i++)
+        {
+            REQUIRE(spool.append(spool_record(i)));
+        }
+        REQUIRE(spool.pending());
+        REQUIRE(spool.replay(4, write) == 4);
+        /* Stops at the first record the database won't take */
+        size_t accepted = 0;
+        REQUIRE(spool.replay(4, [&written, &accepted](const flight_safety_system::server::db_record &record) -> bool {
+            if (accepted == 2)
+            {
+                return false;
+            }
+            accepted++;
+            written.push_back(record);
+            return true;
+        }) == 2);
+        REQUIRE(spool.getStats().backlog == 4);
+    }
+    /* What was left is picked up again */
+    {
+        flight_safety_system::server::db_spool spool(path);
+        REQUIRE(spool.pending());
+        REQUIRE(spool.getStats().backlog == 4);
+        REQUIRE(spool.replay(10, write) == 4);
+        REQUIRE(!spool.pending());
+        REQUIRE(spool.replay(10, write) == 0);
+        auto stats = spool.getStats();
+        REQUIRE(stats.replayed == 4);
+        REQUIRE(stats.dropped == 0);
+        REQUIRE(stats.corrupt == 0);
+    }
+    REQUIRE(written.size() == 10);
+    for (uint64_t i = 0; i < written.size(); i++)
+    {
+        check_record(written[i], i);
+    }
+    remove_directory(path);
+}
+
+TEST_CASE("Database Spool - Disk Budget") {
+    auto path = spool_directory();
+    {
+        /* Segments are made big enough for at least one record of any size, about 11 of these */
+        flight_safety_system::server::db_spool spool(path, 1, 2);
+        for (uint64_t i = 0; i < 100; i++)
+        {
+            REQUIRE(spool.append(spool_record(i)));
+        }
+        auto stats = spool.getStats();
+        REQUIRE(stats.segments == 2);
+        REQUIRE(stats.dropped > 0);
+        REQUIRE(stats.backlog + stats.dropped == 100);
+        /* The newest records are kept, in order */
+        std::vector<flight_safety_system::server::db_record> written;
+        while (spool.replay(flight_safety_system::server::db_spool::replay_batch, [&written](const flight_safety_system::server::db_record &record) -> bool {
+            written.push_back(record);
+            return true;
+        }) > 0)
+        {
+        }
+        REQUIRE(written.size() == stats.backlog);
+        for (uint64_t i = 0; i < written.size(); i++)
+        {
+            check_record(written[i], stats.dropped + i);
+        }
+    }
+    remove_directory(path);
+}
+
+/* The spool's only segment file */
+static auto
+spool_segment(const std::string &path) -> std::string
+{
+    std::string segment;
+    DIR *dir = opendir(path.c_str());
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        if (entry->d_name[0] != '.')
+        {
+            segment = path + "/" + entry->d_name;
+        }
+    }
+    closedir(dir);
+    return segment;
+}
+
+TEST_CASE("Database Spool - Corruption") {
+    auto path = spool_directory();
+    std::string segment;
+    {
+        flight_safety_system::server::db_spool spool(path);
+        for (uint64_t i = 0; i < 5; i++)
+        {
+            REQUIRE(spool.append(spool_record(i)));
+        }
+        segment = spool_segment(path);
+    }
+    REQUIRE(!segment.empty());
+    /* Damage the third record, each of these takes 96 bytes after the 16 byte header */
+    FILE *file = fopen(segment.c_str(), "r+b");
+    REQUIRE(file != nullptr);
+    fseek(file, 16 + 2 * 96 + 20, SEEK_SET);
+    fputc(0xFF, file);
+    fclose(file);
+
+    {
+        flight_safety_system::server::db_spool spool(path);
+        auto stats = spool.getStats();
+        REQUIRE(stats.corrupt == 1);
+        REQUIRE(stats.backlog == 2);
+        size_t count = 0;
+        while (spool.replay(10, [&count](const flight_safety_system::server::db_record &record) -> bool {
+            check_record(record, count++);
+            return true;
+        }) > 0)
+        {
+        }
+        REQUIRE(count == 2);
+    }
+
+    /* A record whose checksum matches but is too short to hold the fixed fields */
+    {
+        flight_safety_system::server::db_spool spool(path);
+        for (uint64_t i = 0; i < 5; i++)
+        {
+            REQUIRE(spool.append(spool_record(i)));
+        }
+        segment = spool_segment(path);
+    }
+    file = fopen(segment.c_str(), "r+b");
+    REQUIRE(file != nullptr);
+    unsigned char payload[4];
+    fseek(file, 16 + 3 * 96 + 8, SEEK_SET);
+    REQUIRE(fread(payload, 1, sizeof(payload), file) == sizeof(payload));
+    uint32_t crc = 0xFFFFFFFF;
+    for (auto byte : payload)
+    {
+        crc ^= byte;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) != 0 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+        }
+    }
+    crc ^= 0xFFFFFFFF;
+    uint32_t short_length = sizeof(payload);
+    fseek(file, 16 + 3 * 96, SEEK_SET);
+    fwrite(&short_length, sizeof(short_length), 1, file);
+    fwrite(&crc, sizeof(crc), 1, file);
+    fclose(file);
+    {
+        flight_safety_system::server::db_spool spool(path);
+        REQUIRE(spool.getStats().corrupt == 1);
+        REQUIRE(spool.getStats().backlog == 3);
+    }
+    remove_directory(path);
+}
+
+TEST_CASE("Memory Storage") {
+    std::shared_ptr<flight_safety_system::server::db_connection> dbc = std::make_shared<flight_safety_system::server::db_connection_memory>(false, 3);
+    auto memory = std::dynamic_pointer_cast<flight_safety_system::server::db_connection_memory>(dbc);
+    memory->addAsset("plane1");
+    memory->setSmmSettings("plane1", "smm.example", "user", "pass");
+    memory->addServer("fss1.example", 20202);
+    memory->addServer("fss2.example", 20202);
+
+    REQUIRE(dbc->check_asset("plane1"));
+    REQUIRE(!dbc->check_asset("plane2"));
+    REQUIRE(dbc->isHealthy());
+    REQUIRE(dbc->recover());
+
+    /* Unknown assets aren't written */
+    REQUIRE(!dbc->asset_add_rtt("plane2", 20, 1600000000000));
+    for (uint64_t i = 0; i < 5; i++)
+    {
+        REQUIRE(dbc->asset_add_position("plane1", -43.5, 172.5, static_cast<uint16_t>(i), 1600000000000 + i));
+    }
+    REQUIRE(dbc->asset_add_status("plane1", 50, 1000, 11.1, 1600000000000));
+    auto search = spool_record(2);
+    search.asset_name = "plane1";
+    REQUIRE(dbc->write(search));
+    auto positions = memory->getRecords("plane1", flight_safety_system::server::db_record_position);
+    REQUIRE(positions.size() == 3);
+    REQUIRE(positions.front().altitude == 2);
+    REQUIRE(positions.back().timestamp == 1600000000004);
+    auto status = memory->getRecords("plane1", flight_safety_system::server::db_record_status);
+    REQUIRE(status.size() == 1);
+    REQUIRE(status[0].bat_percent == 50);
+    REQUIRE(memory->getRecords("plane2", flight_safety_system::server::db_record_rtt).empty());
+    REQUIRE(memory->getRecords("plane1", flight_safety_system::server::db_record_search_status).size() == 1);
+    REQUIRE(dbc->getPoolStats().statements == 7);
+
+    REQUIRE(dbc->asset_get_command("plane1") == nullptr);
+    memory->setCommand("plane1", "RTL");
+    auto command = dbc->asset_get_command("plane1");
+    REQUIRE(command != nullptr);
+    REQUIRE(command->getCommand() == flight_safety_system::transport::asset_command_rtl);
+    memory->setCommand("plane1", "GOTO", -43.6, 172.6, 500);
+    REQUIRE(dbc->asset_get_command("plane1")->getDBId() != command->getDBId());
+    REQUIRE(dbc->asset_get_command("plane1")->getAltitude() == 500);
+
+    REQUIRE(dbc->asset_get_smm_settings("plane1")->getAddress() == "smm.example");
+    REQUIRE(dbc->asset_get_smm_settings("plane2") == nullptr);
+    REQUIRE(dbc->get_active_fss_servers().size() == 2);
+
+    /* Any asset can report when allowed */
+    flight_safety_system::server::db_connection_memory open_storage;
+    REQUIRE(open_storage.check_asset("anything"));
+    REQUIRE(open_storage.asset_add_rtt("anything", 20, 1600000000000));
+    REQUIRE(open_storage.getRecords("anything", flight_safety_system::server::db_record_rtt).size() == 1);
+}